@@ -0,0 +1,109 @@
+/*
+ * Counts the data TLB misses and page faults of a command, like
+ * "perf stat -e dTLB-loads,dTLB-load-misses,page-faults" but without
+ * the perf tool. The counters follow the threads and child processes of
+ * the command and count user mode only.
+ *
+ * usage: perfcount command [args ...]
+ *
+ * The hardware events need a PMU visible to the host (or guest) kernel,
+ * they are reported as "not supported" when perf_event_open() fails.
+ */
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+static const struct {
+  const char *name;
+  unsigned type;
+  unsigned long long config;
+} events[] = {
+  { "dTLB-loads", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16) },
+  { "dTLB-load-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+  { "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+  { "task-clock-ms", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+};
+
+#define NEVENTS (sizeof(events) / sizeof(events[0]))
+
+int main(int argc, char *argv[])
+{
+  int fd[NEVENTS], err[NEVENTS], go[2], status;
+  unsigned n;
+  pid_t pid;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s command [args ...]\n", argv[0]);
+    return 1;
+  }
+
+  /* the child waits until the counters are attached, they start at exec */
+  if (pipe(go) < 0) {
+    perror("pipe");
+    return 1;
+  }
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return 1;
+  }
+  if (pid == 0) {
+    char c;
+    close(go[1]);
+    if (read(go[0], &c, 1) != 1) _exit(127);
+    execvp(argv[1], argv + 1);
+    perror(argv[1]);
+    _exit(127);
+  }
+  close(go[0]);
+
+  for (n = 0; n < NEVENTS; n++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[n].type;
+    attr.config = events[n].config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd[n] = syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+    err[n] = errno;
+  }
+
+  if (write(go[1], "x", 1) != 1) {
+    perror("write");
+    return 1;
+  }
+  close(go[1]);
+  if (waitpid(pid, &status, 0) < 0) {
+    perror("waitpid");
+    return 1;
+  }
+
+  for (n = 0; n < NEVENTS; n++) {
+    uint64_t count;
+    if (fd[n] < 0) {
+      fprintf(stderr, "%20s  not supported (%s)\n", events[n].name, strerror(err[n]));
+      continue;
+    }
+    if (read(fd[n], &count, sizeof(count)) != sizeof(count)) {
+      fprintf(stderr, "%20s  read failed\n", events[n].name);
+      continue;
+    }
+    if (events[n].type == PERF_TYPE_SOFTWARE && events[n].config == PERF_COUNT_SW_TASK_CLOCK)
+      count /= 1000000; /* ns */
+    fprintf(stderr, "%20s  %llu\n", events[n].name, (unsigned long long) count);
+  }
+
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
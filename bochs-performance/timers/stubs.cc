@@ -0,0 +1,107 @@
+/////////////////////////////////////////////////////////////////////////
+// $Id$
+/////////////////////////////////////////////////////////////////////////
+//
+// Stubs for the parts of bochs referenced by pc_system.cc and the
+// parameter tree. The timer benchmark never calls into the cpu, the
+// devices or the gui, the stubs only let it link. The log functions
+// print panics, everything else is dropped.
+//
+/////////////////////////////////////////////////////////////////////////
+
+#include "bochs.h"
+#include "cpu/cpu.h"
+#include "iodev/iodev.h"
+#include "gui/gui.h"
+
+bx_pc_system_c bx_pc_system;
+
+logfunctions *pluginlog = NULL;
+logfunctions *siminterface_log = NULL;
+bx_list_c *root_param = NULL;
+bx_simulator_interface_c *SIM = NULL;
+
+bx_debug_t bx_dbg;
+bool bx_user_quit = 0;
+
+#if BX_SUPPORT_SMP
+bool bx_smp_parallel = 0;
+
+void bx_smp_stop_world(void) {}
+void bx_smp_resume_world(void) {}
+#endif
+
+void print_statistics_tree(bx_param_c *node, int level)
+{
+  UNUSED(node);
+  UNUSED(level);
+}
+
+logfunctions::logfunctions(void) { name = prefix = NULL; logio = NULL; }
+logfunctions::~logfunctions(void) { }
+void logfunctions::put(const char *n, const char *p) { UNUSED(n); UNUSED(p); }
+void logfunctions::info(const char *fmt, ...) { UNUSED(fmt); }
+void logfunctions::ldebug(const char *fmt, ...) { UNUSED(fmt); }
+
+void logfunctions::panic(const char *fmt, ...)
+{
+  va_list ap;
+  va_start(ap, fmt);
+  fprintf(stderr, "PANIC: ");
+  vfprintf(stderr, fmt, ap);
+  fprintf(stderr, "\n");
+  va_end(ap);
+  ::exit(1);
+}
+
+// cpu
+
+#if BX_SUPPORT_SMP
+BX_CPU_C **bx_cpu_array = NULL;
+#else
+BX_CPU_C bx_cpu;
+
+BX_CPU_C::BX_CPU_C(unsigned id): bx_cpuid(id)
+#if BX_SUPPORT_APIC
+   ,lapic (this, id)
+#endif
+{
+}
+
+BX_CPU_C::~BX_CPU_C() {}
+
+#if BX_SUPPORT_APIC
+bx_local_apic_c::bx_local_apic_c(BX_CPU_C *mycpu, unsigned id): cpu(mycpu), apic_id(id) {}
+#endif
+#endif
+Bit8u bx_cpu_count = 1;
+
+void BX_CPU_C::reset(unsigned source) { UNUSED(source); }
+void BX_CPU_C::TLB_flush(void) {}
+#ifdef BX_STUB_TLB_INVLPG_1ARG
+void BX_CPU_C::TLB_invlpg(bx_address laddr) { UNUSED(laddr); }
+#else
+void BX_CPU_C::TLB_invlpg(bx_address laddr, bool allContexts) { UNUSED(laddr); UNUSED(allContexts); }
+#endif
+void BX_CPU_C::raise_INTR(void) {}
+void BX_CPU_C::clear_INTR(void) {}
+
+// devices
+
+bx_devices_c bx_devices;
+
+bx_devices_c::bx_devices_c() {}
+bx_devices_c::~bx_devices_c() {}
+void bx_devices_c::reset(unsigned type) { UNUSED(type); }
+void bx_devices_c::exit(void) {}
+Bit32u bx_devices_c::inp(Bit16u addr, unsigned io_len) { UNUSED(addr); UNUSED(io_len); return 0; }
+void bx_devices_c::outp(Bit16u addr, Bit32u value, unsigned io_len) { UNUSED(addr); UNUSED(value); UNUSED(io_len); }
+
+// the device stubs in bx_devices_c are PCI devices
+Bit32u bx_pci_device_c::pci_read_handler(Bit8u address, unsigned io_len) { UNUSED(address); UNUSED(io_len); return 0; }
+
+// gui
+
+bx_gui_c *bx_gui = NULL;
+
+void bx_gui_c::cleanup(void) {}
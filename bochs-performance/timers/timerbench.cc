@@ -0,0 +1,112 @@
+/////////////////////////////////////////////////////////////////////////
+// $Id$
+/////////////////////////////////////////////////////////////////////////
+//
+// Timer queue microbenchmark for bx_pc_system_c.
+//
+// Links pc_system.cc of a bochs tree with the stubs in stubs.cc to run the
+// timer code on the host. A number of timers is registered and the tick
+// counter is advanced in small steps, like the cpu loop does. One in four
+// timers is a one-shot timer that the handler rearms with
+// activate_timer_ticks(), the others are continuous with different
+// periods. The run reports the host time per timer expiry.
+//
+// usage: timerbench [ticks] [n1 n2 ...]
+//
+/////////////////////////////////////////////////////////////////////////
+
+#include "bochs.h"
+#include "pc_system.h"
+
+#include <time.h>
+
+static Bit64u expiries;
+static Bit32u seed;
+
+static Bit32u next_random(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+static void continuous_handler(void *this_ptr)
+{
+  UNUSED(this_ptr);
+  expiries++;
+}
+
+static void oneshot_handler(void *this_ptr)
+{
+  expiries++;
+  bx_pc_system.activate_timer_ticks(*(int *) this_ptr,
+                                    2000 + next_random() % 100000, 0);
+}
+
+static double run_ms;
+
+static double run(unsigned ntimers, Bit64u ticks)
+{
+  static int timer_id[BX_MAX_TIMERS];
+  unsigned i;
+
+  seed = 1;
+  expiries = 0;
+  bx_pc_system.initialize(10000000);
+  for (i = 0; i < ntimers; i++) {
+    Bit64u period = 2000 + next_random() % 100000;
+    if ((i & 3) == 0) {
+      timer_id[i] = bx_pc_system.register_timer_ticks(&timer_id[i],
+                      oneshot_handler, period, 0, 1, "oneshot");
+    } else {
+      timer_id[i] = bx_pc_system.register_timer_ticks(&timer_id[i],
+                      continuous_handler, period, 1, 1, "continuous");
+    }
+  }
+
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (Bit64u t = 0; t < ticks; t += 16)
+    bx_pc_system.tickn(16);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  for (i = ntimers; i-- > 0; ) {
+    bx_pc_system.deactivate_timer(timer_id[i]);
+    bx_pc_system.unregisterTimer(timer_id[i]);
+  }
+
+  double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+  run_ms = ns / 1e6;
+  return ns / (double) expiries;
+}
+
+int main(int argc, char *argv[])
+{
+  static const unsigned sizes[] = { 10, 20, 50, 100, 200, 500 };
+  Bit64u ticks = 2000000000;
+  int first = 1;
+
+  if (argc > 1) {
+    ticks = strtoull(argv[1], NULL, 0);
+    first = 2;
+  }
+
+  printf("%8s %14s %10s %10s\n", "timers", "expiries", "ms", "ns/expiry");
+  for (unsigned n = 0; ; n++) {
+    unsigned ntimers;
+    if (argc > first) {
+      if ((int) n + first >= argc) break;
+      ntimers = atoi(argv[n + first]);
+    } else {
+      if (n >= sizeof(sizes) / sizeof(sizes[0])) break;
+      ntimers = sizes[n];
+    }
+    if (ntimers >= BX_MAX_TIMERS) {
+      printf("%8u skipped, BX_MAX_TIMERS is %u\n", ntimers, BX_MAX_TIMERS);
+      continue;
+    }
+    double ns = run(ntimers, ticks);
+    printf("%8u %14llu %10.1f %10.1f\n", ntimers, (unsigned long long) expiries,
+           run_ms, ns);
+  }
+  return 0;
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# usage: do_test.sh bochs
+#
+# Builds the boot floppy, runs it once and restores the incremental save
+# state it wrote. The guest prints a checksum of its stack page in both
+# runs, the test passes if they match.
+
+BOCHS=${1:-bochs}
+cd $(dirname $0)
+export BXSHARE=${BXSHARE:-$(cd ../../bochs/bios && pwd)}
+export IMG=stack.img
+
+rm -rf s1 s2 stack.img bochsout.txt
+gcc -m32 -c stack.S -o stack.o || exit 1
+ld -m elf_i386 -Ttext=0x7c00 --oformat binary stack.o -o stack.bin || exit 1
+dd if=/dev/zero of=stack.img bs=1474560 count=1 2>/dev/null
+dd if=stack.bin of=stack.img conv=notrunc 2>/dev/null
+rm -f stack.o stack.bin
+mkdir s1 s2
+
+first=$($BOCHS -q -f bochsrc.txt 2>/dev/null | grep -a '^[0-9A-F]\{8\}$')
+second=$($BOCHS -q -f bochsrc.txt -r s2 2>/dev/null | grep -a '^[0-9A-F]\{8\}$')
+echo "checksum after save: $first, after restore: $second"
+if [ -n "$first" ] && [ "$first" = "$second" ]; then
+  echo "PASS"
+  exit 0
+fi
+echo "FAIL"
+exit 1
@@ -326,6 +326,8 @@ BOCHSAPI extern Bit8u bx_cpu_count;
 BOCHSAPI extern Bit32u apic_id_mask;
 #endif
 
+#include "smpthread.h"
+
 // memory access type (read/write/execute/rw)
 enum {
   BX_READ    = 0,
@@ -108,3 +108,20 @@ void BOCHSAPI_MSVCONLY bx_set_sem(bx_thread_sem_t *thread_sem)
   sem_post(&thread_sem->sem);
 #endif
 }
+
+#if !defined(WIN32)
+int bx_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, unsigned msec)
+{
+  struct timespec ts;
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  ts.tv_sec = tv.tv_sec + msec / 1000;
+  ts.tv_nsec = (tv.tv_usec + (msec % 1000) * 1000) * 1000;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+  return pthread_cond_timedwait(cond, mutex, &ts);
+}
+#endif
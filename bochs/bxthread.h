@@ -38,11 +38,18 @@
 #define BX_INIT_MUTEX(mutex) InitializeCriticalSection(&(mutex))
 #define BX_FINI_MUTEX(mutex) DeleteCriticalSection(&(mutex))
 #define BX_MSLEEP(val) Sleep(val)
+#define BX_COND(cond) CONDITION_VARIABLE cond
+#define BX_INIT_COND(cond) InitializeConditionVariable(&(cond))
+#define BX_FINI_COND(cond)
+#define BX_COND_WAIT(cond,mutex,msec) SleepConditionVariableCS(&(cond), &(mutex), msec)
+#define BX_COND_BROADCAST(cond) WakeAllConditionVariable(&(cond))
+#define BX_YIELD() SwitchToThread()
 
 #else
 
 #include <pthread.h>
 #include <semaphore.h>
+#include <sched.h>
 
 #define BX_THREAD_VAR(name) pthread_t name
 #define BX_THREAD_FUNC(name,arg) void name(void* arg)
@@ -57,6 +64,14 @@
 #define BX_INIT_MUTEX(mutex) pthread_mutex_init(&(mutex),NULL)
 #define BX_FINI_MUTEX(mutex) pthread_mutex_destroy(&(mutex))
 #define BX_MSLEEP(val) usleep(val*1000)
+#define BX_COND(cond) pthread_cond_t cond
+#define BX_INIT_COND(cond) pthread_cond_init(&(cond),NULL)
+#define BX_FINI_COND(cond) pthread_cond_destroy(&(cond))
+#define BX_COND_WAIT(cond,mutex,msec) bx_cond_timedwait(&(cond), &(mutex), msec)
+#define BX_COND_BROADCAST(cond) pthread_cond_broadcast(&(cond))
+#define BX_YIELD() sched_yield()
+
+int bx_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex, unsigned msec);
 
 #endif
 
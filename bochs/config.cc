@@ -538,7 +538,36 @@ void bx_init_options()
       "Maximum amount of instructions allowed to execute before returning control to another CPU.",
       BX_SMP_QUANTUM_MIN, BX_SMP_QUANTUM_MAX,
       16);
+  new bx_param_bool_c(cpu_param,
+      "parallel", "Parallel SMP simulation",
+      "Run each simulated CPU in its own host thread",
+      0);
+  new bx_param_num_c(cpu_param,
+      "skew", "Time skew in parallel SMP simulation",
+      "Maximum amount of instructions a CPU is allowed to run ahead of the emulated time in parallel SMP mode.",
+      BX_SMP_SKEW_MIN, BX_SMP_SKEW_MAX,
+      100000);
 #endif
+  new bx_param_num_c(cpu_param,
+      "dtlb_size", "Data TLB entries",
+      "Number of entries in the first level data TLB (power of 2)",
+      64, 65536,
+      2048);
+  new bx_param_num_c(cpu_param,
+      "itlb_size", "Instruction TLB entries",
+      "Number of entries in the first level instruction TLB (power of 2)",
+      64, 65536,
+      1024);
+  new bx_param_num_c(cpu_param,
+      "stlb_size", "Second level TLB entries",
+      "Number of entries in the second level TLB shared by code and data (power of 2, 0 disables)",
+      0, 65536,
+      4096);
+  new bx_param_num_c(cpu_param,
+      "large_tlb_size", "Large page TLB entries",
+      "Number of entries in the TLB for 2M/4M/1G page translations (power of 2, 0 disables)",
+      0, 1024,
+      32);
   new bx_param_bool_c(cpu_param,
       "reset_on_triple_fault", "Enable CPU reset on triple fault",
       "Enable CPU reset if triple fault occurred (highly recommended)",
@@ -566,6 +595,16 @@ void bx_init_options()
       "Set path to the configurable MSR definition file",
       "", BX_PATHNAME_LEN);
 #endif
+  new bx_param_filename_c(cpu_param,
+      "trace_cache",
+      "Decoded trace cache file",
+      "Set path to the file keeping decoded instruction traces between runs",
+      "", BX_PATHNAME_LEN);
+  new bx_param_string_c(cpu_param,
+      "affinity",
+      "Host CPU affinity",
+      "List of host CPUs the emulation threads are pinned to (e.g. 0-3,8)",
+      "", BX_PATHNAME_LEN);
 
   cpu_param->set_options(menu->SHOW_PARENT);
 
@@ -814,6 +853,64 @@ void bx_init_options()
       1, 2048,
       BX_DEFAULT_MEM_MEGS);
   host_ramsize->set_ask_format("Enter host memory size (MB): [%d] ");
+  static const char *mem_backing_names[] = { "heap", "anonymous", "file", "template", NULL };
+  bx_param_enum_c *backing = new bx_param_enum_c(ram,
+      "backing",
+      "Guest RAM backing",
+      "Allocate guest RAM from heap or map it anonymous, from shared file or copy-on-write from template file",
+      mem_backing_names,
+      BX_MEM_BACKING_HEAP,
+      BX_MEM_BACKING_HEAP);
+  backing->set_ask_format("Choose guest RAM backing [%s] ");
+  path = new bx_param_filename_c(ram,
+      "file",
+      "Guest RAM file",
+      "Pathname of the file mapped as guest RAM",
+      "", BX_PATHNAME_LEN);
+  path->set_ask_format("Enter guest RAM file: [%s] ");
+  new bx_param_bool_c(ram,
+      "huge_pages",
+      "Use host huge pages",
+      "Back the guest RAM by 2M host huge pages",
+      0);
+  new bx_param_bool_c(ram,
+      "incremental_save",
+      "Incremental save state",
+      "Save only the guest RAM pages changed since the last saved or restored state",
+      0);
+  bx_param_num_c *dedup = new bx_param_num_c(ram,
+      "dedup",
+      "Page sharing interval (seconds)",
+      "Share the zero filled and identical guest RAM blocks every N seconds (0 = disabled)",
+      0, 3600,
+      0);
+  dedup->set_ask_format("Enter page sharing interval (seconds): [%d] ");
+  bx_param_num_c *compressed = new bx_param_num_c(ram,
+      "compressed",
+      "Compressed swap space (megabytes)",
+      "Amount of host memory keeping the swapped out guest RAM compressed (0 = disabled)",
+      0, 65536,
+      0);
+  compressed->set_ask_format("Enter compressed swap space size (MB): [%d] ");
+  new bx_param_bool_c(ram,
+      "lazy_restore",
+      "Lazy restore of saved RAM",
+      "Read the saved guest RAM from the save state on first access instead of before resuming",
+      0);
+  static const char *mem_numa_names[] = { "none", "interleave", "bind", NULL };
+  bx_param_enum_c *numa = new bx_param_enum_c(ram,
+      "numa",
+      "NUMA placement of guest RAM",
+      "Leave the guest RAM placement to the host, interleave it across or bind it to the selected NUMA nodes",
+      mem_numa_names,
+      BX_MEM_NUMA_NONE,
+      BX_MEM_NUMA_NONE);
+  numa->set_ask_format("Choose NUMA placement of guest RAM [%s] ");
+  new bx_param_string_c(ram,
+      "numa_nodes",
+      "NUMA nodes for guest RAM",
+      "List of host NUMA nodes used for the guest RAM (e.g. 0-1, empty = all online nodes)",
+      "", BX_PATHNAME_LEN);
   ram->set_options(ram->SERIES_ASK);
 
   path = new bx_param_filename_c(rom,
@@ -1330,7 +1427,7 @@ void bx_init_options()
     14, 15, 11, 9
   };
 
-  #define BXP_PARAMS_PER_ATA_DEVICE 12
+  #define BXP_PARAMS_PER_ATA_DEVICE 13
 
   bx_list_c *ata_menu[BX_MAX_ATA_CHANNEL];
   bx_list_c *ata_res[BX_MAX_ATA_CHANNEL];
@@ -1500,6 +1597,12 @@ void bx_init_options()
         BX_ATA_TRANSLATION_NONE);
       translation->set_ask_format("Enter translation type: [%s]");
 
+      new bx_param_bool_c(menu,
+        "async",
+        "Asynchronous image I/O",
+        "Access the disk image from a worker thread",
+        0);
+
       // the master/slave menu depends on the ATA channel's enabled flag
       enabled->get_dependent_list()->add(menu);
       // the type selector depends on the ATA channel's enabled flag
@@ -1507,7 +1610,7 @@ void bx_init_options()
 
       // all items depend on the drive type
       type->set_dependent_list(menu->clone(), 0);
-      type->set_dependent_bitmap(BX_ATA_DEVICE_DISK, 0xfe6);
+      type->set_dependent_bitmap(BX_ATA_DEVICE_DISK, 0x1fe6);
       type->set_dependent_bitmap(BX_ATA_DEVICE_CDROM, 0x60a);
 
       type->set_handler(bx_param_handler);
@@ -1680,6 +1783,33 @@ void bx_init_options()
     0);
   enabled->set_dependent_list(menu->clone());
 
+  // simulation clones
+  menu = new bx_list_c(misc, "clone", "Simulation Clone Options");
+  menu->set_options(menu->SHOW_PARENT | menu->USE_BOX_TITLE);
+  menu->set_enabled(BX_HAVE_FORK);
+  new bx_param_num_c(menu,
+    "count",
+    "Number of clones",
+    "Number of clones the guest request (port 0x8900 'C') forks off the running simulation",
+    0, 4096,
+    0);
+
+  // disk image block cache
+  menu = new bx_list_c(misc, "disk_cache", "Disk Image Cache Options");
+  menu->set_options(menu->SHOW_PARENT | menu->USE_BOX_TITLE);
+  new bx_param_num_c(menu,
+    "size",
+    "Cache size (MB)",
+    "Size of the block cache shared by the disk images in megabytes (0 disables the cache)",
+    0, 65536,
+    0);
+  new bx_param_num_c(menu,
+    "readahead",
+    "Readahead (KB)",
+    "Largest readahead window for sequential reads in kilobytes (0 disables the readahead)",
+    0, 65536,
+    512);
+
 #if BX_PLUGINS
   // user-defined options subtree
   bx_list_c *user = new bx_list_c(root_param, "user", "User-defined options");
@@ -2780,6 +2910,28 @@ static int parse_line_formatted(const char *context, int num_params, char *param
         SIM->get_param_num(BXPN_HOST_MEM_SIZE)->set(atol(&params[i][5]));
       } else if (!strncmp(params[i], "guest=", 6)) {
         SIM->get_param_num(BXPN_MEM_SIZE)->set(atol(&params[i][6]));
+      } else if (!strncmp(params[i], "backing=", 8)) {
+        if (!SIM->get_param_enum(BXPN_MEM_BACKING)->set_by_name(&params[i][8])) {
+          PARSE_ERR(("%s: memory directive: unknown backing '%s'.", context, &params[i][8]));
+        }
+      } else if (!strncmp(params[i], "file=", 5)) {
+        SIM->get_param_string(BXPN_MEM_BACKING_FILE)->set(&params[i][5]);
+      } else if (!strncmp(params[i], "huge_pages=", 11)) {
+        SIM->get_param_bool(BXPN_MEM_HUGE_PAGES)->set(atol(&params[i][11]));
+      } else if (!strncmp(params[i], "incremental_save=", 17)) {
+        SIM->get_param_bool(BXPN_MEM_INCREMENTAL_SAVE)->set(atol(&params[i][17]));
+      } else if (!strncmp(params[i], "dedup=", 6)) {
+        SIM->get_param_num(BXPN_MEM_DEDUP)->set(atol(&params[i][6]));
+      } else if (!strncmp(params[i], "compressed=", 11)) {
+        SIM->get_param_num(BXPN_MEM_COMPRESSED_SIZE)->set(atol(&params[i][11]));
+      } else if (!strncmp(params[i], "lazy_restore=", 13)) {
+        SIM->get_param_bool(BXPN_MEM_LAZY_RESTORE)->set(atol(&params[i][13]));
+      } else if (!strncmp(params[i], "numa=", 5)) {
+        if (!SIM->get_param_enum(BXPN_MEM_NUMA)->set_by_name(&params[i][5])) {
+          PARSE_ERR(("%s: memory directive malformed.", context));
+        }
+      } else if (!strncmp(params[i], "numa_nodes=", 11)) {
+        SIM->get_param_string(BXPN_MEM_NUMA_NODES)->set(&params[i][11]);
       } else {
         PARSE_ERR(("%s: memory directive malformed.", context));
       }
@@ -3140,6 +3292,24 @@ static int parse_line_formatted(const char *context, int num_params, char *param
     if (parse_param_bool(params[1], 8, BXPN_PORT_E9_HACK) < 0) {
       PARSE_ERR(("%s: port_e9_hack directive malformed.", context));
     }
+  } else if (!strcmp(params[0], "clone")) {
+    if (num_params < 2) {
+      PARSE_ERR(("%s: clone directive malformed.", context));
+    }
+    for (i=1; i<num_params; i++) {
+      if (bx_parse_param_from_list(context, params[i], (bx_list_c*) SIM->get_param(BXPN_CLONE)) < 0) {
+        PARSE_ERR(("%s: clone directive malformed.", context));
+      }
+    }
+  } else if (!strcmp(params[0], "disk_cache")) {
+    if (num_params < 2) {
+      PARSE_ERR(("%s: disk_cache directive malformed.", context));
+    }
+    for (i=1; i<num_params; i++) {
+      if (bx_parse_param_from_list(context, params[i], (bx_list_c*) SIM->get_param(BXPN_DISK_CACHE)) < 0) {
+        PARSE_ERR(("%s: disk_cache directive malformed.", context));
+      }
+    }
   } else if (!strcmp(params[0], "load32bitOSImage")) {
     PARSE_ERR(("%s: load32bitOSImage: This legacy feature is no longer supported.", context));
   } else if (SIM->is_addon_option(params[0])) {
@@ -3398,8 +3568,31 @@ int bx_write_configuration(const char *rc, int overwrite)
     fprintf(fp, ", options=\"%s\"\n", sparam->getptr());
   else
     fprintf(fp, "\n");
-  fprintf(fp, "memory: host=%d, guest=%d\n", SIM->get_param_num(BXPN_HOST_MEM_SIZE)->get(),
+  fprintf(fp, "memory: host=%d, guest=%d", SIM->get_param_num(BXPN_HOST_MEM_SIZE)->get(),
     SIM->get_param_num(BXPN_MEM_SIZE)->get());
+  if (SIM->get_param_enum(BXPN_MEM_BACKING)->get() != BX_MEM_BACKING_HEAP) {
+    fprintf(fp, ", backing=%s", SIM->get_param_enum(BXPN_MEM_BACKING)->get_selected());
+    sparam = SIM->get_param_string(BXPN_MEM_BACKING_FILE);
+    if (!sparam->isempty())
+      fprintf(fp, ", file=\"%s\"", sparam->getptr());
+  }
+  if (SIM->get_param_bool(BXPN_MEM_HUGE_PAGES)->get())
+    fprintf(fp, ", huge_pages=1");
+  if (SIM->get_param_bool(BXPN_MEM_INCREMENTAL_SAVE)->get())
+    fprintf(fp, ", incremental_save=1");
+  if (SIM->get_param_num(BXPN_MEM_DEDUP)->get() > 0)
+    fprintf(fp, ", dedup=%d", SIM->get_param_num(BXPN_MEM_DEDUP)->get());
+  if (SIM->get_param_num(BXPN_MEM_COMPRESSED_SIZE)->get() > 0)
+    fprintf(fp, ", compressed=%d", SIM->get_param_num(BXPN_MEM_COMPRESSED_SIZE)->get());
+  if (SIM->get_param_bool(BXPN_MEM_LAZY_RESTORE)->get())
+    fprintf(fp, ", lazy_restore=1");
+  if (SIM->get_param_enum(BXPN_MEM_NUMA)->get() != BX_MEM_NUMA_NONE) {
+    fprintf(fp, ", numa=%s", SIM->get_param_enum(BXPN_MEM_NUMA)->get_selected());
+    sparam = SIM->get_param_string(BXPN_MEM_NUMA_NODES);
+    if (!sparam->isempty())
+      fprintf(fp, ", numa_nodes=\"%s\"", sparam->getptr());
+  }
+  fprintf(fp, "\n");
 
   bx_write_param_list(fp, (bx_list_c*) SIM->get_param(BXPN_ROMIMAGE), "romimage", 0);
   bx_write_param_list(fp, (bx_list_c*) SIM->get_param(BXPN_VGA_ROMIMAGE), "vgaromimage", 0);
@@ -3461,13 +3654,17 @@ int bx_write_configuration(const char *rc, int overwrite)
   }
   fprintf(fp, "\n");
 #if BX_SUPPORT_SMP
-  fprintf(fp, "cpu: count=%u:%u:%u, ips=%u, quantum=%d, ",
+  fprintf(fp, "cpu: count=%u:%u:%u, ips=%u, quantum=%d, parallel=%d, skew=%u, ",
     SIM->get_param_num(BXPN_CPU_NPROCESSORS)->get(), SIM->get_param_num(BXPN_CPU_NCORES)->get(),
     SIM->get_param_num(BXPN_CPU_NTHREADS)->get(), SIM->get_param_num(BXPN_IPS)->get(),
-    SIM->get_param_num(BXPN_SMP_QUANTUM)->get());
+    SIM->get_param_num(BXPN_SMP_QUANTUM)->get(), SIM->get_param_bool(BXPN_SMP_PARALLEL)->get(),
+    SIM->get_param_num(BXPN_SMP_SKEW)->get());
 #else
   fprintf(fp, "cpu: count=1, ips=%u, ", SIM->get_param_num(BXPN_IPS)->get());
 #endif
+  fprintf(fp, "dtlb_size=%u, itlb_size=%u, stlb_size=%u, large_tlb_size=%u, ",
+    SIM->get_param_num(BXPN_CPU_DTLB_SIZE)->get(), SIM->get_param_num(BXPN_CPU_ITLB_SIZE)->get(),
+    SIM->get_param_num(BXPN_CPU_STLB_SIZE)->get(), SIM->get_param_num(BXPN_CPU_LARGE_TLB_SIZE)->get());
   fprintf(fp, "model=%s, reset_on_triple_fault=%d, cpuid_limit_winnt=%d",
     SIM->get_param_enum(BXPN_CPU_MODEL)->get_selected(),
     SIM->get_param_bool(BXPN_RESET_ON_TRIPLE_FAULT)->get(),
@@ -3483,6 +3680,12 @@ int bx_write_configuration(const char *rc, int overwrite)
   if (!sparam->isempty())
     fprintf(fp, ", msrs=\"%s\"", sparam->getptr());
 #endif
+  sparam = SIM->get_param_string(BXPN_CPU_TRACE_CACHE);
+  if (!sparam->isempty())
+    fprintf(fp, ", trace_cache=\"%s\"", sparam->getptr());
+  sparam = SIM->get_param_string(BXPN_CPU_AFFINITY);
+  if (!sparam->isempty())
+    fprintf(fp, ", affinity=\"%s\"", sparam->getptr());
   fprintf(fp, "\n");
 
 #if BX_CPU_LEVEL >= 4
@@ -3495,6 +3698,12 @@ int bx_write_configuration(const char *rc, int overwrite)
   fprintf(fp, "print_timestamps: enabled=%d\n", bx_dbg.print_timestamps);
   bx_write_debugger_options(fp);
   fprintf(fp, "port_e9_hack: enabled=%d\n", SIM->get_param_bool(BXPN_PORT_E9_HACK)->get());
+  if (SIM->get_param_num(BXPN_CLONE_COUNT)->get() > 0) {
+    bx_write_param_list(fp, (bx_list_c*) SIM->get_param(BXPN_CLONE), NULL, 0);
+  }
+  if (SIM->get_param_num(BXPN_DISK_CACHE_SIZE)->get() > 0) {
+    bx_write_param_list(fp, (bx_list_c*) SIM->get_param(BXPN_DISK_CACHE), NULL, 0);
+  }
   fprintf(fp, "private_colormap: enabled=%d\n", SIM->get_param_bool(BXPN_PRIVATE_COLORMAP)->get());
 #if BX_WITH_AMIGAOS
   fprintf(fp, "fullscreen: enabled=%d\n", SIM->get_param_bool(BXPN_FULLSCREEN)->get());
@@ -409,8 +409,8 @@ BX_CPU_C::system_write_byte(bx_address laddr, Bit8u data)
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 1, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) &data);
       Bit8u *hostAddr = (Bit8u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 1);
      *hostAddr = data;
+      pageWriteStampTable.decWriteStamp(pAddr, 1);
       return;
     }
   }
@@ -433,8 +433,8 @@ BX_CPU_C::system_write_word(bx_address laddr, Bit16u data)
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 2, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) &data);
       Bit16u *hostAddr = (Bit16u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 2);
       WriteHostWordToLittleEndian(hostAddr, data);
+      pageWriteStampTable.decWriteStamp(pAddr, 2);
       return;
     }
   }
@@ -457,8 +457,8 @@ BX_CPU_C::system_write_dword(bx_address laddr, Bit32u data)
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 4, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) &data);
       Bit32u *hostAddr = (Bit32u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 4);
       WriteHostDWordToLittleEndian(hostAddr, data);
+      pageWriteStampTable.decWriteStamp(pAddr, 4);
       return;
     }
   }
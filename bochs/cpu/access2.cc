@@ -26,6 +26,17 @@
 #include "cpu.h"
 #define LOG_THIS BX_CPU_THIS_PTR
 
+// In parallel SMP mode R-M-W instructions write back the result using host
+// compare-and-swap operation and are restarted if the memory was modified
+// by another CPU between the read and the write. The accesses without direct
+// host pointer and CMPXCHG16B are done with the other CPUs stopped.
+#if BX_SMP_ATOMIC_RMW
+#define BX_SMP_RMW_DONE() \
+  if (BX_CPU_THIS_PTR address_xlation.exclusive) smp_end_exclusive_rmw()
+#else
+#define BX_SMP_RMW_DONE()
+#endif
+
   void BX_CPP_AttrRegparmN(3)
 BX_CPU_C::write_linear_byte(unsigned s, bx_address laddr, Bit8u data)
 {
@@ -39,8 +50,8 @@ BX_CPU_C::write_linear_byte(unsigned s, bx_address laddr, Bit8u data)
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 1, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) &data);
       Bit8u *hostAddr = (Bit8u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 1);
       *hostAddr = data;
+      pageWriteStampTable.decWriteStamp(pAddr, 1);
       return;
     }
   }
@@ -66,8 +77,8 @@ BX_CPU_C::write_linear_word(unsigned s, bx_address laddr, Bit16u data)
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 2, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) &data);
       Bit16u *hostAddr = (Bit16u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 2);
       WriteHostWordToLittleEndian(hostAddr, data);
+      pageWriteStampTable.decWriteStamp(pAddr, 2);
       return;
     }
   }
@@ -93,8 +104,8 @@ BX_CPU_C::write_linear_dword(unsigned s, bx_address laddr, Bit32u data)
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 4, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) &data);
       Bit32u *hostAddr = (Bit32u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 4);
       WriteHostDWordToLittleEndian(hostAddr, data);
+      pageWriteStampTable.decWriteStamp(pAddr, 4);
       return;
     }
   }
@@ -120,8 +131,8 @@ BX_CPU_C::write_linear_qword(unsigned s, bx_address laddr, Bit64u data)
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 8, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) &data);
       Bit64u *hostAddr = (Bit64u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 8);
       WriteHostQWordToLittleEndian(hostAddr, data);
+      pageWriteStampTable.decWriteStamp(pAddr, 8);
       return;
     }
   }
@@ -145,9 +156,9 @@ BX_CPU_C::write_linear_xmmword(unsigned s, bx_address laddr, const BxPackedXmmRe
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 16, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) data);
       Bit64u *hostAddr = (Bit64u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 16);
       WriteHostQWordToLittleEndian(hostAddr,   data->xmm64u(0));
       WriteHostQWordToLittleEndian(hostAddr+1, data->xmm64u(1));
+      pageWriteStampTable.decWriteStamp(pAddr, 16);
       return;
     }
   }
@@ -169,9 +180,9 @@ BX_CPU_C::write_linear_xmmword_aligned(unsigned s, bx_address laddr, const BxPac
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 16, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) data);
       Bit64u *hostAddr = (Bit64u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 16);
       WriteHostQWordToLittleEndian(hostAddr,   data->xmm64u(0));
       WriteHostQWordToLittleEndian(hostAddr+1, data->xmm64u(1));
+      pageWriteStampTable.decWriteStamp(pAddr, 16);
       return;
     }
   }
@@ -198,10 +209,10 @@ BX_CPU_C::write_linear_ymmword(unsigned s, bx_address laddr, const BxPackedYmmRe
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 32, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) data);
       Bit64u *hostAddr = (Bit64u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 32);
       for (unsigned n = 0; n < 4; n++) {
         WriteHostQWordToLittleEndian(hostAddr+n, data->ymm64u(n));
       }
+      pageWriteStampTable.decWriteStamp(pAddr, 32);
       return;
     }
   }
@@ -223,10 +234,10 @@ BX_CPU_C::write_linear_ymmword_aligned(unsigned s, bx_address laddr, const BxPac
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 32, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) data);
       Bit64u *hostAddr = (Bit64u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 32);
       for (unsigned n = 0; n < 4; n++) {
         WriteHostQWordToLittleEndian(hostAddr+n, data->ymm64u(n));
       }
+      pageWriteStampTable.decWriteStamp(pAddr, 32);
       return;
     }
   }
@@ -253,10 +264,10 @@ BX_CPU_C::write_linear_zmmword(unsigned s, bx_address laddr, const BxPackedZmmRe
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 64, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) data);
       Bit64u *hostAddr = (Bit64u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 64);
       for (unsigned n = 0; n < 8; n++) {
         WriteHostQWordToLittleEndian(hostAddr+n, data->zmm64u(n));
       }
+      pageWriteStampTable.decWriteStamp(pAddr, 64);
       return;
     }
   }
@@ -278,10 +289,10 @@ BX_CPU_C::write_linear_zmmword_aligned(unsigned s, bx_address laddr, const BxPac
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 64, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) data);
       Bit64u *hostAddr = (Bit64u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 64);
       for (unsigned n = 0; n < 8; n++) {
         WriteHostQWordToLittleEndian(hostAddr+n, data->zmm64u(n));
       }
+      pageWriteStampTable.decWriteStamp(pAddr, 64);
       return;
     }
   }
@@ -617,12 +628,20 @@ BX_CPU_C::read_RMW_linear_byte(unsigned s, bx_address laddr)
       BX_CPU_THIS_PTR address_xlation.paddress1 = pAddr;
 #if BX_SUPPORT_MEMTYPE
       BX_CPU_THIS_PTR address_xlation.memtype1 = tlbEntry->get_memtype();
+#endif
+#if BX_SMP_ATOMIC_RMW
+      BX_CPU_THIS_PTR address_xlation.rmw_data[0] = data;
 #endif
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 1, tlbEntry->get_memtype(), BX_RW, (Bit8u*) &data);
       return data;
     }
   }
 
+#if BX_SMP_ATOMIC_RMW
+  if (bx_smp_parallel && smp_prepare_rmw(tlbEntry, lpf, laddr, 1))
+    return read_RMW_linear_byte(s, laddr);
+#endif
+
   if (access_read_linear(laddr, 1, CPL, BX_RW, 0x0, (void *) &data) < 0)
     exception(int_number(s), 0);
 
@@ -652,12 +671,20 @@ BX_CPU_C::read_RMW_linear_word(unsigned s, bx_address laddr)
       BX_CPU_THIS_PTR address_xlation.paddress1 = pAddr;
 #if BX_SUPPORT_MEMTYPE
       BX_CPU_THIS_PTR address_xlation.memtype1 = tlbEntry->get_memtype();
+#endif
+#if BX_SMP_ATOMIC_RMW
+      BX_CPU_THIS_PTR address_xlation.rmw_data[0] = data;
 #endif
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 2, tlbEntry->get_memtype(), BX_RW, (Bit8u*) &data);
       return data;
     }
   }
 
+#if BX_SMP_ATOMIC_RMW
+  if (bx_smp_parallel && smp_prepare_rmw(tlbEntry, lpf, laddr, 2))
+    return read_RMW_linear_word(s, laddr);
+#endif
+
   if (access_read_linear(laddr, 2, CPL, BX_RW, 0x1, (void *) &data) < 0)
     exception(int_number(s), 0);
 
@@ -687,12 +714,20 @@ BX_CPU_C::read_RMW_linear_dword(unsigned s, bx_address laddr)
       BX_CPU_THIS_PTR address_xlation.paddress1 = pAddr;
 #if BX_SUPPORT_MEMTYPE
       BX_CPU_THIS_PTR address_xlation.memtype1 = tlbEntry->get_memtype();
+#endif
+#if BX_SMP_ATOMIC_RMW
+      BX_CPU_THIS_PTR address_xlation.rmw_data[0] = data;
 #endif
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 4, tlbEntry->get_memtype(), BX_RW, (Bit8u*) &data);
       return data;
     }
   }
 
+#if BX_SMP_ATOMIC_RMW
+  if (bx_smp_parallel && smp_prepare_rmw(tlbEntry, lpf, laddr, 4))
+    return read_RMW_linear_dword(s, laddr);
+#endif
+
   if (access_read_linear(laddr, 4, CPL, BX_RW, 0x3, (void *) &data) < 0)
     exception(int_number(s), 0);
 
@@ -722,12 +757,20 @@ BX_CPU_C::read_RMW_linear_qword(unsigned s, bx_address laddr)
       BX_CPU_THIS_PTR address_xlation.paddress1 = pAddr;
 #if BX_SUPPORT_MEMTYPE
       BX_CPU_THIS_PTR address_xlation.memtype1 = tlbEntry->get_memtype();
+#endif
+#if BX_SMP_ATOMIC_RMW
+      BX_CPU_THIS_PTR address_xlation.rmw_data[0] = data;
 #endif
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 8, tlbEntry->get_memtype(), BX_RW, (Bit8u*) &data);
       return data;
     }
   }
 
+#if BX_SMP_ATOMIC_RMW
+  if (bx_smp_parallel && smp_prepare_rmw(tlbEntry, lpf, laddr, 8))
+    return read_RMW_linear_qword(s, laddr);
+#endif
+
   if (access_read_linear(laddr, 8, CPL, BX_RW, 0x7, (void *) &data) < 0)
     exception(int_number(s), 0);
 
@@ -743,12 +786,22 @@ BX_CPU_C::write_RMW_linear_byte(Bit8u val8)
   if (BX_CPU_THIS_PTR address_xlation.pages > 2) {
     // Pages > 2 means it stores a host address for direct access.
     Bit8u *hostAddr = (Bit8u *) BX_CPU_THIS_PTR address_xlation.pages;
+#if BX_SMP_ATOMIC_RMW
+    if (bx_smp_parallel) {
+      if (! BX_ATOMIC_CAS8(hostAddr, (Bit8u) BX_CPU_THIS_PTR address_xlation.rmw_data[0], val8))
+        smp_restart_rmw();
+      pageWriteStampTable.decWriteStamp(BX_CPU_THIS_PTR address_xlation.paddress1, 1);
+    }
+    else
+#endif
     *hostAddr = val8;
   }
   else {
     // address_xlation.pages must be 1
     access_write_physical(BX_CPU_THIS_PTR address_xlation.paddress1, 1, &val8);
   }
+
+  BX_SMP_RMW_DONE();
 }
 
   void BX_CPP_AttrRegparmN(1)
@@ -757,6 +810,14 @@ BX_CPU_C::write_RMW_linear_word(Bit16u val16)
   if (BX_CPU_THIS_PTR address_xlation.pages > 2) {
     // Pages > 2 means it stores a host address for direct access.
     Bit16u *hostAddr = (Bit16u *) BX_CPU_THIS_PTR address_xlation.pages;
+#if BX_SMP_ATOMIC_RMW
+    if (bx_smp_parallel) {
+      if (! BX_ATOMIC_CAS16(hostAddr, (Bit16u) BX_CPU_THIS_PTR address_xlation.rmw_data[0], val16))
+        smp_restart_rmw();
+      pageWriteStampTable.decWriteStamp(BX_CPU_THIS_PTR address_xlation.paddress1, 2);
+    }
+    else
+#endif
     WriteHostWordToLittleEndian(hostAddr, val16);
     BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID,
         BX_CPU_THIS_PTR address_xlation.paddress1, 2, MEMTYPE(BX_CPU_THIS_PTR address_xlation.memtype1),
@@ -789,6 +850,8 @@ BX_CPU_C::write_RMW_linear_word(Bit16u val16)
         BX_WRITE, 0,  (Bit8u*) &val16);
 #endif
   }
+
+  BX_SMP_RMW_DONE();
 }
 
   void BX_CPP_AttrRegparmN(1)
@@ -797,6 +860,14 @@ BX_CPU_C::write_RMW_linear_dword(Bit32u val32)
   if (BX_CPU_THIS_PTR address_xlation.pages > 2) {
     // Pages > 2 means it stores a host address for direct access.
     Bit32u *hostAddr = (Bit32u *) BX_CPU_THIS_PTR address_xlation.pages;
+#if BX_SMP_ATOMIC_RMW
+    if (bx_smp_parallel) {
+      if (! BX_ATOMIC_CAS32(hostAddr, (Bit32u) BX_CPU_THIS_PTR address_xlation.rmw_data[0], val32))
+        smp_restart_rmw();
+      pageWriteStampTable.decWriteStamp(BX_CPU_THIS_PTR address_xlation.paddress1, 4);
+    }
+    else
+#endif
     WriteHostDWordToLittleEndian(hostAddr, val32);
     BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID,
         BX_CPU_THIS_PTR address_xlation.paddress1, 4, MEMTYPE(BX_CPU_THIS_PTR address_xlation.memtype1),
@@ -839,6 +910,8 @@ BX_CPU_C::write_RMW_linear_dword(Bit32u val32)
         BX_WRITE, 0, (Bit8u*) &val32);
 #endif
   }
+
+  BX_SMP_RMW_DONE();
 }
 
   void BX_CPP_AttrRegparmN(1)
@@ -847,6 +920,14 @@ BX_CPU_C::write_RMW_linear_qword(Bit64u val64)
   if (BX_CPU_THIS_PTR address_xlation.pages > 2) {
     // Pages > 2 means it stores a host address for direct access.
     Bit64u *hostAddr = (Bit64u *) BX_CPU_THIS_PTR address_xlation.pages;
+#if BX_SMP_ATOMIC_RMW
+    if (bx_smp_parallel) {
+      if (! BX_ATOMIC_CAS64(hostAddr, (Bit64u) BX_CPU_THIS_PTR address_xlation.rmw_data[0], val64))
+        smp_restart_rmw();
+      pageWriteStampTable.decWriteStamp(BX_CPU_THIS_PTR address_xlation.paddress1, 8);
+    }
+    else
+#endif
     WriteHostQWordToLittleEndian(hostAddr, val64);
     BX_DBG_PHY_MEMORY_ACCESS(BX_CPU_ID,
         BX_CPU_THIS_PTR address_xlation.paddress1, 8, MEMTYPE(BX_CPU_THIS_PTR address_xlation.memtype1),
@@ -889,12 +970,20 @@ BX_CPU_C::write_RMW_linear_qword(Bit64u val64)
         BX_WRITE, 0, (Bit8u*) &val64);
 #endif
   }
+
+  BX_SMP_RMW_DONE();
 }
 
 #if BX_SUPPORT_X86_64
 
 void BX_CPU_C::read_RMW_linear_dqword_aligned_64(unsigned s, bx_address laddr, Bit64u *hi, Bit64u *lo)
 {
+#if BX_SMP_ATOMIC_RMW
+  // there is no portable 16-byte host compare-and-swap
+  if (bx_smp_parallel && ! bx_smp_world_stopped())
+    smp_begin_exclusive_rmw();
+#endif
+
   bx_address lpf = AlignedAccessLPFOf(laddr, 15);
   bx_TLB_entry *tlbEntry = BX_DTLB_ENTRY_OF(laddr, 0);
   if (tlbEntry->lpf == lpf) {
@@ -911,6 +1000,10 @@ void BX_CPU_C::read_RMW_linear_dqword_aligned_64(unsigned s, bx_address laddr, B
       BX_CPU_THIS_PTR address_xlation.paddress1 = pAddr;
 #if BX_SUPPORT_MEMTYPE
       BX_CPU_THIS_PTR address_xlation.memtype1 = tlbEntry->get_memtype();
+#endif
+#if BX_SMP_ATOMIC_RMW
+      BX_CPU_THIS_PTR address_xlation.rmw_data[0] = *lo;
+      BX_CPU_THIS_PTR address_xlation.rmw_data[1] = *hi;
 #endif
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr,     pAddr,     8, tlbEntry->get_memtype(), BX_RW, (Bit8u*) lo);
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr + 8, pAddr + 8, 8, tlbEntry->get_memtype(), BX_RW, (Bit8u*) hi);
@@ -933,18 +1026,90 @@ void BX_CPU_C::read_RMW_linear_dqword_aligned_64(unsigned s, bx_address laddr, B
 
 void BX_CPU_C::write_RMW_linear_dqword(Bit64u hi, Bit64u lo)
 {
+#if BX_SMP_ATOMIC_RMW
+  // keep the other CPUs stopped until both halves are written
+  bool exclusive = BX_CPU_THIS_PTR address_xlation.exclusive;
+  BX_CPU_THIS_PTR address_xlation.exclusive = 0;
+#endif
+
   write_RMW_linear_qword(lo);
 
   BX_CPU_THIS_PTR address_xlation.paddress1 += 8;
   if (BX_CPU_THIS_PTR address_xlation.pages > 2) {
     // Pages > 2 means it stores a host address for direct access
     BX_CPU_THIS_PTR address_xlation.pages += 8;
+#if BX_SMP_ATOMIC_RMW
+    BX_CPU_THIS_PTR address_xlation.rmw_data[0] = BX_CPU_THIS_PTR address_xlation.rmw_data[1];
+#endif
   }
   else {
     BX_ASSERT(BX_CPU_THIS_PTR address_xlation.pages == 1);
   }
   
   write_RMW_linear_qword(hi);
+
+#if BX_SMP_ATOMIC_RMW
+  BX_CPU_THIS_PTR address_xlation.exclusive = exclusive;
+  BX_SMP_RMW_DONE();
+#endif
+}
+
+#endif
+
+#if BX_SMP_ATOMIC_RMW
+
+// The memory was modified by another CPU between the read and the write of
+// the R-M-W instruction. The instructions write the memory operand before
+// updating the registers, so it could be simply restarted.
+void BX_CPU_C::smp_restart_rmw(void)
+{
+  RIP = BX_CPU_THIS_PTR prev_rip;
+  if (BX_CPU_THIS_PTR speculative_rsp) {
+    RSP = BX_CPU_THIS_PTR prev_rsp;
+#if BX_SUPPORT_CET
+    SSP = BX_CPU_THIS_PTR prev_ssp;
+#endif
+  }
+  BX_CPU_THIS_PTR speculative_rsp = 0;
+
+  longjmp(BX_CPU_THIS_PTR jmp_buf_env, 2); // go back to main decode loop
+}
+
+// The compare-and-swap write back needs direct host access to the operand.
+// Returns true if the TLB entry was filled and allows it now, otherwise the
+// other CPUs are stopped until the R-M-W access completes.
+bool BX_CPU_C::smp_prepare_rmw(bx_TLB_entry *tlbEntry, bx_address lpf, bx_address laddr, unsigned len)
+{
+  if (bx_smp_world_stopped())
+    return 0;
+
+  // misaligned accesses with alignment check and page split accesses are
+  // left to access_read_linear()
+  if (lpf == LPFOf(laddr) && (PAGE_OFFSET(laddr) + len) <= 4096
+#if BX_SUPPORT_X86_64
+      && IsCanonical(laddr)
+#endif
+     )
+  {
+    translate_linear(tlbEntry, laddr, USER_PL, BX_RW);
+    if (tlbEntry->lpf == lpf && isWriteOK(tlbEntry, USER_PL))
+      return 1;
+  }
+
+  smp_begin_exclusive_rmw();
+  return 0;
+}
+
+void BX_CPU_C::smp_begin_exclusive_rmw(void)
+{
+  bx_smp_stop_world();
+  BX_CPU_THIS_PTR address_xlation.exclusive = 1;
+}
+
+void BX_CPU_C::smp_end_exclusive_rmw(void)
+{
+  BX_CPU_THIS_PTR address_xlation.exclusive = 0;
+  bx_smp_resume_world();
 }
 
 #endif
@@ -971,8 +1136,8 @@ void BX_CPU_C::write_new_stack_word(bx_address laddr, unsigned curr_pl, Bit16u d
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 2, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) &data);
       Bit16u *hostAddr = (Bit16u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 2);
       WriteHostWordToLittleEndian(hostAddr, data);
+      pageWriteStampTable.decWriteStamp(pAddr, 2);
       return;
     }
   }
@@ -998,8 +1163,8 @@ void BX_CPU_C::write_new_stack_dword(bx_address laddr, unsigned curr_pl, Bit32u
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 4, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) &data);
       Bit32u *hostAddr = (Bit32u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 4);
       WriteHostDWordToLittleEndian(hostAddr, data);
+      pageWriteStampTable.decWriteStamp(pAddr, 4);
       return;
     }
   }
@@ -1025,8 +1190,8 @@ void BX_CPU_C::write_new_stack_qword(bx_address laddr, unsigned curr_pl, Bit64u
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(laddr, pAddr, 8, tlbEntry->get_memtype(), BX_WRITE, (Bit8u*) &data);
       Bit64u *hostAddr = (Bit64u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 8);
       WriteHostQWordToLittleEndian(hostAddr, data);
+      pageWriteStampTable.decWriteStamp(pAddr, 8);
       return;
     }
   }
@@ -1180,8 +1345,8 @@ void BX_CPP_AttrRegparmN(3) BX_CPU_C::shadow_stack_write_dword(bx_address offset
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(offset, pAddr, 4, tlbEntry->get_memtype(), BX_SHADOW_STACK_WRITE, (Bit8u*) &data);
       Bit32u *hostAddr = (Bit32u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 4);
       WriteHostDWordToLittleEndian(hostAddr, data);
+      pageWriteStampTable.decWriteStamp(pAddr, 4);
       return;
     }
   }
@@ -1203,8 +1368,8 @@ void BX_CPP_AttrRegparmN(3) BX_CPU_C::shadow_stack_write_qword(bx_address offset
       bx_phy_address pAddr = tlbEntry->ppf | pageOffset;
       BX_NOTIFY_LIN_MEMORY_ACCESS(offset, pAddr, 8, tlbEntry->get_memtype(), BX_SHADOW_STACK_WRITE, (Bit8u*) &data);
       Bit64u *hostAddr = (Bit64u*) (hostPageAddr | pageOffset);
-      pageWriteStampTable.decWriteStamp(pAddr, 8);
       WriteHostQWordToLittleEndian(hostAddr, data);
+      pageWriteStampTable.decWriteStamp(pAddr, 8);
       return;
     }
   }
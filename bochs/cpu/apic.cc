@@ -214,6 +214,8 @@ void bx_local_apic_c::reset(unsigned type)
 {
   int i;
 
+  BX_SMP_GUARD();
+
   // default address for a local APIC, can be moved
   base_addr = BX_LAPIC_BASE_ADDR;
   error_status = shadow_error_status = 0;
@@ -314,8 +316,13 @@ bool bx_local_apic_c::is_selected(bx_phy_address addr)
   return 0;
 }
 
+// The local APIC state is also changed by the other CPU threads (IPIs) and
+// by the timers in parallel SMP mode. The methods called directly by the
+// owning CPU hold the simulator lock.
+
 void bx_local_apic_c::read(bx_phy_address addr, void *data, unsigned len)
 {
+  BX_SMP_GUARD();
   if((addr & ~0x3) != ((addr+len-1) & ~0x3)) {
     BX_PANIC(("APIC read at address 0x" FMT_PHY_ADDRX " spans 32-bit boundary !", addr));
     return;
@@ -337,6 +344,7 @@ void bx_local_apic_c::read(bx_phy_address addr, void *data, unsigned len)
 
 void bx_local_apic_c::write(bx_phy_address addr, void *data, unsigned len)
 {
+  BX_SMP_GUARD();
   if (len != 4) {
     BX_PANIC(("APIC write with len=%d (should be 4)", len));
     return;
@@ -657,6 +665,11 @@ void bx_local_apic_c::send_ipi(apic_dest_t dest, Bit32u lo_cmd)
   int vector = (lo_cmd & 0xff);
   int accepted = 0;
 
+#if BX_SUPPORT_SMP
+  // the sender probably waits for the other processors to respond
+  cpu->smp_yield_hint = 1;
+#endif
+
   if(delivery_mode == APIC_DM_INIT)
   {
     if(level == 0 && trig_mode == 1) {
@@ -898,6 +911,7 @@ void bx_local_apic_c::untrigger_irq(Bit8u vector, unsigned trigger_mode)
 
 Bit8u bx_local_apic_c::acknowledge_int(void)
 {
+  BX_SMP_GUARD();
   // CPU calls this when it is ready to service one interrupt
   if(! cpu->is_pending(BX_EVENT_PENDING_LAPIC_INTR))
     BX_PANIC(("APIC %d acknowledged an interrupt, but INTR=0", apic_id));
@@ -983,6 +997,7 @@ Bit8u bx_local_apic_c::get_ppr(void)
 
 void bx_local_apic_c::set_tpr(Bit8u priority)
 {
+  BX_SMP_GUARD();
   if(priority < task_priority) {
     task_priority = priority;
     service_local_apic();
@@ -1128,6 +1143,7 @@ Bit32u bx_local_apic_c::get_current_timer_count(void)
 #if BX_CPU_LEVEL >= 6
 void bx_local_apic_c::set_tsc_deadline(Bit64u deadline)
 {
+  BX_SMP_GUARD();
   Bit32u timervec = lvt[APIC_LVT_TIMER];
 
   if ((timervec & 0x40000) == 0) {
@@ -1152,6 +1168,7 @@ void bx_local_apic_c::set_tsc_deadline(Bit64u deadline)
 
 Bit64u bx_local_apic_c::get_tsc_deadline(void)
 {
+  BX_SMP_GUARD();
   Bit32u timervec = lvt[APIC_LVT_TIMER];
 
   // read as zero if TSC-deadline timer is disabled
@@ -1164,6 +1181,7 @@ Bit64u bx_local_apic_c::get_tsc_deadline(void)
 #if BX_SUPPORT_VMX >= 2
 Bit32u bx_local_apic_c::read_vmx_preemption_timer(void)
 {
+  BX_SMP_GUARD();
   Bit64u diff = (bx_pc_system.time_ticks() >> vmx_preemption_timer_rate) - (vmx_preemption_timer_initial >> vmx_preemption_timer_rate);
   if (vmx_preemption_timer_value < diff)
     return 0;
@@ -1173,6 +1191,7 @@ Bit32u bx_local_apic_c::read_vmx_preemption_timer(void)
 
 void bx_local_apic_c::set_vmx_preemption_timer(Bit32u value)
 {
+  BX_SMP_GUARD();
   vmx_preemption_timer_value = value;
   vmx_preemption_timer_initial = bx_pc_system.time_ticks();
   vmx_preemption_timer_fire = ((vmx_preemption_timer_initial >> vmx_preemption_timer_rate) + value) << vmx_preemption_timer_rate;
@@ -1183,6 +1202,7 @@ void bx_local_apic_c::set_vmx_preemption_timer(Bit32u value)
 
 void bx_local_apic_c::deactivate_vmx_preemption_timer(void)
 {
+  BX_SMP_GUARD();
   if (! vmx_timer_active) return;
   bx_pc_system.deactivate_timer(vmx_timer_handle);
   vmx_timer_active = 0;
@@ -1201,6 +1221,7 @@ void bx_local_apic_c::vmx_preemption_timer_expired(void *this_ptr)
 
 void bx_local_apic_c::set_mwaitx_timer(Bit32u value)
 {
+  BX_SMP_GUARD();
   BX_DEBUG(("MWAITX timer: value = %u", value));
   bx_pc_system.activate_timer_ticks(mwaitx_timer_active, value, 0);
   mwaitx_timer_active = 1;
@@ -1208,6 +1229,7 @@ void bx_local_apic_c::set_mwaitx_timer(Bit32u value)
 
 void bx_local_apic_c::deactivate_mwaitx_timer(void)
 {
+  BX_SMP_GUARD();
   if (! mwaitx_timer_active) return;
   bx_pc_system.deactivate_timer(mwaitx_timer_handle);
   mwaitx_timer_active = 0;
@@ -1227,6 +1249,7 @@ void bx_local_apic_c::mwaitx_timer_expired(void *this_ptr)
 // return false when x2apic is not supported/not readable
 bool bx_local_apic_c::read_x2apic(unsigned index, Bit64u *val_64)
 {
+  BX_SMP_GUARD();
   index = (index - 0x800) << 4;
 
   switch(index) {
@@ -1301,6 +1324,7 @@ bool bx_local_apic_c::read_x2apic(unsigned index, Bit64u *val_64)
 // return false when x2apic is not supported/not writeable
 bool bx_local_apic_c::write_x2apic(unsigned index, Bit32u val32_hi, Bit32u val32_lo)
 {
+  BX_SMP_GUARD();
   index = (index - 0x800) << 4;
 
   if (index != BX_LAPIC_ICR_LO) {
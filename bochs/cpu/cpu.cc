@@ -47,7 +47,11 @@
 
 #endif
 
+#if BX_SUPPORT_SMP
+BX_THREAD_LOCAL jmp_buf BX_CPU_C::jmp_buf_env;
+#else
 jmp_buf BX_CPU_C::jmp_buf_env;
+#endif
 
 void BX_CPU_C::cpu_loop(void)
 {
@@ -246,54 +250,91 @@ bxICacheEntry_c* BX_CPU_C::getICacheEntry(void)
 
 #if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS && BX_ENABLE_TRACE_LINKING
 
-// The function is called after taken branch instructions and tries to link the branch to the next trace
-void BX_CPP_AttrRegparmN(1) BX_CPU_C::linkTrace(bxInstruction_c *i)
-{
-#if BX_SUPPORT_SMP
-  if (BX_SMP_PROCESSORS > 1)
-    return;
-#endif
-
 #define BX_HANDLERS_CHAINING_MAX_DEPTH 1000
 
-  // do not allow extreme trace link depth / avoid host stack overflow
-  // (could happen with badly compiled instruction handlers)
-  static Bit32u linkDepth = 0;
+// do not allow extreme trace link depth / avoid host stack overflow
+// (could happen with badly compiled instruction handlers)
+static Bit32u linkDepth = 0;
 
+// returns false if the execution has to return to the main cpu loop
+BX_CPP_INLINE bool BX_CPU_C::traceLinkAllowed(void)
+{
   if (BX_CPU_THIS_PTR async_event || ++linkDepth > BX_HANDLERS_CHAINING_MAX_DEPTH) {
     linkDepth = 0;
-    return;
+    return false;
   }
 
   Bit32u delta = (Bit32u) (BX_CPU_THIS_PTR icount - BX_CPU_THIS_PTR icount_last_sync);
   if(delta >= bx_pc_system.getNumCpuTicksLeftNextEvent()) {
     linkDepth = 0;
+    return false;
+  }
+
+  return true;
+}
+
+// The function is called after taken branch instructions and tries to link the branch to the next trace
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::linkTrace(bxInstruction_c *i)
+{
+#if BX_SUPPORT_SMP
+  if (BX_SMP_PROCESSORS > 1)
+    return;
+#endif
+
+  if (! traceLinkAllowed()) {
+    // Sample the branch target on the way back to the main cpu loop. Hot
+    // targets are replaced by regions, the fast path is not affected.
+    if (BX_CPU_THIS_PTR iCache.regionCache.hot(RIP)) {
+      bxInstruction_c *region = getRegion();
+      if (region != NULL)
+        i->setNextTrace(region, BX_CPU_THIS_PTR iCache.traceLinkTimeStamp);
+    }
     return;
   }
 
   bxInstruction_c *next = i->getNextTrace(BX_CPU_THIS_PTR iCache.traceLinkTimeStamp);
   if (next) {
     BX_EXECUTE_INSTRUCTION(next);
-    return;
   }
 
-  bx_address eipBiased = RIP + BX_CPU_THIS_PTR eipPageBias;
-  if (eipBiased >= BX_CPU_THIS_PTR eipPageWindowSize) {
-    prefetch();
-    eipBiased = RIP + BX_CPU_THIS_PTR eipPageBias;
+  // followed branch inside of a region, relink it to the region continuation
+  bxInstruction_c *guard = i+1;
+  if (guard->execute1 == &BX_CPU_C::BxRegionGuard && RIP == guard->getRegionGuardRIP()) {
+    next = guard->getRegionGuardNext();
   }
+  else {
+    bx_address eipBiased = RIP + BX_CPU_THIS_PTR eipPageBias;
+    if (eipBiased >= BX_CPU_THIS_PTR eipPageWindowSize) {
+      prefetch();
+      eipBiased = RIP + BX_CPU_THIS_PTR eipPageBias;
+    }
 
-  INC_ICACHE_STAT(iCacheLookups);
+    INC_ICACHE_STAT(iCacheLookups);
 
-  bx_phy_address pAddr = BX_CPU_THIS_PTR pAddrFetchPage + eipBiased;
-  bxICacheEntry_c *entry = BX_CPU_THIS_PTR iCache.find_entry(pAddr, BX_CPU_THIS_PTR fetchModeMask);
+    bx_phy_address pAddr = BX_CPU_THIS_PTR pAddrFetchPage + eipBiased;
+    bxICacheEntry_c *entry = BX_CPU_THIS_PTR iCache.find_entry(pAddr, BX_CPU_THIS_PTR fetchModeMask);
 
-  if (entry != NULL) // link traces - handle only hit cases
-  {
-    i->setNextTrace(entry->i, BX_CPU_THIS_PTR iCache.traceLinkTimeStamp);
-    i = entry->i;
-    BX_EXECUTE_INSTRUCTION(i);
+    if (entry == NULL) // link traces - handle only hit cases
+      return;
+
+    next = entry->i;
   }
+
+  i->setNextTrace(next, BX_CPU_THIS_PTR iCache.traceLinkTimeStamp);
+  BX_EXECUTE_INSTRUCTION(next);
+}
+
+// Inserted after followed branches inside of a region. The taken branch is
+// linked directly to the region continuation, the guard is executed when the
+// branch falls through. Continues the region if the branch went the predicted
+// way, otherwise leaves the region.
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::BxRegionGuard(bxInstruction_c *i)
+{
+  if (RIP != i->getRegionGuardRIP() || ! traceLinkAllowed())
+    return;
+
+  i = i->getRegionGuardNext();
+  BX_EXECUTE_INSTRUCTION(i);
 }
 
 #endif
@@ -201,6 +201,14 @@
 #define BX_CPU_ID (0)
 #endif
 
+// In parallel SMP mode R-M-W instructions and A/D bit updates of the page
+// walk modify the guest memory using host atomic operations
+#if BX_SUPPORT_SMP && defined(BX_LITTLE_ENDIAN)
+#define BX_SMP_ATOMIC_RMW 1
+#else
+#define BX_SMP_ATOMIC_RMW 0
+#endif
+
 #if BX_SUPPORT_AVX
 
 #define BX_READ_8BIT_OPMASK(index)  (BX_CPU_THIS_PTR opmask[index].word.byte.rl)
@@ -867,6 +875,12 @@ public: // for now...
   Bit64u icount;
   Bit64u icount_last_sync;
 
+#if BX_SUPPORT_SMP
+  // the processor is probably waiting for another one (spin-wait loop,
+  // MWAIT or IPI sent), hint for the SMP round-robin scheduler
+  bool smp_yield_hint;
+#endif
+
 #define BX_INHIBIT_INTERRUPTS        0x01
 #define BX_INHIBIT_DEBUG             0x02
 
@@ -1071,13 +1085,22 @@ public: // for now...
   Bit32u  event_mask;
   Bit32u  async_event;
 
+  // events could be signaled by the other CPU threads in parallel SMP mode
   BX_SMF BX_CPP_INLINE void signal_event(Bit32u event) {
+#if BX_SUPPORT_SMP
+    BX_ATOMIC_OR32(&BX_CPU_THIS_PTR pending_event, event);
+#else
     BX_CPU_THIS_PTR pending_event |= event;
+#endif
     if (! is_masked_event(event)) BX_CPU_THIS_PTR async_event = 1;
   }
 
   BX_SMF BX_CPP_INLINE void clear_event(Bit32u event) {
+#if BX_SUPPORT_SMP
+    BX_ATOMIC_AND32(&BX_CPU_THIS_PTR pending_event, ~event);
+#else
     BX_CPU_THIS_PTR pending_event &= ~event;
+#endif
   }
 
   BX_SMF BX_CPP_INLINE void mask_event(Bit32u event) {
@@ -1126,7 +1149,12 @@ public: // for now...
 #endif
 
   // for exceptions
+#if BX_SUPPORT_SMP
+  // every CPU thread has its own in parallel SMP mode
+  static BX_THREAD_LOCAL jmp_buf jmp_buf_env;
+#else
   static jmp_buf jmp_buf_env;
+#endif
   unsigned last_exception_type;
 
   // Boundaries of current code page, based on EIP
@@ -1192,10 +1220,19 @@ public: // for now...
 #define BX_INSTR_FAR_BRANCH_ORIGIN()
 #endif
 
-#define BX_DTLB_SIZE 2048
-#define BX_ITLB_SIZE 1024
-  TLB<BX_DTLB_SIZE> DTLB BX_CPP_AlignN(32);
-  TLB<BX_ITLB_SIZE> ITLB BX_CPP_AlignN(32);
+  // first level TLBs, second level TLB shared by code and data and large
+  // page TLB, sizes are set by the 'cpu' configuration option
+  TLB DTLB BX_CPP_AlignN(32);
+  TLB ITLB BX_CPP_AlignN(32);
+  SecondLevelTLB STLB;
+  LargePageTLB LTLB;
+
+  // translation context of the entries in the first level TLBs, see tlb.h
+  Bit64u tlb_ctx;
+#if BX_SUPPORT_VMX >= 2 || BX_SUPPORT_SVM
+  // EPT pointer or nested CR3 of the guest translations kept in the TLBs
+  Bit64u tlb_nested_root;
+#endif
 
 #if BX_CPU_LEVEL >= 6
   struct {
@@ -1226,6 +1263,11 @@ public: // for now...
 #if BX_SUPPORT_MEMTYPE
     BxMemtype memtype1;       // memory type of the page 1
     BxMemtype memtype2;       // memory type of the page 2
+#endif
+#if BX_SUPPORT_SMP
+    Bit64u rmw_data[2];       // original value read by the R-M-W instruction,
+                              // used for atomic write back in parallel SMP mode
+    bool exclusive;           // the other CPUs are stopped until the write back
 #endif
   } address_xlation;
 
@@ -1285,6 +1327,7 @@ public: // for now...
  ~BX_CPU_C();
 
   void initialize(void);
+  void bind_numa_node(int node);
   void init_statistics(void);
   void after_restore_state(void);
   void register_state(void);
@@ -1555,6 +1598,17 @@ public: // for now...
   BX_SMF void JLE_Jd(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
   BX_SMF void JNLE_Jd(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
 
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS
+  // flag producers fused with the following conditional branch
+  BX_SMF void CMP_GdEdR_Jd(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void CMP_GdEdM_Jd(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void CMP_EdIdR_Jd(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void CMP_EdIdM_Jd(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void TEST_EdGdR_Jd(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void TEST_EdIdR_Jd(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void DEC_EdR_Jd(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+#endif
+
   BX_SMF void SETO_EbR(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
   BX_SMF void SETNO_EbR(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
   BX_SMF void SETB_EbR(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
@@ -4041,6 +4095,24 @@ public: // for now...
   BX_SMF void JLE_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
   BX_SMF void JNLE_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
 
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS
+  // flag producers fused with the following conditional branch
+  BX_SMF void CMP_GdEdR_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void CMP_GdEdM_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void CMP_EdIdR_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void CMP_EdIdM_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void TEST_EdGdR_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void TEST_EdIdR_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void DEC_EdR_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void CMP_GqEqR_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void CMP_GqEqM_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void CMP_EqIdR_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void CMP_EqIdM_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void TEST_EqGqR_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void TEST_EqIdR_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+  BX_SMF void DEC_EqR_Jq(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+#endif
+
   BX_SMF void ENTER64_IwIb(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
   BX_SMF void LEAVE64(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
   BX_SMF void IRET64(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
@@ -4247,6 +4319,9 @@ public: // for now...
   BX_SMF void BxError(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
 #if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS
   BX_SMF void BxEndTrace(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+#if BX_ENABLE_TRACE_LINKING
+  BX_SMF void BxRegionGuard(bxInstruction_c *) BX_CPP_AttrRegparmN(1);
+#endif
 #endif
 
 #if BX_CPU_LEVEL >= 6
@@ -4289,6 +4364,7 @@ public: // for now...
 #if BX_SUPPORT_VMX >= 2
   BX_SMF bool dbg_translate_guest_physical(bx_phy_address guest_paddr, bx_phy_address *phy, bool verbose = 0);
 #endif
+  BX_SMF bool check_addr_in_vmcs_buffers(const Bit8u *addr, const Bit8u *end);
 #if BX_LARGE_RAMFILE
   BX_SMF bool check_addr_in_tlb_buffers(const Bit8u *addr, const Bit8u *end);
 #endif
@@ -4310,6 +4386,9 @@ public: // for now...
   BX_SMF bool mergeTraces(bxICacheEntry_c *entry, bxInstruction_c *i, bx_phy_address pAddr);
 #if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS && BX_ENABLE_TRACE_LINKING
   BX_SMF void linkTrace(bxInstruction_c *i) BX_CPP_AttrRegparmN(1);
+  BX_SMF BX_CPP_INLINE bool traceLinkAllowed(void);
+  BX_SMF bxInstruction_c* getRegion(void);
+  BX_SMF bxInstruction_c* buildRegion(bx_phy_address pAddr);
 #endif
   BX_SMF void prefetch(void);
   BX_SMF void updateFetchModeMask(void);
@@ -4433,6 +4512,12 @@ public: // for now...
   BX_SMF void read_RMW_linear_dqword_aligned_64(unsigned seg, bx_address laddr, Bit64u *hi, Bit64u *lo);
   BX_SMF void write_RMW_linear_dqword(Bit64u hi, Bit64u lo);
 #endif
+#if BX_SUPPORT_SMP
+  BX_SMF void smp_restart_rmw(void) BX_CPP_AttrNoReturn();
+  BX_SMF bool smp_prepare_rmw(bx_TLB_entry *tlbEntry, bx_address lpf, bx_address laddr, unsigned len);
+  BX_SMF void smp_begin_exclusive_rmw(void);
+  BX_SMF void smp_end_exclusive_rmw(void);
+#endif
 
   // write of word/dword to new stack could happen only in legacy mode
   BX_SMF void write_new_stack_word(bx_segment_reg_t *seg, Bit32u offset, unsigned curr_pl, Bit16u data);
@@ -4490,16 +4575,21 @@ public: // for now...
        bx_descriptor_t *descriptor, bx_address rip, unsigned cpl);
 
 #if BX_SUPPORT_REPEAT_SPEEDUPS
-  BX_SMF Bit32u FastRepMOVSB(unsigned srcSeg, Bit32u srcOff, unsigned dstSeg, Bit32u dstOff, Bit32u byteCount, Bit32u granularity);
+  BX_SMF Bit32u FastRepTicksLeft(void);
+  BX_SMF Bit64u FastRepSegment(unsigned seg, Bit32u offset, unsigned rw, bx_address *laddr);
+
+  BX_SMF Bit32u FastRepMOVSB(unsigned srcSeg, Bit32u srcOff, unsigned dstSeg, Bit32u dstOff, Bit64u byteCount, Bit32u granularity);
   BX_SMF Bit32u FastRepMOVSB(bx_address laddrSrc, bx_address laddrDst, Bit64u byteCount, Bit32u granularity);
 
   BX_SMF Bit32u FastRepSTOSB(unsigned dstSeg, Bit32u dstOff, Bit8u  val, Bit32u  byteCount);
   BX_SMF Bit32u FastRepSTOSW(unsigned dstSeg, Bit32u dstOff, Bit16u val, Bit32u  wordCount);
   BX_SMF Bit32u FastRepSTOSD(unsigned dstSeg, Bit32u dstOff, Bit32u val, Bit32u dwordCount);
+  BX_SMF Bit32u FastRepSTOS(bx_address laddrDst, Bit64u val, unsigned granularity, Bit32u count);
 
-  BX_SMF Bit32u FastRepSTOSB(bx_address laddrDst, Bit8u  val, Bit32u  byteCount);
-  BX_SMF Bit32u FastRepSTOSW(bx_address laddrDst, Bit16u val, Bit32u  wordCount);
-  BX_SMF Bit32u FastRepSTOSD(bx_address laddrDst, Bit32u val, Bit32u dwordCount);
+  BX_SMF Bit32u FastRepSCASB(unsigned dstSeg, Bit32u dstOff, Bit8u val, Bit32u byteCount, bool repe);
+  BX_SMF Bit32u FastRepSCASB(bx_address laddrDst, Bit8u val, Bit32u byteCount, bool repe);
+  BX_SMF Bit32u FastRepCMPSB(unsigned srcSeg, Bit32u srcOff, unsigned dstSeg, Bit32u dstOff, Bit32u byteCount, bool repe);
+  BX_SMF Bit32u FastRepCMPSB(bx_address laddrSrc, bx_address laddrDst, Bit32u byteCount, bool repe);
 
   BX_SMF Bit32u FastRepINSW(Bit32u dstOff, Bit16u port, Bit32u wordCount);
   BX_SMF Bit32u FastRepOUTSW(unsigned srcSeg, Bit32u srcOff, Bit16u port, Bit32u wordCount);
@@ -4520,8 +4610,10 @@ public: // for now...
 
   // linear address for translate_linear expected to be canonical !
   BX_SMF bx_phy_address translate_linear(bx_TLB_entry *entry, bx_address laddr, unsigned user, unsigned rw);
+  BX_SMF bool large_page_tlb_allowed(unsigned rw);
   BX_SMF bx_phy_address translate_linear_legacy(bx_address laddr, Bit32u &lpf_mask, unsigned user, unsigned rw);
   BX_SMF void update_access_dirty(bx_phy_address *entry_addr, Bit32u *entry, BxMemtype *entry_memtype, unsigned leaf, unsigned write);
+  BX_SMF void write_paging_entry_bits(bx_phy_address entry_addr, unsigned len, void *entry, Bit64u bits);
 #if BX_CPU_LEVEL >= 6
   BX_SMF bx_phy_address translate_linear_load_PDPTR(bx_address laddr, unsigned user, unsigned rw);
   BX_SMF bx_phy_address translate_linear_PAE(bx_address laddr, Bit32u &lpf_mask, unsigned user, unsigned rw);
@@ -4552,9 +4644,13 @@ public: // for now...
 
 #if BX_CPU_LEVEL >= 6
   BX_SMF void TLB_flushNonGlobal(void);
+  BX_SMF Bit64u TLB_context(void);
+  BX_SMF void TLB_switchContext(bool flushNew);
+  BX_SMF void TLB_flushPCID(unsigned pcid);
+  BX_SMF void TLB_flushVPID(unsigned vpid, bool keep_global);
 #endif
   BX_SMF void TLB_flush(void);
-  BX_SMF void TLB_invlpg(bx_address laddr);
+  BX_SMF void TLB_invlpg(bx_address laddr, bool allContexts = false);
   BX_SMF void inhibit_interrupts(unsigned mask);
   BX_SMF bool interrupts_inhibited(unsigned mask);
   BX_SMF const char *strseg(bx_segment_reg_t *seg);
@@ -4571,7 +4667,7 @@ public: // for now...
 
   BX_SMF bool SetCR0(bxInstruction_c *i, bx_address val);
   BX_SMF bool check_CR0(bx_address val) BX_CPP_AttrRegparmN(1);
-  BX_SMF bool SetCR3(bx_address val) BX_CPP_AttrRegparmN(1);
+  BX_SMF bool SetCR3(bx_address val, bool noFlush = false) BX_CPP_AttrRegparmN(2);
 #if BX_CPU_LEVEL >= 5
   BX_SMF bool SetCR4(bxInstruction_c *i, bx_address val);
   BX_SMF bool check_CR4(bx_address val) BX_CPP_AttrRegparmN(1);
@@ -4600,7 +4696,7 @@ public: // for now...
   BX_SMF void shutdown(void);
   BX_SMF void enter_sleep_state(unsigned state);
   BX_SMF void handleCpuModeChange(void);
-  BX_SMF void handleCpuContextChange(void);
+  BX_SMF void handleCpuContextChange(bool flushTLB = true);
   BX_SMF void handleInterruptMaskChange(void);
 #if BX_CPU_LEVEL >= 4
   BX_SMF void handleAlignmentCheck(void);
@@ -5087,6 +5183,7 @@ public: // for now...
   BX_SMF void SvmEnterSaveHostState(SVM_HOST_STATE *host);
   BX_SMF bool SvmEnterLoadCheckControls(SVM_CONTROLS *ctrls);
   BX_SMF bool SvmEnterLoadCheckGuestState(void);
+  BX_SMF void SvmEnterSwitchTLB(SVM_CONTROLS *ctrls);
   BX_SMF bool SvmInjectEvents(void);
   BX_SMF void Svm_Vmexit(int reason, Bit64u exitinfo1 = 0, Bit64u exitinfo2 = 0);
   BX_SMF void SvmExitSaveGuestState(void);
@@ -25,7 +25,7 @@
 #define BX_CPUSTATS_H
 
 #define InstrumentICACHE 0
-#define InstrumentTLB 0
+#define InstrumentTLB BX_ENABLE_STATISTICS
 #define InstrumentTLBFlush 0
 #define InstrumentStackPrefetch 0
 #define InstrumentSMC 0
@@ -39,6 +39,10 @@ struct bx_cpu_statistics
   Bit64u iCacheLookups;
   Bit64u iCachePrefetch;
   Bit64u iCacheMisses;
+  Bit64u iCacheEvictions;
+  Bit64u iCachePoolReclaims;
+  Bit64u iCacheRegions;
+  Bit64u iCacheWarmHits;
 
   // tlb lookup statistics
   Bit64u tlbLookups;
@@ -47,10 +51,14 @@ struct bx_cpu_statistics
   Bit64u tlbMisses;
   Bit64u tlbExecuteMisses;
   Bit64u tlbWriteMisses;
+  Bit64u tlbSecondLevelHits;
+  Bit64u tlbLargePageHits;
+  Bit64u tlbContextSwitches;
 
   // tlb flush statistics
   Bit64u tlbGlobalFlushes;
   Bit64u tlbNonGlobalFlushes;
+  Bit64u tlbContextFlushes;
 
   // stack prefetch statistics
   Bit64u stackPrefetch;
@@ -60,9 +68,12 @@ struct bx_cpu_statistics
 
   bx_cpu_statistics():
       iCacheLookups(0), iCachePrefetch(0), iCacheMisses(0),
+      iCacheEvictions(0), iCachePoolReclaims(0), iCacheRegions(0),
+      iCacheWarmHits(0),
       tlbLookups(0), tlbExecuteLookups(0), tlbWriteLookups(0),
       tlbMisses(0), tlbExecuteMisses(0), tlbWriteMisses(0),
-      tlbGlobalFlushes(0), tlbNonGlobalFlushes(0),
+      tlbSecondLevelHits(0), tlbLargePageHits(0), tlbContextSwitches(0),
+      tlbGlobalFlushes(0), tlbNonGlobalFlushes(0), tlbContextFlushes(0),
       stackPrefetch(0), smc(0) {}
   
 };
@@ -73,7 +73,7 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::MOV_DdRd(bxInstruction_c *i)
     case 2: // DR2
     case 3: // DR3
       BX_CPU_THIS_PTR dr[i->dst()] = val_32;
-      TLB_invlpg(val_32);
+      TLB_invlpg(val_32, true);
       break;
 
     case 4: // DR4
@@ -252,7 +252,7 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::MOV_DqRq(bxInstruction_c *i)
     case 2: // DR2
     case 3: // DR3
       BX_CPU_THIS_PTR dr[i->dst()] = val_64;
-      TLB_invlpg(val_64);
+      TLB_invlpg(val_64, true);
       break;
 
     case 4: // DR4
@@ -708,12 +708,14 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::MOV_CR3Rq(bxInstruction_c *i)
 #endif
 
   // allow bit 63 (hint that TLB doesn't need to be cleared) to be set when
-  // PCIDE is set, but ignore the hint if given
+  // PCIDE is set, the translations tagged with the new PCID are kept then
+  bool noFlush = false;
   if (BX_CPU_THIS_PTR cr4.get_PCIDE()) {
+    noFlush = (val_64 >> 63) != 0;
     val_64 &= ~(BX_CONST64(1)<<63);
   }
 
-  if (! SetCR3(val_64))
+  if (! SetCR3(val_64, noFlush))
     exception(BX_GP_EXCEPTION, 0);
 
   BX_INSTR_TLB_CNTRL(BX_CPU_ID, BX_INSTR_MOV_CR3, val_64);
@@ -1360,6 +1362,9 @@ bool BX_CPU_C::SetCR4(bxInstruction_c *i, bx_address val)
   BX_CPU_THIS_PTR cr4.set32((Bit32u) val);
 
 #if BX_CPU_LEVEL >= 6
+  // the TLB context is tagged with CR4 paging bits
+  BX_CPU_THIS_PTR tlb_ctx = TLB_context();
+
   handleSseModeChange();
 #if BX_SUPPORT_AVX
   handleAvxModeChange();
@@ -1375,7 +1380,7 @@ bool BX_CPU_C::SetCR4(bxInstruction_c *i, bx_address val)
 }
 #endif // BX_CPU_LEVEL >= 5
 
-bool BX_CPP_AttrRegparmN(1) BX_CPU_C::SetCR3(bx_address val)
+bool BX_CPP_AttrRegparmN(2) BX_CPU_C::SetCR3(bx_address val, bool noFlush)
 {
 #if BX_SUPPORT_X86_64
   if (long_mode()) {
@@ -1390,11 +1395,12 @@ bool BX_CPP_AttrRegparmN(1) BX_CPU_C::SetCR3(bx_address val)
 
   // flush TLB even if value does not change
 #if BX_CPU_LEVEL >= 6
-  if (BX_CPU_THIS_PTR cr4.get_PGE())
-    TLB_flushNonGlobal(); // Don't flush Global entries.
-  else
+  // the translations of other PCIDs are kept, the entries tagged with the
+  // new PCID are invalidated unless noFlush is set
+  TLB_switchContext(! noFlush);
+#else
+  TLB_flush();          // Flush Global entries also.
 #endif
-    TLB_flush();          // Flush Global entries also.
 
   return 1;
 }
@@ -1419,9 +1425,17 @@ bool BX_CPP_AttrRegparmN(1) BX_CPU_C::SetEFER(bx_address val_64)
   }
 #endif
 
+  Bit32u oldEFER = BX_CPU_THIS_PTR efer.get32();
+
   BX_CPU_THIS_PTR efer.set32((val32 & BX_CPU_THIS_PTR efer_suppmask & ~BX_EFER_LMA_MASK)
         | (BX_CPU_THIS_PTR efer.get32() & BX_EFER_LMA_MASK)); // keep LMA untouched
 
+#if BX_CPU_LEVEL >= 6
+  // the TLB context is tagged with EFER.NXE
+  if ((oldEFER ^ BX_CPU_THIS_PTR efer.get32()) & BX_EFER_NXE_MASK)
+    TLB_switchContext(false);
+#endif
+
   return 1;
 }
 #endif
@@ -487,6 +487,128 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::JNLE_Jd(bxInstruction_c *i)
   BX_NEXT_INSTR(i); // trace can continue over non-taken branch
 }
 
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS
+
+// truth tables of the condition codes indexed by BX_FUSED_JCC_FLAGS
+const Bit16u bx_fused_jcc_table[16] = {
+  0xff00, /* O  */ 0x00ff, /* NO  */
+  0xaaaa, /* B  */ 0x5555, /* NB  */
+  0xcccc, /* Z  */ 0x3333, /* NZ  */
+  0xeeee, /* BE */ 0x1111, /* NBE */
+  0xf0f0, /* S  */ 0x0f0f, /* NS  */
+  0x0000, /* P  */ 0x0000, /* NP  */
+  0x0ff0, /* L  */ 0xf00f, /* NL  */
+  0xcffc, /* LE */ 0x3003  /* NLE */
+};
+
+// Commit the flag producer and execute the conditional branch fused with
+// it. The branch condition is evaluated from the producer flags vector and
+// RIP is written once, with either the branch target or the address of
+// the next instruction.
+#define BX_FUSED_JCC32(i, flags) {                                 \
+  BX_COMMIT_INSTRUCTION(i);                                        \
+  if (BX_CPU_THIS_PTR async_event) return;                         \
+  ++i;                                                             \
+  if (BX_FUSED_JCC_TAKEN(i->fusedCondition(), (flags))) {          \
+    Bit32u new_EIP = EIP + i->ilen() + (Bit32s) i->Id();           \
+    branch_near32(new_EIP);                                        \
+    BX_INSTR_CNEAR_BRANCH_TAKEN(BX_CPU_ID, PREV_RIP, new_EIP);     \
+    BX_LINK_TRACE(i);                                              \
+  }                                                                \
+  RIP += i->ilen();                                                \
+  BX_INSTR_CNEAR_BRANCH_NOT_TAKEN(BX_CPU_ID, PREV_RIP);            \
+  BX_NEXT_INSTR(i);                                                \
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMP_GdEdR_Jd(bxInstruction_c *i)
+{
+  Bit32u op1_32, op2_32, diff_32;
+
+  op1_32 = BX_READ_32BIT_REG(i->dst());
+  op2_32 = BX_READ_32BIT_REG(i->src());
+  diff_32 = op1_32 - op2_32;
+
+  SET_FLAGS_OSZAPC_SUB_32(op1_32, op2_32, diff_32);
+
+  BX_FUSED_JCC32(i, BX_FUSED_JCC_FLAGS_SUB_32(op1_32, op2_32, diff_32));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMP_GdEdM_Jd(bxInstruction_c *i)
+{
+  Bit32u op1_32, op2_32, diff_32;
+
+  bx_address eaddr = BX_CPU_RESOLVE_ADDR(i);
+
+  op1_32 = BX_READ_32BIT_REG(i->dst());
+  op2_32 = read_virtual_dword(i->seg(), eaddr);
+  diff_32 = op1_32 - op2_32;
+
+  SET_FLAGS_OSZAPC_SUB_32(op1_32, op2_32, diff_32);
+
+  BX_FUSED_JCC32(i, BX_FUSED_JCC_FLAGS_SUB_32(op1_32, op2_32, diff_32));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMP_EdIdR_Jd(bxInstruction_c *i)
+{
+  Bit32u op1_32, op2_32, diff_32;
+
+  op1_32 = BX_READ_32BIT_REG(i->dst());
+  op2_32 = i->Id();
+  diff_32 = op1_32 - op2_32;
+
+  SET_FLAGS_OSZAPC_SUB_32(op1_32, op2_32, diff_32);
+
+  BX_FUSED_JCC32(i, BX_FUSED_JCC_FLAGS_SUB_32(op1_32, op2_32, diff_32));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMP_EdIdM_Jd(bxInstruction_c *i)
+{
+  Bit32u op1_32, op2_32, diff_32;
+
+  bx_address eaddr = BX_CPU_RESOLVE_ADDR(i);
+
+  op1_32 = read_virtual_dword(i->seg(), eaddr);
+  op2_32 = i->Id();
+  diff_32 = op1_32 - op2_32;
+
+  SET_FLAGS_OSZAPC_SUB_32(op1_32, op2_32, diff_32);
+
+  BX_FUSED_JCC32(i, BX_FUSED_JCC_FLAGS_SUB_32(op1_32, op2_32, diff_32));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::TEST_EdGdR_Jd(bxInstruction_c *i)
+{
+  Bit32u op1_32, op2_32;
+
+  op1_32 = BX_READ_32BIT_REG(i->dst());
+  op2_32 = BX_READ_32BIT_REG(i->src());
+  op1_32 &= op2_32;
+
+  SET_FLAGS_OSZAPC_LOGIC_32(op1_32);
+
+  BX_FUSED_JCC32(i, BX_FUSED_JCC_FLAGS_LOGIC_32(op1_32));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::TEST_EdIdR_Jd(bxInstruction_c *i)
+{
+  Bit32u op1_32 = BX_READ_32BIT_REG(i->dst());
+  op1_32 &= i->Id();
+  SET_FLAGS_OSZAPC_LOGIC_32(op1_32);
+
+  BX_FUSED_JCC32(i, BX_FUSED_JCC_FLAGS_LOGIC_32(op1_32));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::DEC_EdR_Jd(bxInstruction_c *i)
+{
+  Bit32u erx = --BX_READ_32BIT_REG(i->dst());
+  SET_FLAGS_OSZAP_SUB_32(erx + 1, 0, erx);
+  BX_CLEAR_64BIT_HIGH(i->dst());
+
+  BX_FUSED_JCC32(i, BX_FUSED_JCC_FLAGS_DEC_32(getB_CF(), erx));
+}
+
+#endif // BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS
+
 void BX_CPP_AttrRegparmN(1) BX_CPU_C::JMP_Ap(bxInstruction_c *i)
 {
   BX_ASSERT(BX_CPU_THIS_PTR cpu_mode != BX_MODE_LONG_64);
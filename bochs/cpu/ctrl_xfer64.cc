@@ -407,6 +407,203 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::JNLE_Jq(bxInstruction_c *i)
   BX_NEXT_INSTR(i); // trace can continue over non-taken branch
 }
 
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS
+
+// Commit the flag producer and execute the conditional branch fused with
+// it, the branch condition is evaluated from the producer flags vector
+#define BX_FUSED_JCC64(i, flags) {                                 \
+  BX_COMMIT_INSTRUCTION(i);                                        \
+  if (BX_CPU_THIS_PTR async_event) return;                         \
+  ++i;                                                             \
+  RIP += i->ilen();                                                \
+  if (BX_FUSED_JCC_TAKEN(i->fusedCondition(), (flags))) {          \
+    branch_near64(i);                                              \
+    BX_INSTR_CNEAR_BRANCH_TAKEN(BX_CPU_ID, PREV_RIP, RIP);         \
+    BX_LINK_TRACE(i);                                              \
+  }                                                                \
+  BX_INSTR_CNEAR_BRANCH_NOT_TAKEN(BX_CPU_ID, PREV_RIP);            \
+  BX_NEXT_INSTR(i);                                                \
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMP_GdEdR_Jq(bxInstruction_c *i)
+{
+  Bit32u op1_32, op2_32, diff_32;
+
+  op1_32 = BX_READ_32BIT_REG(i->dst());
+  op2_32 = BX_READ_32BIT_REG(i->src());
+  diff_32 = op1_32 - op2_32;
+
+  SET_FLAGS_OSZAPC_SUB_32(op1_32, op2_32, diff_32);
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_SUB_32(op1_32, op2_32, diff_32));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMP_GdEdM_Jq(bxInstruction_c *i)
+{
+  Bit32u op1_32, op2_32, diff_32;
+
+  bx_address eaddr = BX_CPU_RESOLVE_ADDR(i);
+
+  op1_32 = BX_READ_32BIT_REG(i->dst());
+  op2_32 = read_virtual_dword(i->seg(), eaddr);
+  diff_32 = op1_32 - op2_32;
+
+  SET_FLAGS_OSZAPC_SUB_32(op1_32, op2_32, diff_32);
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_SUB_32(op1_32, op2_32, diff_32));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMP_EdIdR_Jq(bxInstruction_c *i)
+{
+  Bit32u op1_32, op2_32, diff_32;
+
+  op1_32 = BX_READ_32BIT_REG(i->dst());
+  op2_32 = i->Id();
+  diff_32 = op1_32 - op2_32;
+
+  SET_FLAGS_OSZAPC_SUB_32(op1_32, op2_32, diff_32);
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_SUB_32(op1_32, op2_32, diff_32));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMP_EdIdM_Jq(bxInstruction_c *i)
+{
+  Bit32u op1_32, op2_32, diff_32;
+
+  bx_address eaddr = BX_CPU_RESOLVE_ADDR(i);
+
+  op1_32 = read_virtual_dword(i->seg(), eaddr);
+  op2_32 = i->Id();
+  diff_32 = op1_32 - op2_32;
+
+  SET_FLAGS_OSZAPC_SUB_32(op1_32, op2_32, diff_32);
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_SUB_32(op1_32, op2_32, diff_32));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::TEST_EdGdR_Jq(bxInstruction_c *i)
+{
+  Bit32u op1_32, op2_32;
+
+  op1_32 = BX_READ_32BIT_REG(i->dst());
+  op2_32 = BX_READ_32BIT_REG(i->src());
+  op1_32 &= op2_32;
+
+  SET_FLAGS_OSZAPC_LOGIC_32(op1_32);
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_LOGIC_32(op1_32));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::TEST_EdIdR_Jq(bxInstruction_c *i)
+{
+  Bit32u op1_32 = BX_READ_32BIT_REG(i->dst());
+  op1_32 &= i->Id();
+  SET_FLAGS_OSZAPC_LOGIC_32(op1_32);
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_LOGIC_32(op1_32));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::DEC_EdR_Jq(bxInstruction_c *i)
+{
+  Bit32u erx = --BX_READ_32BIT_REG(i->dst());
+  SET_FLAGS_OSZAP_SUB_32(erx + 1, 0, erx);
+  BX_CLEAR_64BIT_HIGH(i->dst());
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_DEC_32(getB_CF(), erx));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMP_GqEqR_Jq(bxInstruction_c *i)
+{
+  Bit64u op1_64, op2_64, diff_64;
+
+  op1_64 = BX_READ_64BIT_REG(i->dst());
+  op2_64 = BX_READ_64BIT_REG(i->src());
+  diff_64 = op1_64 - op2_64;
+
+  SET_FLAGS_OSZAPC_SUB_64(op1_64, op2_64, diff_64);
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_SUB_64(op1_64, op2_64, diff_64));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMP_GqEqM_Jq(bxInstruction_c *i)
+{
+  Bit64u op1_64, op2_64, diff_64;
+
+  bx_address eaddr = BX_CPU_RESOLVE_ADDR_64(i);
+
+  op1_64 = BX_READ_64BIT_REG(i->dst());
+  op2_64 = read_linear_qword(i->seg(), get_laddr64(i->seg(), eaddr));
+  diff_64 = op1_64 - op2_64;
+
+  SET_FLAGS_OSZAPC_SUB_64(op1_64, op2_64, diff_64);
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_SUB_64(op1_64, op2_64, diff_64));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMP_EqIdR_Jq(bxInstruction_c *i)
+{
+  Bit64u op1_64, op2_64, diff_64;
+
+  op1_64 = BX_READ_64BIT_REG(i->dst());
+  op2_64 = (Bit32s) i->Id();
+  diff_64 = op1_64 - op2_64;
+
+  SET_FLAGS_OSZAPC_SUB_64(op1_64, op2_64, diff_64);
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_SUB_64(op1_64, op2_64, diff_64));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMP_EqIdM_Jq(bxInstruction_c *i)
+{
+  Bit64u op1_64, op2_64, diff_64;
+
+  bx_address eaddr = BX_CPU_RESOLVE_ADDR_64(i);
+
+  op1_64 = read_linear_qword(i->seg(), get_laddr64(i->seg(), eaddr));
+  op2_64 = (Bit32s) i->Id();
+  diff_64 = op1_64 - op2_64;
+
+  SET_FLAGS_OSZAPC_SUB_64(op1_64, op2_64, diff_64);
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_SUB_64(op1_64, op2_64, diff_64));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::TEST_EqGqR_Jq(bxInstruction_c *i)
+{
+  Bit64u op1_64, op2_64;
+
+  op1_64 = BX_READ_64BIT_REG(i->dst());
+  op2_64 = BX_READ_64BIT_REG(i->src());
+  op1_64 &= op2_64;
+
+  SET_FLAGS_OSZAPC_LOGIC_64(op1_64);
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_LOGIC_64(op1_64));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::TEST_EqIdR_Jq(bxInstruction_c *i)
+{
+  Bit64u op1_64, op2_64;
+
+  op1_64 = BX_READ_64BIT_REG(i->dst());
+  op2_64 = (Bit32s) i->Id();
+  op1_64 &= op2_64;
+
+  SET_FLAGS_OSZAPC_LOGIC_64(op1_64);
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_LOGIC_64(op1_64));
+}
+
+void BX_CPP_AttrRegparmN(1) BX_CPU_C::DEC_EqR_Jq(bxInstruction_c *i)
+{
+  Bit64u rrx = --BX_READ_64BIT_REG(i->dst());
+  SET_FLAGS_OSZAP_SUB_64(rrx + 1, 0, rrx);
+
+  BX_FUSED_JCC64(i, BX_FUSED_JCC_FLAGS_DEC_64(getB_CF(), rrx));
+}
+
+#endif // BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS
+
 void BX_CPP_AttrRegparmN(1) BX_CPU_C::JMP_EqR(bxInstruction_c *i)
 {
   Bit64u op1_64 = BX_READ_64BIT_REG(i->dst());
@@ -2592,6 +2592,176 @@ int assignHandler(bxInstruction_c *i, Bit32u fetchModeMask)
   return(0);
 }
 
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS && BX_CPU_LEVEL >= 3
+
+// Macro-fusion of flag producer with the following conditional branch.
+// Compare, test and decrement of 32-bit or 64-bit operand followed by
+// near Jcc are dispatched as single handler, which updates the lazy flags
+// as usual and takes the branch decision directly from the producer
+// operands (see BX_FUSED_JCC_FLAGS).
+
+#define BX_FUSED_JCC_64 0x10
+
+#if BX_SUPPORT_X86_64
+#define BX_FUSED_JQ(handler) (handler)
+#else
+#define BX_FUSED_JQ(handler) NULL
+#endif
+
+static const struct bxFusedJccHandler {
+  BxExecutePtr_tR producer;
+  BxExecutePtr_tR fusedJd;
+  BxExecutePtr_tR fusedJq;
+} BxFusedJccHandlers[] = {
+  { &BX_CPU_C::CMP_GdEdR, &BX_CPU_C::CMP_GdEdR_Jd, BX_FUSED_JQ(&BX_CPU_C::CMP_GdEdR_Jq) },
+  { &BX_CPU_C::CMP_GdEdM, &BX_CPU_C::CMP_GdEdM_Jd, BX_FUSED_JQ(&BX_CPU_C::CMP_GdEdM_Jq) },
+  { &BX_CPU_C::CMP_EdIdR, &BX_CPU_C::CMP_EdIdR_Jd, BX_FUSED_JQ(&BX_CPU_C::CMP_EdIdR_Jq) },
+  { &BX_CPU_C::CMP_EdIdM, &BX_CPU_C::CMP_EdIdM_Jd, BX_FUSED_JQ(&BX_CPU_C::CMP_EdIdM_Jq) },
+  { &BX_CPU_C::TEST_EdGdR, &BX_CPU_C::TEST_EdGdR_Jd, BX_FUSED_JQ(&BX_CPU_C::TEST_EdGdR_Jq) },
+  { &BX_CPU_C::TEST_EdIdR, &BX_CPU_C::TEST_EdIdR_Jd, BX_FUSED_JQ(&BX_CPU_C::TEST_EdIdR_Jq) },
+  { &BX_CPU_C::DEC_EdR, &BX_CPU_C::DEC_EdR_Jd, BX_FUSED_JQ(&BX_CPU_C::DEC_EdR_Jq) },
+#if BX_SUPPORT_X86_64
+  { &BX_CPU_C::CMP_GqEqR, NULL, &BX_CPU_C::CMP_GqEqR_Jq },
+  { &BX_CPU_C::CMP_GqEqM, NULL, &BX_CPU_C::CMP_GqEqM_Jq },
+  { &BX_CPU_C::CMP_EqIdR, NULL, &BX_CPU_C::CMP_EqIdR_Jq },
+  { &BX_CPU_C::CMP_EqIdM, NULL, &BX_CPU_C::CMP_EqIdM_Jq },
+  { &BX_CPU_C::TEST_EqGqR, NULL, &BX_CPU_C::TEST_EqGqR_Jq },
+  { &BX_CPU_C::TEST_EqIdR, NULL, &BX_CPU_C::TEST_EqIdR_Jq },
+  { &BX_CPU_C::DEC_EqR, NULL, &BX_CPU_C::DEC_EqR_Jq },
+#endif
+};
+
+// returns condition code of near conditional branch which could be fused
+// or -1, PF based conditions are not fused
+static int fusableJccCondition(unsigned ia_opcode)
+{
+  switch(ia_opcode) {
+    case BX_IA_JO_Jd:
+    case BX_IA_JO_Jbd:
+      return 0x0;
+    case BX_IA_JNO_Jd:
+    case BX_IA_JNO_Jbd:
+      return 0x1;
+    case BX_IA_JB_Jd:
+    case BX_IA_JB_Jbd:
+      return 0x2;
+    case BX_IA_JNB_Jd:
+    case BX_IA_JNB_Jbd:
+      return 0x3;
+    case BX_IA_JZ_Jd:
+    case BX_IA_JZ_Jbd:
+      return 0x4;
+    case BX_IA_JNZ_Jd:
+    case BX_IA_JNZ_Jbd:
+      return 0x5;
+    case BX_IA_JBE_Jd:
+    case BX_IA_JBE_Jbd:
+      return 0x6;
+    case BX_IA_JNBE_Jd:
+    case BX_IA_JNBE_Jbd:
+      return 0x7;
+    case BX_IA_JS_Jd:
+    case BX_IA_JS_Jbd:
+      return 0x8;
+    case BX_IA_JNS_Jd:
+    case BX_IA_JNS_Jbd:
+      return 0x9;
+    case BX_IA_JL_Jd:
+    case BX_IA_JL_Jbd:
+      return 0xc;
+    case BX_IA_JNL_Jd:
+    case BX_IA_JNL_Jbd:
+      return 0xd;
+    case BX_IA_JLE_Jd:
+    case BX_IA_JLE_Jbd:
+      return 0xe;
+    case BX_IA_JNLE_Jd:
+    case BX_IA_JNLE_Jbd:
+      return 0xf;
+#if BX_SUPPORT_X86_64
+    case BX_IA_JO_Jq:
+    case BX_IA_JO_Jbq:
+      return BX_FUSED_JCC_64 | 0x0;
+    case BX_IA_JNO_Jq:
+    case BX_IA_JNO_Jbq:
+      return BX_FUSED_JCC_64 | 0x1;
+    case BX_IA_JB_Jq:
+    case BX_IA_JB_Jbq:
+      return BX_FUSED_JCC_64 | 0x2;
+    case BX_IA_JNB_Jq:
+    case BX_IA_JNB_Jbq:
+      return BX_FUSED_JCC_64 | 0x3;
+    case BX_IA_JZ_Jq:
+    case BX_IA_JZ_Jbq:
+      return BX_FUSED_JCC_64 | 0x4;
+    case BX_IA_JNZ_Jq:
+    case BX_IA_JNZ_Jbq:
+      return BX_FUSED_JCC_64 | 0x5;
+    case BX_IA_JBE_Jq:
+    case BX_IA_JBE_Jbq:
+      return BX_FUSED_JCC_64 | 0x6;
+    case BX_IA_JNBE_Jq:
+    case BX_IA_JNBE_Jbq:
+      return BX_FUSED_JCC_64 | 0x7;
+    case BX_IA_JS_Jq:
+    case BX_IA_JS_Jbq:
+      return BX_FUSED_JCC_64 | 0x8;
+    case BX_IA_JNS_Jq:
+    case BX_IA_JNS_Jbq:
+      return BX_FUSED_JCC_64 | 0x9;
+    case BX_IA_JL_Jq:
+    case BX_IA_JL_Jbq:
+      return BX_FUSED_JCC_64 | 0xc;
+    case BX_IA_JNL_Jq:
+    case BX_IA_JNL_Jbq:
+      return BX_FUSED_JCC_64 | 0xd;
+    case BX_IA_JLE_Jq:
+    case BX_IA_JLE_Jbq:
+      return BX_FUSED_JCC_64 | 0xe;
+    case BX_IA_JNLE_Jq:
+    case BX_IA_JNLE_Jbq:
+      return BX_FUSED_JCC_64 | 0xf;
+#endif
+  }
+
+  return -1;
+}
+
+void fuseConditionalBranch(bxInstruction_c *producer, bxInstruction_c *jcc)
+{
+#if BX_INSTRUMENTATION
+  // instrumentation expects callbacks for every instruction
+  return;
+#endif
+
+  int cond = fusableJccCondition(jcc->getIaOpcode());
+  if (cond < 0) return;
+
+  for (unsigned n=0; n < sizeof(BxFusedJccHandlers) / sizeof(BxFusedJccHandlers[0]); n++) {
+    if (producer->execute1 == BxFusedJccHandlers[n].producer) {
+      BxExecutePtr_tR fused = (cond & BX_FUSED_JCC_64) ? BxFusedJccHandlers[n].fusedJq : BxFusedJccHandlers[n].fusedJd;
+      if (fused) {
+        producer->execute1 = fused;
+        jcc->setFusedCondition(cond & 0xf);
+      }
+      break;
+    }
+  }
+}
+
+// fused flag producer must be always followed by its conditional branch
+bool isFusedConditionalBranch(const bxInstruction_c *i)
+{
+  for (unsigned n=0; n < sizeof(BxFusedJccHandlers) / sizeof(BxFusedJccHandlers[0]); n++) {
+    if (i->execute1 == BxFusedJccHandlers[n].fusedJd || i->execute1 == BxFusedJccHandlers[n].fusedJq)
+      return true;
+  }
+
+  return false;
+}
+
+#endif
+
 void BX_CPU_C::init_FetchDecodeTables(void)
 {
   static Bit8u BxOpcodeFeatures[BX_IA_LAST] =
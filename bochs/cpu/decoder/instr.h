@@ -396,6 +396,15 @@ public:
     metaInfo.metaInfo1 |= (1<<4);
   }
 
+  // condition code (0..15) of conditional branch fused with the preceding
+  // flag producer, conditional branches have no register operands
+  BX_CPP_INLINE unsigned fusedCondition() const {
+    return metaData[BX_INSTR_METADATA_SRC3];
+  }
+  BX_CPP_INLINE void setFusedCondition(unsigned cond) {
+    metaData[BX_INSTR_METADATA_SRC3] = cond;
+  }
+
 #if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS && BX_ENABLE_TRACE_LINKING && !defined(BX_STANDALONE_DECODER)
   BX_CPP_INLINE bxInstruction_c* getNextTrace(Bit32u currTraceLinkTimeStamp) {
     if (currTraceLinkTimeStamp > modRMForm.Id2) handlers.next = NULL;
@@ -405,6 +414,27 @@ public:
     handlers.next = iptr;
     modRMForm.Id2 = traceLinkTimeStamp;
   }
+
+  // region guard: expected RIP after the preceding branch and the next
+  // instruction to execute when the branch went the predicted way
+  BX_CPP_INLINE bx_address getRegionGuardRIP() const {
+#if BX_SUPPORT_X86_64
+    return IqForm.Iq;
+#else
+    return modRMForm.Id;
+#endif
+  }
+  BX_CPP_INLINE bxInstruction_c* getRegionGuardNext() const {
+    return handlers.next;
+  }
+  BX_CPP_INLINE void setRegionGuard(bx_address rip, bxInstruction_c* iptr) {
+#if BX_SUPPORT_X86_64
+    IqForm.Iq = rip;
+#else
+    modRMForm.Id = rip;
+#endif
+    handlers.next = iptr;
+  }
 #endif
 
 };
@@ -72,7 +72,9 @@ bool BX_CPU_C::handleWaitForEvent(void)
 
     if (BX_HRQ && BX_DBG_ASYNC_DMA) {
       // handle DMA also when CPU is halted
+      BX_SMP_LOCK();
       DEV_dma_raise_hlda();
+      BX_SMP_UNLOCK();
     }
 
     // for multiprocessor simulation, even if this CPU is halted we still
@@ -130,6 +132,8 @@ void BX_CPU_C::InterruptAcknowledge(void)
 #endif
 
   // NOTE: similar code in ::take_irq()
+  // the interrupt controllers are shared with the other CPU threads
+  BX_SMP_LOCK();
 #if BX_SUPPORT_APIC
   if (is_pending(BX_EVENT_PENDING_LAPIC_INTR))
     vector = BX_CPU_THIS_PTR lapic.acknowledge_int();
@@ -137,6 +141,7 @@ void BX_CPU_C::InterruptAcknowledge(void)
 #endif
     // if no local APIC, always acknowledge the PIC.
     vector = DEV_pic_iac(); // may set INTR with next interrupt
+  BX_SMP_UNLOCK();
 
   BX_CPU_THIS_PTR EXT = 1; /* external event */
 #if BX_SUPPORT_VMX
@@ -334,7 +339,9 @@ bool BX_CPU_C::handleAsyncEvent(void)
   else if (BX_HRQ && BX_DBG_ASYNC_DMA) {
     // NOTE: similar code in ::take_dma()
     // assert Hold Acknowledge (HLDA) and go into a bus hold state
+    BX_SMP_LOCK();
     DEV_dma_raise_hlda();
+    BX_SMP_UNLOCK();
   }
 
   if (BX_CPU_THIS_PTR get_TF())
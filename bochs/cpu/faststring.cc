@@ -29,236 +29,403 @@
 //
 // Repeat Speedups methods
 //
+// The string is processed page by page, the host pointers of every page are
+// resolved through the data TLB. Pages without direct host access (not in
+// the TLB, MMIO, ROM or pages with hardware breakpoints) stop the fast path
+// and the remaining iterations are emulated one by one. Every page written
+// is passed through pageWriteStampTable.decWriteStamp() by v2h_write_byte()
+// and the fast path stops after a page holding traces was written, so the
+// self modifying code is detected before the next instruction is fetched.
+// In parallel SMP mode another CPU could decode a trace from the page while
+// it is written, so the write stamp is checked once more after the write.
+//
 
 #if BX_SUPPORT_REPEAT_SPEEDUPS
-Bit32u BX_CPU_C::FastRepMOVSB(unsigned srcSeg, Bit32u srcOff, unsigned dstSeg, Bit32u dstOff, Bit32u byteCount, Bit32u granularity)
-{
-  BX_ASSERT(BX_CPU_THIS_PTR cpu_mode != BX_MODE_LONG_64);
 
-  bx_address laddrSrc, laddrDst;
+// Advance the linear address to the next chunk, legacy mode linear addresses
+// wrap at 4G
+#if BX_SUPPORT_X86_64
+  #define BX_FAST_REP_ADVANCE(laddr, n) \
+    laddr = long64 ? (laddr + (n)) : (Bit32u) (laddr + (n))
+#else
+  #define BX_FAST_REP_ADVANCE(laddr, n) laddr += (n)
+#endif
 
-  bx_segment_reg_t *srcSegPtr = &BX_CPU_THIS_PTR sregs[srcSeg];
-  if (srcSegPtr->cache.valid & SegAccessROK4G) {
-    laddrSrc = srcOff;
-  }
-  else {
-    if (!(srcSegPtr->cache.valid & SegAccessROK))
-      return 0;
-    if ((srcOff | 0xfff) > srcSegPtr->cache.u.segment.limit_scaled)
-      return 0;
+#if BX_SUPPORT_SMP
+  #define BX_FAST_REP_WRITE_DONE(laddr) \
+    if (bx_smp_parallel) pageWriteStampTable.decWriteStamp(BX_DTLB_ENTRY_OF(laddr, 0)->ppf)
+#else
+  #define BX_FAST_REP_WRITE_DONE(laddr)
+#endif
 
-    laddrSrc = get_laddr32(srcSeg, srcOff);
+// Returns the number of iterations allowed until the next timer event. The
+// instructions executed since the last time sync are accounted first, so the
+// fast path does not stall when the event is already due.
+Bit32u BX_CPU_C::FastRepTicksLeft(void)
+{
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS
+  if (BX_SMP_PROCESSORS == 1) {
+    Bit32u delta = (Bit32u)(BX_CPU_THIS_PTR icount - BX_CPU_THIS_PTR icount_last_sync);
+    if (delta) {
+      BX_CPU_THIS_PTR sync_icount();
+      BX_TICKN(delta);
+      // the timer handlers might have raised an interrupt
+      if (BX_CPU_THIS_PTR async_event)
+        return 0;
+    }
   }
+#endif
 
-  bx_segment_reg_t *dstSegPtr = &BX_CPU_THIS_PTR sregs[dstSeg];
-  if (dstSegPtr->cache.valid & SegAccessWOK4G) {
-    laddrDst = dstOff;
+  return bx_pc_system.getNumCpuTicksLeftNextEvent();
+}
+
+// Returns the linear address of the segment offset and the number of bytes
+// which can be accessed from the offset without segment limit checks (until
+// the segment limit or the 32-bit offset wrap), zero if the segment doesn't
+// allow direct access.
+Bit64u BX_CPU_C::FastRepSegment(unsigned s, Bit32u offset, unsigned rw, bx_address *laddr)
+{
+  bx_segment_reg_t *seg = &BX_CPU_THIS_PTR sregs[s];
+
+#if BX_SUPPORT_X86_64
+  if (long64_mode()) {
+    *laddr = get_laddr64(s, offset);
+    return BX_CONST64(0x100000000) - offset;
   }
-  else {
-    if (!(dstSegPtr->cache.valid & SegAccessWOK))
-      return 0;
-    if ((dstOff | 0xfff) > dstSegPtr->cache.u.segment.limit_scaled)
-      return 0;
+#endif
+
+  Bit32u accessOK   = (rw == BX_READ) ? SegAccessROK   : SegAccessWOK;
+  Bit32u accessOK4G = (rw == BX_READ) ? SegAccessROK4G : SegAccessWOK4G;
 
-    laddrDst = get_laddr32(dstSeg, dstOff);
+  if (seg->cache.valid & accessOK4G) {
+    *laddr = offset;
+    return BX_CONST64(0x100000000) - offset;
   }
 
+  if (!(seg->cache.valid & accessOK) || offset > seg->cache.u.segment.limit_scaled)
+    return 0;
+
+  *laddr = get_laddr32(s, offset);
+  return (Bit64u) seg->cache.u.segment.limit_scaled - offset + 1;
+}
+
+Bit32u BX_CPU_C::FastRepMOVSB(unsigned srcSeg, Bit32u srcOff, unsigned dstSeg, Bit32u dstOff, Bit64u byteCount, Bit32u granularity)
+{
+  bx_address laddrSrc, laddrDst;
+
+  Bit64u bytesSrc = FastRepSegment(srcSeg, srcOff, BX_READ, &laddrSrc);
+  if (byteCount > bytesSrc)
+    byteCount = bytesSrc;
+
+  Bit64u bytesDst = FastRepSegment(dstSeg, dstOff, BX_WRITE, &laddrDst);
+  if (byteCount > bytesDst)
+    byteCount = bytesDst;
+
+  if (byteCount == 0) return 0;
+
   return FastRepMOVSB(laddrSrc, laddrDst, byteCount, granularity);
 }
 
 Bit32u BX_CPU_C::FastRepMOVSB(bx_address laddrSrc, bx_address laddrDst, Bit64u byteCount, Bit32u granularity)
 {
-  Bit8u *hostAddrSrc = v2h_read_byte(laddrSrc, USER_PL);
-  // Check that native host access was not vetoed for that page
-  if (!hostAddrSrc) return 0;
+  assert(! BX_CPU_THIS_PTR get_DF());
+
+#if BX_SUPPORT_X86_64
+  bool long64 = long64_mode();
+#endif
 
-  Bit8u *hostAddrDst = v2h_write_byte(laddrDst, USER_PL);
-  // Check that native host access was not vetoed for that page
-  if (!hostAddrDst) return 0;
+  // Restrict byte count to the number of iterations left until the next event
+  Bit64u maxBytes = (Bit64u) FastRepTicksLeft() * granularity;
+  if (byteCount > maxBytes)
+    byteCount = maxBytes;
 
-  assert(! BX_CPU_THIS_PTR get_DF());
+  byteCount &= ~(Bit64u)(granularity-1);
 
-  // See how many bytes can fit in the rest of this page.
-  Bit32u bytesFitSrc = 0x1000 - PAGE_OFFSET(laddrSrc);
-  Bit32u bytesFitDst = 0x1000 - PAGE_OFFSET(laddrDst);
+  Bit32u done = 0;
 
-  // Restrict word count to the number that will fit in either
-  // source or dest pages.
-  if (byteCount > bytesFitSrc)
-    byteCount = bytesFitSrc;
-  if (byteCount > bytesFitDst)
-    byteCount = bytesFitDst;
-  if (byteCount > bx_pc_system.getNumCpuTicksLeftNextEvent())
-    byteCount = bx_pc_system.getNumCpuTicksLeftNextEvent();
+  while (byteCount) {
+    Bit8u *hostAddrSrc = v2h_read_byte(laddrSrc, USER_PL);
+    // Check that native host access was not vetoed for that page
+    if (!hostAddrSrc) break;
 
-  byteCount &= ~(granularity-1);
+    Bit8u *hostAddrDst = v2h_write_byte(laddrDst, USER_PL);
+    // Check that native host access was not vetoed for that page
+    if (!hostAddrDst) break;
 
-  // If after all the restrictions, there is anything left to do...
-  if (byteCount) {
-    // Transfer data directly using host addresses
-    for (unsigned j=0; j<byteCount; j++) {
-      * (Bit8u *) hostAddrDst = * (Bit8u *) hostAddrSrc;
-      hostAddrDst++;
-      hostAddrSrc++;
+    // See how many bytes can fit in the rest of source and dest pages.
+    Bit32u bytesFitSrc = 0x1000 - PAGE_OFFSET(laddrSrc);
+    Bit32u bytesFitDst = 0x1000 - PAGE_OFFSET(laddrDst);
+
+    Bit32u chunk = (bytesFitSrc < bytesFitDst) ? bytesFitSrc : bytesFitDst;
+    if (chunk > byteCount)
+      chunk = (Bit32u) byteCount;
+
+    // element split between pages is emulated
+    chunk &= ~(granularity-1);
+    if (chunk == 0) break;
+
+    if (hostAddrDst > hostAddrSrc && hostAddrDst < hostAddrSrc + chunk) {
+      // Overlapping move to the higher address, the data written by the
+      // previous elements is replicated, copy element by element
+      Bit8u temp[8];
+      for (unsigned j=0; j<chunk; j+=granularity) {
+        memcpy(temp, hostAddrSrc + j, granularity);
+        memcpy(hostAddrDst + j, temp, granularity);
+      }
     }
+    else {
+      // Transfer data directly using host addresses
+      memmove(hostAddrDst, hostAddrSrc, chunk);
+    }
+    BX_FAST_REP_WRITE_DONE(laddrDst);
+
+    done += chunk;
+    byteCount -= chunk;
+    BX_FAST_REP_ADVANCE(laddrSrc, chunk);
+    BX_FAST_REP_ADVANCE(laddrDst, chunk);
+
+    // stop the trace if the write hit the code
+    if (BX_CPU_THIS_PTR async_event) break;
   }
 
-  return byteCount;
+  return done;
 }
 
 Bit32u BX_CPU_C::FastRepSTOSB(unsigned dstSeg, Bit32u dstOff, Bit8u val, Bit32u count)
 {
   bx_address laddrDst;
 
-  BX_ASSERT(BX_CPU_THIS_PTR cpu_mode != BX_MODE_LONG_64);
+  Bit64u bytesDst = FastRepSegment(dstSeg, dstOff, BX_WRITE, &laddrDst);
+  if (count > bytesDst)
+    count = (Bit32u) bytesDst;
 
-  bx_segment_reg_t *dstSegPtr = &BX_CPU_THIS_PTR sregs[dstSeg];
-  if (dstSegPtr->cache.valid & SegAccessWOK4G) {
-    laddrDst = dstOff;
-  }
-  else {
-    if (!(dstSegPtr->cache.valid & SegAccessWOK))
-      return 0;
-    if ((dstOff | 0xfff) > dstSegPtr->cache.u.segment.limit_scaled)
-      return 0;
+  if (count == 0) return 0;
 
-    laddrDst = get_laddr32(dstSeg, dstOff);
-  }
+  return FastRepSTOS(laddrDst, val, 1, count);
+}
 
-  return FastRepSTOSB(laddrDst, val, count);
+Bit32u BX_CPU_C::FastRepSTOSW(unsigned dstSeg, Bit32u dstOff, Bit16u val, Bit32u count)
+{
+  bx_address laddrDst;
+
+  Bit64u wordsDst = FastRepSegment(dstSeg, dstOff, BX_WRITE, &laddrDst) >> 1;
+  if (count > wordsDst)
+    count = (Bit32u) wordsDst;
+
+  if (count == 0) return 0;
+
+  return FastRepSTOS(laddrDst, val, 2, count);
 }
 
-Bit32u BX_CPU_C::FastRepSTOSB(bx_address laddrDst, Bit8u val, Bit32u count)
+Bit32u BX_CPU_C::FastRepSTOSD(unsigned dstSeg, Bit32u dstOff, Bit32u val, Bit32u count)
 {
-  Bit8u *hostAddrDst = v2h_write_byte(laddrDst, USER_PL);
-  // Check that native host access was not vetoed for that page
-  if (!hostAddrDst) return 0;
+  bx_address laddrDst;
 
+  Bit64u dwordsDst = FastRepSegment(dstSeg, dstOff, BX_WRITE, &laddrDst) >> 2;
+  if (count > dwordsDst)
+    count = (Bit32u) dwordsDst;
+
+  if (count == 0) return 0;
+
+  return FastRepSTOS(laddrDst, val, 4, count);
+}
+
+// store count elements of granularity bytes each, returns number of elements stored
+Bit32u BX_CPU_C::FastRepSTOS(bx_address laddrDst, Bit64u val, unsigned granularity, Bit32u count)
+{
   assert(! BX_CPU_THIS_PTR get_DF());
 
-  // See how many bytes can fit in the rest of this page.
-  Bit32u bytesFitDst = 0x1000 - PAGE_OFFSET(laddrDst);
+#if BX_SUPPORT_X86_64
+  bool long64 = long64_mode();
+#endif
+
+  Bit32u ticks = FastRepTicksLeft();
+  if (count > ticks)
+    count = ticks;
+
+  // the element value made of the same bytes is stored by memset
+  Bit64u pattern = (val & 0xff) * BX_CONST64(0x0101010101010101);
+  bool fill = (granularity == 8) ? (val == pattern) : (val == (pattern >> (64 - granularity*8)));
+
+  Bit32u done = 0;
 
-  // Restrict word count to the number that will fit in either
-  // source or dest pages.
-  if (count > bytesFitDst)
-    count = bytesFitDst;
-  if (count > bx_pc_system.getNumCpuTicksLeftNextEvent())
-    count = bx_pc_system.getNumCpuTicksLeftNextEvent();
+  while (count) {
+    Bit8u *hostAddrDst = v2h_write_byte(laddrDst, USER_PL);
+    // Check that native host access was not vetoed for that page
+    if (!hostAddrDst) break;
+
+    // See how many elements can fit in the rest of this page.
+    Bit32u chunk = (0x1000 - PAGE_OFFSET(laddrDst)) / granularity;
+    if (chunk > count)
+      chunk = count;
+
+    // element split between pages is emulated
+    if (chunk == 0) break;
 
-  // If after all the restrictions, there is anything left to do...
-  if (count) {
     // Transfer data directly using host addresses
-    for (unsigned j=0; j<count; j++) {
-      * (Bit8u *) hostAddrDst = val;
-      hostAddrDst++;
+    if (fill) {
+      memset(hostAddrDst, (Bit8u) val, chunk * granularity);
+    }
+    else {
+      switch(granularity) {
+      case 2:
+        for (unsigned j=0; j<chunk; j++, hostAddrDst += 2)
+          WriteHostWordToLittleEndian((Bit16u*)hostAddrDst, (Bit16u) val);
+        break;
+      case 4:
+        for (unsigned j=0; j<chunk; j++, hostAddrDst += 4)
+          WriteHostDWordToLittleEndian((Bit32u*)hostAddrDst, (Bit32u) val);
+        break;
+      case 8:
+        for (unsigned j=0; j<chunk; j++, hostAddrDst += 8)
+          WriteHostQWordToLittleEndian((Bit64u*)hostAddrDst, val);
+        break;
+      }
     }
+    BX_FAST_REP_WRITE_DONE(laddrDst);
+
+    done += chunk;
+    count -= chunk;
+    BX_FAST_REP_ADVANCE(laddrDst, chunk * granularity);
+
+    // stop the trace if the write hit the code
+    if (BX_CPU_THIS_PTR async_event) break;
   }
 
-  return count;
+  return done;
 }
 
-Bit32u BX_CPU_C::FastRepSTOSW(unsigned dstSeg, Bit32u dstOff, Bit16u val, Bit32u count)
+//
+// REPE/REPNE SCASB and CMPSB only skip the bytes which do not terminate the
+// repeat loop. The caller limits the count to leave at least one iteration
+// to the emulation which sets the flags.
+//
+
+Bit32u BX_CPU_C::FastRepSCASB(unsigned dstSeg, Bit32u dstOff, Bit8u val, Bit32u count, bool repe)
 {
   bx_address laddrDst;
 
-  BX_ASSERT(BX_CPU_THIS_PTR cpu_mode != BX_MODE_LONG_64);
+  Bit64u bytesDst = FastRepSegment(dstSeg, dstOff, BX_READ, &laddrDst);
+  if (count > bytesDst)
+    count = (Bit32u) bytesDst;
 
-  bx_segment_reg_t *dstSegPtr = &BX_CPU_THIS_PTR sregs[dstSeg];
-  if (dstSegPtr->cache.valid & SegAccessWOK4G) {
-    laddrDst = dstOff;
-  }
-  else {
-    if (!(dstSegPtr->cache.valid & SegAccessWOK))
-      return 0;
-    if ((dstOff | 0xfff) > dstSegPtr->cache.u.segment.limit_scaled)
-      return 0;
-
-    laddrDst = get_laddr32(dstSeg, dstOff);
-  }
+  if (count == 0) return 0;
 
-  return FastRepSTOSW(laddrDst, val, count);
+  return FastRepSCASB(laddrDst, val, count, repe);
 }
 
-Bit32u BX_CPU_C::FastRepSTOSW(bx_address laddrDst, Bit16u val, Bit32u count)
+Bit32u BX_CPU_C::FastRepSCASB(bx_address laddrDst, Bit8u val, Bit32u count, bool repe)
 {
-  Bit8u *hostAddrDst = v2h_write_byte(laddrDst, USER_PL);
-  // Check that native host access was not vetoed for that page
-  if (!hostAddrDst) return 0;
-
   assert(! BX_CPU_THIS_PTR get_DF());
 
-  // See how many words can fit in the rest of this page.
-  Bit32u wordsFitDst = (0x1000 - PAGE_OFFSET(laddrDst)) >> 1;
+#if BX_SUPPORT_X86_64
+  bool long64 = long64_mode();
+#endif
+
+  Bit32u ticks = FastRepTicksLeft();
+  if (count >= ticks)
+    count = ticks ? (ticks-1) : 0;
 
-  // Restrict word count to the number that will fit in either
-  // source or dest pages.
-  if (count > wordsFitDst)
-    count = wordsFitDst;
-  if (count > bx_pc_system.getNumCpuTicksLeftNextEvent())
-    count = bx_pc_system.getNumCpuTicksLeftNextEvent();
+  Bit32u done = 0;
 
-  // If after all the restrictions, there is anything left to do...
-  if (count) {
-    // Transfer data directly using host addresses
-    for (unsigned j=0; j<count; j++) {
-      WriteHostWordToLittleEndian((Bit16u*)hostAddrDst, val);
-      hostAddrDst += 2;
+  while (count) {
+    const Bit8u *hostAddrDst = v2h_read_byte(laddrDst, USER_PL);
+    // Check that native host access was not vetoed for that page
+    if (!hostAddrDst) break;
+
+    // See how many bytes can fit in the rest of this page.
+    Bit32u chunk = 0x1000 - PAGE_OFFSET(laddrDst);
+    if (chunk > count)
+      chunk = count;
+
+    Bit32u n = 0;
+    if (repe) {
+      // find the first byte different from the value
+      while (n < chunk && hostAddrDst[n] == val) n++;
+    }
+    else {
+      // find the first byte equal to the value
+      const Bit8u *match = (const Bit8u *) memchr(hostAddrDst, val, chunk);
+      n = match ? (Bit32u)(match - hostAddrDst) : chunk;
     }
+
+    done += n;
+    if (n < chunk) break;
+
+    count -= chunk;
+    BX_FAST_REP_ADVANCE(laddrDst, chunk);
   }
 
-  return count;
+  return done;
 }
 
-Bit32u BX_CPU_C::FastRepSTOSD(unsigned dstSeg, Bit32u dstOff, Bit32u val, Bit32u count)
+Bit32u BX_CPU_C::FastRepCMPSB(unsigned srcSeg, Bit32u srcOff, unsigned dstSeg, Bit32u dstOff, Bit32u count, bool repe)
 {
-  bx_address laddrDst;
+  bx_address laddrSrc, laddrDst;
 
-  BX_ASSERT(BX_CPU_THIS_PTR cpu_mode != BX_MODE_LONG_64);
+  Bit64u bytesSrc = FastRepSegment(srcSeg, srcOff, BX_READ, &laddrSrc);
+  if (count > bytesSrc)
+    count = (Bit32u) bytesSrc;
 
-  bx_segment_reg_t *dstSegPtr = &BX_CPU_THIS_PTR sregs[dstSeg];
-  if (dstSegPtr->cache.valid & SegAccessWOK4G) {
-    laddrDst = dstOff;
-  }
-  else {
-    if (!(dstSegPtr->cache.valid & SegAccessWOK))
-      return 0;
-    if ((dstOff | 0xfff) > dstSegPtr->cache.u.segment.limit_scaled)
-      return 0;
+  Bit64u bytesDst = FastRepSegment(dstSeg, dstOff, BX_READ, &laddrDst);
+  if (count > bytesDst)
+    count = (Bit32u) bytesDst;
 
-    laddrDst = get_laddr32(dstSeg, dstOff);
-  }
+  if (count == 0) return 0;
 
-  return FastRepSTOSD(laddrDst, val, count);
+  return FastRepCMPSB(laddrSrc, laddrDst, count, repe);
 }
 
-Bit32u BX_CPU_C::FastRepSTOSD(bx_address laddrDst, Bit32u val, Bit32u count)
+Bit32u BX_CPU_C::FastRepCMPSB(bx_address laddrSrc, bx_address laddrDst, Bit32u count, bool repe)
 {
-  Bit8u *hostAddrDst = v2h_write_byte(laddrDst, USER_PL);
-  // Check that native host access was not vetoed for that page
-  if (!hostAddrDst) return 0;
-
   assert(! BX_CPU_THIS_PTR get_DF());
 
-  // See how many dwords can fit in the rest of this page.
-  Bit32u dwordsFitDst = (0x1000 - PAGE_OFFSET(laddrDst)) >> 2;
+#if BX_SUPPORT_X86_64
+  bool long64 = long64_mode();
+#endif
 
-  // Restrict dword count to the number that will fit in either
-  // source or dest pages.
-  if (count > dwordsFitDst)
-    count = dwordsFitDst;
-  if (count > bx_pc_system.getNumCpuTicksLeftNextEvent())
-    count = bx_pc_system.getNumCpuTicksLeftNextEvent();
+  Bit32u ticks = FastRepTicksLeft();
+  if (count >= ticks)
+    count = ticks ? (ticks-1) : 0;
 
-  // If after all the restrictions, there is anything left to do...
-  if (count) {
-    // Transfer data directly using host addresses
-    for (unsigned j=0; j<count; j++) {
-      WriteHostDWordToLittleEndian((Bit32u*)hostAddrDst, val);
-      hostAddrDst += 4;
+  Bit32u done = 0;
+
+  while (count) {
+    const Bit8u *hostAddrSrc = v2h_read_byte(laddrSrc, USER_PL);
+    // Check that native host access was not vetoed for that page
+    if (!hostAddrSrc) break;
+
+    const Bit8u *hostAddrDst = v2h_read_byte(laddrDst, USER_PL);
+    // Check that native host access was not vetoed for that page
+    if (!hostAddrDst) break;
+
+    // See how many bytes can fit in the rest of source and dest pages.
+    Bit32u bytesFitSrc = 0x1000 - PAGE_OFFSET(laddrSrc);
+    Bit32u bytesFitDst = 0x1000 - PAGE_OFFSET(laddrDst);
+
+    Bit32u chunk = (bytesFitSrc < bytesFitDst) ? bytesFitSrc : bytesFitDst;
+    if (chunk > count)
+      chunk = count;
+
+    Bit32u n = 0;
+    if (repe) {
+      // find the first differing byte, compare 8 bytes at once first
+      while (n + 8 <= chunk && ! memcmp(hostAddrSrc + n, hostAddrDst + n, 8)) n += 8;
+      while (n < chunk && hostAddrSrc[n] == hostAddrDst[n]) n++;
+    }
+    else {
+      // find the first equal byte
+      while (n < chunk && hostAddrSrc[n] != hostAddrDst[n]) n++;
     }
+
+    done += n;
+    if (n < chunk) break;
+
+    count -= chunk;
+    BX_FAST_REP_ADVANCE(laddrSrc, chunk);
+    BX_FAST_REP_ADVANCE(laddrDst, chunk);
   }
 
-  return count;
+  return done;
 }
 #endif
@@ -33,15 +33,36 @@
 #include "decoder/ia_opcodes.h"
 
 bxPageWriteStampTable pageWriteStampTable;
+bxTraceCacheFile_c traceCacheFile;
 
 extern int fetchDecode32(const Bit8u *fetchPtr, bool is_32, bxInstruction_c *i, unsigned remainingInPage);
 #if BX_SUPPORT_X86_64
 extern int fetchDecode64(const Bit8u *fetchPtr, bxInstruction_c *i, unsigned remainingInPage);
 #endif
 extern int assignHandler(bxInstruction_c *i, Bit32u fetchModeMask);
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS && BX_CPU_LEVEL >= 3
+extern void fuseConditionalBranch(bxInstruction_c *producer, bxInstruction_c *jcc);
+extern bool isFusedConditionalBranch(const bxInstruction_c *i);
+#endif
 
 void flushICaches(void)
 {
+#if BX_SUPPORT_SMP
+  if (bx_smp_parallel && ! bx_smp_world_stopped()) {
+    // the other CPUs are running, they flush their own trace caches at the
+    // next trace boundary. Reset the write stamps first, so traces they
+    // build after the flush are not lost from the table.
+    pageWriteStampTable.resetWriteStamps();
+    int id = bx_smp_cpu_id();
+    if (id >= 0) {
+      BX_CPU(id)->iCache.flushICacheEntries();
+      BX_CPU(id)->async_event |= BX_ASYNC_EVENT_STOP_TRACE;
+    }
+    bx_smp_post_flush();
+    return;
+  }
+#endif
+
   for (unsigned i=0; i<BX_SMP_PROCESSORS; i++) {
     BX_CPU(i)->iCache.flushICacheEntries();
     BX_CPU(i)->async_event |= BX_ASYNC_EVENT_STOP_TRACE;
@@ -54,6 +75,20 @@ void handleSMC(bx_phy_address pAddr, Bit32u mask)
 {
   INC_SMC_STAT(smc);
 
+#if BX_SUPPORT_SMP
+  if (bx_smp_parallel && ! bx_smp_world_stopped()) {
+    // invalidate own trace cache now and let the other running CPUs do the
+    // same at their next trace boundary
+    int id = bx_smp_cpu_id();
+    if (id >= 0) {
+      BX_CPU(id)->async_event |= BX_ASYNC_EVENT_STOP_TRACE;
+      BX_CPU(id)->iCache.handleSMC(pAddr, mask);
+    }
+    bx_smp_post_smc(pAddr, mask);
+    return;
+  }
+#endif
+
   for (unsigned i=0; i<BX_SMP_PROCESSORS; i++) {
     BX_CPU(i)->async_event |= BX_ASYNC_EVENT_STOP_TRACE;
     BX_CPU(i)->iCache.handleSMC(pAddr, mask);
@@ -80,7 +115,11 @@ bxICacheEntry_c* BX_CPU_C::serveICacheMiss(Bit32u eipBiased, bx_phy_address pAdd
 {
   bxICacheEntry_c *entry = BX_CPU_THIS_PTR iCache.get_entry(pAddr, BX_CPU_THIS_PTR fetchModeMask);
 
-  BX_CPU_THIS_PTR iCache.alloc_trace(entry);
+  if (entry->pAddr != BX_ICACHE_INVALID_PHY_ADDRESS)
+    INC_ICACHE_STAT(iCacheEvictions);
+
+  if (BX_CPU_THIS_PTR iCache.alloc_trace(entry))
+    INC_ICACHE_STAT(iCachePoolReclaims);
 
   // Cache miss. We weren't so lucky, but let's be optimistic - try to build 
   // trace from incoming instruction bytes stream !
@@ -102,14 +141,44 @@ bxICacheEntry_c* BX_CPU_C::serveICacheMiss(Bit32u eipBiased, bx_phy_address pAdd
 #endif
 
   // Don't allow traces longer than cpu_loop can execute
-  static unsigned quantum =
+  static unsigned smp_quantum =
 #if BX_SUPPORT_SMP
     (BX_SMP_PROCESSORS > 1) ? SIM->get_param_num(BXPN_SMP_QUANTUM)->get() :
 #endif
     BX_MAX_TRACE_LENGTH;
+
+  // in parallel SMP mode every CPU is running in its own thread
+  unsigned quantum = bx_smp_parallel ? BX_MAX_TRACE_LENGTH : smp_quantum;
+
+#if BX_SUPPORT_SMP
+  if (bx_smp_parallel) {
+    // Mark the rest of the page before decoding the trace. A store of
+    // another CPU racing with the decode finds the mark and invalidates
+    // the trace.
+    pageWriteStampTable.markICacheMask(pAddr, 0xffffffff << (pageOffset >> 7));
+  }
+#endif
+
+  // look for the same trace decoded by the previous run
+  const bxTraceCacheRecord_c *warm = NULL;
+  unsigned warmLen = 0;
+  if (traceCacheFile.enabled()) {
+    warm = traceCacheFile.lookup(BX_CPU_THIS_PTR fetchModeMask, pageOffset, fetchPtr, remainingInPage);
+    if (warm) {
+      warmLen = warm->tlen;
+      INC_ICACHE_STAT(iCacheWarmHits);
+    }
+  }
+  const Bit8u *traceStartPtr = fetchPtr;
+  Bit32u traceStart = pageOffset, traceRemaining = remainingInPage, traceBytes = 0;
  
   for (unsigned n=0;n < quantum;n++)
   {
+    if (n < warmLen) {
+      *i = warm->i[n];
+      ret = 0;
+    }
+    else
 #if BX_SUPPORT_X86_64
     if (BX_CPU_THIS_PTR cpu_mode == BX_MODE_LONG_64)
       ret = fetchDecode64(fetchPtr, i, remainingInPage);
@@ -148,6 +217,10 @@ bxICacheEntry_c* BX_CPU_C::serveICacheMiss(Bit32u eipBiased, bx_phy_address pAdd
 
     ret = assignHandler(i, BX_CPU_THIS_PTR fetchModeMask);
 
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS && BX_CPU_LEVEL >= 3
+    if (n > 0) fuseConditionalBranch(i-1, i);
+#endif
+
     // add instruction to the trace
     unsigned iLen = i->ilen();
     entry->tlen++;
@@ -165,6 +238,7 @@ bxICacheEntry_c* BX_CPU_C::serveICacheMiss(Bit32u eipBiased, bx_phy_address pAdd
 
     // continue to the next instruction
     remainingInPage -= iLen;
+    traceBytes += iLen;
     if (ret != 0 /* stop trace indication */ || remainingInPage == 0) break;
     pAddr += iLen;
     pageOffset += iLen;
@@ -172,7 +246,10 @@ bxICacheEntry_c* BX_CPU_C::serveICacheMiss(Bit32u eipBiased, bx_phy_address pAdd
 
     // try to find a trace starting from current pAddr and merge
     if (remainingInPage >= 15) { // avoid merging with page split trace
+      unsigned tlen = entry->tlen;
       if (mergeTraces(entry, i, pAddr)) {
+          if (! warm && traceCacheFile.enabled())
+            traceCacheFile.insert(BX_CPU_THIS_PTR fetchModeMask, traceStart, traceStartPtr, traceRemaining, traceBytes, entry->i, tlen);
           entry->traceMask |= traceMask;
           pageWriteStampTable.markICacheMask(pAddr, entry->traceMask);
           BX_CPU_THIS_PTR iCache.commit_trace(entry->tlen);
@@ -187,6 +264,9 @@ bxICacheEntry_c* BX_CPU_C::serveICacheMiss(Bit32u eipBiased, bx_phy_address pAdd
 
   pageWriteStampTable.markICacheMask(pAddr, entry->traceMask);
 
+  if (! warm && traceCacheFile.enabled())
+    traceCacheFile.insert(BX_CPU_THIS_PTR fetchModeMask, traceStart, traceStartPtr, traceRemaining, traceBytes, entry->i, entry->tlen);
+
 #if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS
   entry->tlen++; /* Add the inserted end of trace opcode */
   genDummyICacheEntry(i);
@@ -294,3 +374,397 @@ void BX_CPU_C::boundaryFetch(const Bit8u *fetchPtr, unsigned remainingInPage, bx
   BX_INSTR_OPCODE(BX_CPU_ID, i, fetchBuffer, i->ilen(),
       BX_CPU_THIS_PTR sregs[BX_SEG_REG_CS].cache.u.segment.d_b, long64_mode());
 }
+
+#include "decoder/fetchdecode.h"
+
+extern struct bxIAOpcodeTable BxOpcodesTable[];
+
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS && BX_ENABLE_TRACE_LINKING
+
+void genRegionGuard(bxInstruction_c *i, bx_address rip, bxInstruction_c *next)
+{
+  i->setILen(0);
+  i->setIaOpcode(BX_INSERTED_OPCODE);
+  i->execute1 = &BX_CPU_C::BxRegionGuard;
+  i->setRegionGuard(rip, next);
+}
+
+// target of near branch with immediate displacement, same as computed by the
+// branch instruction handler itself
+static bx_address regionBranchTarget(const bxInstruction_c *i, bx_address rip, unsigned src, Bit32u fetchModeMask)
+{
+  unsigned type = BX_DISASM_SRC_TYPE(src);
+  if (type == BX_IMMW || type == BX_IMMBW_SE)
+    return (Bit16u)(rip + i->Iw());
+
+#if BX_SUPPORT_X86_64
+  if (fetchModeMask & BX_FETCH_MODE_IS64_MASK)
+    return rip + (Bit32s) i->Id();
+#endif
+
+  return (Bit32u)(rip + (Bit32s) i->Id());
+}
+
+static bool regionUnconditionalBranch(unsigned ia_opcode)
+{
+  switch(ia_opcode) {
+    case BX_IA_JMP_Jw:
+    case BX_IA_JMP_Jbw:
+    case BX_IA_JMP_Jd:
+    case BX_IA_JMP_Jbd:
+    case BX_IA_CALL_Jw:
+    case BX_IA_CALL_Jd:
+#if BX_SUPPORT_X86_64
+    case BX_IA_JMP_Jq:
+    case BX_IA_JMP_Jbq:
+    case BX_IA_CALL_Jq:
+#endif
+      return true;
+  }
+
+  return false;
+}
+
+// Called when the trace at current RIP became hot, returns the region
+// starting at RIP or NULL if no region could be formed.
+bxInstruction_c* BX_CPU_C::getRegion(void)
+{
+  bx_address eipBiased = RIP + BX_CPU_THIS_PTR eipPageBias;
+  if (eipBiased >= BX_CPU_THIS_PTR eipPageWindowSize)
+    return NULL;
+
+  bx_phy_address pAddr = BX_CPU_THIS_PTR pAddrFetchPage + eipBiased;
+  bxICacheEntry_c *region = BX_CPU_THIS_PTR iCache.regionCache.find_entry(pAddr, BX_CPU_THIS_PTR fetchModeMask);
+  if (region != NULL)
+    return region->i;
+
+  return buildRegion(pAddr);
+}
+
+// Build a region by copying the traces which are already in the trace cache
+// along the predicted path:
+//  - conditional branches are predicted not taken, except of the back-edge
+//    to the region start which closes the loop
+//  - unconditional direct jumps and calls are followed within the page
+//  - traces ended by the trace length limit continue sequentially
+// Any other trace ending instruction terminates the region.
+bxInstruction_c* BX_CPU_C::buildRegion(bx_phy_address pAddr)
+{
+  Bit32u fetchModeMask = BX_CPU_THIS_PTR fetchModeMask;
+
+  bxICacheEntry_c *e = BX_CPU_THIS_PTR iCache.find_entry(pAddr, fetchModeMask);
+  if (e == NULL)
+    return NULL;
+
+  bxInstruction_c *start = BX_CPU_THIS_PTR iCache.alloc_region();
+  bxInstruction_c *i = start, *lastGuard = NULL;
+
+  bx_phy_address pAddrPage = PPFOf(pAddr);
+  bx_address startRIP = RIP, rip = RIP;
+  Bit32u pageOffset = PAGE_OFFSET((Bit32u) pAddr);
+  Bit32u traceMask = 0;
+  unsigned traces = 0;
+  bool closed = false, stop = false;
+
+  while (! stop) {
+    bxInstruction_c *first = i;
+    traceMask |= e->traceMask;
+
+    for (unsigned n=0; n < e->tlen; n++) {
+      bxInstruction_c *ins = e->i + n;
+      // end of trace opcode, the trace was ended by the length limit
+      if (ins->execute1 == &BX_CPU_C::BxEndTrace)
+        break;
+
+      // reserve space for the guard and the end of region opcode, fused
+      // flag producer is never separated from its conditional branch
+      unsigned iLen = ins->ilen(), pairLen = iLen, pairCount = 1;
+#if BX_CPU_LEVEL >= 3
+      if (isFusedConditionalBranch(ins)) {
+        pairLen += (ins+1)->ilen();
+        pairCount++;
+      }
+#endif
+      if ((pageOffset + pairLen) > 4096 || (i - start) + pairCount + 1 >= BX_MAX_REGION_LENGTH) {
+        stop = true;
+        break;
+      }
+
+      *i++ = *ins;
+      rip += iLen;
+      pageOffset += iLen;
+
+      const bxIAOpcodeTable *op = &BxOpcodesTable[ins->getIaOpcode()];
+      bool unconditional = regionUnconditionalBranch(ins->getIaOpcode());
+
+      // LOOP and JCXZ are trace ending and never linked, the guard would not
+      // be reached after them
+      if (BX_DISASM_SRC_ORIGIN(op->src[0]) == BX_SRC_BRANCH_OFFSET && (unconditional || ! (op->opflags & BX_TRACE_END))) {
+        bx_address target = regionBranchTarget(ins, rip, op->src[0], fetchModeMask);
+        // the taken branch is linked directly to the region continuation
+        if (target == startRIP) {
+          (i-1)->setNextTrace(start, BX_CPU_THIS_PTR iCache.traceLinkTimeStamp);
+          genRegionGuard(i++, startRIP, start);
+          stop = closed = true;
+          break;
+        }
+
+        if (unconditional) {
+          Bit32u targetOffset = pageOffset + (Bit32u)(target - rip);
+          if (targetOffset >= 4096) {
+            stop = true;
+            break;
+          }
+
+          lastGuard = i;
+          (i-1)->setNextTrace(i+1, BX_CPU_THIS_PTR iCache.traceLinkTimeStamp);
+          genRegionGuard(i, target, i+1);
+          i++;
+          rip = target;
+          pageOffset = targetOffset;
+          break;
+        }
+      }
+
+      if (op->opflags & BX_TRACE_END) {
+        stop = true;
+        break;
+      }
+    }
+
+    if (i != first) traces++;
+
+    if (! stop) {
+      if (pageOffset >= 4096) break;
+      e = BX_CPU_THIS_PTR iCache.find_entry(pAddrPage + pageOffset, fetchModeMask);
+      if (e == NULL) break;
+    }
+  }
+
+  if (! closed) {
+    // drop the trailing guard, the branch is linked to the next trace instead
+    if (lastGuard == i - 1) {
+      i--;
+      (i-1)->setNextTrace(NULL, 0);
+    }
+    if (traces < 2)
+      return NULL;
+
+    genDummyICacheEntry(i++);
+  }
+
+  pageWriteStampTable.markICacheMask(pAddr, traceMask);
+  BX_CPU_THIS_PTR iCache.regionCache.commit_region(pAddr, fetchModeMask, (unsigned)(i - start), traceMask);
+
+  INC_ICACHE_STAT(iCacheRegions);
+
+  return start;
+}
+
+#endif
+
+// The file starts with the signature of the build and configuration which
+// saved it, the decoded instructions are only valid for the same one. The
+// build is identified by the hash of the decoder opcode table and of the
+// executable file, which also covers the decode tables of fetchdecode.
+// The signature is followed by the traces, every trace is the record
+// header, the code bytes and the decoded instructions without handlers.
+
+#define BX_TRACE_CACHE_FILE_MAGIC   0x43525442 /* "BTRC" */
+#define BX_TRACE_CACHE_FILE_VERSION 2
+
+struct bxTraceCacheFileRecord {
+  Bit32u fetchModeMask;
+  Bit16u pageOffset;
+  Bit16u bytes;
+  Bit16u tlen;
+  Bit16u reserved;
+};
+
+// the handlers are assigned again when a trace is loaded, only the decoder
+// part of the opcode table is part of the signature
+static Bit32u bx_trace_cache_opcode_table_hash(void)
+{
+  Bit32u h = 2166136261U; // FNV-1a
+  for (unsigned n=0; n < BX_IA_LAST; n++) {
+    const bxIAOpcodeTable *op = &BxOpcodesTable[n];
+    for (unsigned k=0; k < 4; k++)
+      h = (h ^ op->src[k]) * 16777619U;
+    h = (h ^ op->opflags) * 16777619U;
+  }
+  return h;
+}
+
+static Bit32u bx_trace_cache_binary_hash(void)
+{
+  FILE *fd = fopen("/proc/self/exe", "rb");
+  if (fd == NULL && bx_startup_flags.argc > 0)
+    fd = fopen(bx_startup_flags.argv[0], "rb");
+
+  Bit32u h = 2166136261U; // FNV-1a
+  if (fd == NULL) {
+    // the executable is not found, the compile time of this file is the
+    // best available identity
+    static const char build[] = __DATE__ " " __TIME__;
+    for (unsigned n=0; n < sizeof(build); n++)
+      h = (h ^ (Bit8u) build[n]) * 16777619U;
+    return h;
+  }
+
+  Bit32u buf[16384];
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), fd)) > 0) {
+    memset((Bit8u*) buf + len, 0, (4 - (len & 3)) & 3);
+    for (unsigned n=0; n < (len + 3) / 4; n++)
+      h = (h ^ buf[n]) * 16777619U;
+  }
+  fclose(fd);
+  return h;
+}
+
+void bxTraceCacheFile_c::add(bxTraceCacheRecord_c *rec)
+{
+  rec->hash = hash(rec->code, BX_MIN(BX_TRACE_CACHE_KEY_BYTES, 4096 - rec->pageOffset));
+  unsigned n = index(rec->fetchModeMask, rec->pageOffset, rec->hash);
+  rec->next = bucket[n];
+  bucket[n] = rec;
+  traces++;
+}
+
+int bxTraceCacheFile_c::load(const char *filename, const Bit32u *ia_extensions_bitmask)
+{
+  if (enabled()) return traces; // already loaded
+
+  bucket = new bxTraceCacheRecord_c*[BxTraceCacheFileBuckets];
+  for (unsigned n=0; n < BxTraceCacheFileBuckets; n++)
+    bucket[n] = NULL;
+
+  path = new char[strlen(filename) + 1];
+  strcpy(path, filename);
+
+  signature[0] = BX_TRACE_CACHE_FILE_MAGIC;
+  signature[1] = BX_TRACE_CACHE_FILE_VERSION;
+  signature[2] = sizeof(bxInstruction_c);
+  signature[3] = BX_IA_LAST;
+  signature[4] = bx_trace_cache_opcode_table_hash();
+  signature[5] = bx_trace_cache_binary_hash();
+  for (unsigned n=0; n < BX_ISA_EXTENSIONS_ARRAY_SIZE; n++)
+    signature[6+n] = ia_extensions_bitmask[n];
+
+  FILE *fd = fopen(path, "rb");
+  if (fd == NULL) return 0; // the file will be created at exit
+
+  Bit32u file_signature[BX_ISA_EXTENSIONS_ARRAY_SIZE + 6];
+  if (fread(file_signature, sizeof(file_signature), 1, fd) != 1 ||
+      memcmp(file_signature, signature, sizeof(signature)) != 0)
+  {
+    fclose(fd);
+    modified = true; // replace the file at exit
+    return -1;
+  }
+
+  bxTraceCacheFileRecord hdr;
+  while (traces < BxTraceCacheFileMaxTraces && fread(&hdr, sizeof(hdr), 1, fd) == 1) {
+    if (hdr.tlen == 0 || hdr.tlen > BX_MAX_TRACE_LENGTH || hdr.bytes == 0 ||
+        hdr.pageOffset + hdr.bytes > 4096) break;
+
+    bxTraceCacheRecord_c *rec = new bxTraceCacheRecord_c;
+    rec->fetchModeMask = hdr.fetchModeMask;
+    rec->pageOffset = hdr.pageOffset;
+    rec->bytes = hdr.bytes;
+    rec->tlen = hdr.tlen;
+    rec->code = new Bit8u[hdr.bytes];
+    rec->i = new bxInstruction_c[hdr.tlen];
+    if (fread(rec->code, hdr.bytes, 1, fd) != 1 ||
+        fread(rec->i, sizeof(bxInstruction_c) * hdr.tlen, 1, fd) != 1)
+    {
+      // truncated file
+      delete [] rec->code;
+      delete [] rec->i;
+      delete rec;
+      modified = true;
+      break;
+    }
+    add(rec);
+  }
+
+  fclose(fd);
+  return traces;
+}
+
+int bxTraceCacheFile_c::save(void)
+{
+  if (! enabled() || ! modified) return 0;
+
+  FILE *fd = fopen(path, "wb");
+  if (fd == NULL) return -1;
+
+  bool ok = fwrite(signature, sizeof(signature), 1, fd) == 1;
+
+  for (unsigned n=0; ok && n < BxTraceCacheFileBuckets; n++) {
+    for (bxTraceCacheRecord_c *rec = bucket[n]; ok && rec != NULL; rec = rec->next) {
+      bxTraceCacheFileRecord hdr;
+      hdr.fetchModeMask = rec->fetchModeMask;
+      hdr.pageOffset = rec->pageOffset;
+      hdr.bytes = rec->bytes;
+      hdr.tlen = rec->tlen;
+      hdr.reserved = 0;
+      ok = fwrite(&hdr, sizeof(hdr), 1, fd) == 1 &&
+           fwrite(rec->code, rec->bytes, 1, fd) == 1 &&
+           fwrite(rec->i, sizeof(bxInstruction_c) * rec->tlen, 1, fd) == 1;
+    }
+  }
+
+  if (fclose(fd) != 0 || ! ok) return -1;
+
+  modified = false;
+  return traces;
+}
+
+const bxTraceCacheRecord_c* bxTraceCacheFile_c::lookup(Bit32u fetchModeMask, Bit32u pageOffset, const Bit8u *code, unsigned remainingInPage) const
+{
+  unsigned keyLen = BX_MIN(BX_TRACE_CACHE_KEY_BYTES, 4096 - pageOffset);
+  if (remainingInPage < keyLen) return NULL;
+
+  Bit32u h = hash(code, keyLen);
+  for (const bxTraceCacheRecord_c *rec = bucket[index(fetchModeMask, pageOffset, h)]; rec != NULL; rec = rec->next) {
+    if (rec->hash == h && rec->pageOffset == pageOffset && rec->fetchModeMask == fetchModeMask &&
+        rec->bytes <= remainingInPage && memcmp(rec->code, code, rec->bytes) == 0)
+      return rec;
+  }
+
+  return NULL;
+}
+
+void bxTraceCacheFile_c::insert(Bit32u fetchModeMask, Bit32u pageOffset, const Bit8u *code,
+       unsigned remainingInPage, unsigned bytes, const bxInstruction_c *i, unsigned tlen)
+{
+  // the key bytes of short trace are saved and compared as well
+  unsigned keyLen = BX_MIN(BX_TRACE_CACHE_KEY_BYTES, 4096 - pageOffset);
+  if (bytes < keyLen) bytes = keyLen;
+  if (tlen == 0 || bytes > remainingInPage)
+    return;
+
+  // the code could be modified by another CPU thread after it was decoded,
+  // the traces are not saved in parallel SMP mode
+  if (bx_smp_parallel) return;
+
+  if (traces >= BxTraceCacheFileMaxTraces) return;
+
+  bxTraceCacheRecord_c *rec = new bxTraceCacheRecord_c;
+  rec->fetchModeMask = fetchModeMask;
+  rec->pageOffset = pageOffset;
+  rec->bytes = bytes;
+  rec->tlen = tlen;
+  rec->code = new Bit8u[bytes];
+  memcpy(rec->code, code, bytes);
+  rec->i = new bxInstruction_c[tlen];
+  memcpy(rec->i, i, sizeof(bxInstruction_c) * tlen);
+  for (unsigned n=0; n < tlen; n++) {
+    // the handlers are assigned again when the trace is loaded
+    rec->i[n].execute1 = NULL;
+    rec->i[n].handlers.execute2 = NULL;
+  }
+  add(rec);
+  modified = true;
+}
@@ -30,13 +30,20 @@ class bxPageWriteStampTable
 {
   const Bit32u PHY_MEM_PAGES = 1024*1024;
   Bit32u *fineGranularityMapping;
+  // pages written since the last checkpoint, for the incremental save
+  Bit32u *dirtyPages;
 
 public:
   bxPageWriteStampTable() {
     fineGranularityMapping = new Bit32u[PHY_MEM_PAGES];
+    dirtyPages = new Bit32u[PHY_MEM_PAGES / 32];
     resetWriteStamps();
+    resetDirtyPages();
+  }
+ ~bxPageWriteStampTable() {
+    delete [] fineGranularityMapping;
+    delete [] dirtyPages;
   }
- ~bxPageWriteStampTable() { delete [] fineGranularityMapping; }
 
   BX_CPP_INLINE static Bit32u hash(bx_phy_address pAddr) {
     // can share writeStamps between multiple pages if >32 bit phy address
@@ -53,12 +60,39 @@ public:
     Bit32u mask  = 1 << (PAGE_OFFSET((Bit32u) pAddr) >> 7);
            mask |= 1 << (PAGE_OFFSET((Bit32u) pAddr + len - 1) >> 7);
 
-    fineGranularityMapping[hash(pAddr)] |= mask;
+    markICacheMask(pAddr, mask);
   }
 
+  // the table is shared by the CPU threads in parallel SMP mode
   BX_CPP_INLINE void markICacheMask(bx_phy_address pAddr, Bit32u mask)
   {
+#if BX_SUPPORT_SMP
+    BX_ATOMIC_OR32(&fineGranularityMapping[hash(pAddr)], mask);
+#else
     fineGranularityMapping[hash(pAddr)] |= mask;
+#endif
+  }
+
+  // pages above 4G share the dirty flag with their alias below 4G,
+  // so the checkpoint might only save more than it has to
+  BX_CPP_INLINE bool isDirtyPage(bx_phy_address pAddr) const
+  {
+    Bit32u index = hash(pAddr);
+    return (dirtyPages[index >> 5] >> (index & 31)) & 1;
+  }
+
+  // the bitmap is small enough to stay in the host cache, it is written
+  // only by the first write to the page after the checkpoint
+  BX_CPP_INLINE void markDirtyPage(Bit32u index)
+  {
+    Bit32u mask = 1 << (index & 31);
+    if (! (dirtyPages[index >> 5] & mask)) {
+#if BX_SUPPORT_SMP
+      BX_ATOMIC_OR32(&dirtyPages[index >> 5], mask);
+#else
+      dirtyPages[index >> 5] |= mask;
+#endif
+    }
   }
 
   // whole page is being altered
@@ -66,6 +100,8 @@ public:
   {
     Bit32u index = hash(pAddr);
 
+    markDirtyPage(index);
+
     if (fineGranularityMapping[index]) {
       handleSMC(pAddr, 0xffffffff); // one of the CPUs might be running trace from this page
       fineGranularityMapping[index] = 0;
@@ -77,6 +113,8 @@ public:
   {
     Bit32u index = hash(pAddr);
 
+    markDirtyPage(index);
+
     if (fineGranularityMapping[index]) {
        Bit32u mask  = 1 << (PAGE_OFFSET((Bit32u) pAddr) >> 7);
               mask |= 1 << (PAGE_OFFSET((Bit32u) pAddr + len - 1) >> 7);
@@ -84,12 +122,48 @@ public:
        if (fineGranularityMapping[index] & mask) {
           // one of the CPUs might be running trace from this page
           handleSMC(pAddr, mask);
+#if BX_SUPPORT_SMP
+          BX_ATOMIC_AND32(&fineGranularityMapping[index], ~mask);
+#else
           fineGranularityMapping[index] &= ~mask;
+#endif
        }       
     }
   }
 
+  // DMA write, the range might span several pages
+  BX_CPP_INLINE void decWriteStampRange(bx_phy_address pAddr, Bit32u len)
+  {
+    while (len > 0) {
+      Bit32u offset = PAGE_OFFSET((Bit32u) pAddr);
+      Bit32u chunk = 0x1000 - offset;
+      if (chunk > len) chunk = len;
+
+      Bit32u index = hash(pAddr);
+      markDirtyPage(index);
+
+      if (fineGranularityMapping[index]) {
+        Bit32u mask = (0xffffffff << (offset >> 7)) &
+                      (0xffffffff >> (31 - ((offset + chunk - 1) >> 7)));
+
+        if (fineGranularityMapping[index] & mask) {
+          // one of the CPUs might be running trace from this page
+          handleSMC(pAddr, mask);
+#if BX_SUPPORT_SMP
+          BX_ATOMIC_AND32(&fineGranularityMapping[index], ~mask);
+#else
+          fineGranularityMapping[index] &= ~mask;
+#endif
+        }
+      }
+      pAddr += chunk;
+      len -= chunk;
+    }
+  }
+
   BX_CPP_INLINE void resetWriteStamps(void);
+
+  void resetDirtyPages(void) { memset(dirtyPages, 0, PHY_MEM_PAGES / 8); }
 };
 
 BX_CPP_INLINE void bxPageWriteStampTable::resetWriteStamps(void)
@@ -104,6 +178,21 @@ extern bxPageWriteStampTable pageWriteStampTable;
 #define BxICacheEntries (64  * 1024)  // Must be a power of 2.
 #define BxICacheMemPool (576 * 1024)
 
+// Trace cache associativity, selected by configure (1, 2 or 4 ways).
+// The total number of entries is kept the same, more ways mean less sets.
+#define BxICacheWays (BX_ICACHE_WAYS)
+#define BxICacheSets (BxICacheEntries / BxICacheWays)
+
+#if BxICacheWays != 1 && BxICacheWays != 2 && BxICacheWays != 4
+  #error "Trace cache associativity must be 1, 2 or 4 ways"
+#endif
+
+// The trace memory pool is split into generations which are recycled in
+// FIFO order. When the pool is exhausted only the traces allocated in the
+// oldest generation are dropped instead of wiping the whole trace cache.
+#define BxICacheMemPoolGenerations 8
+#define BxICacheMemPoolGenSize (BxICacheMemPool / BxICacheMemPoolGenerations)
+
 struct bxICacheEntry_c
 {
   bx_phy_address pAddr; // Physical address of the instruction
@@ -111,6 +200,9 @@ struct bxICacheEntry_c
 
   Bit32u tlen;          // Trace length in instructions
   bxInstruction_c *i;
+#if BxICacheWays > 1
+  Bit32u referenced;    // Hit since the last replacement sweep of the set (NRU)
+#endif
 };
 
 #define BX_MAX_TRACE_LENGTH 32
@@ -130,11 +222,102 @@ BX_CPP_INLINE void flushSMC(bxICacheEntry_c *e)
   }
 }
 
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS && BX_ENABLE_TRACE_LINKING
+
+// Hot regions (superblocks) are built from several traces following the
+// predicted path over direct branches and closing over the loop back-edge.
+// Taken followed branches are linked directly to the region continuation,
+// a region guard placed after them leaves the region when they fall through.
+// Regions are entered through trace links only and never leave their 4K
+// page, so they do not depend on the linear to physical mapping.
+// Hot link targets are found by sampling the targets of the links refused
+// by the link depth or the time limit, the link fast path is unchanged.
+#define BxRegionEntries (1024) // Must be a power of 2.
+#define BxRegionMemPool (32 * 1024)
+#define BxRegionHotCounters (4096) // Must be a power of 2.
+
+#define BX_MAX_REGION_LENGTH 128
+#define BX_REGION_HOT_THRESHOLD 8
+
+class bxRegionCache_c {
+public:
+  bxICacheEntry_c entry[BxRegionEntries];
+  bxInstruction_c mpool[BxRegionMemPool];
+  unsigned mpindex;
+  unsigned regions; // number of regions formed since the last flush
+
+  // sample counters of the trace link targets
+  Bit8u hotness[BxRegionHotCounters];
+
+  BX_CPP_INLINE static unsigned hash(bx_phy_address pAddr, unsigned fetchModeMask)
+  {
+    return ((pAddr ^ (pAddr >> 12)) & (BxRegionEntries-1)) ^ fetchModeMask;
+  }
+
+  // returns true every time the target was sampled BX_REGION_HOT_THRESHOLD
+  // times (modulo counter wrap), the caller is trying to form a region then
+  BX_CPP_INLINE bool hot(bx_address rip)
+  {
+    Bit32u index = ((Bit32u) rip ^ ((Bit32u) rip >> 12)) & (BxRegionHotCounters-1);
+    return ++hotness[index] == BX_REGION_HOT_THRESHOLD;
+  }
+
+  BX_CPP_INLINE bxICacheEntry_c* find_entry(bx_phy_address pAddr, unsigned fetchModeMask)
+  {
+    bxICacheEntry_c *e = &entry[hash(pAddr, fetchModeMask)];
+    return (e->pAddr == pAddr) ? e : NULL;
+  }
+
+  // returns false if the memory pool has no space left for another region
+  BX_CPP_INLINE bool has_space(void) const
+  {
+    return (mpindex + BX_MAX_REGION_LENGTH) <= BxRegionMemPool;
+  }
+
+  BX_CPP_INLINE bxICacheEntry_c* commit_region(bx_phy_address pAddr, unsigned fetchModeMask, unsigned len, Bit32u traceMask)
+  {
+    // the region replaced in the entry is not reachable through the region
+    // cache anymore, but the links into its instructions remain valid
+    bxICacheEntry_c *e = &entry[hash(pAddr, fetchModeMask)];
+    e->pAddr = pAddr;
+    e->traceMask = traceMask;
+    e->tlen = len;
+    e->i = &mpool[mpindex];
+    mpindex += len;
+    regions++;
+    return e;
+  }
+
+  BX_CPP_INLINE void handleSMC(Bit32u pAddrIndex, Bit32u mask)
+  {
+    if (regions == 0) return;
+
+    bxICacheEntry_c *e = entry;
+    for (unsigned n=0; n < BxRegionEntries; n++, e++) {
+      if (pAddrIndex == bxPageWriteStampTable::hash(e->pAddr) && (e->traceMask & mask) != 0)
+        flushSMC(e);
+    }
+  }
+
+  BX_CPP_INLINE void flush(void)
+  {
+    for (unsigned n=0; n < BxRegionEntries; n++) {
+      entry[n].pAddr = BX_ICACHE_INVALID_PHY_ADDRESS;
+      entry[n].traceMask = 0;
+    }
+    mpindex = 0;
+    regions = 0;
+  }
+};
+
+#endif
+
 class BOCHSAPI bxICache_c {
 public:
   bxICacheEntry_c entry[BxICacheEntries];
   bxInstruction_c mpool[BxICacheMemPool];
   unsigned mpindex;
+  unsigned mpGeneration; // generation of the pool currently being filled
 
   Bit32u traceLinkTimeStamp;
 
@@ -145,23 +328,34 @@ public:
   } pageSplitIndex[BX_ICACHE_PAGE_SPLIT_ENTRIES];
   int nextPageSplitIndex;
 
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS && BX_ENABLE_TRACE_LINKING
+  bxRegionCache_c regionCache;
+#endif
+
 public:
   bxICache_c() { flushICacheEntries(); }
 
+  // returns index of the set, all ways of the set are stored contiguously
   BX_CPP_INLINE static unsigned hash(bx_phy_address pAddr, unsigned fetchModeMask)
   {
-//  return ((pAddr + (pAddr << 2) + (pAddr>>6)) & (BxICacheEntries-1)) ^ fetchModeMask;
-    return ((pAddr) & (BxICacheEntries-1)) ^ fetchModeMask;
+//  return ((pAddr + (pAddr << 2) + (pAddr>>6)) & (BxICacheSets-1)) ^ fetchModeMask;
+    return ((pAddr) & (BxICacheSets-1)) ^ fetchModeMask;
   }
 
-  BX_CPP_INLINE void alloc_trace(bxICacheEntry_c *e)
+  // returns true if the oldest pool generation had to be recycled
+  BX_CPP_INLINE bool alloc_trace(bxICacheEntry_c *e)
   {
+    bool reclaimed = false;
+
     // took +1 garbend for instruction chaining speedup (end-of-trace opcode)
-    if ((mpindex + BX_MAX_TRACE_LENGTH + 1) > BxICacheMemPool) {
-      flushICacheEntries();
+    if ((mpindex + BX_MAX_TRACE_LENGTH + 1) > (mpGeneration + 1) * BxICacheMemPoolGenSize) {
+      reclaimNextGeneration();
+      reclaimed = true;
     }
     e->i = &mpool[mpindex];
     e->tlen = 0;
+
+    return reclaimed;
   }
 
   BX_CPP_INLINE void commit_trace(unsigned len) { mpindex += len; }
@@ -184,18 +378,56 @@ public:
 
   BX_CPP_INLINE void flushICacheEntries(void);
 
+  BX_CPP_INLINE void reclaimNextGeneration(void);
+
+  // returns the entry to be replaced by a new trace: an invalid way of the
+  // set if there is one, a way not referenced since the last sweep otherwise
+  // (not recently used). When all the ways are referenced their bits are
+  // cleared and the first way is replaced.
   BX_CPP_INLINE bxICacheEntry_c* get_entry(bx_phy_address pAddr, unsigned fetchModeMask)
   {
-    return &(entry[hash(pAddr, fetchModeMask)]);
+    bxICacheEntry_c *e = &entry[hash(pAddr, fetchModeMask) * BxICacheWays];
+#if BxICacheWays > 1
+    bxICacheEntry_c *victim = NULL;
+    unsigned way;
+    for (way=0; way < BxICacheWays; way++) {
+      if (e[way].pAddr == BX_ICACHE_INVALID_PHY_ADDRESS) {
+        victim = &e[way];
+        break;
+      }
+      if (! e[way].referenced && victim == NULL)
+        victim = &e[way];
+    }
+    if (victim == NULL) {
+      for (way=0; way < BxICacheWays; way++)
+        e[way].referenced = 0;
+      victim = e;
+    }
+    victim->referenced = 1;
+    return victim;
+#else
+    return e;
+#endif
   }
 
   BX_CPP_INLINE bxICacheEntry_c* find_entry(bx_phy_address pAddr, unsigned fetchModeMask)
   {
-    bxICacheEntry_c* e = get_entry(pAddr, fetchModeMask);
+    bxICacheEntry_c *e = &entry[hash(pAddr, fetchModeMask) * BxICacheWays];
+#if BxICacheWays > 1
+    for (unsigned way=0; way < BxICacheWays; way++, e++) {
+      if (e->pAddr == pAddr) {
+        // write the entry only on the first hit after a sweep
+        if (! e->referenced) e->referenced = 1;
+        return e;
+      }
+    }
+    return NULL;
+#else
     if (e->pAddr != pAddr)
        return NULL;
 
     return e;
+#endif
   }
 
   BX_CPP_INLINE bool breakLinks()
@@ -207,6 +439,19 @@ public:
     }
     return false;
   }
+
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS && BX_ENABLE_TRACE_LINKING
+  // returns the memory for a new region, trace links might point into the
+  // region memory pool so they are broken when the pool is recycled
+  BX_CPP_INLINE bxInstruction_c* alloc_region(void)
+  {
+    if (! regionCache.has_space()) {
+      regionCache.flush();
+      breakLinks();
+    }
+    return &regionCache.mpool[regionCache.mpindex];
+  }
+#endif
 };
 
 BX_CPP_INLINE void bxICache_c::flushICacheEntries(void)
@@ -217,6 +462,9 @@ BX_CPP_INLINE void bxICache_c::flushICacheEntries(void)
   for (i=0; i<BxICacheEntries; i++, e++) {
     e->pAddr = BX_ICACHE_INVALID_PHY_ADDRESS;
     e->traceMask = 0;
+#if BxICacheWays > 1
+    e->referenced = 0;
+#endif
   }
 
   nextPageSplitIndex = 0;
@@ -224,8 +472,35 @@ BX_CPP_INLINE void bxICache_c::flushICacheEntries(void)
     pageSplitIndex[i].ppf = BX_ICACHE_INVALID_PHY_ADDRESS;
 
   mpindex = 0;
+  mpGeneration = 0;
 
   traceLinkTimeStamp = 0;
+
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS && BX_ENABLE_TRACE_LINKING
+  regionCache.flush();
+#endif
+}
+
+BX_CPP_INLINE void bxICache_c::reclaimNextGeneration(void)
+{
+  mpGeneration = (mpGeneration + 1) % BxICacheMemPoolGenerations;
+  mpindex = mpGeneration * BxICacheMemPoolGenSize;
+
+  // Drop all traces allocated in the generation that is going to be reused.
+  // Traces from other generations could be linked into the dropped ones, so
+  // break all links between traces as well.
+  const bxInstruction_c *start = &mpool[mpindex];
+  const bxInstruction_c *end = start + BxICacheMemPoolGenSize;
+
+  bxICacheEntry_c* e = entry;
+  for (unsigned n=0; n<BxICacheEntries; n++, e++) {
+    if (e->pAddr != BX_ICACHE_INVALID_PHY_ADDRESS && e->i >= start && e->i < end) {
+      e->pAddr = BX_ICACHE_INVALID_PHY_ADDRESS;
+      e->traceMask = 0;
+    }
+  }
+
+  breakLinks(); // might flush entire trace cache on time stamp wrap
 }
 
 BX_CPP_INLINE void bxICache_c::handleSMC(bx_phy_address pAddr, Bit32u mask)
@@ -258,20 +533,87 @@ BX_CPP_INLINE void bxICache_c::handleSMC(bx_phy_address pAddr, Bit32u mask)
     }
   }
 
-  bxICacheEntry_c *e = get_entry(LPFOf(pAddr), 0);
+  bxICacheEntry_c *e = &entry[hash(LPFOf(pAddr), 0) * BxICacheWays];
 
   // go over 32 "cache lines" of 128 byte each
   for (unsigned n=0; n < 32; n++) {
     Bit32u line_mask = (1 << n);
     if (line_mask > mask) break;
-    for (unsigned index=0; index < 128; index++, e++) {
+    for (unsigned index=0; index < 128 * BxICacheWays; index++, e++) {
       if (pAddrIndex == bxPageWriteStampTable::hash(e->pAddr) && (e->traceMask & mask) != 0) {
         flushSMC(e);
       }
     }
   }
+
+#if BX_SUPPORT_HANDLERS_CHAINING_SPEEDUPS && BX_ENABLE_TRACE_LINKING
+  regionCache.handleSMC(pAddrIndex, mask);
+#endif
 }
 
+// Persistent decoded trace cache, saved at exit and reused by the next
+// run (cpu: trace_cache option). A trace cache miss looks up the saved
+// trace decoded in the same fetch mode at the same page offset, keyed by
+// the hash of its first code bytes, and copies the decoded instructions
+// instead of decoding them if the saved code bytes match the page content.
+// The handlers are not saved, they are assigned again for the current run.
+#define BxTraceCacheFileBuckets (64 * 1024) // Must be a power of 2.
+#define BxTraceCacheFileMaxTraces (256 * 1024)
+#define BX_TRACE_CACHE_KEY_BYTES 16
+
+struct bxTraceCacheRecord_c
+{
+  bxTraceCacheRecord_c *next; // next record in the hash chain
+  Bit32u fetchModeMask;
+  Bit32u hash;                // hash of the first code bytes
+  Bit16u pageOffset;
+  Bit16u bytes;               // trace length in bytes
+  Bit16u tlen;                // trace length in instructions
+  Bit8u *code;
+  bxInstruction_c *i;
+};
+
+class bxTraceCacheFile_c {
+  bxTraceCacheRecord_c **bucket;
+  unsigned traces;
+  bool modified;
+  char *path;
+  Bit32u signature[BX_ISA_EXTENSIONS_ARRAY_SIZE + 6];
+
+  BX_CPP_INLINE static Bit32u hash(const Bit8u *code, unsigned len)
+  {
+    Bit32u h = 2166136261U; // FNV-1a
+    for (unsigned n=0; n < len; n++)
+      h = (h ^ code[n]) * 16777619U;
+    return h;
+  }
+
+  BX_CPP_INLINE static unsigned index(Bit32u fetchModeMask, Bit32u pageOffset, Bit32u hash)
+  {
+    return (hash ^ (pageOffset << 4) ^ fetchModeMask) & (BxTraceCacheFileBuckets-1);
+  }
+
+  void add(bxTraceCacheRecord_c *rec);
+
+public:
+  bxTraceCacheFile_c(): bucket(NULL), traces(0), modified(false), path(NULL) {}
+
+  BX_CPP_INLINE bool enabled(void) const { return bucket != NULL; }
+
+  // returns number of the traces loaded from the file or -1 if the file
+  // was not saved by this build and configuration
+  int load(const char *filename, const Bit32u *ia_extensions_bitmask);
+  // returns number of the saved traces or -1 on error
+  int save(void);
+
+  const bxTraceCacheRecord_c* lookup(Bit32u fetchModeMask, Bit32u pageOffset,
+       const Bit8u *code, unsigned remainingInPage) const;
+  void insert(Bit32u fetchModeMask, Bit32u pageOffset, const Bit8u *code,
+       unsigned remainingInPage, unsigned bytes, const bxInstruction_c *i, unsigned tlen);
+};
+
+extern bxTraceCacheFile_c traceCacheFile;
+
 extern void flushICaches(void);
 
 #endif
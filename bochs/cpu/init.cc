@@ -63,6 +63,10 @@ BX_CPU_C::BX_CPU_C(unsigned id): bx_cpuid(id)
 
   stats = NULL;
 
+#if BX_SUPPORT_SMP
+  address_xlation.exclusive = 0;
+#endif
+
   srand(time(NULL)); // initialize random generator for RDRAND/RDSEED
 }
 
@@ -96,8 +100,26 @@ static bx_cpuid_t *cpuid_factory(BX_CPU_C *cpu)
 #endif
 
 // BX_CPU_C constructor
+// TLB sizes are rounded down to power of 2
+static unsigned get_tlb_size(const char *pname)
+{
+  unsigned size = SIM->get_param_num(pname)->get(), n = 1;
+  if (size == 0) return 0;
+  while ((n << 1) <= size) n <<= 1;
+  return n;
+}
+
 void BX_CPU_C::initialize(void)
 {
+  BX_CPU_THIS_PTR DTLB.init(get_tlb_size(BXPN_CPU_DTLB_SIZE));
+  BX_CPU_THIS_PTR ITLB.init(get_tlb_size(BXPN_CPU_ITLB_SIZE));
+  BX_CPU_THIS_PTR STLB.init(get_tlb_size(BXPN_CPU_STLB_SIZE));
+  BX_CPU_THIS_PTR LTLB.init(get_tlb_size(BXPN_CPU_LARGE_TLB_SIZE));
+  BX_CPU_THIS_PTR tlb_ctx = 0;
+#if BX_SUPPORT_VMX >= 2 || BX_SUPPORT_SVM
+  BX_CPU_THIS_PTR tlb_nested_root = 0;
+#endif
+
 #if BX_CPU_LEVEL >= 4
   BX_CPU_THIS_PTR cpuid = cpuid_factory(this);
   if (! BX_CPU_THIS_PTR cpuid)
@@ -115,6 +137,16 @@ void BX_CPU_C::initialize(void)
 
   init_FetchDecodeTables(); // must be called after init_isa_features_bitmask()
 
+  // persistent decoded trace cache is shared by all the CPUs
+  bx_param_string_c *trace_cache = SIM->get_param_string(BXPN_CPU_TRACE_CACHE);
+  if (BX_CPU_ID == 0 && ! trace_cache->isempty()) {
+    int traces = traceCacheFile.load(trace_cache->getptr(), BX_CPU_THIS_PTR ia_extensions_bitmask);
+    if (traces < 0)
+      BX_INFO(("trace cache file '%s' was saved by another build or configuration, ignored", trace_cache->getptr()));
+    else
+      BX_INFO(("trace cache file '%s': %d traces loaded", trace_cache->getptr(), traces));
+  }
+
 #if BX_CPU_LEVEL >= 6
   xsave_xrestor_init();
 #endif
@@ -153,6 +185,10 @@ void BX_CPU_C::init_statistics(void)
   new bx_shadow_num_c(cpu, "iCacheLookups", &stats->iCacheLookups);
   new bx_shadow_num_c(cpu, "iCachePrefetch", &stats->iCachePrefetch);
   new bx_shadow_num_c(cpu, "iCacheMisses", &stats->iCacheMisses);
+  new bx_shadow_num_c(cpu, "iCacheEvictions", &stats->iCacheEvictions);
+  new bx_shadow_num_c(cpu, "iCachePoolReclaims", &stats->iCachePoolReclaims);
+  new bx_shadow_num_c(cpu, "iCacheRegions", &stats->iCacheRegions);
+  new bx_shadow_num_c(cpu, "iCacheWarmHits", &stats->iCacheWarmHits);
 #endif
 
 #if InstrumentTLB
@@ -162,11 +198,15 @@ void BX_CPU_C::init_statistics(void)
   new bx_shadow_num_c(cpu, "tlbMisses", &stats->tlbMisses);
   new bx_shadow_num_c(cpu, "tlbExecuteMisses", &stats->tlbExecuteMisses);
   new bx_shadow_num_c(cpu, "tlbWriteMisses", &stats->tlbWriteMisses);
+  new bx_shadow_num_c(cpu, "tlbSecondLevelHits", &stats->tlbSecondLevelHits);
+  new bx_shadow_num_c(cpu, "tlbLargePageHits", &stats->tlbLargePageHits);
+  new bx_shadow_num_c(cpu, "tlbContextSwitches", &stats->tlbContextSwitches);
 #endif
 
 #if InstrumentTLBFlush
   new bx_shadow_num_c(cpu, "tlbGlobalFlushes", &stats->tlbGlobalFlushes);
   new bx_shadow_num_c(cpu, "tlbNonGlobalFlushes", &stats->tlbNonGlobalFlushes);
+  new bx_shadow_num_c(cpu, "tlbContextFlushes", &stats->tlbContextFlushes);
 #endif
 
 #if InstrumentStackPrefetch
@@ -180,6 +220,26 @@ void BX_CPU_C::init_statistics(void)
 #endif
 }
 
+// Place the CPU state, including the trace cache, and the TLBs on the host
+// NUMA node running the CPU thread. The pages already touched are migrated,
+// the small TLBs sharing their pages with other data are left alone.
+void BX_CPU_C::bind_numa_node(int node)
+{
+  if ((node < 0) || (node >= BX_NUMA_MAX_NODES)) return;
+
+  Bit64u mask = BX_CONST64(1) << node;
+  if (! bx_numa_bind(this, sizeof(BX_CPU_C), mask, 0))
+    BX_ERROR(("failed to place the CPU state on NUMA node %d", node));
+  bx_numa_bind(DTLB.entry, DTLB.size * sizeof(bx_TLB_entry), mask, 0);
+  bx_numa_bind(ITLB.entry, ITLB.size * sizeof(bx_TLB_entry), mask, 0);
+  if (STLB.size > 0) {
+    bx_numa_bind(STLB.entry, STLB.size * sizeof(bx_TLB_entry), mask, 0);
+    bx_numa_bind(STLB.tag, STLB.size * sizeof(Bit64u), mask, 0);
+  }
+  if (LTLB.size > 0)
+    bx_numa_bind(LTLB.entry, LTLB.size * sizeof(*LTLB.entry), mask, 0);
+}
+
 // save/restore functionality
 void BX_CPU_C::register_state(void)
 {
@@ -507,11 +567,15 @@ void BX_CPU_C::register_state(void)
   BXRS_PARAM_BOOL(cpu, in_smm, in_smm);
 
 #if BX_DEBUGGER
+  // The TLB entries are saved for the debugger only, all the TLBs are flushed
+  // after restore. The saved layout depends on the configured TLB sizes, the
+  // size params make a restore with different sizes fail with a clear message.
   bx_list_c *dtlb = new bx_list_c(cpu, "DTLB");
+  BXRS_PARAM_SPECIAL32(dtlb, size, param_save_handler, param_restore_handler);
 #if BX_CPU_LEVEL >= 5
   BXRS_PARAM_BOOL(dtlb, split_large, DTLB.split_large);
 #endif
-  for (n=0; n<BX_DTLB_SIZE; n++) {
+  for (n=0; n<DTLB.size; n++) {
     sprintf(name, "entry%u", n);
     bx_list_c *tlb_entry = new bx_list_c(dtlb, name);
     BXRS_HEX_PARAM_FIELD(tlb_entry, lpf, DTLB.entry[n].lpf);
@@ -527,10 +591,11 @@ void BX_CPU_C::register_state(void)
   }
 
   bx_list_c *itlb = new bx_list_c(cpu, "ITLB");
+  BXRS_PARAM_SPECIAL32(itlb, size, param_save_handler, param_restore_handler);
 #if BX_CPU_LEVEL >= 5
   BXRS_PARAM_BOOL(itlb, split_large, ITLB.split_large);
 #endif
-  for (n=0; n<BX_ITLB_SIZE; n++) {
+  for (n=0; n<ITLB.size; n++) {
     sprintf(name, "entry%u", n);
     bx_list_c *tlb_entry = new bx_list_c(itlb, name);
     BXRS_HEX_PARAM_FIELD(tlb_entry, lpf, ITLB.entry[n].lpf);
@@ -588,6 +653,11 @@ Bit64s BX_CPU_C::param_save(bx_param_c *param)
     if (segment != NULL) {
       val = segment->selector.value;
     }
+  } else if (!strcmp(pname, "size")) {
+    if (!strcmp(param->get_parent()->get_name(), "DTLB"))
+      val = BX_CPU_THIS_PTR DTLB.size;
+    else
+      val = BX_CPU_THIS_PTR ITLB.size;
   }
   else {
     BX_PANIC(("Unknown param %s in param_save handler !", pname));
@@ -636,6 +706,13 @@ void BX_CPU_C::param_restore(bx_param_c *param, Bit64s val)
       bx_selector_t *selector = &(segment->selector);
       parse_selector((Bit16u)val, selector);
     }
+  } else if (!strcmp(pname, "size")) {
+    const char *tlbname = param->get_parent()->get_name();
+    unsigned size = !strcmp(tlbname, "DTLB") ? BX_CPU_THIS_PTR DTLB.size : BX_CPU_THIS_PTR ITLB.size;
+    if ((unsigned) val != size) {
+      BX_PANIC(("%s size %u in the saved state does not match the configured size %u",
+        tlbname, (unsigned) val, size));
+    }
   }
   else {
     BX_PANIC(("Unknown param %s in param_restore handler !", pname));
@@ -644,7 +721,8 @@ void BX_CPU_C::param_restore(bx_param_c *param, Bit64s val)
 
 void BX_CPU_C::after_restore_state(void)
 {
-  handleCpuContextChange();
+  // the TLB entries are not part of the saved state, flush all TLB levels
+  handleCpuContextChange(true);
 
   BX_CPU_THIS_PTR prev_rip = RIP;
 
@@ -707,6 +785,9 @@ void BX_CPU_C::reset(unsigned source)
   if (source == BX_RESET_HARDWARE)
     BX_CPU_THIS_PTR icount = 0;
   BX_CPU_THIS_PTR icount_last_sync = BX_CPU_THIS_PTR icount;
+#if BX_SUPPORT_SMP
+  BX_CPU_THIS_PTR smp_yield_hint = 0;
+#endif
 
   BX_CPU_THIS_PTR inhibit_mask = 0;
   BX_CPU_THIS_PTR inhibit_icount = 0;
@@ -81,6 +81,9 @@ Bit32u BX_CPU_C::FastRepINSW(Bit32u dstOff, Bit16u port, Bit32u wordCount)
 
   // If after all the restrictions, there is anything left to do...
   if (wordCount) {
+    // the bulk IO state is shared by all the CPU threads
+    BX_SMP_GUARD();
+
     for (count=0; count<wordCount; ) {
       bx_devices.bulkIOQuantumsTransferred = 0;
       if (BX_CPU_THIS_PTR get_DF()==0) { // Only do accel for DF=0
@@ -103,6 +106,12 @@ Bit32u BX_CPU_C::FastRepINSW(Bit32u dstOff, Bit16u port, Bit32u wordCount)
       if (BX_CPU_THIS_PTR async_event) break;
     }
 
+#if BX_SUPPORT_SMP
+    // another CPU might have decoded a trace from the page meanwhile
+    if (bx_smp_parallel)
+      pageWriteStampTable.decWriteStamp(BX_DTLB_ENTRY_OF(laddrDst, 0)->ppf);
+#endif
+
     // Reset for next non-bulk IO
     bx_devices.bulkIOQuantumsRequested = 0;
 
@@ -161,6 +170,9 @@ Bit32u BX_CPU_C::FastRepOUTSW(unsigned srcSeg, Bit32u srcOff, Bit16u port, Bit32
 
   // If after all the restrictions, there is anything left to do...
   if (wordCount) {
+    // the bulk IO state is shared by all the CPU threads
+    BX_SMP_GUARD();
+
     for (count=0; count<wordCount; ) {
       bx_devices.bulkIOQuantumsTransferred = 0;
       if (BX_CPU_THIS_PTR get_DF()==0) { // Only do accel for DF=0
@@ -190,6 +190,43 @@ const Bit32u LF_MASK_PO  = (0x01 << LF_BIT_PO);
    SET_FLAGS_OSZAxC_LOGIC_SIZE(64, (result_64))
 #endif
 
+// *******************
+// Fused Jcc
+// *******************
+
+// A flag producer fused with the following conditional branch evaluates
+// the branch condition directly from its operands and result instead of
+// reading it back from the lazy flags state. The condition flags are
+// packed into 4-bit index (CF, ZF, SF, OF from bit 0 up) which selects
+// a bit from the 16-bit truth table of the condition code. PF based
+// conditions are never fused.
+
+extern const Bit16u bx_fused_jcc_table[16];
+
+#define BX_FUSED_JCC_FLAGS(cf, zf, sf, of) \
+  ((unsigned)(cf) | ((unsigned)(zf) << 1) | ((unsigned)(sf) << 2) | ((unsigned)(of) << 3))
+
+#define BX_FUSED_JCC_FLAGS_SUB_32(op1_32, op2_32, diff_32) \
+  BX_FUSED_JCC_FLAGS((op1_32) < (op2_32), (diff_32) == 0, (diff_32) >> 31, \
+     (((op1_32) ^ (op2_32)) & ((op1_32) ^ (diff_32))) >> 31)
+#define BX_FUSED_JCC_FLAGS_LOGIC_32(result_32) \
+  BX_FUSED_JCC_FLAGS(0, (result_32) == 0, (result_32) >> 31, 0)
+#define BX_FUSED_JCC_FLAGS_DEC_32(cf, result_32) \
+  BX_FUSED_JCC_FLAGS((cf), (result_32) == 0, (result_32) >> 31, (result_32) == 0x7fffffff)
+
+#if BX_SUPPORT_X86_64
+#define BX_FUSED_JCC_FLAGS_SUB_64(op1_64, op2_64, diff_64) \
+  BX_FUSED_JCC_FLAGS((op1_64) < (op2_64), (diff_64) == 0, (diff_64) >> 63, \
+     (((op1_64) ^ (op2_64)) & ((op1_64) ^ (diff_64))) >> 63)
+#define BX_FUSED_JCC_FLAGS_LOGIC_64(result_64) \
+  BX_FUSED_JCC_FLAGS(0, (result_64) == 0, (result_64) >> 63, 0)
+#define BX_FUSED_JCC_FLAGS_DEC_64(cf, result_64) \
+  BX_FUSED_JCC_FLAGS((cf), (result_64) == 0, (result_64) >> 63, (result_64) == BX_CONST64(0x7fffffffffffffff))
+#endif
+
+#define BX_FUSED_JCC_TAKEN(cond, flags) \
+  ((bx_fused_jcc_table[(cond)] >> (flags)) & 1)
+
 struct bx_lazyflags_entry {
   bx_address result;
   bx_address auxbits;
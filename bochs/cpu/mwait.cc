@@ -106,10 +106,14 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::MONITOR(bxInstruction_c *i)
   // Set the monitor immediately. If monitor is still armed when we MWAIT,
   // the processor will stall.
 
-  bx_pc_system.invlpg(paddr);
+  // Arm the monitor before flushing the TLBs, so another CPU running in
+  // parallel can't cache a direct write pointer to the monitored page.
+  BX_SMP_GUARD();
 
   BX_CPU_THIS_PTR monitor.arm(paddr);
 
+  bx_pc_system.invlpg(paddr);
+
   BX_DEBUG(("MONITOR for phys_addr=0x" FMT_PHY_ADDRX, BX_CPU_THIS_PTR monitor.monitor_addr));
 #endif
 
@@ -163,6 +167,9 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::MWAIT(bxInstruction_c *i)
   }
 #endif
 
+  // the monitor could be triggered by another CPU thread
+  BX_SMP_GUARD();
+
   // If monitor has already triggered, we just return.
   if (! BX_CPU_THIS_PTR monitor.armed) {
     BX_DEBUG(("%s: the MONITOR was not armed or already triggered", i->getIaOpcodeNameShort()));
@@ -197,6 +204,10 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::MWAIT(bxInstruction_c *i)
 
   BX_INSTR_MWAIT(BX_CPU_ID, BX_CPU_THIS_PTR monitor.monitor_addr, CACHE_LINE_SIZE, ECX);
 
+#if BX_SUPPORT_SMP
+  BX_CPU_THIS_PTR smp_yield_hint = 1;
+#endif
+
   if (ECX & 2) {
     if (i->getIaOpcode() == BX_IA_MWAITX) {
       BX_CPU_THIS_PTR lapic.set_mwaitx_timer(EBX);
@@ -390,6 +390,12 @@ void BX_CPU_C::TLB_flush(void)
 
   BX_CPU_THIS_PTR DTLB.flush();
   BX_CPU_THIS_PTR ITLB.flush();
+  BX_CPU_THIS_PTR STLB.flush();
+  BX_CPU_THIS_PTR LTLB.flush();
+
+#if BX_CPU_LEVEL >= 6
+  BX_CPU_THIS_PTR tlb_ctx = TLB_context();
+#endif
 
 #if BX_SUPPORT_MONITOR_MWAIT
   // invalidating of the TLB might change translation for monitored page
@@ -411,6 +417,8 @@ void BX_CPU_C::TLB_flushNonGlobal(void)
 
   BX_CPU_THIS_PTR DTLB.flushNonGlobal();
   BX_CPU_THIS_PTR ITLB.flushNonGlobal();
+  BX_CPU_THIS_PTR STLB.flushNonGlobal();
+  BX_CPU_THIS_PTR LTLB.flushNonGlobal();
 
 #if BX_SUPPORT_MONITOR_MWAIT
   // invalidating of the TLB might change translation for monitored page
@@ -421,9 +429,146 @@ void BX_CPU_C::TLB_flushNonGlobal(void)
   // break all links bewteen traces
   BX_CPU_THIS_PTR iCache.breakLinks();
 }
+
+// CR4 paging control bits affecting the cached translations
+const Bit32u BX_CR4_TLB_CONTEXT_MASK = BX_CR4_FLUSH_TLB_MASK & ~BX_CR4_PCIDE_MASK;
+
+Bit64u BX_CPU_C::TLB_context(void)
+{
+  Bit64u ctx = Bit64u((BX_CPU_THIS_PTR cr4.get32() & BX_CR4_TLB_CONTEXT_MASK) |
+                      (BX_CPU_THIS_PTR cr0.get32() & BX_CR0_WP_MASK)) << 32;
+
+  // the execute permissions of the cached translations depend on NXE
+  if (BX_CPU_THIS_PTR efer.get_NXE())
+    ctx |= BX_TLB_CTX_NXE;
+
+#if BX_SUPPORT_X86_64
+  if (BX_CPU_THIS_PTR cr4.get_PCIDE())
+    ctx |= BX_CPU_THIS_PTR cr3 & BX_TLB_CTX_PCID_MASK;
+#endif
+
+#if BX_SUPPORT_VMX >= 2
+  if (BX_CPU_THIS_PTR in_vmx_guest) {
+    if (SECONDARY_VMEXEC_CONTROL(VMX_VM_EXEC_CTRL3_VPID_ENABLE))
+      ctx |= Bit64u(BX_CPU_THIS_PTR vmcs.vpid) << 16;
+  }
+#endif
+
+#if BX_SUPPORT_SVM
+  if (BX_CPU_THIS_PTR in_svm_guest)
+    ctx |= Bit64u(BX_CPU_THIS_PTR vmcb.ctrls.asid & 0xffff) << 16;
+#endif
+
+  return ctx;
+}
+
+// Switch the TLBs to the current translation context (after CR3 load, VM entry
+// or VM exit). The translations of the previous context are moved to the second
+// level TLB instead of being dropped and stay there until evicted or invalidated.
+void BX_CPU_C::TLB_switchContext(bool flushNew)
+{
+  Bit64u ctx = TLB_context();
+
+  if (ctx == BX_CPU_THIS_PTR tlb_ctx) {
+    if (flushNew)
+      TLB_flushPCID((unsigned)(ctx & BX_TLB_CTX_PCID_MASK));
+    return;
+  }
+
+  INC_TLB_STAT(tlbContextSwitches);
+
+  invalidate_prefetch_q();
+  invalidate_stack_cache();
+
+  // global translations remain valid when only PCID is changed
+  bool keep_global = BX_CPU_THIS_PTR cr4.get_PGE() && ((ctx ^ BX_CPU_THIS_PTR tlb_ctx) & ~BX_TLB_CTX_PCID_MASK) == 0;
+
+  BX_CPU_THIS_PTR STLB.spill(BX_CPU_THIS_PTR DTLB, false, BX_CPU_THIS_PTR tlb_ctx, keep_global);
+  BX_CPU_THIS_PTR STLB.spill(BX_CPU_THIS_PTR ITLB, true,  BX_CPU_THIS_PTR tlb_ctx, keep_global);
+  BX_CPU_THIS_PTR tlb_ctx = ctx;
+
+  if (flushNew) {
+    INC_TLBFLUSH_STAT(tlbContextFlushes);
+    bool pge = BX_CPU_THIS_PTR cr4.get_PGE();
+    BX_CPU_THIS_PTR STLB.flushContext(ctx, BX_TLB_CTX_PCID_MASK | BX_TLB_CTX_VPID_MASK, pge);
+    BX_CPU_THIS_PTR LTLB.flushContext(ctx, BX_TLB_CTX_PCID_MASK | BX_TLB_CTX_VPID_MASK, pge);
+  }
+
+#if BX_SUPPORT_MONITOR_MWAIT
+  BX_CPU_THIS_PTR monitor.reset_monitor();
+#endif
+
+  // break all links bewteen traces
+  BX_CPU_THIS_PTR iCache.breakLinks();
+}
+
+// invalidate all non-global translations tagged with PCID of the current VPID
+void BX_CPU_C::TLB_flushPCID(unsigned pcid)
+{
+  INC_TLBFLUSH_STAT(tlbContextFlushes);
+
+  invalidate_prefetch_q();
+  invalidate_stack_cache();
+
+  Bit64u ctx = (BX_CPU_THIS_PTR tlb_ctx & ~BX_TLB_CTX_PCID_MASK) | pcid;
+  bool pge = BX_CPU_THIS_PTR cr4.get_PGE();
+
+  if (ctx == BX_CPU_THIS_PTR tlb_ctx) {
+    if (pge) {
+      BX_CPU_THIS_PTR DTLB.flushNonGlobal();
+      BX_CPU_THIS_PTR ITLB.flushNonGlobal();
+    }
+    else {
+      BX_CPU_THIS_PTR DTLB.flush();
+      BX_CPU_THIS_PTR ITLB.flush();
+    }
+  }
+
+  BX_CPU_THIS_PTR STLB.flushContext(ctx, BX_TLB_CTX_PCID_MASK | BX_TLB_CTX_VPID_MASK, pge);
+  BX_CPU_THIS_PTR LTLB.flushContext(ctx, BX_TLB_CTX_PCID_MASK | BX_TLB_CTX_VPID_MASK, pge);
+
+#if BX_SUPPORT_MONITOR_MWAIT
+  BX_CPU_THIS_PTR monitor.reset_monitor();
 #endif
 
-void BX_CPU_C::TLB_invlpg(bx_address laddr)
+  // break all links bewteen traces
+  BX_CPU_THIS_PTR iCache.breakLinks();
+}
+
+// invalidate all translations tagged with VPID (or SVM ASID)
+void BX_CPU_C::TLB_flushVPID(unsigned vpid, bool keep_global)
+{
+  INC_TLBFLUSH_STAT(tlbContextFlushes);
+
+  invalidate_prefetch_q();
+  invalidate_stack_cache();
+
+  Bit64u ctx = Bit64u(vpid & 0xffff) << 16;
+
+  if (((ctx ^ BX_CPU_THIS_PTR tlb_ctx) & BX_TLB_CTX_VPID_MASK) == 0) {
+    if (keep_global) {
+      BX_CPU_THIS_PTR DTLB.flushNonGlobal();
+      BX_CPU_THIS_PTR ITLB.flushNonGlobal();
+    }
+    else {
+      BX_CPU_THIS_PTR DTLB.flush();
+      BX_CPU_THIS_PTR ITLB.flush();
+    }
+  }
+
+  BX_CPU_THIS_PTR STLB.flushContext(ctx, BX_TLB_CTX_VPID_MASK, keep_global);
+  BX_CPU_THIS_PTR LTLB.flushContext(ctx, BX_TLB_CTX_VPID_MASK, keep_global);
+
+#if BX_SUPPORT_MONITOR_MWAIT
+  BX_CPU_THIS_PTR monitor.reset_monitor();
+#endif
+
+  // break all links bewteen traces
+  BX_CPU_THIS_PTR iCache.breakLinks();
+}
+#endif
+
+void BX_CPU_C::TLB_invlpg(bx_address laddr, bool allContexts)
 {
   invalidate_prefetch_q();
   invalidate_stack_cache();
@@ -431,6 +576,11 @@ void BX_CPU_C::TLB_invlpg(bx_address laddr)
   BX_DEBUG(("TLB_invlpg(0x" FMT_ADDRX "): invalidate TLB entry", laddr));
   BX_CPU_THIS_PTR DTLB.invlpg(laddr);
   BX_CPU_THIS_PTR ITLB.invlpg(laddr);
+  if (allContexts)
+    BX_CPU_THIS_PTR STLB.invlpgAll(laddr);
+  else
+    BX_CPU_THIS_PTR STLB.invlpg(laddr, BX_CPU_THIS_PTR tlb_ctx);
+  BX_CPU_THIS_PTR LTLB.invlpg(laddr);
 
 #if BX_SUPPORT_MONITOR_MWAIT
   // invalidating of the TLB entry might change translation for monitored
@@ -862,7 +1012,7 @@ void BX_CPU_C::update_access_dirty_PAE(bx_phy_address *entry_addr, Bit64u *entry
   for (unsigned level=max_level; level > leaf; level--) {
     if (!(entry[level] & 0x20)) {
       entry[level] |= 0x20;
-      access_write_physical(entry_addr[level], 8, &entry[level]);
+      write_paging_entry_bits(entry_addr[level], 8, &entry[level], 0x20);
       BX_NOTIFY_PHY_MEMORY_ACCESS(entry_addr[level], 8, entry_memtype[level], BX_WRITE,
             (BX_PTE_ACCESS + level), (Bit8u*)(&entry[level]));
     }
@@ -871,7 +1021,7 @@ void BX_CPU_C::update_access_dirty_PAE(bx_phy_address *entry_addr, Bit64u *entry
   // Update A/D bits if needed
   if (!(entry[leaf] & 0x20) || (write && !(entry[leaf] & 0x40))) {
     entry[leaf] |= (0x20 | (write<<6)); // Update A and possibly D bits
-    access_write_physical(entry_addr[leaf], 8, &entry[leaf]);
+    write_paging_entry_bits(entry_addr[leaf], 8, &entry[leaf], 0x20 | (write<<6));
     BX_NOTIFY_PHY_MEMORY_ACCESS(entry_addr[leaf], 8, entry_memtype[leaf], BX_WRITE,
             (BX_PTE_ACCESS + leaf), (Bit8u*)(&entry[leaf]));
   }
@@ -1259,7 +1409,7 @@ void BX_CPU_C::update_access_dirty(bx_phy_address *entry_addr, Bit32u *entry, Bx
     // Update PDE A bit if needed
     if (!(entry[BX_LEVEL_PDE] & 0x20)) {
       entry[BX_LEVEL_PDE] |= 0x20;
-      access_write_physical(entry_addr[BX_LEVEL_PDE], 4, &entry[BX_LEVEL_PDE]);
+      write_paging_entry_bits(entry_addr[BX_LEVEL_PDE], 4, &entry[BX_LEVEL_PDE], 0x20);
       BX_NOTIFY_PHY_MEMORY_ACCESS(entry_addr[BX_LEVEL_PDE], 4, entry_memtype[BX_LEVEL_PDE], BX_WRITE, BX_PDE_ACCESS, (Bit8u*)(&entry[BX_LEVEL_PDE]));
     }
   }
@@ -1267,12 +1417,58 @@ void BX_CPU_C::update_access_dirty(bx_phy_address *entry_addr, Bit32u *entry, Bx
   // Update A/D bits if needed
   if (!(entry[leaf] & 0x20) || (write && !(entry[leaf] & 0x40))) {
     entry[leaf] |= (0x20 | (write<<6)); // Update A and possibly D bits
-    access_write_physical(entry_addr[leaf], 4, &entry[leaf]);
+    write_paging_entry_bits(entry_addr[leaf], 4, &entry[leaf], 0x20 | (write<<6));
     BX_NOTIFY_PHY_MEMORY_ACCESS(entry_addr[leaf], 4, entry_memtype[leaf], BX_WRITE, (BX_PTE_ACCESS + leaf), (Bit8u*)(&entry[leaf]));
   }
 }
 
+// Write back paging structure entry with the A/D bits updated. In parallel
+// SMP mode another CPU might have modified the entry since it was read by
+// the page walk, so only the new bits are set using host atomic operation.
+void BX_CPU_C::write_paging_entry_bits(bx_phy_address entry_addr, unsigned len, void *entry, Bit64u bits)
+{
+#if BX_SMP_ATOMIC_RMW
+  if (bx_smp_parallel) {
+    Bit8u *hostPage = (Bit8u *) getHostMemAddr(PPFOf(entry_addr), BX_WRITE);
+    if (hostPage) {
+      Bit8u *hostAddr = hostPage + PAGE_OFFSET(entry_addr);
+      if (len == 8)
+        BX_ATOMIC_OR64((Bit64u *) hostAddr, bits);
+      else
+        BX_ATOMIC_OR32((Bit32u *) hostAddr, (Bit32u) bits);
+      pageWriteStampTable.decWriteStamp(entry_addr, len);
+      return;
+    }
+  }
+#endif
+
+  access_write_physical(entry_addr, len, entry);
+}
+
 // Translate a linear address to a physical address
+// The large page TLB caches the page walk result only. It can't be used
+// when the page walk does checks not captured by the access type: shadow
+// stack and protection keys checks, and guest physical address translation
+// which is done for every 4K page.
+bool BX_CPU_C::large_page_tlb_allowed(unsigned rw)
+{
+#if BX_SUPPORT_CET
+  if (rw & 4) return false;
+#endif
+#if BX_SUPPORT_PKEYS
+  if (BX_CPU_THIS_PTR cr4.get_PKE() || BX_CPU_THIS_PTR cr4.get_PKS()) return false;
+#endif
+#if BX_SUPPORT_VMX >= 2
+  if (BX_CPU_THIS_PTR in_vmx_guest && SECONDARY_VMEXEC_CONTROL(VMX_VM_EXEC_CTRL3_EPT_ENABLE))
+    return false;
+#endif
+#if BX_SUPPORT_SVM
+  if (BX_CPU_THIS_PTR in_svm_guest && SVM_NESTED_PAGING_ENABLED)
+    return false;
+#endif
+  return true;
+}
+
 bx_phy_address BX_CPU_C::translate_linear(bx_TLB_entry *tlbEntry, bx_address laddr, unsigned user, unsigned rw)
 {
 #if BX_SUPPORT_X86_64
@@ -1326,6 +1522,51 @@ bx_phy_address BX_CPU_C::translate_linear(bx_TLB_entry *tlbEntry, bx_address lad
   if (isWrite)
     INC_TLB_STAT(tlbWriteMisses);
 
+  // The second level TLB might still keep the translation evicted from
+  // the first level TLB, bring it back.
+  bx_TLB_entry *stlbEntry = BX_CPU_THIS_PTR STLB.lookup(lpf, isExecute, BX_CPU_THIS_PTR tlb_ctx);
+  if (stlbEntry) {
+    bool accessOK;
+    if (isExecute) {
+      accessOK = (stlbEntry->accessBits & (1 << user)) != 0;
+    }
+    else {
+#if BX_SUPPORT_PKEYS
+      if (isWrite)
+        accessOK = (stlbEntry->accessBits & (1 << (isShadowStack | (isWrite<<1) | user)) & BX_CPU_THIS_PTR wr_pkey[stlbEntry->pkey]) != 0;
+      else
+        accessOK = (stlbEntry->accessBits & (1 << (isShadowStack | user)) & BX_CPU_THIS_PTR rd_pkey[stlbEntry->pkey]) != 0;
+#else
+      accessOK = (stlbEntry->accessBits & (1 << (isShadowStack | (isWrite<<1) | user))) != 0;
+#endif
+    }
+
+    if (accessOK) {
+      INC_TLB_STAT(tlbSecondLevelHits);
+
+      bx_TLB_entry victim = *tlbEntry;
+      *tlbEntry = *stlbEntry;
+      tlbEntry->accessBits &= ~TLB_CodeEntry;
+      stlbEntry->invalidate();
+      if (victim.valid())
+        BX_CPU_THIS_PTR STLB.insert(&victim, isExecute, BX_CPU_THIS_PTR tlb_ctx);
+
+#if BX_CPU_LEVEL >= 5
+      if (tlbEntry->lpf_mask > 0xfff) {
+        if (isExecute)
+          BX_CPU_THIS_PTR ITLB.split_large = true;
+        else
+          BX_CPU_THIS_PTR DTLB.split_large = true;
+      }
+#endif
+
+      return tlbEntry->ppf | poffset;
+    }
+
+    // not enough access rights cached, re-walk the page tables
+    stlbEntry->invalidate();
+  }
+
   Bit32u lpf_mask = 0xfff; // 4K pages
   Bit32u combined_access = BX_COMBINED_ACCESS_WRITE | BX_COMBINED_ACCESS_USER;
 #if BX_SUPPORT_X86_64
@@ -1334,27 +1575,50 @@ bx_phy_address BX_CPU_C::translate_linear(bx_TLB_entry *tlbEntry, bx_address lad
 
   if(BX_CPU_THIS_PTR cr0.get_PG())
   {
-    BX_DEBUG(("page walk for%s address 0x" FMT_LIN_ADDRX, isShadowStack ? " shadow stack" : "", laddr));
+    bool useLargeTLB = large_page_tlb_allowed(rw);
+    bx_large_TLB_entry *ltlbEntry = useLargeTLB ? BX_CPU_THIS_PTR LTLB.lookup(laddr, rw, user, BX_CPU_THIS_PTR tlb_ctx) : NULL;
+
+    if (ltlbEntry) {
+      // the page walk for the large page was already done
+      INC_TLB_STAT(tlbLargePageHits);
+
+      lpf_mask = ltlbEntry->lpf_mask;
+      combined_access = ltlbEntry->combined_access;
+      paddress = ltlbEntry->ppf | (laddr & lpf_mask);
+    }
+    else {
+      BX_DEBUG(("page walk for%s address 0x" FMT_LIN_ADDRX, isShadowStack ? " shadow stack" : "", laddr));
 
 #if BX_CPU_LEVEL >= 6
 #if BX_SUPPORT_X86_64
-    if (long_mode())
-      paddress = translate_linear_long_mode(laddr, lpf_mask, pkey, user, rw);
-    else
-#endif
-      if (BX_CPU_THIS_PTR cr4.get_PAE())
-        paddress = translate_linear_PAE(laddr, lpf_mask, user, rw);
+      if (long_mode())
+        paddress = translate_linear_long_mode(laddr, lpf_mask, pkey, user, rw);
       else
+#endif
+        if (BX_CPU_THIS_PTR cr4.get_PAE())
+          paddress = translate_linear_PAE(laddr, lpf_mask, user, rw);
+        else
 #endif 
-        paddress = translate_linear_legacy(laddr, lpf_mask, user, rw);
+          paddress = translate_linear_legacy(laddr, lpf_mask, user, rw);
 
-    // translate_linear functions return combined U/S, R/W bits, Global Page bit
-    // and also effective page tables memory type in lower 12 bits of the physical address.
-    // Bit 1 - R/W bit
-    // Bit 2 - U/S bit
-    // Bit 9,10,11 - Effective Memory Table from page tables
-    combined_access = paddress & lpf_mask;
-    paddress = (paddress & ~((Bit64u) lpf_mask)) | (laddr & lpf_mask);
+      // translate_linear functions return combined U/S, R/W bits, Global Page bit
+      // and also effective page tables memory type in lower 12 bits of the physical address.
+      // Bit 1 - R/W bit
+      // Bit 2 - U/S bit
+      // Bit 9,10,11 - Effective Memory Table from page tables
+      combined_access = paddress & lpf_mask;
+      paddress = (paddress & ~((Bit64u) lpf_mask)) | (laddr & lpf_mask);
+
+      if (lpf_mask > 0xfff && useLargeTLB) {
+#if BX_CPU_LEVEL >= 6
+        // SMAP check depends on EFLAGS.AC, always walk the page tables
+        // for supervisor data accesses to user pages
+        if (! (BX_CPU_THIS_PTR cr4.get_SMAP() && ! user && ! isExecute && (combined_access & BX_COMBINED_ACCESS_USER)))
+#endif
+          BX_CPU_THIS_PTR LTLB.insert(laddr, paddress, lpf_mask, combined_access,
+              (combined_access & BX_COMBINED_GLOBAL_PAGE) != 0 && BX_CPU_THIS_PTR cr4.get_PGE(), rw, user, BX_CPU_THIS_PTR tlb_ctx);
+      }
+    }
 
 #if BX_CPU_LEVEL >= 5
     if (lpf_mask > 0xfff) {
@@ -1390,6 +1654,10 @@ bx_phy_address BX_CPU_C::translate_linear(bx_TLB_entry *tlbEntry, bx_address lad
   paddress = A20ADDR(paddress);
   ppf = PPFOf(paddress);
 
+  // the replaced translation moves to the second level TLB
+  if (tlbEntry->valid() && TLB_LPFOf(tlbEntry->lpf) != lpf)
+    BX_CPU_THIS_PTR STLB.insert(tlbEntry, isExecute, BX_CPU_THIS_PTR tlb_ctx);
+
   // direct memory access is NOT allowed by default
   tlbEntry->lpf = lpf | TLB_NoHostPtr;
   tlbEntry->lpf_mask = lpf_mask;
@@ -1426,10 +1694,15 @@ bx_phy_address BX_CPU_C::translate_linear(bx_TLB_entry *tlbEntry, bx_address lad
         && ! (BX_CPU_THIS_PTR in_svm_guest && SVM_NESTED_PAGING_ENABLED)
 #endif
     ) {
-    if (isExecute)
+    if (isExecute) {
       tlbEntry->accessBits |= TLB_UserExecuteOK;
-    else
-      tlbEntry->accessBits |= TLB_UserReadOK | TLB_UserWriteOK;
+    }
+    else {
+      // the host page might be read-only (ROM or shared memory block)
+      tlbEntry->accessBits |= TLB_UserReadOK;
+      if (isWrite)
+        tlbEntry->accessBits |= TLB_UserWriteOK;
+    }
   }
   else {
     if ((combined_access & BX_COMBINED_ACCESS_USER) != 0) {
@@ -1474,7 +1747,8 @@ bx_phy_address BX_CPU_C::translate_linear(bx_TLB_entry *tlbEntry, bx_address lad
   }
 
 #if BX_CPU_LEVEL >= 6
-  if (combined_access & BX_COMBINED_GLOBAL_PAGE) // Global bit
+  // global translations are shared between PCIDs, only when CR4.PGE is set
+  if ((combined_access & BX_COMBINED_GLOBAL_PAGE) && BX_CPU_THIS_PTR cr4.get_PGE()) // Global bit
     tlbEntry->accessBits |= TLB_GlobalPage;
 #endif
 
@@ -2082,7 +2356,7 @@ void BX_CPU_C::update_ept_access_dirty(bx_phy_address *entry_addr, Bit64u *entry
   for (unsigned level=BX_LEVEL_PML4; level > leaf; level--) {
     if (!(entry[level] & 0x100)) {
       entry[level] |= 0x100;
-      access_write_physical(entry_addr[level], 8, &entry[level]);
+      write_paging_entry_bits(entry_addr[level], 8, &entry[level], 0x100);
       BX_NOTIFY_PHY_MEMORY_ACCESS(entry_addr[level], 8, MEMTYPE(eptptr_memtype), BX_WRITE, (BX_EPT_PTE_ACCESS + level), (Bit8u*)(&entry[level]));
     }
   }
@@ -2090,7 +2364,7 @@ void BX_CPU_C::update_ept_access_dirty(bx_phy_address *entry_addr, Bit64u *entry
   // Update A/D bits if needed
   if (!(entry[leaf] & 0x100) || (write && !(entry[leaf] & 0x200))) {
     entry[leaf] |= (0x100 | (write<<9)); // Update A and possibly D bits
-    access_write_physical(entry_addr[leaf], 8, &entry[leaf]);
+    write_paging_entry_bits(entry_addr[leaf], 8, &entry[leaf], 0x100 | (write<<9));
     BX_NOTIFY_PHY_MEMORY_ACCESS(entry_addr[leaf], 8, MEMTYPE(eptptr_memtype), BX_WRITE, (BX_EPT_PTE_ACCESS + leaf), (Bit8u*)(&entry[leaf]));
   }
 }
@@ -2653,8 +2927,7 @@ bx_hostpageaddr_t BX_CPU_C::getHostMemAddr(bx_phy_address paddr, unsigned rw)
   return (bx_hostpageaddr_t) BX_MEM(0)->getHostMemAddr(BX_CPU_THIS, paddr, rw);
 }
 
-#if BX_LARGE_RAMFILE
-bool BX_CPU_C::check_addr_in_tlb_buffers(const Bit8u *addr, const Bit8u *end)
+bool BX_CPU_C::check_addr_in_vmcs_buffers(const Bit8u *addr, const Bit8u *end)
 {
 #if BX_SUPPORT_VMX
   if (BX_CPU_THIS_PTR vmcshostptr) {
@@ -2670,7 +2943,15 @@ bool BX_CPU_C::check_addr_in_tlb_buffers(const Bit8u *addr, const Bit8u *end)
   }
 #endif
 
-  for (unsigned tlb_entry_num=0; tlb_entry_num < BX_DTLB_SIZE; tlb_entry_num++) {
+  return false;
+}
+
+#if BX_LARGE_RAMFILE
+bool BX_CPU_C::check_addr_in_tlb_buffers(const Bit8u *addr, const Bit8u *end)
+{
+  if (check_addr_in_vmcs_buffers(addr, end)) return true;
+
+  for (unsigned tlb_entry_num=0; tlb_entry_num < BX_CPU_THIS_PTR DTLB.size; tlb_entry_num++) {
     bx_TLB_entry *tlbEntry = &BX_CPU_THIS_PTR DTLB.entry[tlb_entry_num];
     if (tlbEntry->valid()) {
       if ((tlbEntry->hostPageAddr >= (const bx_hostpageaddr_t)addr) &&
@@ -2679,7 +2960,7 @@ bool BX_CPU_C::check_addr_in_tlb_buffers(const Bit8u *addr, const Bit8u *end)
     }
   }
 
-  for (unsigned tlb_entry_num=0; tlb_entry_num < BX_ITLB_SIZE; tlb_entry_num++) {
+  for (unsigned tlb_entry_num=0; tlb_entry_num < BX_CPU_THIS_PTR ITLB.size; tlb_entry_num++) {
     bx_TLB_entry *tlbEntry = &BX_CPU_THIS_PTR ITLB.entry[tlb_entry_num];
     if (tlbEntry->valid()) {
       if ((tlbEntry->hostPageAddr >= (const bx_hostpageaddr_t)addr) &&
@@ -2688,6 +2969,15 @@ bool BX_CPU_C::check_addr_in_tlb_buffers(const Bit8u *addr, const Bit8u *end)
     }
   }
 
+  for (unsigned tlb_entry_num=0; tlb_entry_num < BX_CPU_THIS_PTR STLB.size; tlb_entry_num++) {
+    bx_TLB_entry *tlbEntry = &BX_CPU_THIS_PTR STLB.entry[tlb_entry_num];
+    if (tlbEntry->valid()) {
+      if ((tlbEntry->hostPageAddr >= (const bx_hostpageaddr_t)addr) &&
+          (tlbEntry->hostPageAddr  < (const bx_hostpageaddr_t)end))
+        return true;
+    }
+  }
+
   return false;
 }
 #endif
@@ -82,6 +82,14 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::PAUSE(bxInstruction_c *i)
   }
 #endif
 
+#if BX_SUPPORT_SMP
+  // spin-wait loop, let the other processors run
+  if (BX_SMP_PROCESSORS > 1 && ! bx_smp_parallel) {
+    BX_CPU_THIS_PTR smp_yield_hint = 1;
+    BX_CPU_THIS_PTR async_event |= BX_ASYNC_EVENT_STOP_TRACE;
+  }
+#endif
+
   BX_NEXT_INSTR(i);
 }
 
@@ -530,9 +538,12 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::BxNoEVEX(bxInstruction_c *i)
 
 #endif
 
-void BX_CPU_C::handleCpuContextChange(void)
+// if flushTLB is false the caller is responsible to switch the TLBs to the
+// new translation context
+void BX_CPU_C::handleCpuContextChange(bool flushTLB)
 {
-  TLB_flush();
+  if (flushTLB)
+    TLB_flush();
 
   invalidate_prefetch_q();
   invalidate_stack_cache();
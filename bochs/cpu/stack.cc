@@ -146,12 +146,15 @@ void BX_CPP_AttrRegparmN(2) BX_CPU_C::stack_write_byte(bx_address offset, Bit8u
     BX_NOTIFY_LIN_MEMORY_ACCESS(get_laddr(BX_SEG_REG_SS, offset), pAddr, 1,
                                 MEMTYPE(BX_CPU_THIS_PTR espPageMemtype), BX_WRITE, (Bit8u*) &data);
 
+    *hostPageAddr = data;
+
 #if BX_SUPPORT_SMP == 0
-    if (BX_CPU_THIS_PTR espPageFineGranularityMapping)
+    // no traces in the page, only the incremental save needs to see the write
+    if (! BX_CPU_THIS_PTR espPageFineGranularityMapping)
+      pageWriteStampTable.markDirtyPage(pageWriteStampTable.hash(pAddr));
+    else
 #endif
       pageWriteStampTable.decWriteStamp(pAddr, 1);
-
-    *hostPageAddr = data;
   }
   else {
     write_virtual_byte(BX_SEG_REG_SS, offset, data);
@@ -179,12 +182,14 @@ void BX_CPP_AttrRegparmN(2) BX_CPU_C::stack_write_word(bx_address offset, Bit16u
     BX_NOTIFY_LIN_MEMORY_ACCESS(get_laddr(BX_SEG_REG_SS, offset), pAddr, 2,
                                 MEMTYPE(BX_CPU_THIS_PTR espPageMemtype), BX_WRITE, (Bit8u*) &data);
 
+    WriteHostWordToLittleEndian(hostPageAddr, data);
+
 #if BX_SUPPORT_SMP == 0
-    if (BX_CPU_THIS_PTR espPageFineGranularityMapping)
+    if (! BX_CPU_THIS_PTR espPageFineGranularityMapping)
+      pageWriteStampTable.markDirtyPage(pageWriteStampTable.hash(pAddr));
+    else
 #endif
       pageWriteStampTable.decWriteStamp(pAddr, 2);
-
-    WriteHostWordToLittleEndian(hostPageAddr, data);
   }
   else {
     write_virtual_word(BX_SEG_REG_SS, offset, data);
@@ -212,12 +217,14 @@ void BX_CPP_AttrRegparmN(2) BX_CPU_C::stack_write_dword(bx_address offset, Bit32
     BX_NOTIFY_LIN_MEMORY_ACCESS(get_laddr(BX_SEG_REG_SS, offset), pAddr, 4,
                                 MEMTYPE(BX_CPU_THIS_PTR espPageMemtype), BX_WRITE, (Bit8u*) &data);
 
+    WriteHostDWordToLittleEndian(hostPageAddr, data);
+
 #if BX_SUPPORT_SMP == 0
-    if (BX_CPU_THIS_PTR espPageFineGranularityMapping)
+    if (! BX_CPU_THIS_PTR espPageFineGranularityMapping)
+      pageWriteStampTable.markDirtyPage(pageWriteStampTable.hash(pAddr));
+    else
 #endif
       pageWriteStampTable.decWriteStamp(pAddr, 4);
-
-    WriteHostDWordToLittleEndian(hostPageAddr, data);
   }
   else {
     write_virtual_dword(BX_SEG_REG_SS, offset, data);
@@ -245,12 +252,14 @@ void BX_CPP_AttrRegparmN(2) BX_CPU_C::stack_write_qword(bx_address offset, Bit64
     BX_NOTIFY_LIN_MEMORY_ACCESS(get_laddr(BX_SEG_REG_SS, offset), pAddr, 8,
                                 MEMTYPE(BX_CPU_THIS_PTR espPageMemtype), BX_WRITE, (Bit8u*) &data);
 
+    WriteHostQWordToLittleEndian(hostPageAddr, data);
+
 #if BX_SUPPORT_SMP == 0
-    if (BX_CPU_THIS_PTR espPageFineGranularityMapping)
+    if (! BX_CPU_THIS_PTR espPageFineGranularityMapping)
+      pageWriteStampTable.markDirtyPage(pageWriteStampTable.hash(pAddr));
+    else
 #endif
       pageWriteStampTable.decWriteStamp(pAddr, 8);
-
-    WriteHostQWordToLittleEndian(hostPageAddr, data);
   }
   else {
     write_virtual_qword(BX_SEG_REG_SS, offset, data);
@@ -231,47 +231,93 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::MOVSW16_YwXw(bxInstruction_c *i)
 /* 16 bit opsize mode, 32 bit address size */
 void BX_CPP_AttrRegparmN(1) BX_CPU_C::MOVSW32_YwXw(bxInstruction_c *i)
 {
+  Bit32s increment = 0;
+
   Bit32u esi = ESI;
   Bit32u edi = EDI;
 
-  Bit16u temp16 = read_virtual_word(i->seg(), esi);
-  write_virtual_word(BX_SEG_REG_ES, edi, temp16);
+#if (BX_SUPPORT_REPEAT_SPEEDUPS) && (BX_DEBUGGER == 0)
+  /* If conditions are right, we can transfer IO to physical memory
+   * in a batch, rather than one instruction at a time.
+   */
+  if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
+  {
+    Bit32u byteCount = FastRepMOVSB(i->seg(), esi, BX_SEG_REG_ES, edi, ((Bit64u) ECX)*2, 2);
+    if (byteCount) {
+      Bit32u wordCount = byteCount >> 1;
 
-  if (BX_CPU_THIS_PTR get_DF()) {
-    esi -= 2;
-    edi -= 2;
+      // Decrement the ticks count by the number of iterations, minus
+      // one, since the main cpu loop will decrement one.  Also,
+      // the count is predecremented before examined, so definitely
+      // don't roll it under zero.
+      BX_TICKN(wordCount-1);
+
+      // Decrement eCX. Note, the main loop will decrement 1 also, so
+      // decrement by one less than expected, like the case above.
+      RCX = ECX - (wordCount-1);
+
+      increment = byteCount;
+    }
   }
-  else {
-    esi += 2;
-    edi += 2;
+
+  if (increment == 0)
+#endif
+  {
+    Bit16u temp16 = read_virtual_word(i->seg(), esi);
+    write_virtual_word(BX_SEG_REG_ES, edi, temp16);
+
+    increment = BX_CPU_THIS_PTR get_DF() ? -2 : 2;
   }
 
   // zero extension of RSI/RDI
-  RSI = esi;
-  RDI = edi;
+  RSI = esi + increment;
+  RDI = edi + increment;
 }
 
 #if BX_SUPPORT_X86_64
 /* 16 bit opsize mode, 64 bit address size */
 void BX_CPP_AttrRegparmN(1) BX_CPU_C::MOVSW64_YwXw(bxInstruction_c *i)
 {
+  Bit32s increment = 0;
+
   Bit64u rsi = RSI;
   Bit64u rdi = RDI;
 
-  Bit16u temp16 = read_linear_word(i->seg(), get_laddr64(i->seg(), rsi));
-  write_linear_word(BX_SEG_REG_ES, rdi, temp16);
+#if (BX_SUPPORT_REPEAT_SPEEDUPS) && (BX_DEBUGGER == 0)
+  /* If conditions are right, we can transfer IO to physical memory
+   * in a batch, rather than one instruction at a time.
+   */
+  if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
+  {
+    Bit32u byteCount = FastRepMOVSB(get_laddr64(i->seg(), rsi), rdi, ((Bit64u) ECX)*2, 2);
+    if (byteCount) {
+      Bit32u wordCount = byteCount >> 1;
 
-  if (BX_CPU_THIS_PTR get_DF()) {
-    rsi -= 2;
-    rdi -= 2;
+      // Decrement the ticks count by the number of iterations, minus
+      // one, since the main cpu loop will decrement one.  Also,
+      // the count is predecremented before examined, so definitely
+      // don't roll it under zero.
+      BX_TICKN(wordCount-1);
+
+      // Decrement RCX. Note, the main loop will decrement 1 also, so
+      // decrement by one less than expected, like the case above.
+      RCX -= (wordCount-1);
+
+      increment = byteCount;
+    }
   }
-  else {
-    rsi += 2;
-    rdi += 2;
+
+  if (increment == 0)
+#endif
+  {
+    Bit16u temp16 = read_linear_word(i->seg(), get_laddr64(i->seg(), rsi));
+    write_linear_word(BX_SEG_REG_ES, rdi, temp16);
+
+    increment = BX_CPU_THIS_PTR get_DF() ? -2 : 2;
   }
 
-  RSI = rsi;
-  RDI = rdi;
+  RSI = rsi + increment;
+  RDI = rdi + increment;
 }
 #endif
 
@@ -311,7 +357,7 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::MOVSD32_YdXd(bxInstruction_c *i)
    */
   if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
   {
-    Bit32u byteCount = FastRepMOVSB(i->seg(), esi, BX_SEG_REG_ES, edi, ECX*4, 4);
+    Bit32u byteCount = FastRepMOVSB(i->seg(), esi, BX_SEG_REG_ES, edi, ((Bit64u) ECX)*4, 4);
     if (byteCount) {
       Bit32u dwordCount = byteCount >> 2;
 
@@ -359,7 +405,7 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::MOVSD64_YdXd(bxInstruction_c *i)
    */
   if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
   {
-    Bit32u byteCount = FastRepMOVSB(get_laddr64(i->seg(), rsi), rdi, ECX*4, 4);
+    Bit32u byteCount = FastRepMOVSB(get_laddr64(i->seg(), rsi), rdi, ((Bit64u) ECX)*4, 4);
     if (byteCount) {
       Bit32u dwordCount = byteCount >> 2;
 
@@ -427,7 +473,7 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::MOVSQ64_YqXq(bxInstruction_c *i)
    */
   if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
   {
-    Bit32u byteCount = FastRepMOVSB(get_laddr64(i->seg(), rsi), rdi, ECX*8, 8);
+    Bit32u byteCount = FastRepMOVSB(get_laddr64(i->seg(), rsi), rdi, ((Bit64u) ECX)*8, 8);
     if (byteCount) {
       Bit32u qwordCount = byteCount >> 3;
 
@@ -580,6 +626,23 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMPSB32_XbYb(bxInstruction_c *i)
   Bit32u esi = ESI;
   Bit32u edi = EDI;
 
+#if (BX_SUPPORT_REPEAT_SPEEDUPS) && (BX_DEBUGGER == 0)
+  /* If conditions are right, skip the bytes which do not terminate the
+   * repeat loop in a batch. The last byte is compared below and sets the
+   * flags, at least one iteration is left for it.
+   */
+  if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
+  {
+    Bit32u byteCount = FastRepCMPSB(i->seg(), esi, BX_SEG_REG_ES, edi, ECX-1, i->lockRepUsedValue() == 3);
+    if (byteCount) {
+      BX_TICKN(byteCount);
+      RCX = ECX - byteCount;
+      esi += byteCount;
+      edi += byteCount;
+    }
+  }
+#endif
+
   op1_8 = read_virtual_byte(i->seg(), esi);
   op2_8 = read_virtual_byte(BX_SEG_REG_ES, edi);
 
@@ -610,6 +673,23 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::CMPSB64_XbYb(bxInstruction_c *i)
   Bit64u rsi = RSI;
   Bit64u rdi = RDI;
 
+#if (BX_SUPPORT_REPEAT_SPEEDUPS) && (BX_DEBUGGER == 0)
+  /* If conditions are right, skip the bytes which do not terminate the
+   * repeat loop in a batch. The last byte is compared below and sets the
+   * flags, at least one iteration is left for it.
+   */
+  if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
+  {
+    Bit32u byteCount = FastRepCMPSB(get_laddr64(i->seg(), rsi), rdi, ECX-1, i->lockRepUsedValue() == 3);
+    if (byteCount) {
+      BX_TICKN(byteCount);
+      RCX -= byteCount;
+      rsi += byteCount;
+      rdi += byteCount;
+    }
+  }
+#endif
+
   op1_8 = read_linear_byte(i->seg(), get_laddr64(i->seg(), rsi));
   op2_8 = read_linear_byte(BX_SEG_REG_ES, rdi);
 
@@ -974,6 +1054,22 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::SCASB32_ALYb(bxInstruction_c *i)
 
   Bit32u edi = EDI;
 
+#if (BX_SUPPORT_REPEAT_SPEEDUPS) && (BX_DEBUGGER == 0)
+  /* If conditions are right, skip the bytes which do not terminate the
+   * repeat loop in a batch. The last byte is compared below and sets the
+   * flags, at least one iteration is left for it.
+   */
+  if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
+  {
+    Bit32u byteCount = FastRepSCASB(BX_SEG_REG_ES, edi, op1_8, ECX-1, i->lockRepUsedValue() == 3);
+    if (byteCount) {
+      BX_TICKN(byteCount);
+      RCX = ECX - byteCount;
+      edi += byteCount;
+    }
+  }
+#endif
+
   op2_8 = read_virtual_byte(BX_SEG_REG_ES, edi);
   diff_8 = op1_8 - op2_8;
 
@@ -998,6 +1094,22 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::SCASB64_ALYb(bxInstruction_c *i)
 
   Bit64u rdi = RDI;
 
+#if (BX_SUPPORT_REPEAT_SPEEDUPS) && (BX_DEBUGGER == 0)
+  /* If conditions are right, skip the bytes which do not terminate the
+   * repeat loop in a batch. The last byte is compared below and sets the
+   * flags, at least one iteration is left for it.
+   */
+  if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
+  {
+    Bit32u byteCount = FastRepSCASB(rdi, op1_8, ECX-1, i->lockRepUsedValue() == 3);
+    if (byteCount) {
+      BX_TICKN(byteCount);
+      RCX -= byteCount;
+      rdi += byteCount;
+    }
+  }
+#endif
+
   op2_8 = read_virtual_byte(BX_SEG_REG_ES, rdi);
 
   diff_8 = op1_8 - op2_8;
@@ -1351,7 +1463,7 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::STOSB64_YbAL(bxInstruction_c *i)
    */
   if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
   {
-    Bit32u byteCount = FastRepSTOSB(rdi, AL, ECX);
+    Bit32u byteCount = FastRepSTOS(rdi, AL, 1, ECX);
     if (byteCount) {
       // Decrement the ticks count by the number of iterations, minus
       // one, since the main cpu loop will decrement one.  Also,
@@ -1399,19 +1511,41 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::STOSW16_YwAX(bxInstruction_c *i)
 /* 16 bit opsize mode, 32 bit address size */
 void BX_CPP_AttrRegparmN(1) BX_CPU_C::STOSW32_YwAX(bxInstruction_c *i)
 {
+  Bit32s increment = 0;
   Bit32u edi = EDI;
 
-  write_virtual_word(BX_SEG_REG_ES, edi, AX);
+#if (BX_SUPPORT_REPEAT_SPEEDUPS) && (BX_DEBUGGER == 0)
+  /* If conditions are right, we can transfer IO to physical memory
+   * in a batch, rather than one instruction at a time.
+   */
+  if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
+  {
+    Bit32u count = FastRepSTOSW(BX_SEG_REG_ES, edi, AX, ECX);
+    if (count) {
+      // Decrement the ticks count by the number of iterations, minus
+      // one, since the main cpu loop will decrement one.  Also,
+      // the count is predecremented before examined, so definitely
+      // don't roll it under zero.
+      BX_TICKN(count-1);
 
-  if (BX_CPU_THIS_PTR get_DF()) {
-    edi -= 2;
+      // Decrement eCX.  Note, the main loop will decrement 1 also, so
+      // decrement by one less than expected, like the case above.
+      RCX = ECX - (count-1);
+
+      increment = count * 2;
+    }
   }
-  else {
-    edi += 2;
+
+  if (increment == 0)
+#endif
+  {
+    write_virtual_word(BX_SEG_REG_ES, edi, AX);
+
+    increment = BX_CPU_THIS_PTR get_DF() ? -2 : 2;
   }
 
   // zero extension of RDI
-  RDI = edi;
+  RDI = edi + increment;
 }
 
 #if BX_SUPPORT_X86_64
@@ -1419,17 +1553,39 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::STOSW32_YwAX(bxInstruction_c *i)
 void BX_CPP_AttrRegparmN(1) BX_CPU_C::STOSW64_YwAX(bxInstruction_c *i)
 {
   Bit64u rdi = RDI;
+  Bit32s increment = 0;
+
+#if (BX_SUPPORT_REPEAT_SPEEDUPS) && (BX_DEBUGGER == 0)
+  /* If conditions are right, we can transfer IO to physical memory
+   * in a batch, rather than one instruction at a time.
+   */
+  if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
+  {
+    Bit32u count = FastRepSTOS(rdi, AX, 2, ECX);
+    if (count) {
+      // Decrement the ticks count by the number of iterations, minus
+      // one, since the main cpu loop will decrement one.  Also,
+      // the count is predecremented before examined, so definitely
+      // don't roll it under zero.
+      BX_TICKN(count-1);
 
-  write_linear_word(BX_SEG_REG_ES, rdi, AX);
+      // Decrement RCX.  Note, the main loop will decrement 1 also, so
+      // decrement by one less than expected, like the case above.
+      RCX -= (count-1);
 
-  if (BX_CPU_THIS_PTR get_DF()) {
-    rdi -= 2;
+      increment = count * 2;
+    }
   }
-  else {
-    rdi += 2;
+
+  if (increment == 0)
+#endif
+  {
+    write_linear_word(BX_SEG_REG_ES, rdi, AX);
+
+    increment = BX_CPU_THIS_PTR get_DF() ? -2 : 2;
   }
 
-  RDI = rdi;
+  RDI = rdi + increment;
 }
 #endif
 
@@ -1453,19 +1609,41 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::STOSD16_YdEAX(bxInstruction_c *i)
 /* 32 bit opsize mode, 32 bit address size */
 void BX_CPP_AttrRegparmN(1) BX_CPU_C::STOSD32_YdEAX(bxInstruction_c *i)
 {
+  Bit32s increment = 0;
   Bit32u edi = EDI;
 
-  write_virtual_dword(BX_SEG_REG_ES, edi, EAX);
+#if (BX_SUPPORT_REPEAT_SPEEDUPS) && (BX_DEBUGGER == 0)
+  /* If conditions are right, we can transfer IO to physical memory
+   * in a batch, rather than one instruction at a time.
+   */
+  if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
+  {
+    Bit32u count = FastRepSTOSD(BX_SEG_REG_ES, edi, EAX, ECX);
+    if (count) {
+      // Decrement the ticks count by the number of iterations, minus
+      // one, since the main cpu loop will decrement one.  Also,
+      // the count is predecremented before examined, so definitely
+      // don't roll it under zero.
+      BX_TICKN(count-1);
 
-  if (BX_CPU_THIS_PTR get_DF()) {
-    edi -= 4;
+      // Decrement eCX.  Note, the main loop will decrement 1 also, so
+      // decrement by one less than expected, like the case above.
+      RCX = ECX - (count-1);
+
+      increment = count * 4;
+    }
   }
-  else {
-    edi += 4;
+
+  if (increment == 0)
+#endif
+  {
+    write_virtual_dword(BX_SEG_REG_ES, edi, EAX);
+
+    increment = BX_CPU_THIS_PTR get_DF() ? -4 : 4;
   }
 
   // zero extension of RDI
-  RDI = edi;
+  RDI = edi + increment;
 }
 
 #if BX_SUPPORT_X86_64
@@ -1474,17 +1652,39 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::STOSD32_YdEAX(bxInstruction_c *i)
 void BX_CPP_AttrRegparmN(1) BX_CPU_C::STOSD64_YdEAX(bxInstruction_c *i)
 {
   Bit64u rdi = RDI;
+  Bit32s increment = 0;
+
+#if (BX_SUPPORT_REPEAT_SPEEDUPS) && (BX_DEBUGGER == 0)
+  /* If conditions are right, we can transfer IO to physical memory
+   * in a batch, rather than one instruction at a time.
+   */
+  if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
+  {
+    Bit32u count = FastRepSTOS(rdi, EAX, 4, ECX);
+    if (count) {
+      // Decrement the ticks count by the number of iterations, minus
+      // one, since the main cpu loop will decrement one.  Also,
+      // the count is predecremented before examined, so definitely
+      // don't roll it under zero.
+      BX_TICKN(count-1);
 
-  write_linear_dword(BX_SEG_REG_ES, rdi, EAX);
+      // Decrement RCX.  Note, the main loop will decrement 1 also, so
+      // decrement by one less than expected, like the case above.
+      RCX -= (count-1);
 
-  if (BX_CPU_THIS_PTR get_DF()) {
-    rdi -= 4;
+      increment = count * 4;
+    }
   }
-  else {
-    rdi += 4;
+
+  if (increment == 0)
+#endif
+  {
+    write_linear_dword(BX_SEG_REG_ES, rdi, EAX);
+
+    increment = BX_CPU_THIS_PTR get_DF() ? -4 : 4;
   }
 
-  RDI = rdi;
+  RDI = rdi + increment;
 }
 
 /* 64 bit opsize mode, 32 bit address size */
@@ -1509,17 +1709,39 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::STOSQ32_YqRAX(bxInstruction_c *i)
 void BX_CPP_AttrRegparmN(1) BX_CPU_C::STOSQ64_YqRAX(bxInstruction_c *i)
 {
   Bit64u rdi = RDI;
+  Bit32s increment = 0;
 
-  write_linear_qword(BX_SEG_REG_ES, rdi, RAX);
+#if (BX_SUPPORT_REPEAT_SPEEDUPS) && (BX_DEBUGGER == 0)
+  /* If conditions are right, we can transfer IO to physical memory
+   * in a batch, rather than one instruction at a time.
+   */
+  if (i->repUsedL() && !BX_CPU_THIS_PTR get_DF() && !BX_CPU_THIS_PTR async_event)
+  {
+    Bit32u count = FastRepSTOS(rdi, RAX, 8, ECX);
+    if (count) {
+      // Decrement the ticks count by the number of iterations, minus
+      // one, since the main cpu loop will decrement one.  Also,
+      // the count is predecremented before examined, so definitely
+      // don't roll it under zero.
+      BX_TICKN(count-1);
 
-  if (BX_CPU_THIS_PTR get_DF()) {
-    rdi -= 8;
+      // Decrement RCX.  Note, the main loop will decrement 1 also, so
+      // decrement by one less than expected, like the case above.
+      RCX -= (count-1);
+
+      increment = count * 8;
+    }
   }
-  else {
-    rdi += 8;
+
+  if (increment == 0)
+#endif
+  {
+    write_linear_qword(BX_SEG_REG_ES, rdi, RAX);
+
+    increment = BX_CPU_THIS_PTR get_DF() ? -8 : 8;
   }
 
-  RDI = rdi;
+  RDI = rdi + increment;
 }
 
 #endif
@@ -119,8 +119,8 @@ BX_CPP_INLINE void BX_CPU_C::vmcb_write8(unsigned offset, Bit8u val_8)
 
   if (BX_CPU_THIS_PTR vmcbhostptr) {
     Bit8u *hostAddr = (Bit8u*) (BX_CPU_THIS_PTR vmcbhostptr | offset);
-    pageWriteStampTable.decWriteStamp(pAddr, 1);
     *hostAddr = val_8;
+    pageWriteStampTable.decWriteStamp(pAddr, 1);
   }
   else {
     access_write_physical(pAddr, 1, (Bit8u*)(&val_8));
@@ -135,8 +135,8 @@ BX_CPP_INLINE void BX_CPU_C::vmcb_write16(unsigned offset, Bit16u val_16)
 
   if (BX_CPU_THIS_PTR vmcbhostptr) {
     Bit16u *hostAddr = (Bit16u*) (BX_CPU_THIS_PTR vmcbhostptr | offset);
-    pageWriteStampTable.decWriteStamp(pAddr, 2);
     WriteHostWordToLittleEndian(hostAddr, val_16);
+    pageWriteStampTable.decWriteStamp(pAddr, 2);
   }
   else {
     access_write_physical(pAddr, 2, (Bit8u*)(&val_16));
@@ -151,8 +151,8 @@ BX_CPP_INLINE void BX_CPU_C::vmcb_write32(unsigned offset, Bit32u val_32)
 
   if (BX_CPU_THIS_PTR vmcbhostptr) {
     Bit32u *hostAddr = (Bit32u*) (BX_CPU_THIS_PTR vmcbhostptr | offset);
-    pageWriteStampTable.decWriteStamp(pAddr, 4);
     WriteHostDWordToLittleEndian(hostAddr, val_32);
+    pageWriteStampTable.decWriteStamp(pAddr, 4);
   }
   else {
     access_write_physical(pAddr, 4, (Bit8u*)(&val_32));
@@ -167,8 +167,8 @@ BX_CPP_INLINE void BX_CPU_C::vmcb_write64(unsigned offset, Bit64u val_64)
 
   if (BX_CPU_THIS_PTR vmcbhostptr) {
     Bit64u *hostAddr = (Bit64u*) (BX_CPU_THIS_PTR vmcbhostptr | offset);
-    pageWriteStampTable.decWriteStamp(pAddr, 8);
     WriteHostQWordToLittleEndian(hostAddr, val_64);
+    pageWriteStampTable.decWriteStamp(pAddr, 8);
   }
   else {
     access_write_physical(pAddr, 8, (Bit8u*)(&val_64));
@@ -260,7 +260,11 @@ void BX_CPU_C::SvmExitLoadHostState(SVM_HOST_STATE *host)
 
   CPL = 0;
 
-  handleCpuContextChange();
+  // the guest translations stay in the TLBs tagged with the guest ASID, the
+  // host CR3 load invalidates the non-global host translations unless the
+  // host uses PCIDs
+  handleCpuContextChange(false);
+  TLB_switchContext(! BX_CPU_THIS_PTR cr4.get_PCIDE());
 
 #if BX_SUPPORT_MONITOR_MWAIT
   BX_CPU_THIS_PTR monitor.reset_monitor();
@@ -344,12 +348,14 @@ bool BX_CPU_C::SvmEnterLoadCheckControls(SVM_CONTROLS *ctrls)
     return 0;
   }
 
-  Bit32u guest_asid = vmcb_read32(SVM_CONTROL32_GUEST_ASID);
-  if (guest_asid == 0) {
+  ctrls->asid = vmcb_read32(SVM_CONTROL32_GUEST_ASID);
+  if (ctrls->asid == 0) {
     BX_ERROR(("VMRUN: attempt to run guest with host ASID !"));
     return 0;
   }
 
+  ctrls->tlb_control = vmcb_read8(SVM_CONTROL32_TLB_CONTROL);
+
   ctrls->v_tpr = vmcb_read8(SVM_CONTROL_VTPR);
   ctrls->v_intr_masking = vmcb_read8(SVM_CONTROL_VINTR_MASKING) & 0x1;
   ctrls->v_intr_vector = vmcb_read8(SVM_CONTROL_VINTR_VECTOR);
@@ -397,6 +403,26 @@ bool BX_CPU_C::SvmEnterLoadCheckControls(SVM_CONTROLS *ctrls)
   return 1;
 }
 
+void BX_CPU_C::SvmEnterSwitchTLB(SVM_CONTROLS *ctrls)
+{
+  // the guest translations are cached combined with the nested page tables,
+  // drop them all if the nested paging root is changed
+  Bit64u root = ctrls->nested_paging ? ctrls->ncr3 : 0;
+
+  if (ctrls->tlb_control == SVM_TLB_CONTROL_FLUSH_ALL || root != BX_CPU_THIS_PTR tlb_nested_root) {
+    BX_CPU_THIS_PTR tlb_nested_root = root;
+    TLB_flush();
+    return;
+  }
+
+  TLB_switchContext(false);
+
+  if (ctrls->tlb_control == SVM_TLB_CONTROL_FLUSH_ASID)
+    TLB_flushVPID(ctrls->asid, false);
+  else if (ctrls->tlb_control == SVM_TLB_CONTROL_FLUSH_ASID_NON_GLOBAL)
+    TLB_flushVPID(ctrls->asid, true);
+}
+
 bool BX_CPU_C::SvmEnterLoadCheckGuestState(void)
 {
   SVM_GUEST_STATE guest;
@@ -579,7 +605,8 @@ bool BX_CPU_C::SvmEnterLoadCheckGuestState(void)
   if (v_irq)
     signal_event(BX_EVENT_SVM_VIRQ_PENDING);
 
-  handleCpuContextChange();
+  // the TLBs are switched to the guest ASID by VMRUN
+  handleCpuContextChange(false);
 
 #if BX_SUPPORT_MONITOR_MWAIT
   BX_CPU_THIS_PTR monitor.reset_monitor();
@@ -1015,6 +1042,8 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::VMRUN(bxInstruction_c *i)
   BX_CPU_THIS_PTR svm_gif = 1;
   BX_CPU_THIS_PTR async_event = 1;
 
+  SvmEnterSwitchTLB(&BX_CPU_THIS_PTR vmcb.ctrls);
+
   //
   // Step 4: Inject events to the guest
   //
@@ -1214,7 +1243,8 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::INVLPGA(bxInstruction_c *i)
     if (SVM_INTERCEPT(SVM_INTERCEPT0_INVLPGA)) Svm_Vmexit(SVM_VMEXIT_INVLPGA);
   }
 
-  TLB_flush(); // FIXME: flush all entries for now
+  // invalidate the mapping of rAX page in ECX ASID, for now in all ASIDs
+  TLB_invlpg(RAX & i->asize_mask(), true);
 #endif
 
   BX_NEXT_TRACE(i);
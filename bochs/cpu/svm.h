@@ -285,6 +285,14 @@ typedef struct bx_SVM_GUEST_STATE
 
 } SVM_GUEST_STATE;
 
+// VMCB TLB_CONTROL field
+enum {
+  SVM_TLB_CONTROL_DO_NOTHING = 0,
+  SVM_TLB_CONTROL_FLUSH_ALL = 1,
+  SVM_TLB_CONTROL_FLUSH_ASID = 3,
+  SVM_TLB_CONTROL_FLUSH_ASID_NON_GLOBAL = 7
+};
+
 typedef struct bx_SVM_CONTROLS
 {
   Bit16u cr_rd_ctrl;
@@ -312,6 +320,9 @@ typedef struct bx_SVM_CONTROLS
   bool nested_paging;
   Bit64u ncr3;
 
+  Bit32u asid;
+  Bit8u tlb_control;
+
   Bit16u pause_filter_count;
 //Bit16u pause_filter_threshold;
 
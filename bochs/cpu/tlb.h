@@ -175,19 +175,30 @@ struct bx_TLB_entry
   BX_CPP_INLINE Bit32u get_memtype() const { return MEMTYPE(memtype); }
 };
 
-template <unsigned size>
 struct TLB {
-  bx_TLB_entry entry[size];
+  bx_TLB_entry *entry;
+  unsigned size;
+  Bit32u tlb_mask;
 #if BX_CPU_LEVEL >= 5
   bool split_large;
 #endif
 
 public:
-  TLB() { flush(); }
+  TLB(): entry(NULL), size(0), tlb_mask(0) {}
+ ~TLB() { delete [] entry; }
+
+  // allocate the TLB, size must be power of 2
+  void init(unsigned n)
+  {
+    delete [] entry;
+    size = n;
+    entry = (n > 0) ? new bx_TLB_entry[n] : NULL;
+    tlb_mask = (n > 0) ? ((n-1) << 12) : 0;
+    flush();
+  }
 
   BX_CPP_INLINE unsigned get_index_of(bx_address lpf, unsigned len = 0)
   {
-    const Bit32u tlb_mask = ((size-1) << 12);
     return (((unsigned(lpf) + len) & tlb_mask) >> 12);
   }
 
@@ -257,4 +268,259 @@ public:
   }
 };
 
+// Translation context tag. The first level TLBs only keep translations of
+// the current context, the second level and large page TLBs keep the entries
+// of other contexts as well and match them against the current context tag:
+//   bits 11:0  - PCID (when CR4.PCIDE is set)
+//   bits 31:16 - VPID (VMX guest) or ASID (SVM guest)
+//   bits 62:32 - paging control bits of CR0 and CR4
+//   bit  63    - EFER.NXE
+// Global translations are shared by all the PCIDs of the same VPID/ASID.
+const Bit64u BX_TLB_CTX_PCID_MASK = 0xfff;
+const Bit64u BX_TLB_CTX_VPID_MASK = BX_CONST64(0xffff0000);
+const Bit64u BX_TLB_CTX_NXE = BX_CONST64(1) << 63;
+
+BX_CPP_INLINE bool TLB_ContextMatch(Bit64u tag, Bit64u ctx, bool global)
+{
+  return ((tag ^ ctx) & ~(global ? BX_TLB_CTX_PCID_MASK : 0)) == 0;
+}
+
+// Second level TLB shared by code and data. It is filled by the entries
+// evicted from the first level ITLB and DTLB and looked up before walking
+// the page tables. Code entries are tagged with TLB_CodeEntry bit in
+// accessBits and live in the other half of the table than data entries
+// for the same page. The translations of the same page in different
+// contexts are spread over the table by hashing the context into the
+// index, global translations are indexed by VPID/ASID only.
+const Bit32u TLB_CodeEntry = 0x40000000;
+
+struct SecondLevelTLB : public TLB {
+  Bit64u *tag;  // translation context of every entry
+
+public:
+  SecondLevelTLB(): tag(NULL) {}
+ ~SecondLevelTLB() { delete [] tag; }
+
+  // allocate the TLB, size must be power of 2
+  void init(unsigned n)
+  {
+    TLB::init(n);
+    delete [] tag;
+    tag = (n > 0) ? new Bit64u[n] : NULL;
+  }
+
+  BX_CPP_INLINE unsigned get_index_of(bx_address lpf, bool code, Bit64u ctx, bool global)
+  {
+    unsigned hash = unsigned((ctx & BX_TLB_CTX_VPID_MASK) >> 16) * 0x2d;
+    if (! global) hash += unsigned(ctx & BX_TLB_CTX_PCID_MASK) * 0x1d5;
+    unsigned index = (TLB::get_index_of(lpf) ^ hash) & (size - 1);
+    if (code) index ^= (size >> 1);
+    return index;
+  }
+
+  BX_CPP_INLINE bx_TLB_entry *probe(bx_address lpf, bool code, Bit64u ctx, bool global)
+  {
+    unsigned index = get_index_of(lpf, code, ctx, global);
+    bx_TLB_entry *tlbEntry = &entry[index];
+    if (tlbEntry->valid() && LPFOf(tlbEntry->lpf) == lpf &&
+        ((tlbEntry->accessBits & TLB_CodeEntry) != 0) == code &&
+        TLB_ContextMatch(tag[index], ctx, (tlbEntry->accessBits & TLB_GlobalPage) != 0)) return tlbEntry;
+    return NULL;
+  }
+
+  BX_CPP_INLINE bx_TLB_entry *lookup(bx_address lpf, bool code, Bit64u ctx)
+  {
+    if (! size) return NULL;
+    bx_TLB_entry *tlbEntry = probe(lpf, code, ctx, false);
+    if (! tlbEntry && (ctx & BX_TLB_CTX_PCID_MASK) != 0)
+      tlbEntry = probe(lpf, code, ctx, true);
+    return tlbEntry;
+  }
+
+  BX_CPP_INLINE void insert(const bx_TLB_entry *victim, bool code, Bit64u ctx)
+  {
+    if (! size) return;
+    unsigned index = get_index_of(LPFOf(victim->lpf), code, ctx, (victim->accessBits & TLB_GlobalPage) != 0);
+    bx_TLB_entry *tlbEntry = &entry[index];
+    *tlbEntry = *victim;
+    tag[index] = ctx;
+    if (code) tlbEntry->accessBits |= TLB_CodeEntry;
+#if BX_CPU_LEVEL >= 5
+    if (victim->lpf_mask > 0xfff) split_large = true;
+#endif
+  }
+
+  // move the entries of the first level TLB tagged with context ctx into
+  // the second level TLB, the global entries stay in place if keep_global
+  void spill(TLB &tlb, bool code, Bit64u ctx, bool keep_global)
+  {
+    Bit32u lpf_mask = 0;
+
+    for (unsigned n=0; n < tlb.size; n++) {
+      bx_TLB_entry *tlbEntry = &tlb.entry[n];
+      if (tlbEntry->valid()) {
+        if (keep_global && (tlbEntry->accessBits & TLB_GlobalPage)) {
+          lpf_mask |= tlbEntry->lpf_mask;
+        }
+        else {
+          insert(tlbEntry, code, ctx);
+          tlbEntry->invalidate();
+        }
+      }
+    }
+
+#if BX_CPU_LEVEL >= 5
+    tlb.split_large = (lpf_mask > 0xfff);
+#endif
+  }
+
+  // invalidate the entries which context matches ctx in the mask bits
+  void flushContext(Bit64u ctx, Bit64u mask, bool keep_global)
+  {
+    for (unsigned n=0; n < size; n++) {
+      bx_TLB_entry *tlbEntry = &entry[n];
+      if (tlbEntry->valid() && ((tag[n] ^ ctx) & mask) == 0) {
+        if (! keep_global || !(tlbEntry->accessBits & TLB_GlobalPage))
+          tlbEntry->invalidate();
+      }
+    }
+  }
+
+  // invalidate the translations of the page in the context ctx and the
+  // global translations of the page
+  BX_CPP_INLINE void invlpg(bx_address laddr, Bit64u ctx)
+  {
+#if BX_CPU_LEVEL >= 5
+    if (split_large) {
+      TLB::invlpg(laddr);
+      return;
+    }
+#endif
+    if (! size) return;
+    for (unsigned code=0; code < 2; code++) {
+      for (unsigned global=0; global < 2; global++) {
+        bx_TLB_entry *tlbEntry = &entry[get_index_of(LPFOf(laddr), code, ctx, global)];
+        if (LPFOf(tlbEntry->lpf) == LPFOf(laddr))
+          tlbEntry->invalidate();
+      }
+    }
+  }
+
+  // invalidate the translations of the page in all the contexts
+  void invlpgAll(bx_address laddr)
+  {
+    for (unsigned n=0; n < size; n++) {
+      bx_TLB_entry *tlbEntry = &entry[n];
+      if (tlbEntry->valid()) {
+        bx_address entry_lpf_mask = tlbEntry->lpf_mask;
+        if ((laddr & ~entry_lpf_mask) == (tlbEntry->lpf & ~entry_lpf_mask))
+          tlbEntry->invalidate();
+      }
+    }
+  }
+};
+
+// Large page TLB keeps one entry for every 2M/4M/1G page translation. It
+// doesn't provide host pointers, a hit saves the page walk and is used to
+// fill the first level TLB entry for the accessed 4K page. The table is
+// indexed by the 2M region of the linear address.
+struct bx_large_TLB_entry
+{
+  bx_address lpf;          // linear address of the large page
+  bx_phy_address ppf;      // physical address of the large page
+  Bit32u lpf_mask;         // linear address mask of the page size
+  Bit32u combined_access;  // combined access bits returned by the page walk
+  Bit32u accessKinds;      // access types (rw, user) already allowed by the page walk
+  bool global;
+  Bit64u tag;              // translation context
+
+  bx_large_TLB_entry() { invalidate(); }
+
+  BX_CPP_INLINE bool valid() const { return lpf != BX_INVALID_TLB_ENTRY; }
+  BX_CPP_INLINE void invalidate() { lpf = BX_INVALID_TLB_ENTRY; accessKinds = 0; }
+
+  BX_CPP_INLINE bool match(bx_address laddr) const { return (laddr & ~bx_address(lpf_mask)) == lpf; }
+};
+
+BX_CPP_INLINE Bit32u LARGE_TLB_ACCESS_KIND(unsigned rw, unsigned user) { return 1 << ((rw & 7)*2 + user); }
+
+struct LargePageTLB {
+  bx_large_TLB_entry *entry;
+  unsigned size;
+
+public:
+  LargePageTLB(): entry(NULL), size(0) {}
+ ~LargePageTLB() { delete [] entry; }
+
+  // allocate the TLB, size must be power of 2
+  void init(unsigned n)
+  {
+    delete [] entry;
+    size = n;
+    entry = (n > 0) ? new bx_large_TLB_entry[n] : NULL;
+  }
+
+  BX_CPP_INLINE bx_large_TLB_entry *get_entry_of(bx_address laddr)
+  {
+    return &entry[unsigned(laddr >> 21) & (size-1)];
+  }
+
+  BX_CPP_INLINE bx_large_TLB_entry *lookup(bx_address laddr, unsigned rw, unsigned user, Bit64u ctx)
+  {
+    if (! size) return NULL;
+    bx_large_TLB_entry *tlbEntry = get_entry_of(laddr);
+    if (tlbEntry->valid() && tlbEntry->match(laddr) && (tlbEntry->accessKinds & LARGE_TLB_ACCESS_KIND(rw, user)) &&
+        TLB_ContextMatch(tlbEntry->tag, ctx, tlbEntry->global))
+      return tlbEntry;
+    return NULL;
+  }
+
+  BX_CPP_INLINE void insert(bx_address laddr, bx_phy_address paddr, Bit32u lpf_mask, Bit32u combined_access, bool global, unsigned rw, unsigned user, Bit64u ctx)
+  {
+    if (! size) return;
+    bx_large_TLB_entry *tlbEntry = get_entry_of(laddr);
+    bx_address lpf = laddr & ~bx_address(lpf_mask);
+    bx_phy_address ppf = paddr & ~bx_phy_address(lpf_mask);
+    if (! tlbEntry->valid() || tlbEntry->lpf != lpf || tlbEntry->ppf != ppf ||
+          tlbEntry->lpf_mask != lpf_mask || tlbEntry->combined_access != combined_access ||
+          tlbEntry->tag != ctx)
+    {
+      tlbEntry->lpf = lpf;
+      tlbEntry->ppf = ppf;
+      tlbEntry->lpf_mask = lpf_mask;
+      tlbEntry->combined_access = combined_access;
+      tlbEntry->global = global;
+      tlbEntry->tag = ctx;
+      tlbEntry->accessKinds = 0;
+    }
+    tlbEntry->accessKinds |= LARGE_TLB_ACCESS_KIND(rw, user);
+  }
+
+  BX_CPP_INLINE void flush(void)
+  {
+    for (unsigned n=0; n < size; n++)
+      entry[n].invalidate();
+  }
+
+  BX_CPP_INLINE void flushNonGlobal(void)
+  {
+    for (unsigned n=0; n < size; n++)
+      if (! entry[n].global) entry[n].invalidate();
+  }
+
+  // invalidate the entries which context matches ctx in the mask bits
+  BX_CPP_INLINE void flushContext(Bit64u ctx, Bit64u mask, bool keep_global)
+  {
+    for (unsigned n=0; n < size; n++)
+      if (((entry[n].tag ^ ctx) & mask) == 0 && (! keep_global || ! entry[n].global)) entry[n].invalidate();
+  }
+
+  BX_CPP_INLINE void invlpg(bx_address laddr)
+  {
+    // a 1G page could be cached in any of the entries
+    for (unsigned n=0; n < size; n++)
+      if (entry[n].valid() && entry[n].match(laddr)) entry[n].invalidate();
+  }
+};
+
 #endif
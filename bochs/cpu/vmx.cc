@@ -181,8 +181,8 @@ void BX_CPP_AttrRegparmN(2) BX_CPU_C::VMwrite16(unsigned encoding, Bit16u val_16
 
   if (BX_CPU_THIS_PTR vmcshostptr) {
     Bit16u *hostAddr = (Bit16u*) (BX_CPU_THIS_PTR vmcshostptr | offset);
-    pageWriteStampTable.decWriteStamp(pAddr, 2);
     WriteHostWordToLittleEndian(hostAddr, val_16);
+    pageWriteStampTable.decWriteStamp(pAddr, 2);
   }
   else {
     access_write_physical(pAddr, 2, (Bit8u*)(&val_16));
@@ -223,8 +223,8 @@ void BX_CPP_AttrRegparmN(2) BX_CPU_C::VMwrite32(unsigned encoding, Bit32u val_32
 
   if (BX_CPU_THIS_PTR vmcshostptr) {
     Bit32u *hostAddr = (Bit32u*) (BX_CPU_THIS_PTR vmcshostptr | offset);
-    pageWriteStampTable.decWriteStamp(pAddr, 4);
     WriteHostDWordToLittleEndian(hostAddr, val_32);
+    pageWriteStampTable.decWriteStamp(pAddr, 4);
   }
   else {
     access_write_physical(pAddr, 4, (Bit8u*)(&val_32));
@@ -269,8 +269,8 @@ void BX_CPP_AttrRegparmN(2) BX_CPU_C::VMwrite64(unsigned encoding, Bit64u val_64
 
   if (BX_CPU_THIS_PTR vmcshostptr) {
     Bit64u *hostAddr = (Bit64u*) (BX_CPU_THIS_PTR vmcshostptr | offset);
-    pageWriteStampTable.decWriteStamp(pAddr, 8);
     WriteHostQWordToLittleEndian(hostAddr, val_64);
+    pageWriteStampTable.decWriteStamp(pAddr, 8);
   }
   else {
     access_write_physical(pAddr, 8, (Bit8u*)(&val_64));
@@ -2152,7 +2152,8 @@ Bit32u BX_CPU_C::VMenterLoadCheckGuestState(Bit64u *qualification)
   if (vm->vmexec_ctrls2 & VMX_VM_EXEC_CTRL2_INTERRUPT_WINDOW_VMEXIT)
     signal_event(BX_EVENT_VMX_INTERRUPT_WINDOW_EXITING);
 
-  handleCpuContextChange();
+  // the TLBs are switched to the guest context by VM entry
+  handleCpuContextChange(false);
 
 #if BX_SUPPORT_MONITOR_MWAIT
   BX_CPU_THIS_PTR monitor.reset_monitor();
@@ -2669,7 +2670,17 @@ void BX_CPU_C::VMexitLoadHostState(void)
 
   BX_CPU_THIS_PTR activity_state = BX_ACTIVITY_STATE_ACTIVE;
 
-  handleCpuContextChange();
+#if BX_SUPPORT_VMX >= 2
+  // with VPID enabled the guest translations stay in the TLBs tagged with VPID,
+  // the host CR3 load invalidates the non-global host translations unless the
+  // host uses PCIDs, then they are tagged with the PCID of the host CR3
+  if (SECONDARY_VMEXEC_CONTROL(VMX_VM_EXEC_CTRL3_VPID_ENABLE)) {
+    handleCpuContextChange(false);
+    TLB_switchContext(! BX_CPU_THIS_PTR cr4.get_PCIDE());
+  }
+  else
+#endif
+    handleCpuContextChange();
 
 #if BX_SUPPORT_MONITOR_MWAIT
   BX_CPU_THIS_PTR monitor.reset_monitor();
@@ -3110,6 +3121,23 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::VMLAUNCH(bxInstruction_c *i)
 
   BX_CPU_THIS_PTR in_vmx_guest = 1;
 
+#if BX_SUPPORT_VMX >= 2
+  // with VPID enabled VM entry doesn't invalidate any translations, the guest
+  // translations are cached combined with EPT so drop them all if EPTP is changed
+  if (SECONDARY_VMEXEC_CONTROL(VMX_VM_EXEC_CTRL3_VPID_ENABLE)) {
+    Bit64u root = SECONDARY_VMEXEC_CONTROL(VMX_VM_EXEC_CTRL3_EPT_ENABLE) ? BX_CPU_THIS_PTR vmcs.eptptr : 0;
+    if (root != BX_CPU_THIS_PTR tlb_nested_root) {
+      BX_CPU_THIS_PTR tlb_nested_root = root;
+      TLB_flush();
+    }
+    else {
+      TLB_switchContext(false);
+    }
+  }
+  else
+#endif
+    TLB_flush();
+
   unmask_event(BX_EVENT_INIT);
 
   if (VMEXIT(VMX_VM_EXEC_CTRL2_TSC_OFFSET))
@@ -3779,11 +3807,11 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::INVVPID(bxInstruction_c *i)
       BX_NEXT_TRACE(i);
     }
 
-    TLB_flush(); // invalidate all mappings for address LADDR tagged with VPID
+    TLB_invlpg((bx_address) invvpid_desc.xmm64u(1), true); // invalidate all mappings for address LADDR tagged with VPID
     break;
 
   case BX_INVEPT_INVVPID_SINGLE_CONTEXT_INVALIDATION:
-    TLB_flush(); // invalidate all mappings tagged with VPID
+    TLB_flushVPID(vpid, false); // invalidate all mappings tagged with VPID
     break;
 
   case BX_INVEPT_INVVPID_ALL_CONTEXT_INVALIDATION:
@@ -3791,7 +3819,7 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::INVVPID(bxInstruction_c *i)
     break;
    
   case BX_INVEPT_INVVPID_SINGLE_CONTEXT_NON_GLOBAL_INVALIDATION:
-    TLB_flushNonGlobal(); // invalidate all mappings tagged with VPID except globals
+    TLB_flushVPID(vpid, true); // invalidate all mappings tagged with VPID except globals
     break;
 
   default:
@@ -3876,7 +3904,14 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::INVPCID(bxInstruction_c *i)
       BX_ERROR(("INVPCID: invalid PCID"));
       exception(BX_GP_EXCEPTION, 0);
     }
-    TLB_flushNonGlobal(); // Invalidate all mappings for LADDR tagged with PCID except globals
+    {
+      bx_address laddr = (bx_address) invpcid_desc.xmm64u(1);
+#if BX_SUPPORT_X86_64
+      if (! long_mode()) laddr &= 0xffffffff;
+#endif
+      // Invalidate all mappings for LADDR tagged with PCID except globals
+      TLB_invlpg(laddr, pcid != (BX_CPU_THIS_PTR tlb_ctx & BX_TLB_CTX_PCID_MASK));
+    }
     break;
 
   case BX_INVPCID_SINGLE_CONTEXT_NON_GLOBAL_INVALIDATION:
@@ -3884,7 +3919,7 @@ void BX_CPP_AttrRegparmN(1) BX_CPU_C::INVPCID(bxInstruction_c *i)
       BX_ERROR(("INVPCID: invalid PCID"));
       exception(BX_GP_EXCEPTION, 0);
     }
-    TLB_flushNonGlobal(); // Invalidate all mappings tagged with PCID except globals
+    TLB_flushPCID(pcid); // Invalidate all mappings tagged with PCID except globals
     break;
 
   case BX_INVPCID_ALL_CONTEXT_INVALIDATION:
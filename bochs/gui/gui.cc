@@ -884,6 +884,30 @@ void bx_gui_c::mouse_enabled_changed(bool val)
   BX_GUI_THIS mouse_enabled_changed_specific (val);
 }
 
+// A clone of the simulation must not touch the display of its parent. It
+// continues with the nogui display library, the old instance is not shut
+// down, since the parent still uses the window or the terminal.
+void bx_gui_c::detach_display(void)
+{
+#if BX_WITH_NOGUI
+  char *argv[1];
+
+  if (!strcmp(SIM->get_param_enum(BXPN_SEL_DISPLAY_LIBRARY)->get_selected(), "nogui"))
+    return;
+  argv[0] = (char *)"bochs";
+  unsigned xres = max_xres, yres = max_yres, xtile = x_tilesize, ytile = y_tilesize;
+  PLUG_load_plugin_var("nogui", PLUGTYPE_GUI);
+  if (bx_gui != this) {
+#if BX_GUI_SIGHANDLER
+    bx_gui_sighandler = 0;
+#endif
+    bx_gui->init(1, argv, xres, yres, xtile, ytile);
+  }
+#else
+  BX_ERROR(("nogui display library not available, the clone shares the display"));
+#endif
+}
+
 void bx_gui_c::init_signal_handlers()
 {
 #if BX_GUI_SIGHANDLER
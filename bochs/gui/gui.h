@@ -193,6 +193,7 @@ public:
   void unregister_statusitem(int id);
   void statusbar_setitem(int element, bool active, bool w=0);
   static void init_signal_handlers();
+  void detach_display(void);
   static void toggle_mouse_enable(void);
   bool mouse_toggle_check(Bit32u key, bool pressed);
   const char* get_toggle_info(void);
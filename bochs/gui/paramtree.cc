@@ -1060,6 +1060,10 @@ bx_shadow_data_c::bx_shadow_data_c(bx_param_c *parent,
   this->data_ptr = ptr_to_data;
   this->data_size = data_size;
   this->is_text = is_text;
+  this->sr_devptr = NULL;
+  this->delta_handler = NULL;
+  this->clean_handler = NULL;
+  this->lazy_handler = NULL;
   if (parent) {
     BX_ASSERT(parent->get_type() == BXT_LIST);
     this->parent = (bx_list_c *)parent;
@@ -1083,6 +1087,53 @@ void bx_shadow_data_c::set(Bit32u index, Bit8u value)
   }
 }
 
+void bx_shadow_data_c::set_delta_handlers(void *devptr, data_delta_handler delta, data_clean_handler clean)
+{
+  this->sr_devptr = devptr;
+  this->delta_handler = delta;
+  this->clean_handler = clean;
+}
+
+void bx_shadow_data_c::save_delta(FILE *delta_fp)
+{
+  if (delta_handler)
+    (*delta_handler)(sr_devptr, delta_fp);
+}
+
+void bx_shadow_data_c::clean()
+{
+  if (clean_handler)
+    (*clean_handler)(sr_devptr);
+}
+
+void bx_shadow_data_c::set_lazy_handler(void *devptr, data_lazy_handler lazy)
+{
+  this->sr_devptr = devptr;
+  this->lazy_handler = lazy;
+}
+
+bool bx_shadow_data_c::restore_lazy(const char *path)
+{
+  if (lazy_handler)
+    return (*lazy_handler)(sr_devptr, path);
+  return 0;
+}
+
+// Delta record: 64-bit offset and 32-bit length in little endian byte order
+// followed by the data, a record with zero length ends the delta.
+void bx_write_delta_record(FILE *delta_fp, Bit64u offset, const Bit8u *data, Bit32u len)
+{
+  Bit8u header[12];
+
+  for (int i = 0; i < 8; i++)
+    header[i] = (Bit8u)(offset >> (i * 8));
+  for (int i = 0; i < 4; i++)
+    header[8 + i] = (Bit8u)(len >> (i * 8));
+  fwrite(header, 1, sizeof(header), delta_fp);
+  if (len > 0)
+    fwrite(data, 1, len, delta_fp);
+}
+
 bx_shadow_filedata_c::bx_shadow_filedata_c(bx_param_c *parent,
     const char *name, FILE **scratch_file_ptr_ptr)
   : bx_param_c(SIM->gen_param_id(), name, "")
@@ -1091,6 +1142,9 @@ bx_shadow_filedata_c::bx_shadow_filedata_c(bx_param_c *parent,
   this->scratch_fpp = scratch_file_ptr_ptr;
   this->save_handler = NULL;
   this->restore_handler = NULL;
+  this->delta_handler = NULL;
+  this->clean_handler = NULL;
+  this->lazy_handler = NULL;
   if (parent) {
     BX_ASSERT(parent->get_type() == BXT_LIST);
     this->parent = (bx_list_c *)parent;
@@ -1118,6 +1172,38 @@ void bx_shadow_filedata_c::restore(FILE *save_fp)
     (*restore_handler)(sr_devptr, save_fp);
 }
 
+void bx_shadow_filedata_c::set_delta_handlers(void *devptr, data_delta_handler delta, data_clean_handler clean)
+{
+  this->sr_devptr = devptr;
+  this->delta_handler = delta;
+  this->clean_handler = clean;
+}
+
+void bx_shadow_filedata_c::save_delta(FILE *delta_fp)
+{
+  if (delta_handler)
+    (*delta_handler)(sr_devptr, delta_fp);
+}
+
+void bx_shadow_filedata_c::clean()
+{
+  if (clean_handler)
+    (*clean_handler)(sr_devptr);
+}
+
+void bx_shadow_filedata_c::set_lazy_handler(void *devptr, data_lazy_handler lazy)
+{
+  this->sr_devptr = devptr;
+  this->lazy_handler = lazy;
+}
+
+bool bx_shadow_filedata_c::restore_lazy(const char *path)
+{
+  if (lazy_handler)
+    return (*lazy_handler)(sr_devptr, path);
+  return 0;
+}
+
 bx_list_c::bx_list_c(bx_param_c *parent)
   : bx_param_c(SIM->gen_param_id(), "list", "")
 {
@@ -447,10 +447,25 @@ public:
   void set_extension(const char *newext) {ext = newext;}
 };
 
+// Incremental save support: the delta handler writes the parts of the data
+// changed since the last checkpoint using bx_write_delta_record(), the clean
+// handler starts tracking the changes again.
+typedef void (*data_delta_handler)(void *devptr, FILE *delta_fp);
+typedef void (*data_clean_handler)(void *devptr);
+// Lazy restore: the handler takes over reading the saved data from the file
+// while the simulation runs. It returns false to have the data read now.
+typedef bool (*data_lazy_handler)(void *devptr, const char *path);
+
+BOCHSAPI extern void bx_write_delta_record(FILE *delta_fp, Bit64u offset, const Bit8u *data, Bit32u len);
+
 class BOCHSAPI bx_shadow_data_c : public bx_param_c {
   Bit32u data_size;
   Bit8u *data_ptr;
   bool is_text;
+  void *sr_devptr;
+  data_delta_handler delta_handler;
+  data_clean_handler clean_handler;
+  data_lazy_handler lazy_handler;
 public:
   bx_shadow_data_c(bx_param_c *parent,
       const char *name,
@@ -462,6 +477,12 @@ public:
   bool is_text_format() const {return is_text;}
   Bit8u get(Bit32u index);
   void set(Bit32u index, Bit8u value);
+  void set_delta_handlers(void *devptr, data_delta_handler delta, data_clean_handler clean);
+  bool has_delta() const {return delta_handler != NULL;}
+  void save_delta(FILE *delta_fp);
+  void clean();
+  void set_lazy_handler(void *devptr, data_lazy_handler lazy);
+  bool restore_lazy(const char *path);
 };
 
 typedef void (*filedata_save_handler)(void *devptr, FILE *save_fp);
@@ -473,14 +494,23 @@ protected:
   void *sr_devptr;
   filedata_save_handler    save_handler;
   filedata_restore_handler restore_handler;
+  data_delta_handler       delta_handler;
+  data_clean_handler       clean_handler;
+  data_lazy_handler        lazy_handler;
 
 public:
   bx_shadow_filedata_c(bx_param_c *parent,
       const char *name, FILE **scratch_file_ptr_ptr);
   void set_sr_handlers(void *devptr, filedata_save_handler save, filedata_restore_handler restore);
+  void set_delta_handlers(void *devptr, data_delta_handler delta, data_clean_handler clean);
   FILE **get_fpp() {return scratch_fpp;}
   void save(FILE *save_file);
   void restore(FILE *save_file);
+  bool has_delta() const {return delta_handler != NULL;}
+  void save_delta(FILE *delta_fp);
+  void clean();
+  void set_lazy_handler(void *devptr, data_lazy_handler lazy);
+  bool restore_lazy(const char *path);
 };
 
 typedef struct _bx_listitem_t {
@@ -29,6 +29,13 @@
 #include "bx_debug/debug.h"
 #include "virt_timer.h"
 
+#if BX_HAVE_FORK
+#include <sys/wait.h>
+#ifdef __linux__
+#include <dirent.h>
+#endif
+#endif
+
 bx_simulator_interface_c *SIM = NULL;
 logfunctions *siminterface_log = NULL;
 bx_list_c *root_param = NULL;
@@ -80,6 +87,15 @@ class bx_real_sim_c : public bx_simulator_interface_c {
   bool bx_debug_gui;
   bool bx_log_viewer;
   bool wxsel;
+  // last state saved or restored and the parent of the save in progress,
+  // empty if the save must be complete
+  char sr_parent[BX_PATHNAME_LEN];
+  char sr_delta_parent[BX_PATHNAME_LEN];
+  // fork clones: id of this clone (0 = parent) and the running clones
+  unsigned clone_id;
+  unsigned num_clones;
+  int *clone_pids;
+  void after_clone(unsigned id);
 public:
   bx_real_sim_c();
   virtual ~bx_real_sim_c() {}
@@ -211,6 +227,10 @@ public:
     return (bx_list_c*)get_param("bochs", NULL);
   }
   virtual bool restore_bochs_param(bx_list_c *root, const char *sr_path, const char *restore_name);
+  // fork clones support
+  virtual int clone_simulation(unsigned count);
+  virtual unsigned get_clone_id() const { return clone_id; }
+  virtual void wait_for_clones();
   // special config parameter and options functions for plugins
   virtual bool opt_plugin_ctrl(const char *plugname, bool load);
 #if BX_NETWORKING
@@ -235,6 +255,8 @@ public:
 
 private:
   bool save_sr_param(FILE *fp, bx_param_c *node, const char *sr_path, int level);
+  bool save_sr_delta(bx_param_c *node, const char *sr_path, const char *fname);
+  bool restore_sr_data(bx_param_c *param, const char *sr_path, const char *fname, int depth);
 };
 
 // recursive function to find parameters from the path
@@ -371,6 +393,11 @@ bx_real_sim_c::bx_real_sim_c()
   param_id = BXP_NEW_PARAM_ID;
   rt_conf_entries = NULL;
   addon_options = NULL;
+  sr_parent[0] = 0;
+  sr_delta_parent[0] = 0;
+  clone_id = 0;
+  num_clones = 0;
+  clone_pids = NULL;
 }
 
 int bx_real_sim_c::set_init_done(bool n)
@@ -464,6 +491,13 @@ void bx_real_sim_c::quit_sim(int code)
 {
   BX_INFO(("quit_sim called with exit code %d", code));
   exit_code = code;
+#if BX_SUPPORT_SMP
+  if (bx_smp_parallel && bx_smp_cpu_id() >= 0) {
+    // called from a CPU thread in parallel SMP mode: stop all the CPU
+    // threads, the main thread will shut the simulation down
+    bx_smp_cpu_exit();
+  }
+#endif
   io->exit_log();
   // use longjmp to quit cleanly, no matter where in the stack we are.
   if (quit_context != NULL) {
@@ -877,9 +911,14 @@ int bx_real_sim_c::configuration_interface(const char *ignore, ci_command_t comm
     wxsel = 0;
   bx_debug_gui = wxsel;
   // enter configuration mode, just while running the configuration interface
+  // the simulation must not run while the runtime options are changed
+  if (command == CI_RUNTIME_CONFIG)
+    BX_SMP_STOP_WORLD();
   set_display_mode(DISP_MODE_CONFIG);
   int retval = (*ci_callback)(ci_callback_data, command);
   set_display_mode(DISP_MODE_SIM);
+  if (command == CI_RUNTIME_CONFIG)
+    BX_SMP_RESUME_WORLD();
   return retval;
 }
 
@@ -1079,7 +1118,14 @@ bool bx_real_sim_c::save_state(const char *checkpoint_path)
   int dev, ndev = SIM->get_n_log_modules();
   int type, ntype = SIM->get_max_log_level();
 
+  if (get_param_bool(BXPN_MEM_INCREMENTAL_SAVE)->get())
+    strcpy(sr_delta_parent, sr_parent);
+  else
+    sr_delta_parent[0] = 0;
   get_param_string(BXPN_RESTORE_PATH)->set(checkpoint_path);
+  // the changes since the last state will not be tracked any more, so the
+  // next save must be complete if this one fails
+  sr_parent[0] = 0;
   sprintf(sr_file, "%s/config", checkpoint_path);
   if (write_rc(sr_file, 1) < 0)
     return 0;
@@ -1114,6 +1160,7 @@ bool bx_real_sim_c::save_state(const char *checkpoint_path)
     }
   }
   get_param_string(BXPN_RESTORE_PATH)->set("none");
+  strcpy(sr_parent, checkpoint_path);
   return 1;
 }
 
@@ -1197,16 +1244,128 @@ static int bx_restore_getline(FILE *fp, char *line, int maxlen)
   return (ret != NULL) ? len : 0;
 }
 
+// The data file of an incremental save starts with the signature and the
+// path of the parent state, followed by the records of the changed data
+#define BX_SR_DELTA_SIGNATURE "BXDELTA "
+// longer chains of incremental saves are ended by a complete save
+#define BX_SR_MAX_DELTA_CHAIN 64
+
+// Returns -1 if the data file is missing, 0 for the complete data and 1 for
+// the changes since the parent state returned in 'parent'
+static int bx_get_delta_parent(const char *sr_path, const char *fname, char *parent)
+{
+  char path[BX_PATHNAME_LEN], sig[8];
+  int ret = 0;
+
+  sprintf(path, "%s/%s", sr_path, fname);
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    return -1;
+  if ((fread(sig, 1, 8, fp) == 8) && !memcmp(sig, BX_SR_DELTA_SIGNATURE, 8)) {
+    ret = (bx_restore_getline(fp, parent, BX_PATHNAME_LEN) > 0);
+  }
+  fclose(fp);
+  return ret;
+}
+
+// Load the saved data of a BXT_PARAM_DATA or BXT_PARAM_FILEDATA parameter.
+// For an incremental save the parent states are restored first and the
+// changes are applied on top of them. A complete save may be left to the
+// lazy restore handler of the parameter, which reads it when needed.
+bool bx_real_sim_c::restore_sr_data(bx_param_c *param, const char *sr_path, const char *fname, int depth)
+{
+  char devdata[BX_PATHNAME_LEN], parent[BX_PATHNAME_LEN];
+  Bit8u header[12], *buffer = NULL;
+  Bit32u buflen = 0;
+  FILE *fp2;
+
+  int delta = bx_get_delta_parent(sr_path, fname, parent);
+  if (delta < 0)
+    return 0;
+  sprintf(devdata, "%s/%s", sr_path, fname);
+  fp2 = fopen(devdata, "rb");
+  if (fp2 == NULL)
+    return 0;
+  if (delta) {
+    if (depth >= BX_SR_MAX_DELTA_CHAIN) {
+      BX_ERROR(("restore_sr_data(): incremental save chain of '%s' is too long", devdata));
+      fclose(fp2);
+      return 0;
+    }
+    BX_INFO(("restoring '%s' changes on top of '%s'", devdata, parent));
+    if (!restore_sr_data(param, parent, fname, depth + 1)) {
+      BX_ERROR(("restore_sr_data(): cannot restore parent state '%s/%s'", parent, fname));
+      fclose(fp2);
+      return 0;
+    }
+    bx_restore_getline(fp2, parent, BX_PATHNAME_LEN);
+    while (fread(header, 1, sizeof(header), fp2) == sizeof(header)) {
+      Bit64u offset = 0;
+      Bit32u len = 0;
+      for (int i = 7; i >= 0; i--)
+        offset = (offset << 8) | header[i];
+      for (int i = 3; i >= 0; i--)
+        len = (len << 8) | header[8 + i];
+      if (len == 0) break;
+      if (param->get_type() == BXT_PARAM_DATA) {
+        bx_shadow_data_c *dparam = (bx_shadow_data_c*)param;
+        if ((offset + len) > dparam->get_size()) {
+          BX_ERROR(("restore_sr_data(): record out of range in '%s'", devdata));
+          break;
+        }
+        if (fread(dparam->getptr() + offset, 1, len, fp2) != len)
+          break;
+      } else {
+        FILE **fpp = ((bx_shadow_filedata_c*)param)->get_fpp();
+        if (len > buflen) {
+          delete [] buffer;
+          buffer = new Bit8u[len];
+          buflen = len;
+        }
+        if ((*fpp == NULL) || (fread(buffer, 1, len, fp2) != len))
+          break;
+        fseeko64(*fpp, offset, SEEK_SET);
+        fwrite(buffer, 1, len, *fpp);
+        fflush(*fpp);
+      }
+    }
+    delete [] buffer;
+  } else if (param->get_type() == BXT_PARAM_DATA) {
+    bx_shadow_data_c *dparam = (bx_shadow_data_c*)param;
+    if ((depth > 0) || !dparam->restore_lazy(devdata))
+      fread(dparam->getptr(), 1, dparam->get_size(), fp2);
+  } else if ((depth == 0) && ((bx_shadow_filedata_c*)param)->restore_lazy(devdata)) {
+    ((bx_shadow_filedata_c*)param)->restore(fp2);
+  } else {
+    FILE **fpp = ((bx_shadow_filedata_c*)param)->get_fpp();
+    // If the temporary backing store file wasn't created, do it now.
+    if (*fpp == NULL)
+      *fpp = tmpfile();
+    if (*fpp != NULL) {
+      rewind(*fpp);
+      while (!feof(fp2)) {
+        char buffer[64];
+        size_t chars = fread(buffer, 1, sizeof(buffer), fp2);
+        fwrite(buffer, 1, chars, *fpp);
+      }
+      fflush(*fpp);
+    }
+    ((bx_shadow_filedata_c*)param)->restore(fp2);
+  }
+  fclose(fp2);
+  return 1;
+}
+
 bool bx_real_sim_c::restore_bochs_param(bx_list_c *root, const char *sr_path, const char *restore_name)
 {
-  char devstate[BX_PATHNAME_LEN], devdata[BX_PATHNAME_LEN];
+  char devstate[BX_PATHNAME_LEN];
   char line[512], buf[512];
   char pname[81]; // take extra 81st character for /0
   char *ptr;
   int i;
   unsigned n;
   bx_param_c *param = NULL;
-  FILE *fp, *fp2;
+  FILE *fp;
 
   if (root->get_by_name(restore_name) == NULL) {
     BX_ERROR(("restore_bochs_param(): unknown parameter to restore"));
@@ -1254,12 +1413,8 @@ bool bx_real_sim_c::restore_bochs_param(bx_list_c *root, const char *sr_path, co
                   {
                     bx_shadow_data_c *dparam = (bx_shadow_data_c*)param;
                     if (!dparam->is_text_format()) {
-                      sprintf(devdata, "%s/%s", sr_path, ptr);
-                      fp2 = fopen(devdata, "rb");
-                      if (fp2 != NULL) {
-                        fread(dparam->getptr(), 1, dparam->get_size(), fp2);
-                        fclose(fp2);
-                      }
+                      if (restore_sr_data(param, sr_path, ptr, 0))
+                        dparam->clean();
                     } else if (!strcmp(ptr, "[")) {
                       i = 0;
                       do {
@@ -1281,24 +1436,8 @@ bool bx_real_sim_c::restore_bochs_param(bx_list_c *root, const char *sr_path, co
                   }
                   break;
                 case BXT_PARAM_FILEDATA:
-                  sprintf(devdata, "%s/%s", sr_path, ptr);
-                  fp2 = fopen(devdata, "rb");
-                  if (fp2 != NULL) {
-                    FILE **fpp = ((bx_shadow_filedata_c*)param)->get_fpp();
-                    // If the temporary backing store file wasn't created, do it now.
-                    if (*fpp == NULL)
-                      *fpp = tmpfile();
-                    if (*fpp != NULL) {
-                      while (!feof(fp2)) {
-                        char buffer[64];
-                        size_t chars = fread(buffer, 1, sizeof(buffer), fp2);
-                        fwrite(buffer, 1, chars, *fpp);
-                      }
-                      fflush(*fpp);
-                    }
-                    ((bx_shadow_filedata_c*)param)->restore(fp2);
-                    fclose(fp2);
-                  }
+                  if (restore_sr_data(param, sr_path, ptr, 0))
+                    ((bx_shadow_filedata_c*)param)->clean();
                   break;
                 case BXT_LIST:
                   base = (bx_list_c*)param;
@@ -1326,10 +1465,198 @@ bool bx_real_sim_c::restore_hardware()
 {
   bx_list_c *sr_list = get_bochs_root();
   int ndev = sr_list->get_size();
+  Bit64u start = bx_get_realtime64_usec();
   for (int dev=0; dev<ndev; dev++) {
     if (!restore_bochs_param(sr_list, get_param_string(BXPN_RESTORE_PATH)->getptr(), sr_list->get(dev)->get_name()))
       return 0;
   }
+  strcpy(sr_parent, get_param_string(BXPN_RESTORE_PATH)->getptr());
+  BX_INFO(("hardware state restored in %u usec", (unsigned)(bx_get_realtime64_usec() - start)));
+  return 1;
+}
+
+#if BX_HAVE_FORK && defined(__linux__)
+// A clone inherits the open file descriptions of its parent and with them
+// the file offsets. Reopen the regular files to get private descriptions,
+// except the standard streams which the clones share with the parent.
+static void bx_clone_reopen_files(void)
+{
+  char path[32];
+  struct dirent *entry;
+  struct stat stat_buf;
+
+  DIR *dir = opendir("/proc/self/fd");
+  if (dir == NULL) return;
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] == '.') continue;
+    int fd = atoi(entry->d_name);
+    if ((fd <= 2) || (fd == dirfd(dir)) || (fstat(fd, &stat_buf) < 0) || !S_ISREG(stat_buf.st_mode))
+      continue;
+    int flags = fcntl(fd, F_GETFL);
+    int fdflags = fcntl(fd, F_GETFD);
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    sprintf(path, "/proc/self/fd/%d", fd);
+    int newfd = open(path, flags & (O_ACCMODE | O_APPEND));
+    if (newfd < 0) {
+      BX_ERROR(("clone: couldn't reopen file descriptor %d", fd));
+      continue;
+    }
+    lseek(newfd, offset, SEEK_SET);
+    dup2(newfd, fd);
+    fcntl(fd, F_SETFD, fdflags);
+    close(newfd);
+  }
+  closedir(dir);
+}
+#endif
+
+// Set up the parent (id 0) or a clone after the fork
+void bx_real_sim_c::after_clone(unsigned id)
+{
+  if (id > 0) {
+    clone_id = id;
+    num_clones = 0;
+#if BX_HAVE_FORK && defined(__linux__)
+    bx_clone_reopen_files();
+#endif
+    const char *logfn = get_param_string(BXPN_LOG_FILENAME)->getptr();
+    if (strcmp(logfn, "-")) {
+      char clone_log[BX_PATHNAME_LEN];
+      snprintf(clone_log, BX_PATHNAME_LEN, "%s.clone%u", logfn, id);
+      io->exit_log();
+      io->init_log(clone_log);
+    }
+    BX_MEM(0)->after_clone();
+    bx_gui->detach_display();
+#if BX_SHOW_IPS && !defined(__MINGW32__) && !defined(_MSC_VER)
+    // the pending alarm of the parent is not inherited
+    alarm(1);
+#endif
+  }
+  DEV_after_clone(id);
+}
+
+int bx_real_sim_c::clone_simulation(unsigned count)
+{
+#if BX_HAVE_FORK
+  int pipefd[2];
+  unsigned started = 0;
+  char ready = 1;
+
+  if (count == 0) return 0;
+  if (bx_smp_parallel) {
+    BX_ERROR(("clone: not supported in parallel SMP mode"));
+    return -1;
+  }
+  if (is_wx_selected()) {
+    BX_ERROR(("clone: not supported with the wxWidgets interface"));
+    return -1;
+  }
+  if (pipe(pipefd) < 0) {
+    BX_ERROR(("clone: couldn't create the pipe"));
+    return -1;
+  }
+  // nothing buffered must be written twice
+  fflush(NULL);
+
+  int *pids = new int[num_clones + count];
+  for (unsigned n=0; n<num_clones; n++)
+    pids[n] = clone_pids[n];
+  delete [] clone_pids;
+  clone_pids = pids;
+
+  Bit64u start = bx_get_realtime64_usec();
+  while (started < count) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      BX_ERROR(("clone: fork failed: %s", strerror(errno)));
+      break;
+    }
+    if (pid == 0) {
+      unsigned id = clone_id * count + started + 1;
+      close(pipefd[0]);
+      after_clone(id);
+      // the clone does not use the shared state of the parent any more
+      if (write(pipefd[1], &ready, 1) != 1)
+        BX_ERROR(("clone: couldn't notify the parent"));
+      close(pipefd[1]);
+      BX_INFO(("clone %u: first instruction %u usec after the clone request", id,
+               (unsigned)(bx_get_realtime64_usec() - start)));
+      return (int) id;
+    }
+    clone_pids[num_clones++] = pid;
+    started++;
+  }
+  close(pipefd[1]);
+  // the parent must not run until the clones have copied what they share
+  for (unsigned n=0; n<started; n++) {
+    if (read(pipefd[0], &ready, 1) != 1) break;
+  }
+  close(pipefd[0]);
+  if (started > 0)
+    after_clone(0);
+  BX_INFO(("%u clones of the simulation started in %u usec", started,
+           (unsigned)(bx_get_realtime64_usec() - start)));
+  return (started > 0) ? 0 : -1;
+#else
+  BX_ERROR(("clone: not supported on this host"));
+  return -1;
+#endif
+}
+
+void bx_real_sim_c::wait_for_clones()
+{
+#if BX_HAVE_FORK
+  if (num_clones > 0) {
+    BX_INFO(("waiting for %u clones to finish", num_clones));
+    for (unsigned n=0; n<num_clones; n++) {
+      waitpid(clone_pids[n], NULL, 0);
+    }
+    num_clones = 0;
+  }
+#endif
+}
+
+// Write the changes since the last saved or restored state only. Saving
+// into one of the states of the parent chain must be complete.
+bool bx_real_sim_c::save_sr_delta(bx_param_c *node, const char *sr_path, const char *fname)
+{
+  char path[BX_PATHNAME_LEN], parent[BX_PATHNAME_LEN];
+  int depth, delta;
+
+  if (!sr_delta_parent[0] || (sr_path == NULL))
+    return 0;
+  if (node->get_type() == BXT_PARAM_DATA) {
+    if (!((bx_shadow_data_c*)node)->has_delta())
+      return 0;
+  } else if (!((bx_shadow_filedata_c*)node)->has_delta()) {
+    return 0;
+  }
+  strcpy(path, sr_delta_parent);
+  for (depth = 0; depth < BX_SR_MAX_DELTA_CHAIN; depth++) {
+    if (!strcmp(path, sr_path))
+      return 0;
+    delta = bx_get_delta_parent(path, fname, parent);
+    if (delta < 0)
+      return 0;
+    if (delta == 0)
+      break;
+    strcpy(path, parent);
+  }
+  if (depth >= BX_SR_MAX_DELTA_CHAIN)
+    return 0;
+
+  sprintf(path, "%s/%s", sr_path, fname);
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL)
+    return 0;
+  fprintf(fp, "%s%s\n", BX_SR_DELTA_SIGNATURE, sr_delta_parent);
+  if (node->get_type() == BXT_PARAM_DATA)
+    ((bx_shadow_data_c*)node)->save_delta(fp);
+  else
+    ((bx_shadow_filedata_c*)node)->save_delta(fp);
+  bx_write_delta_record(fp, 0, NULL, 0);
+  fclose(fp);
   return 1;
 }
 
@@ -1364,15 +1691,20 @@ bool bx_real_sim_c::save_sr_param(FILE *fp, bx_param_c *node, const char *sr_pat
             strcpy(pname, pname+6);
           }
           fprintf(fp, "%s\n", pname);
-          if (sr_path)
-            sprintf(tmpstr, "%s/%s", sr_path, pname);
-          else
-            strcpy(tmpstr, pname);
-          fp2 = fopen(tmpstr, "wb");
-          if (fp2 != NULL) {
-            fwrite(dparam->getptr(), 1, dparam->get_size(), fp2);
-            fclose(fp2);
+          if (!save_sr_delta(node, sr_path, pname)) {
+            if (sr_path)
+              sprintf(tmpstr, "%s/%s", sr_path, pname);
+            else
+              strcpy(tmpstr, pname);
+            // a lazy restore might still map the file being replaced
+            unlink(tmpstr);
+            fp2 = fopen(tmpstr, "wb");
+            if (fp2 != NULL) {
+              fwrite(dparam->getptr(), 1, dparam->get_size(), fp2);
+              fclose(fp2);
+            }
           }
+          dparam->clean();
         } else {
           fprintf(fp, "[\n");
           for (i=0; i < (int)dparam->get_size(); i++) {
@@ -1397,15 +1729,23 @@ bool bx_real_sim_c::save_sr_param(FILE *fp, bx_param_c *node, const char *sr_pat
       break;
     case BXT_PARAM_FILEDATA:
       fprintf(fp, "%s.%s\n", node->get_parent()->get_name(), node->get_name());
+      sprintf(pname, "%s.%s", node->get_parent()->get_name(), node->get_name());
+      if (save_sr_delta(node, sr_path, pname)) {
+        ((bx_shadow_filedata_c*)node)->clean();
+        break;
+      }
       if (sr_path)
         sprintf(tmpstr, "%s/%s.%s", sr_path, node->get_parent()->get_name(), node->get_name());
       else
         sprintf(tmpstr, "%s.%s", node->get_parent()->get_name(), node->get_name());
+      // a lazy restore might still read the file being replaced
+      unlink(tmpstr);
       fp2 = fopen(tmpstr, "wb");
       if (fp2 != NULL) {
         FILE **fpp = ((bx_shadow_filedata_c*)node)->get_fpp();
         // If the backing store hasn't been created, just save an empty 0 byte placeholder file.
         if (*fpp != NULL) {
+          rewind(*fpp);
           while (!feof(*fpp)) {
             char buffer[64];
             size_t chars = fread (buffer, 1, sizeof(buffer), *fpp);
@@ -1416,6 +1756,7 @@ bool bx_real_sim_c::save_sr_param(FILE *fp, bx_param_c *node, const char *sr_pat
         ((bx_shadow_filedata_c*)node)->save(fp2);
         fclose(fp2);
       }
+      ((bx_shadow_filedata_c*)node)->clean();
       break;
     case BXT_LIST:
       {
@@ -511,6 +511,19 @@ enum {
 };
 #define BX_CLOCK_SYNC_LAST       BX_CLOCK_SYNC_BOTH
 
+enum {
+  BX_MEM_BACKING_HEAP,
+  BX_MEM_BACKING_ANONYMOUS,
+  BX_MEM_BACKING_FILE,
+  BX_MEM_BACKING_TEMPLATE
+};
+
+enum {
+  BX_MEM_NUMA_NONE,
+  BX_MEM_NUMA_INTERLEAVE,
+  BX_MEM_NUMA_BIND
+};
+
 enum {
   BX_PCI_CHIPSET_I430FX,
   BX_PCI_CHIPSET_I440FX,
@@ -740,6 +753,12 @@ public:
   virtual bx_list_c *get_bochs_root() {return NULL;}
   virtual bool restore_bochs_param(bx_list_c *root, const char *sr_path, const char *restore_name) { return 0; }
 
+  // fork clones of the running simulation: returns the clone id (1..count)
+  // in the clones, 0 in the parent and -1 if no clone could be started
+  virtual int clone_simulation(unsigned count) {return -1;}
+  virtual unsigned get_clone_id() const {return 0;}
+  virtual void wait_for_clones() {}
+
   // special config parameter and options functions for plugins
   virtual bool opt_plugin_ctrl(const char *plugname, bool load) {return 0;}
   virtual void init_std_nic_options(const char *name, bx_list_c *menu) {}
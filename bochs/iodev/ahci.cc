@@ -0,0 +1,1595 @@
+/////////////////////////////////////////////////////////////////////////
+// $Id$
+/////////////////////////////////////////////////////////////////////////
+//
+//  Copyright (C) 2021  The Bochs Project
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+/////////////////////////////////////////////////////////////////////////
+
+// AHCI 1.3 SATA host bus adapter (Intel ICH9 compatible)
+//
+// Each port has a command list of 32 slots and a FIS receive area in guest
+// memory. A write to the command issue register (PxCI) makes the HBA
+// execute all the issued slots at once. Native Command Queuing commands
+// (READ / WRITE FPDMA QUEUED) complete with one Set Device Bits FIS for
+// all the tags finished in that pass, so a batch of queued commands costs
+// one doorbell write and one interrupt. Disks use the device_image_t
+// backends, CD-ROM drives cdrom_base_c with a subset of the ATAPI commands.
+
+// Define BX_PLUGGABLE in files that can be compiled into plugins.  For
+// platforms that require a special tag on exported symbols, BX_PLUGGABLE
+// is used to know when we are exporting symbols and when we are importing.
+#define BX_PLUGGABLE
+
+#include "iodev.h"
+#if BX_SUPPORT_PCI && BX_SUPPORT_AHCI
+
+#include "pci.h"
+#include "hdimage/hdimage.h"
+#include "hdimage/cdrom.h"
+#include "ahci.h"
+
+#define LOG_THIS theAHCI->
+
+bx_ahci_c *theAHCI = NULL;
+
+// global HBA registers
+#define AHCI_CAP                0x00
+#define AHCI_GHC                0x04
+#define AHCI_IS                 0x08
+#define AHCI_PI                 0x0c
+#define AHCI_VS                 0x10
+#define AHCI_CAP2               0x24
+#define AHCI_PORT_BASE          0x100
+#define AHCI_PORT_SIZE          0x80
+
+#define AHCI_CAP_S64A           (1u << 31)
+#define AHCI_CAP_SNCQ           (1u << 30)
+#define AHCI_CAP_SCLO           (1u << 24)
+#define AHCI_CAP_ISS_GEN2       (2u << 20)
+#define AHCI_CAP_SAM            (1u << 18)
+
+#define AHCI_GHC_HR             (1u << 0)
+#define AHCI_GHC_IE             (1u << 1)
+#define AHCI_GHC_AE             (1u << 31)
+
+// port registers
+#define PORT_CLB                0x00
+#define PORT_CLBU               0x04
+#define PORT_FB                 0x08
+#define PORT_FBU                0x0c
+#define PORT_IS                 0x10
+#define PORT_IE                 0x14
+#define PORT_CMD                0x18
+#define PORT_TFD                0x20
+#define PORT_SIG                0x24
+#define PORT_SSTS               0x28
+#define PORT_SCTL               0x2c
+#define PORT_SERR               0x30
+#define PORT_SACT               0x34
+#define PORT_CI                 0x38
+#define PORT_SNTF               0x3c
+
+// port interrupt status bits
+#define PORT_IRQ_D2H_REG        (1u << 0)
+#define PORT_IRQ_PIOS           (1u << 1)
+#define PORT_IRQ_SDB            (1u << 3)
+#define PORT_IRQ_DPS            (1u << 5)
+#define PORT_IRQ_CONNECT        (1u << 6)
+#define PORT_IRQ_PHYRDY         (1u << 22)
+#define PORT_IRQ_IF_FATAL       (1u << 27)
+#define PORT_IRQ_TF_ERR         (1u << 30)
+#define PORT_IRQ_MASK           0xfdc000ff
+
+// port command bits
+#define PORT_CMD_ST             (1u << 0)
+#define PORT_CMD_SUD            (1u << 1)
+#define PORT_CMD_POD            (1u << 2)
+#define PORT_CMD_CLO            (1u << 3)
+#define PORT_CMD_FRE            (1u << 4)
+#define PORT_CMD_FR             (1u << 14)
+#define PORT_CMD_CR             (1u << 15)
+#define PORT_CMD_ATAPI          (1u << 24)
+#define PORT_CMD_WRITABLE       (PORT_CMD_ST | PORT_CMD_CLO | PORT_CMD_FRE | PORT_CMD_ATAPI | \
+                                 0xfe000000)
+#define PORT_CMD_ICC_MASK       0xf0000000
+
+#define SERR_DIAG_X             (1u << 26)
+
+// received FIS area offsets
+#define RX_FIS_PIO_SETUP        0x20
+#define RX_FIS_D2H_REG          0x40
+#define RX_FIS_SDB              0x58
+
+#define FIS_TYPE_REG_H2D        0x27
+#define FIS_TYPE_REG_D2H        0x34
+#define FIS_TYPE_SDB            0xa1
+#define FIS_TYPE_PIO_SETUP      0x5f
+
+// ATA status and error bits
+#define ATA_STAT_ERR            0x01
+#define ATA_STAT_DRQ            0x08
+#define ATA_STAT_DSC            0x10
+#define ATA_STAT_DRDY           0x40
+#define ATA_STAT_BSY            0x80
+#define ATA_ERR_ABRT            0x04
+#define ATA_ERR_IDNF            0x10
+#define ATA_ERR_UNC             0x40
+
+#define ATA_STAT_OK             (ATA_STAT_DRDY | ATA_STAT_DSC)
+
+#define AHCI_SIG_DISK           0x00000101
+#define AHCI_SIG_ATAPI          0xeb140101
+
+// ATAPI sense keys and additional sense codes
+#define SENSE_NONE              0
+#define SENSE_NOT_READY         2
+#define SENSE_ILLEGAL_REQUEST   5
+#define SENSE_UNIT_ATTENTION    6
+#define ASC_ILLEGAL_OPCODE      0x20
+#define ASC_LOGICAL_BLOCK_OOR   0x21
+#define ASC_INV_FIELD_IN_CMD_PACKET 0x24
+#define ASC_MEDIUM_NOT_PRESENT  0x3a
+
+#define AHCI_MAX_MULTIPLE       16
+
+// builtin configuration handling functions
+
+void ahci_init_options(void)
+{
+  char name[8], label[32];
+
+  static const char *ahci_device_type_names[] = { "none", "disk", "cdrom", NULL };
+
+  bx_param_c *pci = SIM->get_param("pci");
+  bx_list_c *ahci = new bx_list_c(pci, "ahci", "AHCI SATA controller");
+  ahci->set_options(ahci->SHOW_PARENT);
+  ahci->set_enabled(BX_SUPPORT_AHCI);
+  for (Bit8u port = 0; port < AHCI_MAX_PORTS; port++) {
+    sprintf(name, "port%d", port);
+    sprintf(label, "AHCI port #%d", port);
+    bx_list_c *menu = new bx_list_c(ahci, name, label);
+    menu->set_options(menu->SERIES_ASK);
+    bx_param_enum_c *type = new bx_param_enum_c(menu,
+      "type",
+      "Type of SATA device",
+      "Type of SATA device (disk or cdrom)",
+      ahci_device_type_names,
+      AHCI_DEV_NONE,
+      AHCI_DEV_NONE);
+    bx_param_filename_c *path = new bx_param_filename_c(menu,
+      "path",
+      "Path or physical device name",
+      "Pathname of the image or physical device (cdrom only)",
+      "", BX_PATHNAME_LEN);
+    path->set_extension("img");
+    bx_param_enum_c *mode = new bx_param_enum_c(menu,
+      "mode",
+      "Type of disk image",
+      "Mode of the SATA harddisk",
+      bx_hdimage_ctl.get_mode_names(),
+      0, 0);
+    bx_param_filename_c *journal = new bx_param_filename_c(menu,
+      "journal",
+      "Path of journal file",
+      "Pathname of the journal file",
+      "", BX_PATHNAME_LEN);
+    bx_list_c *deplist = new bx_list_c(NULL);
+    deplist->add(journal);
+    mode->set_dependent_list(deplist, 0);
+    mode->set_dependent_bitmap(bx_hdimage_ctl.get_mode_id("undoable"), 1);
+    mode->set_dependent_bitmap(bx_hdimage_ctl.get_mode_id("volatile"), 1);
+    mode->set_dependent_bitmap(bx_hdimage_ctl.get_mode_id("vvfat"), 1);
+    // path and mode depend on the device type
+    type->set_dependent_list(menu->clone(), 0);
+    type->set_dependent_bitmap(AHCI_DEV_DISK, 0x06);
+    type->set_dependent_bitmap(AHCI_DEV_CDROM, 0x02);
+  }
+}
+
+Bit32s ahci_options_parser(const char *context, int num_params, char *params[])
+{
+  int port = 0, first = 1;
+  char pname[24];
+
+  if (!strcmp(params[0], "ahci")) {
+    if ((num_params > 1) && !strncmp(params[1], "port=", 5)) {
+      port = atol(&params[1][5]);
+      if ((port < 0) || (port >= AHCI_MAX_PORTS)) {
+        BX_ERROR(("%s: 'ahci' directive: illegal port number", context));
+        return 0;
+      }
+      first = 2;
+    }
+    sprintf(pname, "%s.port%d", BXPN_AHCI, port);
+    bx_list_c *base = (bx_list_c*) SIM->get_param(pname);
+    for (int i = first; i < num_params; i++) {
+      if (SIM->parse_param_from_list(context, params[i], base) < 0) {
+        BX_ERROR(("%s: unknown parameter for ahci ignored.", context));
+      }
+    }
+  } else {
+    BX_PANIC(("%s: unknown directive '%s'", context, params[0]));
+  }
+  return 0;
+}
+
+Bit32s ahci_options_save(FILE *fp)
+{
+  char pname[24], ahcistr[16];
+
+  for (Bit8u port = 0; port < AHCI_MAX_PORTS; port++) {
+    sprintf(pname, "%s.port%d", BXPN_AHCI, port);
+    bx_list_c *base = (bx_list_c*) SIM->get_param(pname);
+    if (SIM->get_param_enum("type", base)->get() != AHCI_DEV_NONE) {
+      sprintf(ahcistr, "ahci: port=%d, ", port);
+      SIM->write_param_list(fp, base, ahcistr, 0);
+    }
+  }
+  return 0;
+}
+
+// device plugin entry point
+
+PLUGIN_ENTRY_FOR_MODULE(ahci)
+{
+  if (mode == PLUGIN_INIT) {
+    theAHCI = new bx_ahci_c();
+    BX_REGISTER_DEVICE_DEVMODEL(plugin, type, theAHCI, BX_PLUGIN_AHCI);
+    // add new configuration parameter for the config interface
+    ahci_init_options();
+    // register add-on option for bochsrc and command line
+    SIM->register_addon_option("ahci", ahci_options_parser, ahci_options_save);
+  } else if (mode == PLUGIN_FINI) {
+    delete theAHCI;
+    SIM->unregister_addon_option("ahci");
+    bx_list_c *menu = (bx_list_c*)SIM->get_param("pci");
+    menu->remove("ahci");
+  } else if (mode == PLUGIN_PROBE) {
+    return (int)PLUGTYPE_OPTIONAL;
+  } else if (mode == PLUGIN_FLAGS) {
+    return PLUGFLAG_PCI;
+  }
+  return 0; // Success
+}
+
+// the device object
+
+bx_ahci_c::bx_ahci_c()
+{
+  put("AHCI");
+  memset(&s, 0, sizeof(bx_ahci_t));
+  for (unsigned p = 0; p < AHCI_MAX_PORTS; p++) {
+    s.port[p].statusbar_id = -1;
+    hdimage[p] = NULL;
+    cdrom[p] = NULL;
+  }
+  buffer = NULL;
+  buffer_size = 0;
+  dma_sg = NULL;
+  dma_sg_size = 0;
+  dma_sg_count = 0;
+}
+
+bx_ahci_c::~bx_ahci_c()
+{
+  for (unsigned p = 0; p < AHCI_MAX_PORTS; p++) {
+    if (hdimage[p] != NULL) {
+      hdimage[p]->close();
+      delete hdimage[p];
+    }
+    if (cdrom[p] != NULL) {
+      delete cdrom[p];
+    }
+  }
+  if (buffer != NULL) {
+    delete [] buffer;
+  }
+  if (dma_sg != NULL) {
+    delete [] dma_sg;
+  }
+  SIM->get_bochs_root()->remove("ahci");
+  BX_DEBUG(("Exit"));
+}
+
+void bx_ahci_c::init(void)
+{
+  char pname[24], sbtext[8];
+  unsigned p, count = 0;
+
+  for (p = 0; p < AHCI_MAX_PORTS; p++) {
+    sprintf(pname, "%s.port%d", BXPN_AHCI, p);
+    bx_list_c *base = (bx_list_c*) SIM->get_param(pname);
+    ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+    const char *path = SIM->get_param_string("path", base)->getptr();
+    port->type = (Bit8u)SIM->get_param_enum("type", base)->get();
+    if (port->type == AHCI_DEV_DISK) {
+      const char *image_mode = SIM->get_param_enum("mode", base)->get_selected();
+      if (strlen(path) == 0) {
+        BX_PANIC(("ahci port %d: disk image not specified", p));
+        port->type = AHCI_DEV_NONE;
+        continue;
+      }
+      hdimage[p] = DEV_hdimage_init_image(image_mode, 0,
+                                          SIM->get_param_string("journal", base)->getptr());
+      if (hdimage[p] == NULL) {
+        port->type = AHCI_DEV_NONE;
+        continue;
+      }
+      // default geometry, only used by vvfat (512 MB)
+      hdimage[p]->cylinders = 1040;
+      hdimage[p]->heads = 16;
+      hdimage[p]->spt = 63;
+      hdimage[p]->sect_size = 512;
+      if (hdimage[p]->open(path) < 0) {
+        BX_PANIC(("ahci port %d: could not open disk image file '%s'", p, path));
+        port->type = AHCI_DEV_NONE;
+        continue;
+      }
+      port->capacity = hdimage[p]->hd_size >> 9;
+      if ((hdimage[p]->get_capabilities() & HDIMAGE_HAS_GEOMETRY) == 0) {
+        // the geometry is only reported by IDENTIFY DEVICE
+        Bit64u cyl = port->capacity / (16 * 63);
+        hdimage[p]->cylinders = (cyl > 16383) ? 16383 : (unsigned)cyl;
+        hdimage[p]->heads = 16;
+        hdimage[p]->spt = 63;
+      }
+      BX_INFO(("port %d: disk '%s', '%s' mode, %u MB", p, path, image_mode,
+               (Bit32u)(hdimage[p]->hd_size >> 20)));
+      sprintf(sbtext, "SATA%d", p);
+    } else if (port->type == AHCI_DEV_CDROM) {
+      cdrom[p] = DEV_hdimage_init_cdrom(path);
+      BX_INFO(("port %d: CD-ROM '%s'", p, path));
+      if ((strlen(path) > 0) && cdrom[p]->insert_cdrom()) {
+        port->cd_ready = 1;
+        port->capacity = cdrom[p]->capacity();
+        BX_INFO(("Media present in CD-ROM drive, capacity is %d sectors",
+                 (Bit32u)port->capacity));
+      } else {
+        BX_INFO(("Media not present in CD-ROM drive"));
+      }
+      sprintf(sbtext, "SCD%d", p);
+    } else {
+      continue;
+    }
+    port->statusbar_id = bx_gui->register_statusitem(sbtext, 1);
+    count++;
+  }
+  if (count == 0) {
+    BX_INFO(("AHCI controller disabled (no port configured)"));
+    // mark unused plugin for removal
+    ((bx_param_bool_c*)((bx_list_c*)SIM->get_param(BXPN_PLUGIN_CTRL))->get_by_name("ahci"))->set(0);
+    return;
+  }
+
+  BX_AHCI_THIS s.devfunc = 0x00;
+  DEV_register_pci_handlers(this, &BX_AHCI_THIS s.devfunc, BX_PLUGIN_AHCI,
+                            "AHCI SATA controller");
+
+  // initialize readonly registers
+  init_pci_conf(0x8086, 0x2922, 0x02, 0x010601, 0x00, BX_PCI_INTA);
+  BX_AHCI_THIS init_bar_mem(5, AHCI_ABAR_SIZE, mem_read_handler, mem_write_handler);
+
+  BX_AHCI_THIS alloc_buffer(0x10000);
+}
+
+void bx_ahci_c::reset(unsigned type)
+{
+  unsigned i;
+
+  static const struct reset_vals_t {
+    unsigned      addr;
+    unsigned char val;
+  } reset_vals[] = {
+    { 0x04, 0x00 }, { 0x05, 0x00 }, // command
+    { 0x06, 0x10 }, { 0x07, 0x00 }, // status (capability list)
+    { 0x2c, 0x86 }, { 0x2d, 0x80 }, // subsystem vendor
+    { 0x2e, 0x22 }, { 0x2f, 0x29 }, // subsystem id
+    { 0x34, 0x80 },                 // capability pointer
+    { 0x3c, 0x00 },                 // IRQ
+    // power management capability
+    { 0x80, 0x01 }, { 0x81, 0x00 }, { 0x82, 0x03 }, { 0x83, 0x00 },
+  };
+  for (i = 0; i < sizeof(reset_vals) / sizeof(*reset_vals); ++i) {
+    BX_AHCI_THIS pci_conf[reset_vals[i].addr] = reset_vals[i].val;
+  }
+  BX_AHCI_THIS hba_reset();
+}
+
+// HBA reset (system reset or GHC.HR)
+void bx_ahci_c::hba_reset(void)
+{
+  BX_AHCI_THIS s.ghc = AHCI_GHC_AE;
+  BX_AHCI_THIS s.is = 0;
+  for (unsigned p = 0; p < AHCI_MAX_PORTS; p++) {
+    ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+    port->clb = 0;
+    port->clbu = 0;
+    port->fb = 0;
+    port->fbu = 0;
+    port->ie = 0;
+    port->cmd = PORT_CMD_SUD | PORT_CMD_POD;
+    if (port->type == AHCI_DEV_CDROM) {
+      port->cmd |= PORT_CMD_ATAPI;
+    }
+    port->sctl = 0;
+    port->sntf = 0;
+    BX_AHCI_THIS port_reset(p);
+  }
+  BX_AHCI_THIS update_irq();
+}
+
+// COMRESET: the link is established again and the device sends its signature
+void bx_ahci_c::port_reset(unsigned p)
+{
+  ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+
+  port->is = 0;
+  port->serr = 0;
+  port->sact = 0;
+  port->ci = 0;
+  if (port->type != AHCI_DEV_NONE) {
+    port->ssts = 0x123; // device present, Gen2 speed, interface active
+    BX_AHCI_THIS device_reset(p);
+  } else {
+    port->ssts = 0;
+    port->sig = 0xffffffff;
+    port->tfd = 0x7f;
+  }
+}
+
+void bx_ahci_c::device_reset(unsigned p)
+{
+  ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+
+  port->multiple_sectors = 0;
+  if (port->type == AHCI_DEV_CDROM) {
+    port->sig = AHCI_SIG_ATAPI;
+    port->tfd = 0x100;
+    port->sense_key = SENSE_NONE;
+    port->asc = 0;
+  } else {
+    port->sig = AHCI_SIG_DISK;
+    port->tfd = 0x100 | ATA_STAT_OK;
+  }
+}
+
+void bx_ahci_c::register_state(void)
+{
+  char pname[8];
+
+  bx_list_c *list = new bx_list_c(SIM->get_bochs_root(), "ahci", "AHCI Controller State");
+  BXRS_HEX_PARAM_FIELD(list, ghc, BX_AHCI_THIS s.ghc);
+  BXRS_HEX_PARAM_FIELD(list, is, BX_AHCI_THIS s.is);
+  for (unsigned p = 0; p < AHCI_MAX_PORTS; p++) {
+    ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+    sprintf(pname, "port%d", p);
+    bx_list_c *plist = new bx_list_c(list, pname, "");
+    BXRS_HEX_PARAM_FIELD(plist, clb, port->clb);
+    BXRS_HEX_PARAM_FIELD(plist, clbu, port->clbu);
+    BXRS_HEX_PARAM_FIELD(plist, fb, port->fb);
+    BXRS_HEX_PARAM_FIELD(plist, fbu, port->fbu);
+    BXRS_HEX_PARAM_FIELD(plist, is, port->is);
+    BXRS_HEX_PARAM_FIELD(plist, ie, port->ie);
+    BXRS_HEX_PARAM_FIELD(plist, cmd, port->cmd);
+    BXRS_HEX_PARAM_FIELD(plist, tfd, port->tfd);
+    BXRS_HEX_PARAM_FIELD(plist, sig, port->sig);
+    BXRS_HEX_PARAM_FIELD(plist, ssts, port->ssts);
+    BXRS_HEX_PARAM_FIELD(plist, sctl, port->sctl);
+    BXRS_HEX_PARAM_FIELD(plist, serr, port->serr);
+    BXRS_HEX_PARAM_FIELD(plist, sact, port->sact);
+    BXRS_HEX_PARAM_FIELD(plist, ci, port->ci);
+    BXRS_HEX_PARAM_FIELD(plist, sntf, port->sntf);
+    BXRS_DEC_PARAM_FIELD(plist, multiple_sectors, port->multiple_sectors);
+    BXRS_HEX_PARAM_FIELD(plist, sense_key, port->sense_key);
+    BXRS_HEX_PARAM_FIELD(plist, asc, port->asc);
+    BXRS_PARAM_BOOL(plist, cd_ready, port->cd_ready);
+    BXRS_PARAM_BOOL(plist, media_changed, port->media_changed);
+    if (hdimage[p] != NULL) {
+      hdimage[p]->register_state(plist);
+    }
+  }
+
+  register_pci_state(list);
+}
+
+void bx_ahci_c::after_restore_state(void)
+{
+  bx_pci_device_c::after_restore_pci_state(NULL);
+  BX_AHCI_THIS update_irq();
+}
+
+// Set the global interrupt status of the ports with an enabled interrupt
+// pending and update the INTx line.
+void bx_ahci_c::update_irq(void)
+{
+  for (unsigned p = 0; p < AHCI_MAX_PORTS; p++) {
+    if (BX_AHCI_THIS s.port[p].is & BX_AHCI_THIS s.port[p].ie) {
+      BX_AHCI_THIS s.is |= (1 << p);
+    }
+  }
+  bool level = ((BX_AHCI_THIS s.ghc & AHCI_GHC_IE) != 0) && (BX_AHCI_THIS s.is != 0);
+  DEV_pci_set_irq(BX_AHCI_THIS s.devfunc, BX_AHCI_THIS pci_conf[0x3d], level);
+}
+
+void bx_ahci_c::alloc_buffer(Bit32u size)
+{
+  if (size > BX_AHCI_THIS buffer_size) {
+    if (BX_AHCI_THIS buffer != NULL) {
+      delete [] BX_AHCI_THIS buffer;
+    }
+    BX_AHCI_THIS buffer_size = size;
+    BX_AHCI_THIS buffer = new Bit8u[size];
+  }
+}
+
+// Write a received FIS to the FIS receive area of the port
+void bx_ahci_c::post_fis(unsigned p, Bit32u offset, const Bit8u *fis, unsigned len)
+{
+  ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+
+  if (port->cmd & PORT_CMD_FRE) {
+    Bit64u fb = ((Bit64u)port->fbu << 32) | port->fb;
+    DEV_MEM_WRITE_PHYSICAL_DMA((bx_phy_address)(fb + offset), len, (Bit8u*)fis);
+  }
+}
+
+// Register - device to host FIS with the command block registers of 'cfis'
+void bx_ahci_c::post_d2h_fis(unsigned p, Bit8u status, Bit8u error, const Bit8u *cfis, bool irq)
+{
+  Bit8u fis[20];
+
+  memset(fis, 0, 20);
+  fis[0] = FIS_TYPE_REG_D2H;
+  fis[1] = irq ? 0x40 : 0x00;
+  fis[2] = status;
+  fis[3] = error;
+  if (cfis != NULL) {
+    memcpy(&fis[4], &cfis[4], 7);   // LBA and device
+    memcpy(&fis[12], &cfis[12], 2); // count
+  }
+  BX_AHCI_THIS s.port[p].tfd = ((Bit32u)error << 8) | status;
+  BX_AHCI_THIS post_fis(p, RX_FIS_D2H_REG, fis, 20);
+}
+
+// initial Register FIS of the device after a reset
+void bx_ahci_c::post_signature(unsigned p)
+{
+  ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+  Bit8u sig[16];
+
+  memset(sig, 0, 16);
+  sig[12] = (Bit8u)port->sig;         // count
+  sig[4] = (Bit8u)(port->sig >> 8);   // LBA low
+  sig[5] = (Bit8u)(port->sig >> 16);  // LBA mid
+  sig[6] = (Bit8u)(port->sig >> 24);  // LBA high
+  BX_AHCI_THIS post_d2h_fis(p, (Bit8u)port->tfd, (Bit8u)(port->tfd >> 8), sig, 0);
+}
+
+// Read the physical region descriptor table of a command into the
+// scatter-gather list. Returns the total byte count.
+Bit32u bx_ahci_c::get_prdt(Bit64u ctba, unsigned prdtl, bool *prd_irq)
+{
+  Bit8u prd[16];
+  Bit32u total = 0;
+
+  if (prdtl > BX_AHCI_THIS dma_sg_size) {
+    if (BX_AHCI_THIS dma_sg != NULL) {
+      delete [] BX_AHCI_THIS dma_sg;
+    }
+    BX_AHCI_THIS dma_sg_size = prdtl;
+    BX_AHCI_THIS dma_sg = new bx_dma_segment[prdtl];
+  }
+  *prd_irq = 0;
+  for (unsigned i = 0; i < prdtl; i++) {
+    DEV_MEM_READ_PHYSICAL_DMA((bx_phy_address)(ctba + 0x80 + i * 16), 16, prd);
+    Bit64u dba = ReadHostQWordFromLittleEndian((Bit64u*)&prd[0]);
+    Bit32u dbc = ReadHostDWordFromLittleEndian((Bit32u*)&prd[12]);
+    BX_AHCI_THIS dma_sg[i].addr = (bx_phy_address)(dba & ~(Bit64u)1);
+    BX_AHCI_THIS dma_sg[i].len = (dbc & 0x3fffff) + 1;
+    total += BX_AHCI_THIS dma_sg[i].len;
+    if (dbc & 0x80000000) {
+      *prd_irq = 1;
+    }
+  }
+  BX_AHCI_THIS dma_sg_count = prdtl;
+  return total;
+}
+
+// Transfer 'len' bytes between the buffer and the guest memory described
+// by the PRD table of the current command (write: from the guest to the
+// buffer). Returns the number of bytes transferred.
+Bit32u bx_ahci_c::dma_transfer(Bit32u len, bool write)
+{
+  Bit32u total = 0;
+  unsigned n;
+
+  for (n = 0; (n < BX_AHCI_THIS dma_sg_count) && (total < len); n++) {
+    if (BX_AHCI_THIS dma_sg[n].len > (len - total)) {
+      BX_AHCI_THIS dma_sg[n].len = len - total;
+    }
+    total += BX_AHCI_THIS dma_sg[n].len;
+  }
+  if (write) {
+    DEV_MEM_READ_PHYSICAL_DMA_SG(BX_AHCI_THIS dma_sg, n, BX_AHCI_THIS buffer);
+  } else {
+    DEV_MEM_WRITE_PHYSICAL_DMA_SG(BX_AHCI_THIS dma_sg, n, BX_AHCI_THIS buffer);
+  }
+  return total;
+}
+
+// Execute all the issued commands of a port. The queued commands finished
+// in this pass are reported with a single Set Device Bits FIS.
+void bx_ahci_c::process_commands(unsigned p)
+{
+  ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+  Bit32u ncq_done = 0;
+
+  if (!(port->cmd & PORT_CMD_ST) || (port->type == AHCI_DEV_NONE))
+    return;
+
+  for (unsigned slot = 0; slot < AHCI_MAX_CMDS; slot++) {
+    if (!(port->ci & (1 << slot)))
+      continue;
+    if (port->tfd & (ATA_STAT_BSY | ATA_STAT_DRQ)) {
+      // the port needs a command list override or a reset first
+      break;
+    }
+    port->cmd = (port->cmd & ~0x1f00) | (slot << 8); // current command slot
+    if (!BX_AHCI_THIS execute_command(p, slot, &ncq_done))
+      break;
+  }
+  if (ncq_done != 0) {
+    Bit8u fis[8];
+    fis[0] = FIS_TYPE_SDB;
+    fis[1] = 0x40;
+    fis[2] = ATA_STAT_OK & 0x77;
+    fis[3] = 0;
+    WriteHostDWordToLittleEndian((Bit32u*)&fis[4], ncq_done);
+    port->tfd = (port->tfd & ~0xff77) | (ATA_STAT_OK & 0x77);
+    BX_AHCI_THIS post_fis(p, RX_FIS_SDB, fis, 8);
+    port->sact &= ~ncq_done;
+    port->is |= PORT_IRQ_SDB;
+  }
+  BX_AHCI_THIS update_irq();
+}
+
+// Execute the command of one slot. Returns 0 if the command failed and the
+// port stopped processing commands.
+bool bx_ahci_c::execute_command(unsigned p, unsigned slot, Bit32u *ncq_done)
+{
+  ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+  Bit8u hdr[32], cfis[20], acmd[16];
+  Bit32u prd_bytes, xfer = 0;
+  Bit8u status = ATA_STAT_OK, error = 0;
+  bool prd_irq, pio = 0;
+
+  Bit64u clb = ((Bit64u)port->clbu << 32) | port->clb;
+  DEV_MEM_READ_PHYSICAL_DMA((bx_phy_address)(clb + slot * 32), 32, hdr);
+  Bit32u dw0 = ReadHostDWordFromLittleEndian((Bit32u*)&hdr[0]);
+  Bit64u ctba = ReadHostQWordFromLittleEndian((Bit64u*)&hdr[8]) & ~(Bit64u)0x7f;
+  DEV_MEM_READ_PHYSICAL_DMA((bx_phy_address)ctba, 20, cfis);
+
+  if (cfis[0] != FIS_TYPE_REG_H2D) {
+    BX_ERROR(("port %d: unsupported FIS type 0x%02x in slot %d", p, cfis[0], slot));
+    port->is |= PORT_IRQ_IF_FATAL;
+    port->tfd |= ATA_STAT_ERR;
+    return 0;
+  }
+  if (!(cfis[1] & 0x80)) {
+    // device control register update: software reset when SRST is released
+    if (!(cfis[15] & 0x04)) {
+      BX_DEBUG(("port %d: software reset", p));
+      BX_AHCI_THIS device_reset(p);
+      BX_AHCI_THIS post_signature(p);
+    }
+    port->ci &= ~(1 << slot);
+    return 1;
+  }
+  prd_bytes = BX_AHCI_THIS get_prdt(ctba, dw0 >> 16, &prd_irq);
+
+  if (((cfis[2] == 0x60) || (cfis[2] == 0x61)) && (port->type == AHCI_DEV_DISK)) {
+    // READ / WRITE FPDMA QUEUED
+    unsigned tag = cfis[12] >> 3;
+    Bit32u count = cfis[3] | (cfis[11] << 8);
+    Bit64u lba = cfis[4] | (cfis[5] << 8) | (cfis[6] << 16) | ((Bit64u)cfis[8] << 24) |
+                 ((Bit64u)cfis[9] << 32) | ((Bit64u)cfis[10] << 40);
+    if (count == 0) count = 65536;
+    // the command is accepted before the data phase
+    port->ci &= ~(1 << slot);
+    if (port->sact & (1 << tag)) {
+      error = BX_AHCI_THIS disk_rw(p, lba, count, (cfis[2] == 0x61), prd_bytes, &xfer) ?
+              0 : ATA_ERR_IDNF;
+    } else {
+      BX_ERROR(("port %d: queued command with inactive tag %d", p, tag));
+      error = ATA_ERR_ABRT;
+    }
+    WriteHostDWordToLittleEndian((Bit32u*)&hdr[4], xfer);
+    DEV_MEM_WRITE_PHYSICAL_DMA((bx_phy_address)(clb + slot * 32 + 4), 4, &hdr[4]);
+    if (error == 0) {
+      if (prd_irq) port->is |= PORT_IRQ_DPS;
+      *ncq_done |= (1 << tag);
+      return 1;
+    }
+    // report the error with a Set Device Bits FIS that also completes the
+    // tags finished before, the failed tag stays active
+    Bit8u fis[8];
+    fis[0] = FIS_TYPE_SDB;
+    fis[1] = 0x40;
+    fis[2] = (ATA_STAT_OK | ATA_STAT_ERR) & 0x77;
+    fis[3] = error;
+    WriteHostDWordToLittleEndian((Bit32u*)&fis[4], *ncq_done);
+    port->sact &= ~(*ncq_done);
+    *ncq_done = 0;
+    port->tfd = ((Bit32u)error << 8) | ATA_STAT_OK | ATA_STAT_ERR;
+    BX_AHCI_THIS post_fis(p, RX_FIS_SDB, fis, 8);
+    port->is |= PORT_IRQ_SDB | PORT_IRQ_TF_ERR;
+    return 0;
+  }
+
+  if ((cfis[2] == 0xa0) && (port->type == AHCI_DEV_CDROM)) {
+    DEV_MEM_READ_PHYSICAL_DMA((bx_phy_address)(ctba + 0x40), 16, acmd);
+    BX_AHCI_THIS atapi_command(p, acmd, prd_bytes, &xfer, &status, &error);
+    pio = ((cfis[3] & 0x01) == 0);
+  } else {
+    BX_AHCI_THIS ata_command(p, cfis, prd_bytes, &xfer, &status, &error);
+    switch (cfis[2]) {
+      case 0xec: case 0xa1:
+      case 0x20: case 0x21: case 0x24: case 0x29: case 0xc4:
+      case 0x30: case 0x31: case 0x34: case 0x39: case 0xc5:
+        pio = 1;
+    }
+  }
+  WriteHostDWordToLittleEndian((Bit32u*)&hdr[4], xfer);
+  DEV_MEM_WRITE_PHYSICAL_DMA((bx_phy_address)(clb + slot * 32 + 4), 4, &hdr[4]);
+  if (pio && (xfer > 0)) {
+    // PIO Setup FIS, the ending status is used by the driver for data-in
+    Bit8u fis[20];
+    bool data_in = ((dw0 & 0x40) == 0);
+    memset(fis, 0, 20);
+    fis[0] = FIS_TYPE_PIO_SETUP;
+    fis[1] = data_in ? 0x60 : 0x00;
+    fis[2] = ATA_STAT_DRDY | ATA_STAT_DSC | ATA_STAT_DRQ;
+    memcpy(&fis[4], &cfis[4], 7);
+    memcpy(&fis[12], &cfis[12], 2);
+    fis[15] = status;
+    WriteHostWordToLittleEndian((Bit16u*)&fis[16], (xfer > 0xffff) ? 0xffff : (Bit16u)xfer);
+    BX_AHCI_THIS post_fis(p, RX_FIS_PIO_SETUP, fis, 20);
+    if (data_in) port->is |= PORT_IRQ_PIOS;
+  }
+  BX_AHCI_THIS post_d2h_fis(p, status, error, cfis, 1);
+  port->is |= PORT_IRQ_D2H_REG;
+  if (prd_irq && (xfer > 0)) port->is |= PORT_IRQ_DPS;
+  if (status & ATA_STAT_ERR) {
+    // the slot stays issued until the driver restarts the port
+    port->is |= PORT_IRQ_TF_ERR;
+    return 0;
+  }
+  port->ci &= ~(1 << slot);
+  return 1;
+}
+
+// Read or write sectors with one image request and one scatter-gather DMA
+bool bx_ahci_c::disk_rw(unsigned p, Bit64u lba, Bit32u count, bool write, Bit32u prd_bytes, Bit32u *xfer)
+{
+  ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+  Bit32u bytes = count << 9;
+
+  *xfer = 0;
+  if ((lba > port->capacity) || (count > (port->capacity - lba))) {
+    BX_ERROR(("port %d: sectors out of range: lba=" FMT_LL "d, count=%d", p, lba, count));
+    return 0;
+  }
+  if (bytes > prd_bytes) {
+    BX_ERROR(("port %d: PRD table too small for %d sectors", p, count));
+    return 0;
+  }
+  BX_AHCI_THIS alloc_buffer(bytes);
+  if (!write) {
+    bx_gui->statusbar_setitem(port->statusbar_id, 1);
+    if (hdimage[p]->read_at((Bit64s)lba << 9, BX_AHCI_THIS buffer, bytes) != (ssize_t)bytes) {
+      BX_ERROR(("port %d: could not read %d sectors at lba " FMT_LL "d", p, count, lba));
+      return 0;
+    }
+    *xfer = BX_AHCI_THIS dma_transfer(bytes, 0);
+  } else {
+    bx_gui->statusbar_setitem(port->statusbar_id, 1, 1 /* write */);
+    *xfer = BX_AHCI_THIS dma_transfer(bytes, 1);
+    if (hdimage[p]->write_at((Bit64s)lba << 9, BX_AHCI_THIS buffer, bytes) != (ssize_t)bytes) {
+      BX_ERROR(("port %d: could not write %d sectors at lba " FMT_LL "d", p, count, lba));
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void bx_ahci_c::ata_command(unsigned p, const Bit8u *fis, Bit32u prd_bytes, Bit32u *xfer,
+                            Bit8u *status, Bit8u *error)
+{
+  ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+  Bit8u command = fis[2];
+  Bit16u id[256];
+  Bit64u lba;
+  Bit32u count;
+  bool lba48 = 0, write = 0;
+  unsigned i;
+
+  *xfer = 0;
+  if (port->type == AHCI_DEV_CDROM) {
+    switch (command) {
+      case 0xa1: // IDENTIFY PACKET DEVICE
+        BX_AHCI_THIS identify_atapi(p, id);
+        for (i = 0; i < 256; i++) {
+          WriteHostWordToLittleEndian((Bit16u*)&BX_AHCI_THIS buffer[i * 2], id[i]);
+        }
+        *xfer = BX_AHCI_THIS dma_transfer((prd_bytes < 512) ? prd_bytes : 512, 0);
+        break;
+      case 0x08: // DEVICE RESET
+        BX_AHCI_THIS device_reset(p);
+        break;
+      case 0x90: // EXECUTE DEVICE DIAGNOSTIC
+        *error = 0x01;
+        break;
+      case 0xef: // SET FEATURES
+      case 0xe5: // CHECK POWER MODE
+      case 0xe0: // STANDBY IMMEDIATE
+      case 0xe1: // IDLE IMMEDIATE
+        break;
+      default:
+        BX_DEBUG(("port %d: ATA command 0x%02x aborted (ATAPI device)", p, command));
+        *status = ATA_STAT_OK | ATA_STAT_ERR;
+        *error = ATA_ERR_ABRT;
+    }
+    return;
+  }
+
+  switch (command) {
+    case 0xec: // IDENTIFY DEVICE
+      BX_AHCI_THIS identify_drive(p, id);
+      for (i = 0; i < 256; i++) {
+        WriteHostWordToLittleEndian((Bit16u*)&BX_AHCI_THIS buffer[i * 2], id[i]);
+      }
+      *xfer = BX_AHCI_THIS dma_transfer((prd_bytes < 512) ? prd_bytes : 512, 0);
+      break;
+
+    case 0x34: // WRITE SECTORS EXT
+    case 0x39: // WRITE MULTIPLE EXT
+    case 0x35: // WRITE DMA EXT
+      write = 1;
+    case 0x24: // READ SECTORS EXT
+    case 0x29: // READ MULTIPLE EXT
+    case 0x25: // READ DMA EXT
+      lba48 = 1;
+    case 0x20: // READ SECTORS
+    case 0x21: // READ SECTORS, without retries
+    case 0xc4: // READ MULTIPLE
+    case 0xc8: // READ DMA
+    case 0xc9: // READ DMA, without retries
+    case 0x30: // WRITE SECTORS
+    case 0x31: // WRITE SECTORS, without retries
+    case 0xc5: // WRITE MULTIPLE
+    case 0xca: // WRITE DMA
+    case 0xcb: // WRITE DMA, without retries
+      if ((command == 0x30) || (command == 0x31) || (command == 0xc5) ||
+          (command == 0xca) || (command == 0xcb)) {
+        write = 1;
+      }
+      if (((command == 0xc4) || (command == 0xc5) || (command == 0x29) ||
+           (command == 0x39)) && (port->multiple_sectors == 0)) {
+        *status = ATA_STAT_OK | ATA_STAT_ERR;
+        *error = ATA_ERR_ABRT;
+        break;
+      }
+      if (lba48) {
+        lba = fis[4] | (fis[5] << 8) | (fis[6] << 16) | ((Bit64u)fis[8] << 24) |
+              ((Bit64u)fis[9] << 32) | ((Bit64u)fis[10] << 40);
+        count = fis[12] | (fis[13] << 8);
+        if (count == 0) count = 65536;
+      } else {
+        if (fis[7] & 0x40) {
+          lba = fis[4] | (fis[5] << 8) | (fis[6] << 16) | ((fis[7] & 0x0f) << 24);
+        } else {
+          // CHS translation with the geometry reported by IDENTIFY DEVICE
+          Bit32u cyl = fis[5] | (fis[6] << 8);
+          lba = ((Bit64u)cyl * hdimage[p]->heads + (fis[7] & 0x0f)) * hdimage[p]->spt +
+                fis[4] - 1;
+        }
+        count = fis[12];
+        if (count == 0) count = 256;
+      }
+      if (!BX_AHCI_THIS disk_rw(p, lba, count, write, prd_bytes, xfer)) {
+        *status = ATA_STAT_OK | ATA_STAT_ERR;
+        *error = ATA_ERR_IDNF;
+      }
+      break;
+
+    case 0x40: // READ VERIFY SECTORS
+    case 0x41: // READ VERIFY SECTORS, without retries
+    case 0x42: // READ VERIFY SECTORS EXT
+      if (command == 0x42) {
+        lba = fis[4] | (fis[5] << 8) | (fis[6] << 16) | ((Bit64u)fis[8] << 24) |
+              ((Bit64u)fis[9] << 32) | ((Bit64u)fis[10] << 40);
+        count = fis[12] | (fis[13] << 8);
+        if (count == 0) count = 65536;
+      } else {
+        lba = fis[4] | (fis[5] << 8) | (fis[6] << 16) | ((fis[7] & 0x0f) << 24);
+        count = fis[12];
+        if (count == 0) count = 256;
+      }
+      if ((lba > port->capacity) || (count > (port->capacity - lba))) {
+        *status = ATA_STAT_OK | ATA_STAT_ERR;
+        *error = ATA_ERR_IDNF;
+      }
+      break;
+
+    case 0xc6: // SET MULTIPLE MODE
+      if ((fis[12] > AHCI_MAX_MULTIPLE) || (fis[12] & (fis[12] - 1))) {
+        *status = ATA_STAT_OK | ATA_STAT_ERR;
+        *error = ATA_ERR_ABRT;
+      } else {
+        port->multiple_sectors = fis[12];
+      }
+      break;
+
+    case 0x90: // EXECUTE DEVICE DIAGNOSTIC
+      *error = 0x01;
+      break;
+
+    case 0xe7: // FLUSH CACHE
+    case 0xea: // FLUSH CACHE EXT
+      // the image data is written through, nothing to do
+    case 0xef: // SET FEATURES
+    case 0x91: // INITIALIZE DRIVE PARAMETERS
+    case 0x10: // RECALIBRATE
+    case 0x70: // SEEK
+    case 0xe5: // CHECK POWER MODE
+    case 0xe0: // STANDBY IMMEDIATE
+    case 0xe1: // IDLE IMMEDIATE
+    case 0xe2: // STANDBY
+    case 0xe3: // IDLE
+      break;
+
+    default:
+      BX_DEBUG(("port %d: ATA command 0x%02x not supported", p, command));
+      *status = ATA_STAT_OK | ATA_STAT_ERR;
+      *error = ATA_ERR_ABRT;
+  }
+}
+
+void bx_ahci_c::atapi_set_sense(unsigned p, Bit8u key, Bit8u asc)
+{
+  BX_AHCI_THIS s.port[p].sense_key = key;
+  BX_AHCI_THIS s.port[p].asc = asc;
+}
+
+void bx_ahci_c::atapi_command(unsigned p, const Bit8u *acmd, Bit32u prd_bytes, Bit32u *xfer,
+                              Bit8u *status, Bit8u *error)
+{
+  ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+  Bit8u *buf = BX_AHCI_THIS buffer;
+  Bit32u len = 0, alloc_len = 0, lba, count;
+  int blocksize = 2048;
+  bool check = 0;
+
+  *xfer = 0;
+  BX_DEBUG(("port %d: ATAPI command 0x%02x", p, acmd[0]));
+  switch (acmd[0]) {
+    case 0x00: // test unit ready
+      if (!port->cd_ready) {
+        BX_AHCI_THIS atapi_set_sense(p, SENSE_NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+        check = 1;
+      }
+      break;
+
+    case 0x03: // request sense
+      memset(buf, 0, 18);
+      buf[0] = 0x70 | (1 << 7);
+      buf[2] = port->sense_key;
+      buf[7] = 17 - 7;
+      buf[12] = port->asc;
+      len = 18;
+      alloc_len = acmd[4];
+      BX_AHCI_THIS atapi_set_sense(p, SENSE_NONE, 0);
+      break;
+
+    case 0x12: // inquiry
+      memset(buf, 0, 36);
+      buf[0] = 0x05; // CD-ROM
+      buf[1] = 0x80; // Removable
+      buf[3] = 0x21; // ATAPI-2, as specified
+      buf[4] = 31;   // additional length (total 36)
+      memcpy(&buf[8], "BOCHS   ", 8);
+      memcpy(&buf[16], "SATA CD-ROM     ", 16);
+      memcpy(&buf[32], "1.0 ", 4);
+      len = 36;
+      alloc_len = acmd[4];
+      break;
+
+    case 0x1a: // mode sense (6)
+    case 0x5a: // mode sense (10)
+      {
+        Bit8u page = acmd[2] & 0x3f;
+        unsigned hdr_len = (acmd[0] == 0x5a) ? 8 : 4;
+        if ((acmd[2] >> 6) == 3) {
+          BX_AHCI_THIS atapi_set_sense(p, SENSE_ILLEGAL_REQUEST, 0x39);
+          check = 1;
+          break;
+        }
+        memset(buf, 0, 64);
+        len = hdr_len;
+        if ((page == 0x01) || (page == 0x3f)) {
+          // error recovery
+          buf[len] = 0x01;
+          buf[len + 1] = 0x06;
+          buf[len + 3] = 0x05; // read retry count
+          len += 8;
+        }
+        if ((page == 0x2a) || (page == 0x3f)) {
+          // CD-ROM capabilities & mech. status
+          buf[len] = 0x2a;
+          buf[len + 1] = 0x12;
+          buf[len + 2] = 0x03;
+          buf[len + 4] = 0x71;
+          buf[len + 5] = 3 << 5;
+          buf[len + 6] = 1 | (port->cd_ready ? (1 << 1) : 0) | (1 << 3) | (1 << 5);
+          buf[len + 7] = 0;
+          buf[len + 8] = (16 * 176) >> 8;
+          buf[len + 9] = (16 * 176) & 0xff;
+          buf[len + 11] = 2;
+          buf[len + 12] = 2 >> 8;
+          buf[len + 13] = 0;
+          buf[len + 14] = (16 * 176) >> 8;
+          buf[len + 15] = (16 * 176) & 0xff;
+          len += 20;
+        }
+        if (len == hdr_len) {
+          BX_AHCI_THIS atapi_set_sense(p, SENSE_ILLEGAL_REQUEST, ASC_INV_FIELD_IN_CMD_PACKET);
+          check = 1;
+          break;
+        }
+        if (acmd[0] == 0x5a) {
+          buf[0] = (Bit8u)((len - 2) >> 8);
+          buf[1] = (Bit8u)(len - 2);
+          buf[2] = 0x70; // no media present
+          alloc_len = (acmd[7] << 8) | acmd[8];
+        } else {
+          buf[0] = (Bit8u)(len - 1);
+          buf[1] = 0x70;
+          alloc_len = acmd[4];
+        }
+      }
+      break;
+
+    case 0x1b: // start stop unit
+      if ((acmd[4] & 0x03) == 0x02) {
+        // eject the disc
+        if (port->cd_ready) {
+          cdrom[p]->eject_cdrom();
+          port->cd_ready = 0;
+          port->media_changed = 1;
+        }
+      } else if ((acmd[4] & 0x03) == 0x01) {
+        cdrom[p]->start_cdrom();
+      }
+      break;
+
+    case 0x1e: // prevent/allow medium removal
+      break;
+
+    case 0x25: // read cd-rom capacity
+      if (!port->cd_ready) {
+        BX_AHCI_THIS atapi_set_sense(p, SENSE_NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+        check = 1;
+        break;
+      }
+      lba = (Bit32u)port->capacity - 1;
+      buf[0] = (Bit8u)(lba >> 24);
+      buf[1] = (Bit8u)(lba >> 16);
+      buf[2] = (Bit8u)(lba >> 8);
+      buf[3] = (Bit8u)lba;
+      buf[4] = 0;
+      buf[5] = 0;
+      buf[6] = 2048 >> 8;
+      buf[7] = 0;
+      len = alloc_len = 8;
+      break;
+
+    case 0xbe: // read cd
+    case 0x28: // read (10)
+    case 0xa8: // read (12)
+      if (!port->cd_ready) {
+        BX_AHCI_THIS atapi_set_sense(p, SENSE_NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+        check = 1;
+        break;
+      }
+      lba = (acmd[2] << 24) | (acmd[3] << 16) | (acmd[4] << 8) | acmd[5];
+      if (acmd[0] == 0x28) {
+        count = (acmd[7] << 8) | acmd[8];
+      } else if (acmd[0] == 0xa8) {
+        count = (acmd[6] << 24) | (acmd[7] << 16) | (acmd[8] << 8) | acmd[9];
+      } else {
+        count = (acmd[6] << 16) | (acmd[7] << 8) | acmd[8];
+        if ((acmd[9] & 0xf8) == 0xf8) {
+          blocksize = 2352;
+        } else if ((acmd[9] & 0xf8) == 0x00) {
+          count = 0;
+        } else if ((acmd[9] & 0xf8) != 0x10) {
+          BX_ERROR(("port %d: read cd: unknown format 0x%02x", p, acmd[9]));
+          BX_AHCI_THIS atapi_set_sense(p, SENSE_ILLEGAL_REQUEST, ASC_INV_FIELD_IN_CMD_PACKET);
+          check = 1;
+          break;
+        }
+      }
+      if ((lba > port->capacity) || (count > (port->capacity - lba))) {
+        BX_AHCI_THIS atapi_set_sense(p, SENSE_ILLEGAL_REQUEST, ASC_LOGICAL_BLOCK_OOR);
+        check = 1;
+        break;
+      }
+      if (((Bit64u)count * blocksize) > prd_bytes) {
+        BX_ERROR(("port %d: PRD table too small for %d blocks", p, count));
+        BX_AHCI_THIS atapi_set_sense(p, SENSE_ILLEGAL_REQUEST, ASC_INV_FIELD_IN_CMD_PACKET);
+        check = 1;
+        break;
+      }
+      len = alloc_len = count * blocksize;
+      BX_AHCI_THIS alloc_buffer(len);
+      buf = BX_AHCI_THIS buffer;
+      bx_gui->statusbar_setitem(port->statusbar_id, 1);
+      for (Bit32u i = 0; i < count; i++) {
+        if (!cdrom[p]->read_block(buf + i * blocksize, lba + i, blocksize)) {
+          BX_ERROR(("port %d: could not read block %d", p, lba + i));
+          BX_AHCI_THIS atapi_set_sense(p, SENSE_ILLEGAL_REQUEST, ASC_LOGICAL_BLOCK_OOR);
+          check = 1;
+          break;
+        }
+      }
+      break;
+
+    case 0x2b: // seek
+      if (!port->cd_ready) {
+        BX_AHCI_THIS atapi_set_sense(p, SENSE_NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+        check = 1;
+      }
+      break;
+
+    case 0x43: // read toc
+      if (!port->cd_ready) {
+        BX_AHCI_THIS atapi_set_sense(p, SENSE_NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+        check = 1;
+      } else {
+        bool msf = (acmd[1] >> 1) & 1;
+        int toc_length = 0;
+        Bit8u format = acmd[9] >> 6;
+        if ((format > 2) ||
+            !cdrom[p]->read_toc(buf, &toc_length, msf, acmd[6], format)) {
+          BX_AHCI_THIS atapi_set_sense(p, SENSE_ILLEGAL_REQUEST, ASC_INV_FIELD_IN_CMD_PACKET);
+          check = 1;
+        } else {
+          len = toc_length;
+          alloc_len = (acmd[7] << 8) | acmd[8];
+        }
+      }
+      break;
+
+    case 0x4a: // get event status notification
+      if (!(acmd[1] & 0x01)) {
+        // only the polled mode is supported
+        BX_AHCI_THIS atapi_set_sense(p, SENSE_ILLEGAL_REQUEST, ASC_INV_FIELD_IN_CMD_PACKET);
+        check = 1;
+        break;
+      }
+      memset(buf, 0, 8);
+      buf[3] = (1 << 4); // we only support the MEDIA event (bit 4)
+      if (acmd[4] & (1 << 4)) {
+        buf[1] = 6;
+        buf[2] = 4;
+        buf[4] = !port->media_changed ? 0 : (port->cd_ready ? 4 : 3);
+        buf[5] = port->cd_ready ? (1 << 1) : 0;
+        port->media_changed = 0;
+        len = 8;
+      } else {
+        buf[2] = 0x80;
+        len = 4;
+      }
+      alloc_len = (acmd[7] << 8) | acmd[8];
+      break;
+
+    case 0xbd: // mechanism status
+      memset(buf, 0, 8);
+      buf[5] = 1; // one slot
+      len = 8;
+      alloc_len = (acmd[8] << 8) | acmd[9];
+      break;
+
+    default:
+      BX_DEBUG(("port %d: ATAPI command 0x%02x not supported", p, acmd[0]));
+      BX_AHCI_THIS atapi_set_sense(p, SENSE_ILLEGAL_REQUEST, ASC_ILLEGAL_OPCODE);
+      check = 1;
+  }
+  if (check) {
+    *status = ATA_STAT_DRDY | ATA_STAT_ERR;
+    *error = (port->sense_key << 4) | ATA_ERR_ABRT;
+    return;
+  }
+  if (len > alloc_len) len = alloc_len;
+  if (len > prd_bytes) len = prd_bytes;
+  if (len > 0) {
+    *xfer = BX_AHCI_THIS dma_transfer(len, 0);
+  }
+}
+
+void bx_ahci_c::identify_drive(unsigned p, Bit16u *id)
+{
+  const char *serial = "BXSATA00000         ";
+  const char *firmware = "1.0     ";
+  const char *model = "BOCHS SATA HARDDISK                     ";
+  Bit64u num_sects = BX_AHCI_THIS s.port[p].capacity;
+  unsigned i;
+
+  memset(id, 0, 512);
+  id[0] = 0x0040;
+  id[1] = hdimage[p]->cylinders;
+  id[3] = hdimage[p]->heads;
+  id[6] = hdimage[p]->spt;
+  for (i = 0; i < 10; i++) {
+    id[10 + i] = (serial[i * 2] << 8) | serial[i * 2 + 1];
+  }
+  id[10 + 4] = (id[10 + 4] & 0xff00) | ('0' + p);
+  id[20] = 3;
+  id[21] = 512;
+  for (i = 0; i < 4; i++) {
+    id[23 + i] = (firmware[i * 2] << 8) | firmware[i * 2 + 1];
+  }
+  for (i = 0; i < 20; i++) {
+    id[27 + i] = (model[i * 2] << 8) | model[i * 2 + 1];
+  }
+  id[47] = 0x8000 | AHCI_MAX_MULTIPLE;
+  id[49] = (1 << 9) | (1 << 8); // LBA and DMA
+  id[53] = 0x07;
+  id[54] = id[1];
+  id[55] = id[3];
+  id[56] = id[6];
+  Bit32u chs_sects = (Bit32u)id[1] * id[3] * id[6];
+  id[57] = (Bit16u)chs_sects;
+  id[58] = (Bit16u)(chs_sects >> 16);
+  if (BX_AHCI_THIS s.port[p].multiple_sectors > 0) {
+    id[59] = 0x0100 | BX_AHCI_THIS s.port[p].multiple_sectors;
+  }
+  Bit32u lba28 = (num_sects > 0x0fffffff) ? 0x0fffffff : (Bit32u)num_sects;
+  id[60] = (Bit16u)lba28;
+  id[61] = (Bit16u)(lba28 >> 16);
+  id[63] = 0x07;
+  id[64] = 0x03;
+  for (i = 65; i <= 68; i++)
+    id[i] = 120;
+  // Word 75: queue depth - 1
+  id[75] = AHCI_MAX_CMDS - 1;
+  // Word 76: SATA capabilities (NCQ, Gen1 and Gen2 speed)
+  id[76] = (1 << 8) | (1 << 2) | (1 << 1);
+  id[80] = 0x7e;
+  id[82] = (1 << 14) | (1 << 5);
+  id[83] = (1 << 14) | (1 << 13) | (1 << 12) | (1 << 10);
+  id[84] = 1 << 14;
+  id[85] = (1 << 14) | (1 << 5);
+  id[86] = (1 << 13) | (1 << 12) | (1 << 10);
+  id[87] = 1 << 14;
+  id[88] = 0x3f | (1 << 13); // UDMA mode 5 selected
+  id[100] = (Bit16u)num_sects;
+  id[101] = (Bit16u)(num_sects >> 16);
+  id[102] = (Bit16u)(num_sects >> 32);
+  id[103] = (Bit16u)(num_sects >> 48);
+}
+
+void bx_ahci_c::identify_atapi(unsigned p, Bit16u *id)
+{
+  const char *serial = "BXSATACD0000        ";
+  const char *firmware = "1.0     ";
+  const char *model = "BOCHS SATA CD-ROM                       ";
+  unsigned i;
+
+  memset(id, 0, 512);
+  id[0] = (2 << 14) | (5 << 8) | (1 << 7) | (2 << 5); // Removable CDROM, 12 byte packets
+  for (i = 0; i < 10; i++) {
+    id[10 + i] = (serial[i * 2] << 8) | serial[i * 2 + 1];
+  }
+  id[10 + 5] = (id[10 + 5] & 0xff00) | ('0' + p);
+  for (i = 0; i < 4; i++) {
+    id[23 + i] = (firmware[i * 2] << 8) | firmware[i * 2 + 1];
+  }
+  for (i = 0; i < 20; i++) {
+    id[27 + i] = (model[i * 2] << 8) | model[i * 2 + 1];
+  }
+  id[49] = (1 << 9) | (1 << 8); // LBA and DMA
+  id[53] = 0x07;
+  id[63] = 0x07;
+  id[64] = 0x03;
+  id[65] = 0x00b4;
+  id[66] = 0x00b4;
+  id[67] = 0x012c;
+  id[68] = 0x00b4;
+  id[71] = 30;
+  id[72] = 30;
+  id[76] = (1 << 2) | (1 << 1);
+  id[80] = 0x1e;
+  id[88] = 0x3f | (1 << 13);
+}
+
+Bit32u bx_ahci_c::read_port_reg(unsigned p, Bit32u reg)
+{
+  ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+
+  switch (reg) {
+    case PORT_CLB:  return port->clb;
+    case PORT_CLBU: return port->clbu;
+    case PORT_FB:   return port->fb;
+    case PORT_FBU:  return port->fbu;
+    case PORT_IS:   return port->is;
+    case PORT_IE:   return port->ie;
+    case PORT_CMD:  return port->cmd;
+    case PORT_TFD:  return port->tfd;
+    case PORT_SIG:  return port->sig;
+    case PORT_SSTS: return port->ssts;
+    case PORT_SCTL: return port->sctl;
+    case PORT_SERR: return port->serr;
+    case PORT_SACT: return port->sact;
+    case PORT_CI:   return port->ci;
+    case PORT_SNTF: return port->sntf;
+  }
+  return 0;
+}
+
+void bx_ahci_c::write_port_reg(unsigned p, Bit32u reg, Bit32u value)
+{
+  ahci_port_t *port = &BX_AHCI_THIS s.port[p];
+  Bit32u oldval;
+
+  switch (reg) {
+    case PORT_CLB:
+      port->clb = value & ~0x3ff;
+      break;
+    case PORT_CLBU:
+      port->clbu = value;
+      break;
+    case PORT_FB:
+      port->fb = value & ~0xff;
+      break;
+    case PORT_FBU:
+      port->fbu = value;
+      break;
+    case PORT_IS:
+      // the connect change bit is cleared with SERR.DIAG.X
+      port->is &= ~(value & ~(PORT_IRQ_CONNECT | PORT_IRQ_PHYRDY));
+      BX_AHCI_THIS update_irq();
+      break;
+    case PORT_IE:
+      port->ie = value & PORT_IRQ_MASK;
+      BX_AHCI_THIS update_irq();
+      break;
+    case PORT_CMD:
+      oldval = port->cmd;
+      port->cmd = (oldval & ~PORT_CMD_WRITABLE) | (value & PORT_CMD_WRITABLE);
+      port->cmd &= ~PORT_CMD_ICC_MASK;
+      if (port->cmd & PORT_CMD_CLO) {
+        port->tfd &= ~(ATA_STAT_BSY | ATA_STAT_DRQ);
+        port->cmd &= ~PORT_CMD_CLO;
+      }
+      if (port->cmd & PORT_CMD_FRE) {
+        port->cmd |= PORT_CMD_FR;
+        if (!(oldval & PORT_CMD_FRE) && (port->type != AHCI_DEV_NONE)) {
+          BX_AHCI_THIS post_signature(p);
+        }
+      } else {
+        port->cmd &= ~PORT_CMD_FR;
+      }
+      if (port->cmd & PORT_CMD_ST) {
+        port->cmd |= PORT_CMD_CR;
+      } else if (oldval & PORT_CMD_ST) {
+        // stopping the command list engine drops all outstanding commands
+        port->cmd &= ~(PORT_CMD_CR | 0x1f00);
+        port->ci = 0;
+        port->sact = 0;
+      }
+      if (port->ci != 0) {
+        BX_AHCI_THIS process_commands(p);
+      }
+      break;
+    case PORT_SCTL:
+      oldval = port->sctl;
+      port->sctl = value & 0xfff;
+      if ((port->sctl & 0x0f) == 1) {
+        // COMRESET asserted, the link is down
+        port->ssts = 0;
+      } else if ((oldval & 0x0f) == 1) {
+        BX_AHCI_THIS port_reset(p);
+        if (port->type != AHCI_DEV_NONE) {
+          port->serr |= SERR_DIAG_X;
+          port->is |= PORT_IRQ_CONNECT;
+          BX_AHCI_THIS post_signature(p);
+        }
+        BX_AHCI_THIS update_irq();
+      }
+      break;
+    case PORT_SERR:
+      port->serr &= ~value;
+      if (!(port->serr & SERR_DIAG_X)) {
+        port->is &= ~PORT_IRQ_CONNECT;
+      }
+      BX_AHCI_THIS update_irq();
+      break;
+    case PORT_SACT:
+      if (port->cmd & PORT_CMD_ST) {
+        port->sact |= value;
+      }
+      break;
+    case PORT_CI:
+      // the doorbell: execute all the commands issued so far
+      if (port->cmd & PORT_CMD_ST) {
+        port->ci |= value;
+        BX_AHCI_THIS process_commands(p);
+      }
+      break;
+    case PORT_SNTF:
+      port->sntf &= ~value;
+      break;
+    default:
+      BX_DEBUG(("port %d: write to read-only register 0x%02x ignored", p, reg));
+  }
+}
+
+Bit32u bx_ahci_c::read_reg(Bit32u offset)
+{
+  Bit32u value = 0;
+
+  if (offset >= AHCI_PORT_BASE) {
+    unsigned p = (offset - AHCI_PORT_BASE) / AHCI_PORT_SIZE;
+    if (p < AHCI_MAX_PORTS) {
+      value = BX_AHCI_THIS read_port_reg(p, (offset - AHCI_PORT_BASE) % AHCI_PORT_SIZE);
+    }
+    return value;
+  }
+  switch (offset) {
+    case AHCI_CAP:
+      value = AHCI_CAP_S64A | AHCI_CAP_SNCQ | AHCI_CAP_SCLO | AHCI_CAP_ISS_GEN2 |
+              AHCI_CAP_SAM | ((AHCI_MAX_CMDS - 1) << 8) | (AHCI_MAX_PORTS - 1);
+      break;
+    case AHCI_GHC:
+      value = BX_AHCI_THIS s.ghc;
+      break;
+    case AHCI_IS:
+      value = BX_AHCI_THIS s.is;
+      break;
+    case AHCI_PI:
+      value = (1 << AHCI_MAX_PORTS) - 1;
+      break;
+    case AHCI_VS:
+      value = 0x00010300; // 1.3
+      break;
+  }
+  return value;
+}
+
+// 'mask' selects the bytes written by the guest
+void bx_ahci_c::write_reg(Bit32u offset, Bit32u value, Bit32u mask)
+{
+  if (offset >= AHCI_PORT_BASE) {
+    unsigned p = (offset - AHCI_PORT_BASE) / AHCI_PORT_SIZE;
+    Bit32u reg = (offset - AHCI_PORT_BASE) % AHCI_PORT_SIZE;
+    if (p < AHCI_MAX_PORTS) {
+      if ((reg == PORT_IS) || (reg == PORT_SERR) || (reg == PORT_SACT) ||
+          (reg == PORT_CI) || (reg == PORT_SNTF)) {
+        value &= mask;
+      } else {
+        value = (BX_AHCI_THIS read_port_reg(p, reg) & ~mask) | (value & mask);
+      }
+      BX_AHCI_THIS write_port_reg(p, reg, value);
+    }
+    return;
+  }
+  switch (offset) {
+    case AHCI_GHC:
+      value = (BX_AHCI_THIS s.ghc & ~mask) | (value & mask);
+      if (value & AHCI_GHC_HR) {
+        BX_DEBUG(("HBA reset"));
+        BX_AHCI_THIS hba_reset();
+      } else {
+        BX_AHCI_THIS s.ghc = (value & AHCI_GHC_IE) | AHCI_GHC_AE;
+        BX_AHCI_THIS update_irq();
+      }
+      break;
+    case AHCI_IS:
+      BX_AHCI_THIS s.is &= ~(value & mask);
+      BX_AHCI_THIS update_irq();
+      break;
+    default:
+      BX_DEBUG(("write to read-only register 0x%02x ignored", offset));
+  }
+}
+
+bool bx_ahci_c::mem_read_handler(bx_phy_address addr, unsigned len,
+                                 void *data, void *param)
+{
+  bx_ahci_c *class_ptr = (bx_ahci_c *) param;
+
+  return class_ptr->mem_read(addr, len, data);
+}
+
+bool bx_ahci_c::mem_read(bx_phy_address addr, unsigned len, void *data)
+{
+  Bit8u *data_ptr = (Bit8u*) data;
+  Bit32u offset = (Bit32u)(addr - BX_AHCI_THIS pci_bar[5].addr);
+
+  for (unsigned i = 0; i < len; ) {
+    Bit32u value = BX_AHCI_THIS read_reg((offset + i) & ~3);
+    for (unsigned b = (offset + i) & 3; (b < 4) && (i < len); b++, i++) {
+      data_ptr[i] = (Bit8u)(value >> (b * 8));
+    }
+  }
+  return 1;
+}
+
+bool bx_ahci_c::mem_write_handler(bx_phy_address addr, unsigned len,
+                                  void *data, void *param)
+{
+  bx_ahci_c *class_ptr = (bx_ahci_c *) param;
+
+  return class_ptr->mem_write(addr, len, data);
+}
+
+bool bx_ahci_c::mem_write(bx_phy_address addr, unsigned len, void *data)
+{
+  Bit8u *data_ptr = (Bit8u*) data;
+  Bit32u offset = (Bit32u)(addr - BX_AHCI_THIS pci_bar[5].addr);
+
+  for (unsigned i = 0; i < len; ) {
+    Bit32u value = 0, mask = 0;
+    Bit32u reg = (offset + i) & ~3;
+    for (unsigned b = (offset + i) & 3; (b < 4) && (i < len); b++, i++) {
+      value |= (Bit32u)data_ptr[i] << (b * 8);
+      mask |= 0xff << (b * 8);
+    }
+    BX_AHCI_THIS write_reg(reg, value, mask);
+  }
+  return 1;
+}
+
+// pci configuration space write callback handler
+void bx_ahci_c::pci_write_handler(Bit8u address, Bit32u value, unsigned io_len)
+{
+  Bit8u value8, oldval;
+
+  if ((address >= 0x10) && (address < 0x34))
+    return;
+
+  BX_DEBUG_PCI_WRITE(address, value, io_len);
+  for (unsigned i=0; i<io_len; i++) {
+    value8 = (value >> (i*8)) & 0xFF;
+    oldval = BX_AHCI_THIS pci_conf[address+i];
+    switch (address+i) {
+      case 0x04:
+        value8 &= 0x06;
+        break;
+      case 0x84: // power management control / status
+        value8 &= 0x03;
+        break;
+      default:
+        value8 = oldval;
+    }
+    BX_AHCI_THIS pci_conf[address+i] = value8;
+  }
+}
+
+#endif // BX_SUPPORT_PCI && BX_SUPPORT_AHCI
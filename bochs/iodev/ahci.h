@@ -0,0 +1,132 @@
+/////////////////////////////////////////////////////////////////////////
+// $Id$
+/////////////////////////////////////////////////////////////////////////
+//
+//  Copyright (C) 2021  The Bochs Project
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef BX_IODEV_AHCI_H
+#define BX_IODEV_AHCI_H
+
+#define BX_AHCI_THIS this->
+#define BX_AHCI_THIS_PTR this
+
+#define AHCI_MAX_PORTS      4
+#define AHCI_MAX_CMDS       32
+#define AHCI_ABAR_SIZE      0x1000
+
+#define AHCI_DEV_NONE       0
+#define AHCI_DEV_DISK       1
+#define AHCI_DEV_CDROM      2
+
+class device_image_t;
+class cdrom_base_c;
+
+typedef struct {
+  // port registers
+  Bit32u clb;
+  Bit32u clbu;
+  Bit32u fb;
+  Bit32u fbu;
+  Bit32u is;
+  Bit32u ie;
+  Bit32u cmd;
+  Bit32u tfd;
+  Bit32u sig;
+  Bit32u ssts;
+  Bit32u sctl;
+  Bit32u serr;
+  Bit32u sact;
+  Bit32u ci;
+  Bit32u sntf;
+
+  // attached device
+  Bit8u  type;
+  Bit8u  multiple_sectors;
+  Bit8u  sense_key;
+  Bit8u  asc;
+  bool   cd_ready;
+  bool   media_changed;
+  Bit64u capacity;        // in sectors (disk) or 2048 byte blocks (cdrom)
+  int    statusbar_id;
+} ahci_port_t;
+
+typedef struct {
+  Bit8u  devfunc;
+  // global HBA registers
+  Bit32u ghc;
+  Bit32u is;
+  ahci_port_t port[AHCI_MAX_PORTS];
+} bx_ahci_t;
+
+class bx_ahci_c : public bx_pci_device_c {
+public:
+  bx_ahci_c();
+  virtual ~bx_ahci_c();
+  virtual void init(void);
+  virtual void reset(unsigned type);
+  virtual void register_state(void);
+  virtual void after_restore_state(void);
+
+  virtual void pci_write_handler(Bit8u address, Bit32u value, unsigned io_len);
+
+private:
+  bx_ahci_t s;
+
+  device_image_t *hdimage[AHCI_MAX_PORTS];
+  cdrom_base_c *cdrom[AHCI_MAX_PORTS];
+  Bit8u  *buffer;
+  Bit32u buffer_size;
+  bx_dma_segment *dma_sg;
+  unsigned dma_sg_size;
+  unsigned dma_sg_count;
+
+  void hba_reset(void);
+  void port_reset(unsigned p);
+  void device_reset(unsigned p);
+  void update_irq(void);
+
+  void process_commands(unsigned p);
+  bool execute_command(unsigned p, unsigned slot, Bit32u *ncq_done);
+  Bit32u get_prdt(Bit64u ctba, unsigned prdtl, bool *prd_irq);
+  Bit32u dma_transfer(Bit32u len, bool write);
+  void alloc_buffer(Bit32u size);
+
+  void ata_command(unsigned p, const Bit8u *fis, Bit32u prd_bytes, Bit32u *xfer, Bit8u *status, Bit8u *error);
+  bool disk_rw(unsigned p, Bit64u lba, Bit32u count, bool write, Bit32u prd_bytes, Bit32u *xfer);
+  void atapi_command(unsigned p, const Bit8u *acmd, Bit32u prd_bytes, Bit32u *xfer, Bit8u *status, Bit8u *error);
+  void atapi_set_sense(unsigned p, Bit8u key, Bit8u asc);
+  void identify_drive(unsigned p, Bit16u *id);
+  void identify_atapi(unsigned p, Bit16u *id);
+
+  void post_fis(unsigned p, Bit32u offset, const Bit8u *fis, unsigned len);
+  void post_d2h_fis(unsigned p, Bit8u status, Bit8u error, const Bit8u *cfis, bool irq);
+  void post_signature(unsigned p);
+
+  Bit32u read_port_reg(unsigned p, Bit32u reg);
+  void write_port_reg(unsigned p, Bit32u reg, Bit32u value);
+  Bit32u read_reg(Bit32u offset);
+  void write_reg(Bit32u offset, Bit32u value, Bit32u mask);
+
+  static bool mem_read_handler(bx_phy_address addr, unsigned len, void *data, void *param);
+  static bool mem_write_handler(bx_phy_address addr, unsigned len, void *data, void *param);
+  bool mem_read(bx_phy_address addr, unsigned len, void *data);
+  bool mem_write(bx_phy_address addr, unsigned len, void *data);
+};
+
+#endif
@@ -414,6 +414,11 @@ void bx_devices_c::after_restore_state()
   bx_plugins_after_restore_state();
 }
 
+void bx_devices_c::after_clone(unsigned clone_id)
+{
+  bx_plugins_after_clone(clone_id);
+}
+
 void bx_devices_c::exit()
 {
   // delete i/o handlers before unloading plugins
@@ -1045,6 +1050,9 @@ bx_devices_c::inp(Bit16u addr, unsigned io_len)
   struct io_handler_struct *io_read_handler;
   Bit32u ret;
 
+  // the devices are not thread safe
+  BX_SMP_GUARD();
+
   BX_INSTR_INP(addr, io_len);
 
   io_read_handler = read_port_to_handler[addr];
@@ -1077,6 +1085,8 @@ bx_devices_c::outp(Bit16u addr, Bit32u value, unsigned io_len)
 {
   struct io_handler_struct *io_write_handler;
 
+  BX_SMP_GUARD();
+
   BX_INSTR_OUTP(addr, io_len, value);
   BX_DBG_IO_REPORT(addr, io_len, BX_WRITE, value);
 
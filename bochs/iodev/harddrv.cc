@@ -29,9 +29,9 @@
 #define BX_PLUGGABLE
 
 #include "iodev.h"
-#include "harddrv.h"
 #include "hdimage/hdimage.h"
 #include "hdimage/cdrom.h"
+#include "harddrv.h"
 
 #define LOG_THIS theHardDrive->
 
@@ -39,6 +39,11 @@
 
 #define INDEX_PULSE_CYCLE 10
 
+// interval of polling the asynchronous image requests (usec)
+#define AIO_POLL_INTERVAL 100
+// maximum amount of data read ahead for a READ DMA command
+#define AIO_MAX_READ_AHEAD (4 * 1024 * 1024)
+
 #define PACKET_SIZE 12
 
 // some packet handling macros
@@ -135,6 +140,11 @@ bx_hard_drive_c::bx_hard_drive_c()
       channels[channel].drives[device].cdrom.cd = NULL;
       channels[channel].drives[device].seek_timer_index = BX_NULL_TIMER_HANDLE;
       channels[channel].drives[device].statusbar_id = -1;
+      channels[channel].drives[device].async = 0;
+      channels[channel].drives[device].aio.state = HDIMAGE_AIO_IDLE;
+      channels[channel].drives[device].aio_buffer = NULL;
+      channels[channel].drives[device].aio_buffer_size = 0;
+      channels[channel].drives[device].aio_sectors = 0;
     }
   }
   rt_conf_id = -1;
@@ -149,6 +159,7 @@ bx_hard_drive_c::~bx_hard_drive_c()
   for (Bit8u channel=0; channel<BX_MAX_ATA_CHANNEL; channel++) {
     for (Bit8u device=0; device<2; device ++) {
       if (channels[channel].drives[device].hdimage != NULL) {
+        channels[channel].drives[device].hdimage->aio_wait();
         channels[channel].drives[device].hdimage->close();
         delete channels[channel].drives[device].hdimage;
         channels[channel].drives[device].hdimage = NULL;
@@ -160,6 +171,7 @@ bx_hard_drive_c::~bx_hard_drive_c()
       if (channels[channel].drives[device].controller.buffer != NULL) {
         delete [] channels[channel].drives[device].controller.buffer;
       }
+      delete [] channels[channel].drives[device].aio_buffer;
       sprintf(ata_name, "ata.%d.%s", channel, (device==0)?"master":"slave");
       base = (bx_list_c*) SIM->get_param(ata_name);
       SIM->get_param_string("path", base)->set_handler(NULL);
@@ -368,6 +380,10 @@ void bx_hard_drive_c::init(void)
         BX_HD_THIS channels[channel].drives[device].controller.buffer_total_size =
           MAX_MULTIPLE_SECTORS * sect_size;
         BX_HD_THIS channels[channel].drives[device].sect_size = sect_size;
+        BX_HD_THIS channels[channel].drives[device].async = SIM->get_param_bool("async", base)->get();
+        if (BX_HD_THIS channels[channel].drives[device].async) {
+          BX_INFO(("ata%d-%d: asynchronous image I/O enabled", channel, device));
+        }
       } else if (SIM->get_param_enum("type", base)->get() == BX_ATA_DEVICE_CDROM) {
         bx_list_c *cdrom_rt = (bx_list_c*)SIM->get_param(BXPN_MENU_RUNTIME_CDROM);
         sprintf(pname, "cdrom%d", BX_HD_THIS cdrom_count + 1);
@@ -576,6 +592,8 @@ void bx_hard_drive_c::reset(unsigned type)
   for (unsigned channel=0; channel<BX_MAX_ATA_CHANNEL; channel++) {
     if (BX_HD_THIS channels[channel].irq)
       DEV_pic_lower_irq(BX_HD_THIS channels[channel].irq);
+    BX_DRIVE(channel, 0).aio_sectors = 0;
+    BX_DRIVE(channel, 1).aio_sectors = 0;
   }
 }
 
@@ -651,6 +669,41 @@ void bx_hard_drive_c::register_state(void)
   }
 }
 
+// The parent and the clones share the disk images after a fork clone. Each
+// of them continues with a private volatile redolog on top of its image, so
+// the shared part is never written again.
+void bx_hard_drive_c::after_clone(unsigned clone_id)
+{
+  char ata_name[20], dname[32];
+  bx_list_c *base, *drive;
+
+  for (Bit8u channel=0; channel<BX_MAX_ATA_CHANNEL; channel++) {
+    for (Bit8u device=0; device<2; device++) {
+      device_image_t *image = BX_HD_THIS channels[channel].drives[device].hdimage;
+      if (!BX_DRIVE_IS_HD(channel, device) || (image == NULL)) continue;
+      sprintf(ata_name, "ata.%d.%s", channel, (device==0)?"master":"slave");
+      base = (bx_list_c*) SIM->get_param(ata_name);
+      volatile_image_t *overlay = new volatile_image_t(NULL);
+      overlay->cylinders = image->cylinders;
+      overlay->heads = image->heads;
+      overlay->spt = image->spt;
+      if (overlay->attach(image, SIM->get_param_string("path", base)->getptr()) < 0) {
+        BX_PANIC(("ata%d-%d: could not create the redolog of clone %u", channel, device, clone_id));
+        delete overlay;
+        continue;
+      }
+      BX_HD_THIS channels[channel].drives[device].hdimage = overlay;
+      // save/restore the redolog of the overlay from now on
+      sprintf(dname, "hard_drive.%d.drive%d", channel, device);
+      drive = (bx_list_c*) SIM->get_param(dname, SIM->get_bochs_root());
+      if (drive != NULL) {
+        drive->remove("image");
+        overlay->register_state(drive);
+      }
+    }
+  }
+}
+
 void bx_hard_drive_c::seek_timer_handler(void *this_ptr)
 {
   bx_hard_drive_c *class_ptr = (bx_hard_drive_c *) this_ptr;
@@ -681,6 +734,17 @@ void bx_hard_drive_c::seek_timer()
         break;
       case 0x25: // READ DMA EXT
       case 0xC8: // READ DMA
+        if ((BX_DRIVE(channel, device).aio.state == HDIMAGE_AIO_PENDING) &&
+            !BX_DRIVE(channel, device).hdimage->aio_done(&BX_DRIVE(channel, device).aio)) {
+          // the guest keeps running while the sectors are read
+          bx_pc_system.activate_timer(BX_DRIVE(channel, device).seek_timer_index, AIO_POLL_INTERVAL, 0);
+          break;
+        }
+        if ((BX_DRIVE(channel, device).aio_sectors > 0) &&
+            (BX_DRIVE(channel, device).aio.result != (ssize_t) BX_DRIVE(channel, device).aio.count)) {
+          // read them again one by one, the failing sector aborts the command
+          BX_DRIVE(channel, device).aio_sectors = 0;
+        }
         controller->error_register = 0;
         controller->status.busy  = 0;
         controller->status.drive_ready = 1;
@@ -1985,6 +2049,8 @@ void bx_hard_drive_c::write(Bit32u address, Bit32u value, unsigned io_len)
       if ((value & 0xf0) == 0x10)
         value = 0x10;
       controller->status.err = 0;
+      // the sectors read ahead for a previous READ DMA are not used any more
+      BX_SELECTED_DRIVE(channel).aio_sectors = 0;
       switch (value) {
 
         case 0x10: // CALIBRATE DRIVE
@@ -2412,6 +2478,13 @@ void bx_hard_drive_c::write(Bit32u address, Bit32u value, unsigned io_len)
         case 0xE1: // IDLE IMMEDIATE
         case 0xE7: // FLUSH CACHE
         case 0xEA: // FLUSH CACHE EXT
+          if (BX_SELECTED_IS_HD(channel) && BX_SELECTED_DRIVE(channel).async &&
+              !BX_SELECTED_DRIVE(channel).hdimage->aio_wait()) {
+            BX_ERROR(("ata%d-%d: asynchronous write to the image failed",
+                      channel, BX_SLAVE_SELECTED(channel)));
+            command_aborted(channel, value);
+            break;
+          }
           controller->status.busy = 0;
           controller->status.drive_ready = 1;
           controller->status.write_fault = 0;
@@ -2467,6 +2540,9 @@ void bx_hard_drive_c::write(Bit32u address, Bit32u value, unsigned io_len)
             controller->status.seek_complete = 0;
             controller->status.drq   = 0;
             controller->status.corrected_data = 0;
+            if (BX_SELECTED_DRIVE(channel).async) {
+              aio_read_ahead(channel, logical_sector);
+            }
             start_seek(channel);
           } else {
             BX_ERROR(("write cmd 0x%02x (READ DMA) not supported", value));
@@ -2616,6 +2692,7 @@ void bx_hard_drive_c::write(Bit32u address, Bit32u value, unsigned io_len)
 
           BX_CONTROLLER(channel,id).current_command = 0x00;
           BX_CONTROLLER(channel,id).buffer_index = 0;
+          BX_DRIVE(channel,id).aio_sectors = 0;
 
           BX_CONTROLLER(channel,id).multiple_sectors  = 0;
           BX_CONTROLLER(channel,id).lba_mode          = 0;
@@ -2680,17 +2757,32 @@ bx_hard_drive_c::calculate_logical_address(Bit8u channel, Bit64s *sector)
   return 1;
 }
 
-  void BX_CPP_AttrRegparmN(2)
-bx_hard_drive_c::increment_address(Bit8u channel, Bit64s *sector)
+bool bx_hard_drive_c::calculate_logical_range(Bit8u channel, Bit64s *sector, Bit32u count)
+{
+  if (!calculate_logical_address(channel, sector))
+    return 0;
+
+  Bit64s sector_count = BX_SELECTED_DRIVE(channel).hdimage->hd_size / BX_SELECTED_DRIVE(channel).sect_size;
+  if ((*sector + count) > sector_count) {
+    BX_ERROR (("logical address out of bounds (" FMT_LL "d/" FMT_LL "d) - aborting command", *sector + count - 1, sector_count));
+    return 0;
+  }
+  return 1;
+}
+
+// Advance the task file registers by count sectors and update the position
+// of the drive. In LBA mode *sector is also updated.
+void bx_hard_drive_c::increment_address(Bit8u channel, Bit64s *sector, Bit32u count)
 {
   controller_t *controller = &BX_SELECTED_CONTROLLER(channel);
 
-  controller->sector_count--;
-  controller->num_sectors--;
+  controller->sector_count -= count;
+  controller->num_sectors -= count;
+  BX_SELECTED_DRIVE(channel).next_lsector = *sector + count;
 
   if (controller->lba_mode) {
     Bit64s logical_sector = *sector;
-    logical_sector++;
+    logical_sector += count;
     if (!controller->lba48) {
       controller->head_no = (Bit8u)((logical_sector >> 24) & 0xf);
       controller->cylinder_no = (Bit16u)((logical_sector >> 8) & 0xffff);
@@ -2704,15 +2796,17 @@ bx_hard_drive_c::increment_address(Bit8u channel, Bit64s *sector)
     }
     *sector = logical_sector;
   } else {
-    controller->sector_no++;
-    if (controller->sector_no > BX_SELECTED_DRIVE(channel).hdimage->spt) {
-      controller->sector_no = 1;
-      controller->head_no++;
-      if (controller->head_no >= BX_SELECTED_DRIVE(channel).hdimage->heads) {
-        controller->head_no = 0;
-        controller->cylinder_no++;
-        if (controller->cylinder_no >= BX_SELECTED_DRIVE(channel).hdimage->cylinders) {
-          controller->cylinder_no = BX_SELECTED_DRIVE(channel).hdimage->cylinders - 1;
+    while (count-- > 0) {
+      controller->sector_no++;
+      if (controller->sector_no > BX_SELECTED_DRIVE(channel).hdimage->spt) {
+        controller->sector_no = 1;
+        controller->head_no++;
+        if (controller->head_no >= BX_SELECTED_DRIVE(channel).hdimage->heads) {
+          controller->head_no = 0;
+          controller->cylinder_no++;
+          if (controller->cylinder_no >= BX_SELECTED_DRIVE(channel).hdimage->cylinders) {
+            controller->cylinder_no = BX_SELECTED_DRIVE(channel).hdimage->cylinders - 1;
+          }
         }
       }
     }
@@ -3376,9 +3470,17 @@ bool bx_hard_drive_c::bmdma_read_sector(Bit8u channel, Bit8u *buffer, Bit32u *se
 
   if ((controller->current_command == 0xC8) ||
       (controller->current_command == 0x25)) {
-    *sector_size = BX_SELECTED_DRIVE(channel).hdimage->sect_size;
+    // as many sectors of the command as fit into the PRD (at least one)
+    Bit32u sect_size = BX_SELECTED_DRIVE(channel).hdimage->sect_size;
+    Bit32u count = *sector_size / sect_size;
     if (controller->num_sectors == 0)
       return 0;
+    if (count == 0) {
+      count = 1;
+    } else if (count > controller->num_sectors) {
+      count = controller->num_sectors;
+    }
+    *sector_size = count * sect_size;
     if (!ide_read_sector(channel, buffer, *sector_size)) {
       return 0;
     }
@@ -3430,7 +3532,7 @@ bool bx_hard_drive_c::bmdma_read_sector(Bit8u channel, Bit8u *buffer, Bit32u *se
   return 1;
 }
 
-bool bx_hard_drive_c::bmdma_write_sector(Bit8u channel, Bit8u *buffer)
+bool bx_hard_drive_c::bmdma_write_sector(Bit8u channel, Bit8u *buffer, Bit32u *sector_size)
 {
   controller_t *controller = &BX_SELECTED_CONTROLLER(channel);
 
@@ -3442,7 +3544,16 @@ bool bx_hard_drive_c::bmdma_write_sector(Bit8u channel, Bit8u *buffer)
   }
   if (controller->num_sectors == 0)
     return 0;
-  if (!ide_write_sector(channel, buffer, BX_SELECTED_DRIVE(channel).sect_size)) {
+  // as many sectors of the command as the bus master has collected
+  Bit32u sect_size = BX_SELECTED_DRIVE(channel).sect_size;
+  Bit32u count = *sector_size / sect_size;
+  if (count == 0) {
+    count = 1;
+  } else if (count > controller->num_sectors) {
+    count = controller->num_sectors;
+  }
+  *sector_size = count * sect_size;
+  if (!ide_write_sector(channel, buffer, *sector_size)) {
     return 0;
   }
   return 1;
@@ -3465,6 +3576,7 @@ void bx_hard_drive_c::bmdma_complete(Bit8u channel)
     controller->status.seek_complete = 1;
     controller->status.corrected_data = 0;
     BX_SELECTED_DRIVE(channel).curr_lsector = BX_SELECTED_DRIVE(channel).next_lsector;
+    BX_SELECTED_DRIVE(channel).aio_sectors = 0;
   }
   raise_interrupt(channel);
 }
@@ -3486,40 +3598,41 @@ void bx_hard_drive_c::set_signature(Bit8u channel, Bit8u id)
   }
 }
 
+// The sectors of one transfer are contiguous on the image, so they are read
+// and written with one image request. The status bar is updated once.
 bool bx_hard_drive_c::ide_read_sector(Bit8u channel, Bit8u *buffer, Bit32u buffer_size)
 {
   controller_t *controller = &BX_SELECTED_CONTROLLER(channel);
 
   Bit64s logical_sector = 0;
-  Bit64s ret;
+  ssize_t ret;
 
   unsigned sect_size = BX_SELECTED_DRIVE(channel).sect_size;
-  int sector_count = (buffer_size / sect_size);
-  Bit8u *bufptr = buffer;
-  do {
-    if (!calculate_logical_address(channel, &logical_sector)) {
-      command_aborted(channel, controller->current_command);
-      return 0;
-    }
-    ret = BX_SELECTED_DRIVE(channel).hdimage->lseek(logical_sector * sect_size, SEEK_SET);
-    if (ret < 0) {
-      BX_ERROR(("could not lseek() hard drive image file"));
-      command_aborted(channel, controller->current_command);
-      return 0;
+  Bit32u sector_count = (buffer_size / sect_size);
+  if (!calculate_logical_range(channel, &logical_sector, sector_count)) {
+    command_aborted(channel, controller->current_command);
+    return 0;
+  }
+  /* set status bar conditions for device */
+  bx_gui->statusbar_setitem(BX_SELECTED_DRIVE(channel).statusbar_id, 1);
+  Bit64u index = (Bit64u)(logical_sector - BX_SELECTED_DRIVE(channel).aio_lsector);
+  if ((BX_SELECTED_DRIVE(channel).aio_sectors > 0) &&
+      (BX_SELECTED_DRIVE(channel).aio.state == HDIMAGE_AIO_DONE) &&
+      (index + sector_count <= BX_SELECTED_DRIVE(channel).aio_sectors)) {
+    // read ahead by the asynchronous request
+    memcpy(buffer, BX_SELECTED_DRIVE(channel).aio_buffer + index * sect_size, sector_count * sect_size);
+  } else {
+    if (BX_SELECTED_DRIVE(channel).async && !BX_SELECTED_DRIVE(channel).hdimage->aio_wait()) {
+      BX_ERROR(("asynchronous write to the hard drive image file failed"));
     }
-    /* set status bar conditions for device */
-    bx_gui->statusbar_setitem(BX_SELECTED_DRIVE(channel).statusbar_id, 1);
-    ret = BX_SELECTED_DRIVE(channel).hdimage->read((bx_ptr_t)bufptr, sect_size);
-    if (ret < sect_size) {
+    ret = BX_SELECTED_DRIVE(channel).hdimage->read_at(logical_sector * sect_size, buffer, sector_count * sect_size);
+    if (ret < (ssize_t)(sector_count * sect_size)) {
       BX_ERROR(("could not read() hard drive image file at byte %lu", (unsigned long)logical_sector*sect_size));
       command_aborted(channel, controller->current_command);
       return 0;
     }
-    increment_address(channel, &logical_sector);
-    BX_SELECTED_DRIVE(channel).next_lsector = logical_sector;
-    bufptr += sect_size;
-  } while (--sector_count > 0);
-
+  }
+  increment_address(channel, &logical_sector, sector_count);
   return 1;
 }
 
@@ -3528,35 +3641,38 @@ bool bx_hard_drive_c::ide_write_sector(Bit8u channel, Bit8u *buffer, Bit32u buff
   controller_t *controller = &BX_SELECTED_CONTROLLER(channel);
 
   Bit64s logical_sector = 0;
-  Bit64s ret;
+  ssize_t ret;
 
   unsigned sect_size = BX_SELECTED_DRIVE(channel).sect_size;
-  int sector_count = (buffer_size / sect_size);
-  Bit8u *bufptr = buffer;
-  do {
-    if (!calculate_logical_address(channel, &logical_sector)) {
-      command_aborted(channel, controller->current_command);
-      return 0;
-    }
-    ret = BX_SELECTED_DRIVE(channel).hdimage->lseek(logical_sector * sect_size, SEEK_SET);
-    if (ret < 0) {
-      BX_ERROR(("could not lseek() hard drive image file at byte %lu", (unsigned long)logical_sector * sect_size));
+  Bit32u sector_count = (buffer_size / sect_size);
+  if (!calculate_logical_range(channel, &logical_sector, sector_count)) {
+    command_aborted(channel, controller->current_command);
+    return 0;
+  }
+  /* set status bar conditions for device */
+  bx_gui->statusbar_setitem(BX_SELECTED_DRIVE(channel).statusbar_id, 1, 1 /* write */);
+  if ((BX_SELECTED_DRIVE(channel).aio_sectors > 0) &&
+      (logical_sector < (Bit64s)(BX_SELECTED_DRIVE(channel).aio_lsector + BX_SELECTED_DRIVE(channel).aio_sectors)) &&
+      ((logical_sector + sector_count) > BX_SELECTED_DRIVE(channel).aio_lsector)) {
+    // the sectors read ahead are overwritten
+    BX_SELECTED_DRIVE(channel).aio_sectors = 0;
+  }
+  if (BX_SELECTED_DRIVE(channel).async) {
+    // written behind, a failure is reported by the next write
+    if (!BX_SELECTED_DRIVE(channel).hdimage->aio_write(logical_sector * sect_size, buffer, sector_count * sect_size)) {
+      BX_ERROR(("asynchronous write to the hard drive image file failed"));
       command_aborted(channel, controller->current_command);
       return 0;
     }
-    /* set status bar conditions for device */
-    bx_gui->statusbar_setitem(BX_SELECTED_DRIVE(channel).statusbar_id, 1, 1 /* write */);
-    ret = BX_SELECTED_DRIVE(channel).hdimage->write((bx_ptr_t)bufptr, sect_size);
-    if (ret < sect_size) {
+  } else {
+    ret = BX_SELECTED_DRIVE(channel).hdimage->write_at(logical_sector * sect_size, buffer, sector_count * sect_size);
+    if (ret < (ssize_t)(sector_count * sect_size)) {
       BX_ERROR(("could not write() hard drive image file at byte %lu", (unsigned long)logical_sector*sect_size));
       command_aborted(channel, controller->current_command);
       return 0;
     }
-    increment_address(channel, &logical_sector);
-    BX_SELECTED_DRIVE(channel).next_lsector = logical_sector;
-    bufptr += sect_size;
-  } while (--sector_count > 0);
-
+  }
+  increment_address(channel, &logical_sector, sector_count);
   return 1;
 }
 
@@ -3601,6 +3717,33 @@ void bx_hard_drive_c::start_seek(Bit8u channel)
     BX_SELECTED_DRIVE(channel).seek_timer_index, seek_time, 0);
 }
 
+// Submit the read of the READ DMA sectors to the image worker thread, the
+// seek timer waits for it and ide_read_sector() copies them from the buffer.
+void bx_hard_drive_c::aio_read_ahead(Bit8u channel, Bit64s logical_sector)
+{
+  controller_t *controller = &BX_SELECTED_CONTROLLER(channel);
+  unsigned sect_size = BX_SELECTED_DRIVE(channel).sect_size;
+  Bit32u sectors = controller->num_sectors;
+
+  // the request and the buffer may be still in use by an aborted command
+  BX_SELECTED_DRIVE(channel).hdimage->aio_wait();
+  BX_SELECTED_DRIVE(channel).aio_sectors = 0;
+  if (sectors > (AIO_MAX_READ_AHEAD / sect_size))
+    sectors = AIO_MAX_READ_AHEAD / sect_size;
+  if ((Bit64u)((logical_sector + sectors) * sect_size) > BX_SELECTED_DRIVE(channel).hdimage->hd_size)
+    return;
+  Bit32u count = sectors * sect_size;
+  if (count > BX_SELECTED_DRIVE(channel).aio_buffer_size) {
+    delete [] BX_SELECTED_DRIVE(channel).aio_buffer;
+    BX_SELECTED_DRIVE(channel).aio_buffer = new Bit8u[count];
+    BX_SELECTED_DRIVE(channel).aio_buffer_size = count;
+  }
+  BX_SELECTED_DRIVE(channel).aio_lsector = logical_sector;
+  BX_SELECTED_DRIVE(channel).aio_sectors = sectors;
+  BX_SELECTED_DRIVE(channel).hdimage->aio_read(logical_sector * sect_size,
+    BX_SELECTED_DRIVE(channel).aio_buffer, count, &BX_SELECTED_DRIVE(channel).aio);
+}
+
 error_recovery_t::error_recovery_t()
 {
   if (sizeof(error_recovery_t) != 8) {
@@ -171,10 +171,11 @@ public:
   virtual void     reset(unsigned type);
 #if BX_SUPPORT_PCI
   virtual bool     bmdma_read_sector(Bit8u channel, Bit8u *buffer, Bit32u *sector_size);
-  virtual bool     bmdma_write_sector(Bit8u channel, Bit8u *buffer);
+  virtual bool     bmdma_write_sector(Bit8u channel, Bit8u *buffer, Bit32u *sector_size);
   virtual void     bmdma_complete(Bit8u channel);
 #endif
   virtual void     register_state(void);
+  virtual void     after_clone(unsigned clone_id);
 
   virtual Bit32u virt_read_handler(Bit32u address, unsigned io_len)
   {
@@ -202,7 +203,8 @@ public:
 private:
 
   BX_HD_SMF bool calculate_logical_address(Bit8u channel, Bit64s *sector) BX_CPP_AttrRegparmN(2);
-  BX_HD_SMF void increment_address(Bit8u channel, Bit64s *sector) BX_CPP_AttrRegparmN(2);
+  BX_HD_SMF bool calculate_logical_range(Bit8u channel, Bit64s *sector, Bit32u count);
+  BX_HD_SMF void increment_address(Bit8u channel, Bit64s *sector, Bit32u count);
   BX_HD_SMF void identify_drive(Bit8u channel);
   BX_HD_SMF void identify_ATAPI_drive(Bit8u channel);
   BX_HD_SMF void command_aborted(Bit8u channel, unsigned command);
@@ -219,6 +221,7 @@ private:
   BX_HD_SMF bool ide_write_sector(Bit8u channel, Bit8u *buffer, Bit32u buffer_size);
   BX_HD_SMF void lba48_transform(controller_t *controller, bool lba48);
   BX_HD_SMF void start_seek(Bit8u channel);
+  BX_HD_SMF void aio_read_ahead(Bit8u channel, Bit64s logical_sector);
 
   BX_HD_SMF bool set_cd_media_status(Bit32u handle, bool status);
 
@@ -249,6 +252,15 @@ private:
       Bit64s next_lsector;
       unsigned sect_size;
 
+      // asynchronous image I/O: the sectors of a READ DMA command are read
+      // ahead while the drive is seeking, the writes are written behind
+      bool async;
+      hdimage_aio_req_t aio;
+      Bit8u *aio_buffer;
+      Bit32u aio_buffer_size;
+      Bit64s aio_lsector;  // first sector in the buffer
+      Bit32u aio_sectors;  // number of sectors read ahead, 0 if none
+
       Bit8u model_no[41];
       int statusbar_id;
       Bit8u device_num; // for ATAPI identify & inquiry
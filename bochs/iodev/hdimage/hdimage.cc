@@ -26,6 +26,7 @@
 #include "misc/bswap.h"
 #else
 #include "bochs.h"
+#include "bxthread.h"
 #include "gui/siminterface.h"
 #include "param_names.h"
 #include "plugin.h"
@@ -70,6 +71,8 @@ const char *builtin_mode_names[n_hdimage_builtin_modes] = {
 
 const char **hdimage_mode_names;
 
+static bool hdimage_cache_enabled(void);
+
 bx_hdimage_ctl_c::bx_hdimage_ctl_c()
 {
   put("hdimage", "IMG");
@@ -170,6 +173,12 @@ device_image_t* bx_hdimage_ctl_c::init_image(const char *image_mode, Bit64u disk
     }
     hdimage = hdimage_locator_c::create(image_mode, disk_size, journal);
   }
+  // vvfat builds the disk from the host directory and the DLL has its own
+  // access method, both are left uncached
+  if ((hdimage != NULL) && strcmp(image_mode, "vvfat") && strcmp(image_mode, "dll") &&
+      hdimage_cache_enabled()) {
+    hdimage = new cached_image_t(hdimage);
+  }
   return hdimage;
 }
 
@@ -490,6 +499,8 @@ Bit64s hdimage_save_handler(void *class_ptr, bx_param_c *param)
     return 0;
   }
   sprintf(path, "%s/%s", SIM->get_param_string(BXPN_RESTORE_PATH)->getptr(), imgname);
+  // the queued writes must be in the image before it is saved
+  ((device_image_t*)class_ptr)->aio_wait();
   return ((device_image_t*)class_ptr)->save_state(path);
 }
 
@@ -619,6 +630,244 @@ bool hdimage_copy_file(const char *src, const char *dst)
 #endif
 }
 
+#ifndef BXIMAGE
+/*** asynchronous image I/O ***/
+
+// Every image using the asynchronous I/O gets a worker thread running its
+// requests in submission order, so the image methods and their state (file
+// offset, metadata caches) are never used by two threads at once. The writes
+// are copied and queued, contiguous queued writes are merged into one request.
+
+// buffer size of a queued write request
+#define HDIMAGE_AIO_WRITE_CHUNK (64 * 1024)
+// aio_write() waits when this much write data is queued
+#define HDIMAGE_AIO_MAX_QUEUED  (16 * 1024 * 1024)
+
+class hdimage_aio_c {
+public:
+  device_image_t *image;
+  BX_THREAD_VAR(thread);
+  BX_MUTEX(mutex);
+  BX_COND(cond);      // signals new requests and completions
+  hdimage_aio_req_t *head, *tail;
+  unsigned pending;   // requests queued or running
+  size_t queued;      // write data not written yet
+  bool stop;
+  bool write_error;
+  bool running;       // the worker thread is started
+  Bit64u reads, writes, merged, polls;
+  hdimage_aio_c *next;
+};
+
+// all workers, only changed by the simulation thread
+static hdimage_aio_c *hdimage_aio_list = NULL;
+
+static BX_THREAD_FUNC(hdimage_aio_thread, indata)
+{
+  hdimage_aio_c *aio = (hdimage_aio_c*) indata;
+  hdimage_aio_req_t *req;
+  ssize_t ret;
+
+  BX_LOCK(aio->mutex);
+  while (1) {
+    while ((aio->head == NULL) && !aio->stop) {
+      BX_COND_WAIT(aio->cond, aio->mutex, 100);
+    }
+    req = aio->head;
+    if (req == NULL) break;
+    aio->head = req->next;
+    // the tail is taken as well, no more writes are merged into it
+    if (aio->head == NULL) aio->tail = NULL;
+    BX_UNLOCK(aio->mutex);
+
+    if (req->write) {
+      ret = aio->image->write_at(req->offset, req->buf, req->count);
+    } else {
+      ret = aio->image->read_at(req->offset, req->buf, req->count);
+    }
+
+    BX_LOCK(aio->mutex);
+    req->result = ret;
+    if (req->write) {
+      if (ret != (ssize_t) req->count) aio->write_error = 1;
+      aio->queued -= req->size;
+      delete [] req->buf;
+      delete req;
+    } else {
+      req->state = HDIMAGE_AIO_DONE;
+    }
+    aio->pending--;
+    BX_COND_BROADCAST(aio->cond);
+  }
+  BX_UNLOCK(aio->mutex);
+  BX_THREAD_EXIT;
+}
+
+#if BX_HAVE_FORK && !defined(WIN32)
+// A fork clone doesn't inherit the worker threads. The fork waits until all
+// queued requests are completed, so the written data is in the images and no
+// request is in flight in the clone. The clone starts its own worker with the
+// next request. The handlers are registered after the ones of the block
+// cache, so the workers are idle before the cache holds its mutex.
+static void hdimage_aio_prepare_fork(void)
+{
+  for (hdimage_aio_c *aio = hdimage_aio_list; aio != NULL; aio = aio->next) {
+    BX_LOCK(aio->mutex);
+    while (aio->pending > 0) {
+      BX_COND_WAIT(aio->cond, aio->mutex, 100);
+    }
+  }
+}
+
+static void hdimage_aio_parent_fork(void)
+{
+  for (hdimage_aio_c *aio = hdimage_aio_list; aio != NULL; aio = aio->next) {
+    BX_UNLOCK(aio->mutex);
+  }
+}
+
+static void hdimage_aio_child_fork(void)
+{
+  for (hdimage_aio_c *aio = hdimage_aio_list; aio != NULL; aio = aio->next) {
+    aio->running = 0;
+    BX_INIT_COND(aio->cond);
+    BX_UNLOCK(aio->mutex);
+  }
+}
+#endif
+
+static hdimage_aio_c *hdimage_aio_start(device_image_t *image)
+{
+  hdimage_aio_c *aio = new hdimage_aio_c;
+
+#if BX_HAVE_FORK && !defined(WIN32)
+  static bool atfork = 0;
+  if (!atfork) {
+    pthread_atfork(hdimage_aio_prepare_fork, hdimage_aio_parent_fork, hdimage_aio_child_fork);
+    atfork = 1;
+  }
+#endif
+  aio->image = image;
+  aio->head = aio->tail = NULL;
+  aio->pending = 0;
+  aio->queued = 0;
+  aio->stop = 0;
+  aio->write_error = 0;
+  aio->running = 0;
+  aio->reads = aio->writes = aio->merged = aio->polls = 0;
+  BX_INIT_MUTEX(aio->mutex);
+  BX_INIT_COND(aio->cond);
+  aio->next = hdimage_aio_list;
+  hdimage_aio_list = aio;
+  return aio;
+}
+
+// called with the lock held
+static void hdimage_aio_queue(hdimage_aio_c *aio, hdimage_aio_req_t *req)
+{
+  req->next = NULL;
+  if (aio->tail != NULL) {
+    aio->tail->next = req;
+  } else {
+    aio->head = req;
+  }
+  aio->tail = req;
+  aio->pending++;
+  if (!aio->running) {
+    aio->running = 1;
+    BX_THREAD_CREATE(hdimage_aio_thread, aio, aio->thread);
+  }
+  BX_COND_BROADCAST(aio->cond);
+}
+
+bool device_image_t::aio_read(Bit64s offset, void *buf, size_t count, hdimage_aio_req_t *req)
+{
+  if (aio == NULL) {
+    aio = hdimage_aio_start(this);
+  }
+  req->offset = offset;
+  req->buf = (Bit8u*) buf;
+  req->count = count;
+  req->size = 0;
+  req->write = 0;
+  req->result = 0;
+  req->state = HDIMAGE_AIO_PENDING;
+  BX_LOCK(aio->mutex);
+  hdimage_aio_queue(aio, req);
+  aio->reads++;
+  BX_UNLOCK(aio->mutex);
+  return 1;
+}
+
+bool device_image_t::aio_write(Bit64s offset, const void *buf, size_t count)
+{
+  hdimage_aio_req_t *req;
+  bool ok;
+
+  if (aio == NULL) {
+    aio = hdimage_aio_start(this);
+  }
+  BX_LOCK(aio->mutex);
+  while (aio->queued > HDIMAGE_AIO_MAX_QUEUED) {
+    BX_COND_WAIT(aio->cond, aio->mutex, 100);
+  }
+  ok = !aio->write_error;
+  aio->write_error = 0;
+  aio->writes++;
+  req = aio->tail;
+  if ((req != NULL) && req->write && ((req->offset + (Bit64s) req->count) == offset) &&
+      ((req->count + count) <= req->size)) {
+    // not taken by the worker yet, append the data
+    memcpy(req->buf + req->count, buf, count);
+    req->count += count;
+    aio->merged++;
+  } else {
+    req = new hdimage_aio_req_t;
+    req->offset = offset;
+    req->size = (count > HDIMAGE_AIO_WRITE_CHUNK) ? count : HDIMAGE_AIO_WRITE_CHUNK;
+    req->buf = new Bit8u[req->size];
+    memcpy(req->buf, buf, count);
+    req->count = count;
+    req->write = 1;
+    req->result = 0;
+    req->state = HDIMAGE_AIO_PENDING;
+    aio->queued += req->size;
+    hdimage_aio_queue(aio, req);
+  }
+  BX_UNLOCK(aio->mutex);
+  return ok;
+}
+
+bool device_image_t::aio_done(hdimage_aio_req_t *req)
+{
+  bool done;
+
+  if (req->state != HDIMAGE_AIO_PENDING)
+    return 1;
+  BX_LOCK(aio->mutex);
+  done = (req->state == HDIMAGE_AIO_DONE);
+  if (!done) aio->polls++;
+  BX_UNLOCK(aio->mutex);
+  return done;
+}
+
+bool device_image_t::aio_wait(void)
+{
+  bool ok;
+
+  if (aio == NULL)
+    return 1;
+  BX_LOCK(aio->mutex);
+  while (aio->pending > 0) {
+    BX_COND_WAIT(aio->cond, aio->mutex, 100);
+  }
+  ok = !aio->write_error;
+  aio->write_error = 0;
+  BX_UNLOCK(aio->mutex);
+  return ok;
+}
+#endif
+
 /*** base class device_image_t ***/
 
 device_image_t::device_image_t()
@@ -626,6 +875,37 @@ device_image_t::device_image_t()
   cylinders = 0;
   hd_size = 0;
   sect_size = 512;
+  aio = NULL;
+}
+
+device_image_t::~device_image_t()
+{
+#ifndef BXIMAGE
+  if (aio != NULL) {
+    aio_wait();
+    hdimage_aio_c **link = &hdimage_aio_list;
+    while (*link != aio) {
+      link = &(*link)->next;
+    }
+    *link = aio->next;
+    if (aio->running) {
+      BX_LOCK(aio->mutex);
+      aio->stop = 1;
+      BX_COND_BROADCAST(aio->cond);
+      BX_UNLOCK(aio->mutex);
+#if defined(WIN32)
+      WaitForSingleObject(aio->thread, INFINITE);
+#else
+      BX_THREAD_JOIN(aio->thread);
+#endif
+    }
+    BX_FINI_COND(aio->cond);
+    BX_FINI_MUTEX(aio->mutex);
+    BX_INFO(("async I/O: " FMT_LL "u reads, " FMT_LL "u writes (" FMT_LL "u merged), " FMT_LL "u polls in flight",
+      aio->reads, aio->writes, aio->merged, aio->polls));
+    delete aio;
+  }
+#endif
 }
 
 int device_image_t::open(const char* _pathname)
@@ -633,6 +913,49 @@ int device_image_t::open(const char* _pathname)
   return open(_pathname, O_RDWR);
 }
 
+ssize_t device_image_t::read_at(Bit64s offset, void* buf, size_t count)
+{
+  char *cbuf = (char*)buf;
+  size_t n = 0, len;
+  ssize_t ret;
+
+  // not all image modes accept multi-sector requests and some of them don't
+  // advance the position of all their files with every sector read, so seek
+  // to every sector like the single sector requests of the devices do
+  while (n < count) {
+    len = ((count - n) < sect_size) ? (count - n) : sect_size;
+    if (lseek(offset + n, SEEK_SET) < 0) {
+      return (n > 0) ? (ssize_t)n : -1;
+    }
+    ret = read(cbuf + n, len);
+    if (ret != (ssize_t)len) {
+      return (ret < 0) ? ret : (ssize_t)(n + ret);
+    }
+    n += len;
+  }
+  return count;
+}
+
+ssize_t device_image_t::write_at(Bit64s offset, const void* buf, size_t count)
+{
+  const char *cbuf = (const char*)buf;
+  size_t n = 0, len;
+  ssize_t ret;
+
+  while (n < count) {
+    len = ((count - n) < sect_size) ? (count - n) : sect_size;
+    if (lseek(offset + n, SEEK_SET) < 0) {
+      return (n > 0) ? (ssize_t)n : -1;
+    }
+    ret = write(cbuf + n, len);
+    if (ret != (ssize_t)len) {
+      return (ret < 0) ? ret : (ssize_t)(n + ret);
+    }
+    n += len;
+  }
+  return count;
+}
+
 Bit32u device_image_t::get_capabilities()
 {
   return (cylinders == 0) ? HDIMAGE_AUTO_GEOMETRY : 0;
@@ -689,6 +1012,24 @@ ssize_t flat_image_t::write(const void* buf, size_t count)
   return ::write(fd, (char*) buf, count);
 }
 
+ssize_t flat_image_t::read_at(Bit64s offset, void* buf, size_t count)
+{
+#ifndef WIN32
+  return ::pread(fd, (char*) buf, count, (off_t)offset);
+#else
+  return bx_read_image(fd, offset, buf, (int)count);
+#endif
+}
+
+ssize_t flat_image_t::write_at(Bit64s offset, const void* buf, size_t count)
+{
+#ifndef WIN32
+  return ::pwrite(fd, (const char*) buf, count, (off_t)offset);
+#else
+  return bx_write_image(fd, offset, (void*)buf, (int)count);
+#endif
+}
+
 int flat_image_t::check_format(int fd, Bit64u imgsize)
 {
   char buffer[512];
@@ -917,6 +1258,22 @@ ssize_t concat_image_t::write(const void* buf, size_t count)
   return (ret < 0) ? ret : count;
 }
 
+ssize_t concat_image_t::read_at(Bit64s offset, void* buf, size_t count)
+{
+  if (lseek(offset, SEEK_SET) < 0) {
+    return -1;
+  }
+  return read(buf, count);
+}
+
+ssize_t concat_image_t::write_at(Bit64s offset, const void* buf, size_t count)
+{
+  if (lseek(offset, SEEK_SET) < 0) {
+    return -1;
+  }
+  return write(buf, count);
+}
+
 #ifndef BXIMAGE
 bool concat_image_t::save_state(const char *backup_fname)
 {
@@ -2469,6 +2826,7 @@ void undoable_image_t::restore_state(const char *backup_fname)
 volatile_image_t::volatile_image_t(const char* _redolog_name)
 {
   redolog = new redolog_t();
+  ro_disk = NULL;
   redolog_temp = NULL;
   redolog_name = NULL;
   if (_redolog_name != NULL) {
@@ -2487,8 +2845,6 @@ volatile_image_t::~volatile_image_t()
 
 int volatile_image_t::open(const char* pathname, int flags)
 {
-  int filedes;
-  Bit32u timestamp;
   const char* image_mode = NULL;
 
   UNUSED(flags);
@@ -2508,6 +2864,15 @@ int volatile_image_t::open(const char* pathname, int flags)
   if (ro_disk->open(pathname, O_RDONLY)<0)
     return -1;
 
+  return attach(ro_disk, pathname);
+}
+
+int volatile_image_t::attach(device_image_t *base, const char* pathname)
+{
+  int filedes;
+  Bit32u timestamp;
+
+  ro_disk = base;
   hd_size = ro_disk->hd_size;
   if (ro_disk->get_capabilities() & HDIMAGE_HAS_GEOMETRY) {
     cylinders = ro_disk->cylinders;
@@ -2642,3 +3007,647 @@ void volatile_image_t::restore_state(const char *backup_fname)
 #endif
 }
 #endif
+
+#ifndef BXIMAGE
+/*** shared block cache ***/
+
+// With the "disk_cache" option all disk images share one cache of
+// HDIMAGE_CACHE_BLOCK sized blocks. The blocks of all images are kept in one
+// LRU list, the least recently used block is reused when the configured size
+// is reached. The cache never holds dirty data: writes go to the image first
+// and then update the cached blocks they overlap.
+//
+// Every image counts the reads starting where the previous one ended. After
+// HDIMAGE_CACHE_SEQ_READS of them the worker thread of the cache reads the
+// blocks following the request. The readahead window starts with
+// HDIMAGE_CACHE_RA_MIN blocks and doubles each time the reads reach its
+// second half, up to the configured maximum. A non-sequential read cancels
+// the readahead of the image.
+//
+// The I/O mutex of an image serializes the accesses to the underlying image,
+// so the image modes never see two threads at once. Blocks are only added
+// with it held, a block read from the image can't overwrite newer data of a
+// write. Lock order: the I/O mutex of the image, then the cache mutex.
+
+#define HDIMAGE_CACHE_BLOCK     (32 * 1024)
+// largest run of missing blocks read with one request
+#define HDIMAGE_CACHE_MAX_RUN   32
+// blocks read ahead with one request
+#define HDIMAGE_CACHE_RA_CHUNK  4
+#define HDIMAGE_CACHE_RA_MIN    4
+#define HDIMAGE_CACHE_SEQ_READS 2
+
+typedef struct hdimage_cache_block {
+  struct hdimage_cache_img *owner;
+  Bit64u index;
+  Bit8u  *data;
+  bool   readahead;  // read ahead and not used yet
+  struct hdimage_cache_block *hnext;
+  struct hdimage_cache_block *prev, *next;
+} hdimage_cache_block_t;
+
+struct hdimage_cache_img {
+  device_image_t *image;
+  char   *pathname;
+  BX_MUTEX(io_mutex);
+  Bit8u  *buffer;      // HDIMAGE_CACHE_MAX_RUN blocks, used with io_mutex held
+  Bit64u nblocks;
+  Bit64s last_end;     // end offset of the last read
+  unsigned seq_reads;
+  Bit32u ra_window;
+  Bit64u ra_pos, ra_end;
+  bool   ra_queued;
+  struct hdimage_cache_img *ra_next;
+  Bit64u hits, misses, ra_blocks, ra_hits;
+};
+
+class hdimage_cache_c {
+public:
+  bool   initialized;
+  Bit32u max_blocks;
+  Bit32u num_blocks;
+  Bit32u ra_max;       // readahead window limit in blocks
+  hdimage_cache_block_t **hash;
+  Bit32u hash_mask;
+  hdimage_cache_block_t *lru_head, *lru_tail;
+  struct hdimage_cache_img *ra_head, *ra_tail;
+  struct hdimage_cache_img *ra_busy;
+  unsigned images;
+  bool   running, stop, hold;
+  BX_THREAD_VAR(thread);
+  BX_MUTEX(mutex);
+  BX_COND(cond);       // signals readahead requests and completions
+  Bit64u hits, misses, ra_blocks, ra_hits, evictions;
+};
+
+static hdimage_cache_c hdimage_cache;
+
+static BX_CPP_INLINE Bit32u hdimage_cache_hash(struct hdimage_cache_img *img, Bit64u index)
+{
+  return (Bit32u)(index ^ (index >> 24) ^ ((bx_ptr_equiv_t)img >> 6)) & hdimage_cache.hash_mask;
+}
+
+// the following functions are called with the cache mutex held
+
+static hdimage_cache_block_t *hdimage_cache_lookup(struct hdimage_cache_img *img, Bit64u index)
+{
+  hdimage_cache_block_t *b = hdimage_cache.hash[hdimage_cache_hash(img, index)];
+
+  while ((b != NULL) && ((b->owner != img) || (b->index != index))) {
+    b = b->hnext;
+  }
+  return b;
+}
+
+static void hdimage_cache_lru_remove(hdimage_cache_block_t *b)
+{
+  if (b->prev != NULL) b->prev->next = b->next;
+  else hdimage_cache.lru_head = b->next;
+  if (b->next != NULL) b->next->prev = b->prev;
+  else hdimage_cache.lru_tail = b->prev;
+}
+
+static void hdimage_cache_lru_insert(hdimage_cache_block_t *b)
+{
+  b->prev = NULL;
+  b->next = hdimage_cache.lru_head;
+  if (b->next != NULL) b->next->prev = b;
+  else hdimage_cache.lru_tail = b;
+  hdimage_cache.lru_head = b;
+}
+
+static void hdimage_cache_hash_remove(hdimage_cache_block_t *b)
+{
+  hdimage_cache_block_t **link = &hdimage_cache.hash[hdimage_cache_hash(b->owner, b->index)];
+
+  while (*link != b) {
+    link = &(*link)->hnext;
+  }
+  *link = b->hnext;
+}
+
+static void hdimage_cache_insert(struct hdimage_cache_img *img, Bit64u index, const Bit8u *data, bool readahead)
+{
+  hdimage_cache_c *c = &hdimage_cache;
+  hdimage_cache_block_t *b;
+
+  if (hdimage_cache_lookup(img, index) != NULL)
+    return;
+  if (c->num_blocks < c->max_blocks) {
+    b = new hdimage_cache_block_t;
+    b->data = new Bit8u[HDIMAGE_CACHE_BLOCK];
+    c->num_blocks++;
+  } else {
+    b = c->lru_tail;
+    hdimage_cache_lru_remove(b);
+    hdimage_cache_hash_remove(b);
+    c->evictions++;
+  }
+  b->owner = img;
+  b->index = index;
+  b->readahead = readahead;
+  memcpy(b->data, data, HDIMAGE_CACHE_BLOCK);
+  Bit32u h = hdimage_cache_hash(img, index);
+  b->hnext = c->hash[h];
+  c->hash[h] = b;
+  hdimage_cache_lru_insert(b);
+}
+
+static void hdimage_cache_drop(struct hdimage_cache_img *img)
+{
+  hdimage_cache_c *c = &hdimage_cache;
+  hdimage_cache_block_t *b = c->lru_head, *next;
+
+  while (b != NULL) {
+    next = b->next;
+    if (b->owner == img) {
+      hdimage_cache_lru_remove(b);
+      hdimage_cache_hash_remove(b);
+      delete [] b->data;
+      delete b;
+      c->num_blocks--;
+    }
+    b = next;
+  }
+}
+
+static void hdimage_cache_ra_remove(struct hdimage_cache_img *img)
+{
+  hdimage_cache_c *c = &hdimage_cache;
+  struct hdimage_cache_img **link = &c->ra_head;
+
+  if (!img->ra_queued)
+    return;
+  c->ra_tail = NULL;
+  while (*link != NULL) {
+    if (*link == img) {
+      *link = img->ra_next;
+    } else {
+      c->ra_tail = *link;
+      link = &(*link)->ra_next;
+    }
+  }
+  img->ra_queued = 0;
+}
+
+static void hdimage_cache_ra_queue(struct hdimage_cache_img *img)
+{
+  hdimage_cache_c *c = &hdimage_cache;
+
+  img->ra_next = NULL;
+  if (c->ra_tail != NULL) {
+    c->ra_tail->ra_next = img;
+  } else {
+    c->ra_head = img;
+  }
+  c->ra_tail = img;
+  img->ra_queued = 1;
+}
+
+// Read the run of missing blocks at index (at most up to end) into the
+// buffer of the image and the cache. Called with the I/O mutex held. Returns
+// the number of blocks read, 0 if the block at index is cached or -1.
+static int hdimage_cache_load(struct hdimage_cache_img *img, Bit64u index, Bit64u end, bool readahead)
+{
+  hdimage_cache_c *c = &hdimage_cache;
+  int run = 0;
+
+  BX_LOCK(c->mutex);
+  while (((index + run) < end) && (run < HDIMAGE_CACHE_MAX_RUN) &&
+         (hdimage_cache_lookup(img, index + run) == NULL)) {
+    run++;
+  }
+  BX_UNLOCK(c->mutex);
+  if (run == 0)
+    return 0;
+  Bit64s offset = (Bit64s)index * HDIMAGE_CACHE_BLOCK;
+  size_t len = run * HDIMAGE_CACHE_BLOCK;
+  if ((Bit64u)(offset + len) > img->image->hd_size) {
+    len = (size_t)(img->image->hd_size - offset);
+    memset(img->buffer + len, 0, run * HDIMAGE_CACHE_BLOCK - len);
+  }
+  if (img->image->read_at(offset, img->buffer, len) != (ssize_t)len)
+    return -1;
+  BX_LOCK(c->mutex);
+  for (int i = 0; i < run; i++) {
+    hdimage_cache_insert(img, index + i, img->buffer + i * HDIMAGE_CACHE_BLOCK, readahead);
+  }
+  if (readahead) {
+    img->ra_blocks += run;
+    c->ra_blocks += run;
+  } else {
+    img->misses += run;
+    c->misses += run;
+  }
+  BX_UNLOCK(c->mutex);
+  return run;
+}
+
+static BX_THREAD_FUNC(hdimage_cache_thread, indata)
+{
+  hdimage_cache_c *c = (hdimage_cache_c*) indata;
+  struct hdimage_cache_img *img;
+  Bit64u index, end;
+  int ret;
+
+  BX_LOCK(c->mutex);
+  while (1) {
+    while (((c->ra_head == NULL) || c->hold) && !c->stop) {
+      BX_COND_WAIT(c->cond, c->mutex, 100);
+    }
+    if (c->stop) break;
+    img = c->ra_head;
+    c->ra_head = img->ra_next;
+    if (c->ra_head == NULL) c->ra_tail = NULL;
+    img->ra_queued = 0;
+    if (img->ra_pos >= img->ra_end) continue;
+    index = img->ra_pos;
+    end = index + HDIMAGE_CACHE_RA_CHUNK;
+    if (end > img->ra_end) end = img->ra_end;
+    img->ra_pos = end;
+    // round robin between the images
+    if (img->ra_pos < img->ra_end) hdimage_cache_ra_queue(img);
+    c->ra_busy = img;
+    BX_UNLOCK(c->mutex);
+
+    BX_LOCK(img->io_mutex);
+    while (index < end) {
+      ret = hdimage_cache_load(img, index, end, 1);
+      if (ret < 0) break;
+      index += (ret > 0) ? ret : 1;
+    }
+    BX_UNLOCK(img->io_mutex);
+
+    BX_LOCK(c->mutex);
+    c->ra_busy = NULL;
+    BX_COND_BROADCAST(c->cond);
+  }
+  BX_UNLOCK(c->mutex);
+  BX_THREAD_EXIT;
+}
+
+// Called after a read. Detects sequential reads and extends the readahead.
+static void hdimage_cache_readahead(struct hdimage_cache_img *img, Bit64s offset, size_t count)
+{
+  hdimage_cache_c *c = &hdimage_cache;
+  Bit64u next = (offset + count + HDIMAGE_CACHE_BLOCK - 1) / HDIMAGE_CACHE_BLOCK;
+  bool extend = 0;
+
+  BX_LOCK(c->mutex);
+  if (offset == img->last_end) {
+    img->seq_reads++;
+  } else {
+    img->seq_reads = 0;
+    img->ra_window = 0;
+    img->ra_end = img->ra_pos;
+  }
+  img->last_end = offset + count;
+  if ((c->ra_max > 0) && (img->seq_reads >= HDIMAGE_CACHE_SEQ_READS) && (next < img->nblocks)) {
+    if (img->ra_window == 0) {
+      img->ra_window = (c->ra_max < HDIMAGE_CACHE_RA_MIN) ? c->ra_max : HDIMAGE_CACHE_RA_MIN;
+      img->ra_pos = img->ra_end = next;
+      extend = 1;
+    } else if (img->ra_end <= (next + img->ra_window / 2)) {
+      img->ra_window <<= 1;
+      if (img->ra_window > c->ra_max) img->ra_window = c->ra_max;
+      if (img->ra_pos < next) img->ra_pos = next;
+      extend = 1;
+    }
+  }
+  if (extend) {
+    Bit64u end = next + img->ra_window;
+    if (end > img->nblocks) end = img->nblocks;
+    if (end > img->ra_end) img->ra_end = end;
+    if ((img->ra_pos < img->ra_end) && !img->ra_queued) {
+      hdimage_cache_ra_queue(img);
+      if (!c->running) {
+        c->running = 1;
+        c->stop = 0;
+        BX_THREAD_CREATE(hdimage_cache_thread, c, c->thread);
+      }
+      BX_COND_BROADCAST(c->cond);
+    }
+  }
+  BX_UNLOCK(c->mutex);
+}
+
+#if BX_HAVE_FORK && !defined(WIN32)
+// A fork clone doesn't inherit the worker thread. The fork waits until the
+// worker is idle, the clone starts its own worker with the next readahead.
+static void hdimage_cache_prepare_fork(void)
+{
+  BX_LOCK(hdimage_cache.mutex);
+  hdimage_cache.hold = 1;
+  while (hdimage_cache.ra_busy != NULL) {
+    BX_COND_WAIT(hdimage_cache.cond, hdimage_cache.mutex, 100);
+  }
+}
+
+static void hdimage_cache_parent_fork(void)
+{
+  hdimage_cache.hold = 0;
+  BX_COND_BROADCAST(hdimage_cache.cond);
+  BX_UNLOCK(hdimage_cache.mutex);
+}
+
+static void hdimage_cache_child_fork(void)
+{
+  hdimage_cache.hold = 0;
+  hdimage_cache.running = 0;
+  BX_INIT_COND(hdimage_cache.cond);
+  BX_UNLOCK(hdimage_cache.mutex);
+}
+#endif
+
+// Set up the cache with the first image. Returns true if it is enabled.
+static bool hdimage_cache_enabled(void)
+{
+  hdimage_cache_c *c = &hdimage_cache;
+
+  if (c->initialized)
+    return (c->max_blocks > 0);
+  c->initialized = 1;
+  Bit32u size = (Bit32u)SIM->get_param_num(BXPN_DISK_CACHE_SIZE)->get();
+  Bit32u readahead = (Bit32u)SIM->get_param_num(BXPN_DISK_CACHE_READAHEAD)->get();
+  c->max_blocks = (Bit32u)(((Bit64u)size << 20) / HDIMAGE_CACHE_BLOCK);
+  c->ra_max = (readahead << 10) / HDIMAGE_CACHE_BLOCK;
+  if (c->max_blocks == 0)
+    return 0;
+  Bit32u buckets = 64;
+  while (buckets < c->max_blocks) buckets <<= 1;
+  c->hash = new hdimage_cache_block_t*[buckets];
+  memset(c->hash, 0, buckets * sizeof(hdimage_cache_block_t*));
+  c->hash_mask = buckets - 1;
+  c->num_blocks = 0;
+  c->lru_head = c->lru_tail = NULL;
+  c->ra_head = c->ra_tail = c->ra_busy = NULL;
+  c->images = 0;
+  c->running = c->stop = c->hold = 0;
+  c->hits = c->misses = c->ra_blocks = c->ra_hits = c->evictions = 0;
+  BX_INIT_MUTEX(c->mutex);
+  BX_INIT_COND(c->cond);
+#if BX_HAVE_FORK && !defined(WIN32)
+  pthread_atfork(hdimage_cache_prepare_fork, hdimage_cache_parent_fork, hdimage_cache_child_fork);
+#endif
+#if BX_ENABLE_STATISTICS
+  bx_list_c *list = new bx_list_c(SIM->get_statistics_root(), "disk_cache", "Disk cache statistics");
+  new bx_shadow_num_c(list, "hits", &c->hits);
+  new bx_shadow_num_c(list, "misses", &c->misses);
+  new bx_shadow_num_c(list, "readahead", &c->ra_blocks);
+  new bx_shadow_num_c(list, "readaheadHits", &c->ra_hits);
+  new bx_shadow_num_c(list, "evictions", &c->evictions);
+  new bx_shadow_num_c(list, "blocks", &c->num_blocks);
+#endif
+  BX_INFO(("disk cache: %u MB, readahead up to %u KB", size, c->ra_max * (HDIMAGE_CACHE_BLOCK >> 10)));
+  return 1;
+}
+
+/*** cached_image_t function definitions ***/
+
+cached_image_t::cached_image_t(device_image_t *_image)
+{
+  image = _image;
+  cache = NULL;
+  cur_offset = 0;
+}
+
+cached_image_t::~cached_image_t()
+{
+  close();
+  delete image;
+}
+
+int cached_image_t::open(const char* pathname, int flags)
+{
+  int ret;
+
+  image->cylinders = cylinders;
+  image->heads = heads;
+  image->spt = spt;
+  image->sect_size = sect_size;
+  if ((ret = image->open(pathname, flags)) < 0) {
+    return ret;
+  }
+  cylinders = image->cylinders;
+  heads = image->heads;
+  spt = image->spt;
+  sect_size = image->sect_size;
+  hd_size = image->hd_size;
+  cur_offset = 0;
+
+  cache = new struct hdimage_cache_img;
+  cache->image = image;
+  cache->pathname = new char[strlen(pathname) + 1];
+  strcpy(cache->pathname, pathname);
+  BX_INIT_MUTEX(cache->io_mutex);
+  cache->buffer = new Bit8u[HDIMAGE_CACHE_MAX_RUN * HDIMAGE_CACHE_BLOCK];
+  cache->nblocks = (hd_size + HDIMAGE_CACHE_BLOCK - 1) / HDIMAGE_CACHE_BLOCK;
+  cache->last_end = -1;
+  cache->seq_reads = 0;
+  cache->ra_window = 0;
+  cache->ra_pos = cache->ra_end = 0;
+  cache->ra_queued = 0;
+  cache->hits = cache->misses = cache->ra_blocks = cache->ra_hits = 0;
+  BX_LOCK(hdimage_cache.mutex);
+  hdimage_cache.images++;
+  BX_UNLOCK(hdimage_cache.mutex);
+  return ret;
+}
+
+void cached_image_t::close()
+{
+  hdimage_cache_c *c = &hdimage_cache;
+  bool stop;
+
+  if (cache == NULL)
+    return;
+  aio_wait();
+  BX_LOCK(c->mutex);
+  hdimage_cache_ra_remove(cache);
+  while (c->ra_busy == cache) {
+    BX_COND_WAIT(c->cond, c->mutex, 100);
+  }
+  hdimage_cache_drop(cache);
+  stop = (--c->images == 0) && c->running;
+  if (stop) {
+    c->stop = 1;
+    BX_COND_BROADCAST(c->cond);
+  }
+  BX_UNLOCK(c->mutex);
+  if (stop) {
+#if defined(WIN32)
+    WaitForSingleObject(c->thread, INFINITE);
+#else
+    BX_THREAD_JOIN(c->thread);
+#endif
+    c->running = 0;
+  }
+  BX_INFO(("disk cache '%s': " FMT_LL "u hits, " FMT_LL "u misses, " FMT_LL "u blocks read ahead (" FMT_LL "u used)",
+    cache->pathname, cache->hits, cache->misses, cache->ra_blocks, cache->ra_hits));
+  image->close();
+  BX_FINI_MUTEX(cache->io_mutex);
+  delete [] cache->buffer;
+  delete [] cache->pathname;
+  delete cache;
+  cache = NULL;
+}
+
+Bit64s cached_image_t::lseek(Bit64s offset, int whence)
+{
+  if (whence == SEEK_CUR) {
+    offset += cur_offset;
+  } else if (whence == SEEK_END) {
+    offset += (Bit64s)hd_size;
+  } else if (whence != SEEK_SET) {
+    return -1;
+  }
+  if ((offset < 0) || ((Bit64u)offset > hd_size)) {
+    return -1;
+  }
+  cur_offset = offset;
+  return offset;
+}
+
+ssize_t cached_image_t::read(void* buf, size_t count)
+{
+  ssize_t ret = read_at(cur_offset, buf, count);
+  if (ret > 0) cur_offset += ret;
+  return ret;
+}
+
+ssize_t cached_image_t::write(const void* buf, size_t count)
+{
+  ssize_t ret = write_at(cur_offset, buf, count);
+  if (ret > 0) cur_offset += ret;
+  return ret;
+}
+
+ssize_t cached_image_t::read_at(Bit64s offset, void* buf, size_t count)
+{
+  hdimage_cache_c *c = &hdimage_cache;
+  hdimage_cache_block_t *b;
+  Bit8u *cbuf = (Bit8u*)buf;
+  size_t n = 0, len;
+  Bit64u index, end;
+  Bit32u boff;
+  int ret;
+
+  if ((offset < 0) || ((Bit64u)offset > hd_size)) {
+    return -1;
+  }
+  if (count > (hd_size - offset)) {
+    count = (size_t)(hd_size - offset);
+  }
+  end = (offset + count + HDIMAGE_CACHE_BLOCK - 1) / HDIMAGE_CACHE_BLOCK;
+  while (n < count) {
+    index = (offset + n) / HDIMAGE_CACHE_BLOCK;
+    boff = (Bit32u)((offset + n) % HDIMAGE_CACHE_BLOCK);
+    BX_LOCK(c->mutex);
+    b = hdimage_cache_lookup(cache, index);
+    if (b != NULL) {
+      len = HDIMAGE_CACHE_BLOCK - boff;
+      if (len > (count - n)) len = count - n;
+      memcpy(cbuf + n, b->data + boff, len);
+      hdimage_cache_lru_remove(b);
+      hdimage_cache_lru_insert(b);
+      cache->hits++;
+      c->hits++;
+      if (b->readahead) {
+        b->readahead = 0;
+        cache->ra_hits++;
+        c->ra_hits++;
+      }
+      BX_UNLOCK(c->mutex);
+      n += len;
+      continue;
+    }
+    BX_UNLOCK(c->mutex);
+    // read all missing blocks up to the next cached one with one request
+    BX_LOCK(cache->io_mutex);
+    ret = hdimage_cache_load(cache, index, end, 0);
+    if (ret > 0) {
+      len = (size_t)((index + ret) * HDIMAGE_CACHE_BLOCK - (offset + n));
+      if (len > (count - n)) len = count - n;
+      memcpy(cbuf + n, cache->buffer + boff, len);
+      n += len;
+    }
+    BX_UNLOCK(cache->io_mutex);
+    if (ret < 0) {
+      return (n > 0) ? (ssize_t)n : -1;
+    }
+  }
+  hdimage_cache_readahead(cache, offset, count);
+  return count;
+}
+
+ssize_t cached_image_t::write_at(Bit64s offset, const void* buf, size_t count)
+{
+  hdimage_cache_c *c = &hdimage_cache;
+  hdimage_cache_block_t *b;
+  const Bit8u *cbuf = (const Bit8u*)buf;
+  Bit64u index;
+  Bit32u boff;
+  size_t n = 0, len;
+  ssize_t ret;
+
+  BX_LOCK(cache->io_mutex);
+  ret = image->write_at(offset, buf, count);
+  BX_LOCK(c->mutex);
+  while (n < count) {
+    index = (offset + n) / HDIMAGE_CACHE_BLOCK;
+    boff = (Bit32u)((offset + n) % HDIMAGE_CACHE_BLOCK);
+    len = HDIMAGE_CACHE_BLOCK - boff;
+    if (len > (count - n)) len = count - n;
+    if ((b = hdimage_cache_lookup(cache, index)) != NULL) {
+      if (ret == (ssize_t)count) {
+        memcpy(b->data + boff, cbuf + n, len);
+      } else {
+        // the block content is unknown after a failed write
+        hdimage_cache_lru_remove(b);
+        hdimage_cache_hash_remove(b);
+        delete [] b->data;
+        delete b;
+        c->num_blocks--;
+      }
+    }
+    n += len;
+  }
+  BX_UNLOCK(c->mutex);
+  BX_UNLOCK(cache->io_mutex);
+  return ret;
+}
+
+Bit32u cached_image_t::get_capabilities()
+{
+  return image->get_capabilities();
+}
+
+Bit32u cached_image_t::get_timestamp()
+{
+  return image->get_timestamp();
+}
+
+bool cached_image_t::save_state(const char *backup_fname)
+{
+  bool ret;
+
+  BX_LOCK(cache->io_mutex);
+  ret = image->save_state(backup_fname);
+  BX_UNLOCK(cache->io_mutex);
+  return ret;
+}
+
+void cached_image_t::restore_state(const char *backup_fname)
+{
+  BX_LOCK(cache->io_mutex);
+  image->restore_state(backup_fname);
+  BX_LOCK(hdimage_cache.mutex);
+  hdimage_cache_drop(cache);
+  cache->last_end = -1;
+  cache->seq_reads = 0;
+  cache->ra_window = 0;
+  cache->ra_end = cache->ra_pos;
+  BX_UNLOCK(hdimage_cache.mutex);
+  BX_UNLOCK(cache->io_mutex);
+}
+#endif
@@ -141,6 +141,29 @@
 class device_image_t;
 class redolog_t;
 class cdrom_base_c;
+class hdimage_aio_c;
+struct hdimage_cache_img;
+
+#ifndef BXIMAGE
+// asynchronous image request states
+#define HDIMAGE_AIO_IDLE    0
+#define HDIMAGE_AIO_PENDING 1
+#define HDIMAGE_AIO_DONE    2
+
+// Asynchronous image request. The worker thread of the image runs it with
+// the synchronous read_at() / write_at() methods, the device polls it with
+// aio_done() from a timer until it is complete.
+typedef struct hdimage_aio_req {
+  Bit64s  offset;
+  Bit8u  *buf;
+  size_t  count;
+  size_t  size;    // allocated buffer size of the queued writes
+  bool    write;
+  ssize_t result;  // number of bytes transferred, -1 on error
+  volatile int state;
+  struct hdimage_aio_req *next;
+} hdimage_aio_req_t;
+#endif
 
 #ifdef BXIMAGE
 int bx_create_image_file(const char *filename);
@@ -169,7 +192,7 @@ class BOCHSAPI_MSVCONLY device_image_t
   public:
       // Default constructor
       device_image_t();
-      virtual ~device_image_t() {}
+      virtual ~device_image_t();
 
       // Open a image. Returns non-negative if successful.
       virtual int open(const char* pathname);
@@ -192,6 +215,12 @@ class BOCHSAPI_MSVCONLY device_image_t
       // written (count).
       virtual ssize_t write(const void* buf, size_t count) = 0;
 
+      // Read / write count bytes (a multiple of the sector size) at offset
+      // with one request if the image mode supports it. The default splits
+      // the request up into single sector lseek() and read() / write() calls.
+      virtual ssize_t read_at(Bit64s offset, void* buf, size_t count);
+      virtual ssize_t write_at(Bit64s offset, const void* buf, size_t count);
+
       // Get image capabilities
       virtual Bit32u get_capabilities();
 
@@ -209,6 +238,17 @@ class BOCHSAPI_MSVCONLY device_image_t
       virtual void register_state(bx_list_c *parent);
       virtual bool save_state(const char *backup_fname) {return 0;}
       virtual void restore_state(const char *backup_fname) {}
+
+      // Asynchronous I/O. The read is submitted to the worker thread of the
+      // image, the buffer must stay valid until aio_done() returns true. The
+      // write data is copied and written behind, a write error is returned
+      // by the next aio_write() or aio_wait(). While requests are in flight
+      // the image must not be accessed with the synchronous methods.
+      bool aio_read(Bit64s offset, void *buf, size_t count, hdimage_aio_req_t *req);
+      bool aio_write(Bit64s offset, const void *buf, size_t count);
+      bool aio_done(hdimage_aio_req_t *req);
+      // Wait until all the requests are completed. Returns 0 if a write failed.
+      bool aio_wait(void);
 #endif
 
       unsigned cylinders;
@@ -222,6 +262,8 @@ class BOCHSAPI_MSVCONLY device_image_t
 #else
       FILETIME mtime;
 #endif
+  private:
+      hdimage_aio_c *aio;
 };
 
 // FLAT MODE
@@ -246,6 +288,10 @@ class flat_image_t : public device_image_t
       // written (count).
       ssize_t write(const void* buf, size_t count);
 
+      // Read / write count bytes at offset with one system call
+      ssize_t read_at(Bit64s offset, void* buf, size_t count);
+      ssize_t write_at(Bit64s offset, const void* buf, size_t count);
+
       // Check image format
       static int check_format(int fd, Bit64u imgsize);
 
@@ -285,6 +331,10 @@ class concat_image_t : public device_image_t
       // written (count).
       ssize_t write(const void* buf, size_t count);
 
+      // Read / write count bytes at offset, split at the image boundaries
+      ssize_t read_at(Bit64s offset, void* buf, size_t count);
+      ssize_t write_at(Bit64s offset, const void* buf, size_t count);
+
 #ifndef BXIMAGE
       // Save/restore support
       bool save_state(const char *backup_fname);
@@ -576,6 +626,11 @@ class volatile_image_t : public device_image_t
       // Open an image with specific flags. Returns non-negative if successful.
       int open(const char* pathname, int flags);
 
+      // Use an already opened image as the read-only base disk. The
+      // pathname is used for the messages and as redolog name template.
+      // Returns non-negative if successful.
+      int attach(device_image_t *base, const char* pathname);
+
       // Close the image.
       void close();
 
@@ -608,6 +663,55 @@ class volatile_image_t : public device_image_t
       Bit32u          caps;
 };
 
+#ifndef BXIMAGE
+// CACHED MODE
+// Not selectable as a mode: init_image() puts it on top of the image if the
+// disk cache is enabled. Reads are served from the block cache shared by all
+// images, writes go through to the image and update the cached blocks.
+class cached_image_t : public device_image_t
+{
+  public:
+      // Constructor. The cached image owns the underlying image.
+      cached_image_t(device_image_t *image);
+      virtual ~cached_image_t();
+
+      // Open an image with specific flags. Returns non-negative if successful.
+      int open(const char* pathname, int flags);
+
+      // Close the image.
+      void close();
+
+      // Position ourselves. Return the resulting offset from the
+      // beginning of the file.
+      Bit64s lseek(Bit64s offset, int whence);
+
+      // Read count bytes to the buffer buf. Return the number of
+      // bytes read (count).
+      ssize_t read(void* buf, size_t count);
+
+      // Write count bytes from buf. Return the number of bytes
+      // written (count).
+      ssize_t write(const void* buf, size_t count);
+
+      // Read / write count bytes at offset through the cache
+      ssize_t read_at(Bit64s offset, void* buf, size_t count);
+      ssize_t write_at(Bit64s offset, const void* buf, size_t count);
+
+      // Get image capabilities / modification time of the underlying image
+      Bit32u get_capabilities();
+      Bit32u get_timestamp();
+
+      // Save/restore support
+      bool save_state(const char *backup_fname);
+      void restore_state(const char *backup_fname);
+
+  private:
+      device_image_t *image;          // underlying image
+      struct hdimage_cache_img *cache;
+      Bit64s cur_offset;
+};
+#endif
+
 
 #ifndef BXIMAGE
 
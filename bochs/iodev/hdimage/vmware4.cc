@@ -87,6 +87,10 @@ protected:
 
 vmware4_image_t::vmware4_image_t()
   : file_descriptor(-1),
+  flb_count(0),
+  flb(0),
+  flb_copy(0),
+  slb(0),
   tlb(0),
   tlb_offset(INVALID_OFFSET),
   current_offset(INVALID_OFFSET),
@@ -119,6 +123,11 @@ int vmware4_image_t::open(const char* _pathname, int flags)
     return -1;
   }
 
+  if (!read_flb()) {
+    BX_PANIC(("unable to read vmware4 block directory from file '%s'", pathname));
+    return -1;
+  }
+
   tlb = new Bit8u[(unsigned)header.tlb_size_sectors * SECTOR_SIZE];
   if (tlb == 0)
     BX_PANIC(("unable to allocate " FMT_LL "d bytes for vmware4 image's tlb", header.tlb_size_sectors * SECTOR_SIZE));
@@ -150,6 +159,14 @@ void vmware4_image_t::close()
 
   flush();
   delete [] tlb; tlb = 0;
+  if (slb != 0) {
+    for (Bit32u i = 0; i < flb_count; i++)
+      delete [] slb[i];
+    delete [] slb; slb = 0;
+  }
+  delete [] flb; flb = 0;
+  delete [] flb_copy; flb_copy = 0;
+  flb_count = 0;
 
   bx_close_image(file_descriptor, pathname);
   file_descriptor = -1;
@@ -315,8 +332,12 @@ off_t vmware4_image_t::perform_seek()
   Bit32u slb_index = (Bit32u)(index % header.slb_count);
   Bit32u flb_index = (Bit32u)(index / header.slb_count);
 
-  Bit32u slb_sector = read_block_index(header.flb_offset_sectors, flb_index);
-  Bit32u slb_copy_sector = read_block_index(header.flb_copy_offset_sectors, flb_index);
+  if (flb_index >= flb_count) {
+    BX_DEBUG(("vmware4 seek beyond the block directory"));
+    return INVALID_OFFSET;
+  }
+  Bit32u slb_sector = flb[flb_index];
+  Bit32u slb_copy_sector = flb_copy[flb_index];
 
   if (slb_sector == 0 && slb_copy_sector == 0) {
     BX_DEBUG(("loaded vmware4 disk image requires un-implemented feature"));
@@ -325,7 +346,10 @@ off_t vmware4_image_t::perform_seek()
   if (slb_sector == 0)
     slb_sector = slb_copy_sector;
 
-  Bit32u tlb_sector = read_block_index(slb_sector, slb_index);
+  Bit32u *table = get_slb(flb_index, slb_sector);
+  if (table == 0)
+    return INVALID_OFFSET;
+  Bit32u tlb_sector = table[slb_index];
   tlb_offset = index * header.tlb_size_sectors * SECTOR_SIZE;
   if (tlb_sector == 0) {
     //
@@ -343,6 +367,7 @@ off_t vmware4_image_t::perform_seek()
 
     write_block_index(slb_sector, slb_index, tlb_sector);
     write_block_index(slb_copy_sector, slb_index, tlb_sector);
+    table[slb_index] = tlb_sector;
 
     ::lseek(file_descriptor, eof, SEEK_SET);
   } else {
@@ -367,14 +392,43 @@ void vmware4_image_t::flush()
   is_dirty = 0;
 }
 
-Bit32u vmware4_image_t::read_block_index(Bit64u sector, Bit32u index)
+bool vmware4_image_t::read_flb()
 {
-  Bit32u ret;
-
-  bx_read_image(file_descriptor, sector * SECTOR_SIZE + index * sizeof(Bit32u),
-                &ret, sizeof(Bit32u));
+  Bit64u tlb_count = (header.total_sectors + header.tlb_size_sectors - 1) / header.tlb_size_sectors;
+
+  flb_count = (Bit32u)((tlb_count + header.slb_count - 1) / header.slb_count);
+  flb = new Bit32u[flb_count];
+  flb_copy = new Bit32u[flb_count];
+  slb = new Bit32u*[flb_count];
+  int size = flb_count * sizeof(Bit32u);
+  if ((bx_read_image(file_descriptor, header.flb_offset_sectors * SECTOR_SIZE, flb, size) != size) ||
+      (bx_read_image(file_descriptor, header.flb_copy_offset_sectors * SECTOR_SIZE, flb_copy, size) != size)) {
+    return 0;
+  }
+  for (Bit32u i = 0; i < flb_count; i++) {
+    flb[i] = dtoh32(flb[i]);
+    flb_copy[i] = dtoh32(flb_copy[i]);
+    slb[i] = 0;
+  }
+  return 1;
+}
 
-  return dtoh32(ret);
+// Returns the block table of the directory entry, it is read on first use.
+Bit32u* vmware4_image_t::get_slb(Bit32u flb_index, Bit32u slb_sector)
+{
+  if (slb[flb_index] == 0) {
+    Bit32u *table = new Bit32u[header.slb_count];
+    int size = header.slb_count * sizeof(Bit32u);
+    if (bx_read_image(file_descriptor, (Bit64s)slb_sector * SECTOR_SIZE, table, size) != size) {
+      BX_DEBUG(("vmware4 block table read failed at sector %u", slb_sector));
+      delete [] table;
+      return 0;
+    }
+    for (Bit32u i = 0; i < header.slb_count; i++)
+      table[i] = dtoh32(table[i]);
+    slb[flb_index] = table;
+  }
+  return slb[flb_index];
 }
 
 void vmware4_image_t::write_block_index(Bit64u sector, Bit32u index, Bit32u block_sector)
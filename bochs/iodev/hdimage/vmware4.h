@@ -93,11 +93,18 @@ class vmware4_image_t : public device_image_t
         bool read_header();
         off_t perform_seek();
         void flush();
-        Bit32u read_block_index(Bit64u sector, Bit32u index);
         void write_block_index(Bit64u sector, Bit32u index, Bit32u block_sector);
+        bool read_flb();
+        Bit32u* get_slb(Bit32u flb_index, Bit32u slb_sector);
 
         int file_descriptor;
         VM4_Header header;
+        // The block directory (flb) and the block tables (slb) are kept in
+        // memory once read, so only the data block is read on a seek.
+        Bit32u flb_count;
+        Bit32u* flb;
+        Bit32u* flb_copy;
+        Bit32u** slb;
         Bit8u* tlb;
         off_t tlb_offset;
         off_t current_offset;
@@ -88,6 +88,8 @@ class BOCHSAPI bx_devmodel_c : public logfunctions {
   virtual void reset(unsigned type) {}
   virtual void register_state(void) {}
   virtual void after_restore_state(void) {}
+  // called in the parent (clone_id 0) and in each child after a fork clone
+  virtual void after_clone(unsigned clone_id) {}
 #if BX_DEBUGGER
   virtual void debug_dump(int argc, char **argv) {}
 #endif
@@ -199,7 +201,7 @@ public:
   virtual bool bmdma_read_sector(Bit8u channel, Bit8u *buffer, Bit32u *sector_size) {
     STUBFUNC(HD, bmdma_read_sector); return 0;
   }
-  virtual bool bmdma_write_sector(Bit8u channel, Bit8u *buffer) {
+  virtual bool bmdma_write_sector(Bit8u channel, Bit8u *buffer, Bit32u *sector_size) {
     STUBFUNC(HD, bmdma_write_sector); return 0;
   }
   virtual void bmdma_complete(Bit8u channel) {
@@ -387,6 +389,7 @@ public:
   void exit(void);
   void register_state(void);
   void after_restore_state(void);
+  void after_clone(unsigned clone_id);
   BX_MEM_C *mem;  // address space associated with these devices
   bool register_io_read_handler(void *this_ptr, bx_read_handler_t f,
                                 Bit32u addr, const char *name, Bit8u mask);
@@ -627,14 +630,13 @@ BX_CPP_INLINE void DEV_MEM_READ_PHYSICAL(bx_phy_address phy_addr, unsigned len,
 
 BX_CPP_INLINE void DEV_MEM_READ_PHYSICAL_DMA(bx_phy_address phy_addr, unsigned len, Bit8u *ptr)
 {
-  while(len > 0) { 
-    unsigned remainingInPage = 0x1000 - (phy_addr & 0xfff);
-    if (len < remainingInPage) remainingInPage = len;
-    BX_MEM(0)->dmaReadPhysicalPage(phy_addr, remainingInPage, ptr);
-    ptr += remainingInPage;
-    phy_addr += remainingInPage;
-    len -= remainingInPage;
-  }
+  BX_MEM(0)->dmaReadPhysical(phy_addr, len, ptr);
+}
+
+// gather the guest physical ranges into one buffer
+BX_CPP_INLINE void DEV_MEM_READ_PHYSICAL_DMA_SG(const bx_dma_segment *sg, unsigned count, Bit8u *ptr)
+{
+  BX_MEM(0)->dmaReadPhysicalSG(sg, count, ptr);
 }
 
 // memory stub has an assumption that there are no memory accesses splitting 4K page
@@ -655,14 +657,13 @@ BX_CPP_INLINE void DEV_MEM_WRITE_PHYSICAL(bx_phy_address phy_addr, unsigned len,
 
 BX_CPP_INLINE void DEV_MEM_WRITE_PHYSICAL_DMA(bx_phy_address phy_addr, unsigned len, Bit8u *ptr)
 {
-  while(len > 0) { 
-    unsigned remainingInPage = 0x1000 - (phy_addr & 0xfff);
-    if (len < remainingInPage) remainingInPage = len;
-    BX_MEM(0)->dmaWritePhysicalPage(phy_addr, remainingInPage, ptr);
-    ptr += remainingInPage;
-    phy_addr += remainingInPage;
-    len -= remainingInPage;
-  }
+  BX_MEM(0)->dmaWritePhysical(phy_addr, len, ptr);
+}
+
+// scatter one buffer to the guest physical ranges
+BX_CPP_INLINE void DEV_MEM_WRITE_PHYSICAL_DMA_SG(const bx_dma_segment *sg, unsigned count, Bit8u *ptr)
+{
+  BX_MEM(0)->dmaWritePhysicalSG(sg, count, ptr);
 }
 
 BOCHSAPI extern bx_devices_c bx_devices;
@@ -62,6 +62,7 @@ void bx_unmapped_c::init(void)
   s.port80 = 0x00;
   s.port8e = 0x00;
   s.shutdown = 0;
+  s.save_request = 0;
   s.port_e9_hack = SIM->get_param_bool(BXPN_PORT_E9_HACK)->get();
   SIM->get_param_num(BXPN_PORT_E9_HACK)->set_handler(param_handler);
 }
@@ -100,6 +101,14 @@ Bit32u bx_unmapped_c::read(Bit32u address, unsigned io_len)
       retval = BX_UM_THIS s.port8e;
       break;
 
+    case 0x8900: // clone id after a clone request, 0 in the parent
+      if (SIM->get_param_num(BXPN_CLONE_COUNT)->get() > 0) {
+        retval = SIM->get_clone_id();
+      } else {
+        retval = 0xffffffff;
+      }
+      break;
+
     // Unused port on ISA - this can be used by the emulated code
     // to detect it is running inside Bochs and that the debugging
     // features are available (write 0xFF or something on unused
@@ -236,6 +245,22 @@ void bx_unmapped_c::write(Bit32u address, Bit32u value, unsigned io_len)
 
     case 0x8900: // Shutdown port, could be moved in a PM device
                  // or a host <-> guest communication device
+      if (BX_UM_THIS s.save_request) {
+        // collect the directory name up to the 0 byte, then save
+        if (value != 0) {
+          if (BX_UM_THIS s.save_path_len < (BX_PATHNAME_LEN - 1))
+            BX_UM_THIS s.save_path[BX_UM_THIS s.save_path_len++] = (char) value;
+          break;
+        }
+        BX_UM_THIS s.save_path[BX_UM_THIS s.save_path_len] = 0;
+        BX_UM_THIS s.save_request = 0;
+        if (SIM->save_state(BX_UM_THIS s.save_path)) {
+          BX_INFO(("state saved to '%s'", BX_UM_THIS s.save_path));
+        } else {
+          BX_ERROR(("failed to save the state to '%s'", BX_UM_THIS s.save_path));
+        }
+        break;
+      }
       switch (value) {
         case 'S': if (BX_UM_THIS s.shutdown == 0) BX_UM_THIS s.shutdown = 1; break;
         case 'h': if (BX_UM_THIS s.shutdown == 1) BX_UM_THIS s.shutdown = 2; break;
@@ -250,6 +275,21 @@ void bx_unmapped_c::write(Bit32u address, Bit32u value, unsigned io_len)
         // output 'D' to port 8900, and bochs quits to debugger
         case 'D': bx_debug_break(); break;
 #endif
+        // output 'C' to port 8900 to fork the configured number of
+        // clones of the running simulation
+        case 'C':
+          BX_UM_THIS s.shutdown = 0;
+          if (SIM->get_param_num(BXPN_CLONE_COUNT)->get() > 0) {
+            SIM->clone_simulation(SIM->get_param_num(BXPN_CLONE_COUNT)->get());
+          }
+          break;
+        // output 'V', a directory name and a 0 byte to port 8900 to
+        // save the state of the simulation into that directory
+        case 'V':
+          BX_UM_THIS s.shutdown = 0;
+          BX_UM_THIS s.save_request = 1;
+          BX_UM_THIS s.save_path_len = 0;
+          break;
         default : BX_UM_THIS s.shutdown = 0; break;
       }
       if (BX_UM_THIS s.shutdown == 8) {
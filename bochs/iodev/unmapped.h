@@ -51,6 +51,9 @@ private:
     Bit8u port8e;
     Bit8u shutdown;
     bool port_e9_hack;
+    bool save_request;
+    unsigned save_path_len;
+    char save_path[BX_PATHNAME_LEN];
   } s;  // state information
 };
 
@@ -42,6 +42,9 @@
 
 #define DEVICE_NAME "SCSI drive"
 
+// interval of polling the asynchronous image requests (usec)
+#define SCSI_AIO_POLL_INTERVAL 100
+
 static SCSIRequest *free_requests = NULL;
 static Bit32u serial_number = 12345678;
 
@@ -83,6 +86,7 @@ scsi_device_t::scsi_device_t(device_image_t *_hdimage, int _tcq,
   cdrom = NULL;
   hdimage = _hdimage;
   requests = NULL;
+  async_io = 0;
   sense = 0;
   tcq = _tcq;
   completion = _completion;
@@ -107,6 +111,7 @@ scsi_device_t::scsi_device_t(cdrom_base_c *_cdrom, int _tcq,
   cdrom = _cdrom;
   hdimage = NULL;
   requests = NULL;
+  async_io = 0;
   sense = 0;
   tcq = _tcq;
   completion = _completion;
@@ -128,6 +133,9 @@ scsi_device_t::~scsi_device_t(void)
 {
   SCSIRequest *r, *next;
 
+  if (hdimage != NULL) {
+    hdimage->aio_wait();
+  }
   if (requests) {
     r = requests;
     while (r != NULL) {
@@ -180,6 +188,7 @@ SCSIRequest* scsi_device_t::scsi_new_request(Bit32u tag)
   r->write_cmd = 0;
   r->async_mode = 0;
   r->seek_pending = 0;
+  r->aio.state = HDIMAGE_AIO_IDLE;
   r->buf_len = 0;
   r->status = 0;
 
@@ -192,6 +201,10 @@ void scsi_device_t::scsi_remove_request(SCSIRequest *r)
 {
   SCSIRequest *last;
 
+  if (r->aio.state == HDIMAGE_AIO_PENDING) {
+    // the worker thread still reads into the buffer
+    hdimage->aio_wait();
+  }
   if (requests == r) {
     requests = r->next;
   } else {
@@ -229,6 +242,9 @@ bool scsi_device_t::save_requests(const char *path)
   char tmppath[BX_PATHNAME_LEN];
   FILE *fp, *fp2;
 
+  if (hdimage != NULL) {
+    hdimage->aio_wait();
+  }
   if (requests != NULL) {
     fp = fopen(path, "w");
     if (fp != NULL) {
@@ -847,7 +863,11 @@ Bit32s scsi_device_t::scsi_send_command(Bit32u tag, Bit8u *buf, int lun, bool as
       break;
     case 0x35:
       BX_DEBUG(("Synchronise cache (sector " FMT_LL "d, count %d)", lba, len));
-      // TODO: flush cache
+      if (async_io && !hdimage->aio_wait()) {
+        BX_ERROR(("could not write() hard drive image file"));
+        scsi_command_complete(r, STATUS_CHECK_CONDITION, SENSE_HARDWARE_ERROR);
+        return 0;
+      }
       break;
     case 0x43:
       {
@@ -994,6 +1014,13 @@ void scsi_device_t::start_seek(SCSIRequest *r)
   bx_pc_system.activate_timer(seek_timer_index, seek_time, 0);
   bx_pc_system.setTimerParam(seek_timer_index, r->tag);
   r->seek_pending = 1;
+  if (async_io && !r->write_cmd) {
+    // read the data while seeking, seek_complete() picks it up
+    Bit32u n = r->sector_count;
+    if (n > (Bit32u)(SCSI_DMA_BUF_SIZE / block_size))
+      n = SCSI_DMA_BUF_SIZE / block_size;
+    hdimage->aio_read(r->sector * block_size, r->dma_buf, n * block_size, &r->aio);
+  }
 }
 
 void scsi_device_t::seek_timer_handler(void *this_ptr)
@@ -1007,6 +1034,11 @@ void scsi_device_t::seek_timer()
   Bit32u tag = bx_pc_system.triggeredTimerParam();
   SCSIRequest *r = scsi_find_request(tag);
 
+  if ((r->aio.state == HDIMAGE_AIO_PENDING) && !hdimage->aio_done(&r->aio)) {
+    // the guest keeps running while the data is read
+    bx_pc_system.activate_timer(seek_timer_index, SCSI_AIO_POLL_INTERVAL, 0);
+    return;
+  }
   seek_complete(r);
 }
 
@@ -1031,19 +1063,19 @@ void scsi_device_t::seek_complete(SCSIRequest *r)
         scsi_command_complete(r, STATUS_CHECK_CONDITION, SENSE_MEDIUM_ERROR);
         return;
       }
-    } else {
-      ret = (int)hdimage->lseek(r->sector * block_size, SEEK_SET);
-      if (ret < 0) {
-        BX_ERROR(("could not lseek() hard drive image file"));
+    } else if (r->aio.state == HDIMAGE_AIO_DONE) {
+      r->aio.state = HDIMAGE_AIO_IDLE;
+      if (r->aio.result != (ssize_t)r->buf_len) {
+        BX_ERROR(("could not read() hard drive image file"));
         scsi_command_complete(r, STATUS_CHECK_CONDITION, SENSE_HARDWARE_ERROR);
         return;
       }
-      i = 0;
-      do {
-        ret = (int)hdimage->read((bx_ptr_t)(r->dma_buf + (i * block_size)),
-                                 block_size);
-      } while ((++i < n) && (ret == block_size));
-      if (ret != block_size) {
+    } else {
+      if (async_io && !hdimage->aio_wait()) {
+        BX_ERROR(("could not write() hard drive image file"));
+      }
+      ret = (int)hdimage->read_at(r->sector * block_size, r->dma_buf, r->buf_len);
+      if (ret != r->buf_len) {
         BX_ERROR(("could not read() hard drive image file"));
         scsi_command_complete(r, STATUS_CHECK_CONDITION, SENSE_HARDWARE_ERROR);
         return;
@@ -1055,18 +1087,19 @@ void scsi_device_t::seek_complete(SCSIRequest *r)
   } else {
     bx_gui->statusbar_setitem(statusbar_id, 1, 1);
     n = r->buf_len / block_size;
-    if (n) {
-      ret = (int)hdimage->lseek(r->sector * block_size, SEEK_SET);
-      if (ret < 0) {
-        BX_ERROR(("could not lseek() hard drive image file"));
+    if (n && async_io) {
+      // written behind, a failure is reported by the next write
+      if (!hdimage->aio_write(r->sector * block_size, r->dma_buf, n * block_size)) {
+        BX_ERROR(("could not write() hard drive image file"));
         scsi_command_complete(r, STATUS_CHECK_CONDITION, SENSE_HARDWARE_ERROR);
+        return;
       }
-      i = 0;
-      do {
-        ret = (int)hdimage->write((bx_ptr_t)(r->dma_buf + (i * block_size)),
-                                  block_size);
-      } while ((++i < n) && (ret == block_size));
-      if (ret != block_size) {
+      r->sector += n;
+      r->sector_count -= n;
+      scsi_write_complete((void*)r, 0);
+    } else if (n) {
+      ret = (int)hdimage->write_at(r->sector * block_size, r->dma_buf, n * block_size);
+      if (ret != (int)(n * block_size)) {
         BX_ERROR(("could not write() hard drive image file"));
         scsi_command_complete(r, STATUS_CHECK_CONDITION, SENSE_HARDWARE_ERROR);
         return;
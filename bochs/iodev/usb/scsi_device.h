@@ -64,6 +64,7 @@ typedef struct SCSIRequest {
   bool write_cmd;
   bool async_mode;
   Bit8u seek_pending;
+  hdimage_aio_req_t aio;
   struct SCSIRequest *next;
 } SCSIRequest;
 
@@ -89,6 +90,7 @@ public:
   void set_inserted(bool value);
   bool get_inserted() {return inserted;}
   bool get_locked() {return locked;}
+  void set_async_io(bool value) {async_io = value;}
   static void seek_timer_handler(void *);
   bool save_requests(const char *path);
   void restore_requests(const char *path);
@@ -118,6 +120,7 @@ private:
   // members set in constructor / runtime config
   Bit64u max_lba;
   bool inserted;
+  bool async_io;
   // members handled by save/restore
   Bit64u curr_lba;
   int sense;
@@ -1217,11 +1217,13 @@ int bx_usb_ehci_c::qh_do_overlay(EHCIQueue *q)
   return 0;
 }
 
-// Bochs specific code (no async and scatter/gather support yet)
+// Bochs specific code (no async support yet)
 int bx_usb_ehci_c::transfer(EHCIPacket *p)
 {
-  Bit32u cpage, offset, bytes, plen, blen = 0;
+  Bit32u cpage, offset, bytes, plen;
   Bit64u page;
+  bx_dma_segment sg[5];
+  unsigned count = 0;
 
   cpage  = get_field(p->qtd.token, QTD_TOKEN_CPAGE);
   bytes  = get_field(p->qtd.token, QTD_TOKEN_TBYTES);
@@ -1242,14 +1244,21 @@ int bx_usb_ehci_c::transfer(EHCIPacket *p)
       cpage++;
     }
 
-    if (p->pid == USB_TOKEN_IN) {
-      DEV_MEM_WRITE_PHYSICAL_DMA(page, plen, p->packet.data+blen);
+    // the buffer pages of the qTD are moved with one call
+    if (count > 0 && (sg[count-1].addr + sg[count-1].len) == page) {
+      sg[count-1].len += plen;
     } else {
-      DEV_MEM_READ_PHYSICAL_DMA(page, plen, p->packet.data+blen);
+      sg[count].addr = page;
+      sg[count].len = plen;
+      count++;
     }
-    blen += plen;
     bytes -= plen;
   }
+  if (p->pid == USB_TOKEN_IN) {
+    DEV_MEM_WRITE_PHYSICAL_DMA_SG(sg, count, p->packet.data);
+  } else {
+    DEV_MEM_READ_PHYSICAL_DMA_SG(sg, count, p->packet.data);
+  }
   return 0;
 }
 
@@ -396,6 +396,7 @@ usb_msd_device_c::~usb_msd_device_c(void)
   if (s.scsi_dev != NULL)
     delete s.scsi_dev;
   if (s.hdimage != NULL) {
+    s.hdimage->aio_wait();
     s.hdimage->close();
     delete s.hdimage;
     free(s.image_mode);
@@ -461,6 +462,13 @@ bool usb_msd_device_c::set_option(const char *option)
     } else {
       BX_ERROR(("Option 'size' is only valid for USB VVFAT disks"));
     }
+  } else if (!strncmp(option, "async:", 6)) {
+    if (d.type == USB_MSD_TYPE_DISK) {
+      s.async = (atoi(option+6) != 0);
+      return 1;
+    } else {
+      BX_ERROR(("Option 'async' is only valid for USB disks"));
+    }
   } else if (!strncmp(option, "sect_size:", 10)) {
     if (d.type == USB_MSD_TYPE_DISK) {
       s.sect_size = (unsigned)strtol(option+10, &suffix, 10);
@@ -498,6 +506,7 @@ bool usb_msd_device_c::init()
         return 0;
       } else {
         s.scsi_dev = new scsi_device_t(s.hdimage, 0, usb_msd_command_complete, (void*)this);
+        s.scsi_dev->set_async_io(s.async);
       }
       sprintf(s.info_txt, "USB HD: path='%s', mode='%s', sect_size=%d", s.fname,
               s.image_mode, s.hdimage->sect_size);
@@ -70,6 +70,7 @@ private:
     char journal[BX_PATHNAME_LEN]; // undoable / volatile disk only
     int size; // VVFAT disk only
     unsigned sect_size; // sector size for disks only (default = 512 bytes)
+    bool async;         // asynchronous image I/O for disks only
     // members handled by runtime config
     bool status_changed;
     // members handled by save/restore
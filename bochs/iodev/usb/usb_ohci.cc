@@ -1316,10 +1316,14 @@ bool bx_usb_ohci_c::process_td(struct OHCI_TD *td, struct OHCI_ED *ed)
   }
   if ((ret > 0) && (pid == USB_TOKEN_IN)) {
     if (((TD_GET_CBP(td) & 0xfff) + ret) > 0x1000) {
+      bx_dma_segment sg[2];
       len1 = 0x1000 - (TD_GET_CBP(td) & 0xfff);
       len2 = ret - len1;
-      DEV_MEM_WRITE_PHYSICAL_DMA(TD_GET_CBP(td), len1, p->packet.data);
-      DEV_MEM_WRITE_PHYSICAL_DMA((TD_GET_BE(td) & ~0xfff), len2, p->packet.data+len1);
+      sg[0].addr = TD_GET_CBP(td);
+      sg[0].len = len1;
+      sg[1].addr = TD_GET_BE(td) & ~0xfff;
+      sg[1].len = len2;
+      DEV_MEM_WRITE_PHYSICAL_DMA_SG(sg, 2, p->packet.data);
     } else {
       DEV_MEM_WRITE_PHYSICAL_DMA(TD_GET_CBP(td), ret, p->packet.data);
     }
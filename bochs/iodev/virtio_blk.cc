@@ -0,0 +1,873 @@
+/////////////////////////////////////////////////////////////////////////
+// $Id$
+/////////////////////////////////////////////////////////////////////////
+//
+//  Copyright (C) 2021  The Bochs Project
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+/////////////////////////////////////////////////////////////////////////
+
+// Paravirtual block device (virtio 1.0, modern PCI transport)
+//
+// The device has a single split virtqueue. A notify from the guest makes
+// the device process all the available requests at once. Each request is
+// transferred with one scatter-gather DMA and one image access. If the
+// 'coalesce' option is set, the completion interrupt is delayed so that the
+// requests finished in that period share one interrupt.
+
+// Define BX_PLUGGABLE in files that can be compiled into plugins.  For
+// platforms that require a special tag on exported symbols, BX_PLUGGABLE
+// is used to know when we are exporting symbols and when we are importing.
+#define BX_PLUGGABLE
+
+#include "iodev.h"
+#if BX_SUPPORT_PCI && BX_SUPPORT_VIRTIO_BLK
+
+#include "pci.h"
+#include "hdimage/hdimage.h"
+#include "virtio_blk.h"
+
+#define LOG_THIS theVirtioBlk->
+
+bx_virtio_blk_c *theVirtioBlk = NULL;
+
+// device status bits
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_NEEDS_RESET   0x40
+
+// PCI capability types
+#define VIRTIO_PCI_CAP_COMMON_CFG   1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG   2
+#define VIRTIO_PCI_CAP_ISR_CFG      3
+#define VIRTIO_PCI_CAP_DEVICE_CFG   4
+
+// feature bits
+#define VIRTIO_BLK_F_SIZE_MAX       1
+#define VIRTIO_BLK_F_SEG_MAX        2
+#define VIRTIO_BLK_F_GEOMETRY       4
+#define VIRTIO_BLK_F_RO             5
+#define VIRTIO_BLK_F_BLK_SIZE       6
+#define VIRTIO_BLK_F_FLUSH          9
+#define VIRTIO_RING_F_INDIRECT_DESC 28
+#define VIRTIO_RING_F_EVENT_IDX     29
+#define VIRTIO_F_VERSION_1          32
+
+// descriptor flags
+#define VRING_DESC_F_NEXT           1
+#define VRING_DESC_F_WRITE          2
+#define VRING_DESC_F_INDIRECT       4
+
+#define VRING_AVAIL_F_NO_INTERRUPT  1
+
+// request types and status values
+#define VIRTIO_BLK_T_IN             0
+#define VIRTIO_BLK_T_OUT            1
+#define VIRTIO_BLK_T_FLUSH          4
+#define VIRTIO_BLK_T_GET_ID         8
+
+#define VIRTIO_BLK_S_OK             0
+#define VIRTIO_BLK_S_IOERR          1
+#define VIRTIO_BLK_S_UNSUPP         2
+
+#define VIRTIO_BLK_ID_BYTES         20
+
+// largest data transfer of one request
+#define VIRTIO_BLK_MAX_XFER         (VIRTIO_BLK_SEG_MAX * VIRTIO_BLK_SIZE_MAX)
+
+// builtin configuration handling functions
+
+void virtio_blk_init_options(void)
+{
+  bx_param_c *pci = SIM->get_param("pci");
+  bx_list_c *menu = new bx_list_c(pci, "virtio_blk", "Virtio block device");
+  menu->set_options(menu->SHOW_PARENT);
+  menu->set_enabled(BX_SUPPORT_VIRTIO_BLK);
+
+  bx_param_bool_c *enabled = new bx_param_bool_c(menu,
+    "enabled",
+    "Enable virtio block device",
+    "Enables the paravirtual virtio block device",
+    1);
+  enabled->set_enabled(BX_SUPPORT_VIRTIO_BLK);
+
+  bx_param_filename_c *path = new bx_param_filename_c(menu,
+    "path",
+    "Path of the disk image",
+    "Pathname of the disk image",
+    "", BX_PATHNAME_LEN);
+  path->set_extension("img");
+  bx_param_enum_c *mode = new bx_param_enum_c(menu,
+    "mode",
+    "Type of disk image",
+    "Mode of the disk image",
+    bx_hdimage_ctl.get_mode_names(),
+    0, 0);
+  bx_param_filename_c *journal = new bx_param_filename_c(menu,
+    "journal",
+    "Path of journal file",
+    "Pathname of the journal file",
+    "", BX_PATHNAME_LEN);
+  bx_param_num_c *coalesce = new bx_param_num_c(menu,
+    "coalesce",
+    "Interrupt coalescing (usec)",
+    "Delay of the completion interrupt in microseconds (0 = no delay)",
+    0, 100000,
+    0);
+
+  bx_list_c *deplist = new bx_list_c(NULL);
+  deplist->add(path);
+  deplist->add(mode);
+  deplist->add(coalesce);
+  enabled->set_dependent_list(deplist);
+  deplist = new bx_list_c(NULL);
+  deplist->add(journal);
+  mode->set_dependent_list(deplist, 0);
+  mode->set_dependent_bitmap(bx_hdimage_ctl.get_mode_id("undoable"), 1);
+  mode->set_dependent_bitmap(bx_hdimage_ctl.get_mode_id("volatile"), 1);
+  mode->set_dependent_bitmap(bx_hdimage_ctl.get_mode_id("vvfat"), 1);
+}
+
+Bit32s virtio_blk_options_parser(const char *context, int num_params, char *params[])
+{
+  if (!strcmp(params[0], "virtio_blk")) {
+    bx_list_c *base = (bx_list_c*) SIM->get_param(BXPN_VIRTIO_BLK);
+    for (int i = 1; i < num_params; i++) {
+      if (SIM->parse_param_from_list(context, params[i], base) < 0) {
+        BX_ERROR(("%s: unknown parameter for virtio_blk ignored.", context));
+      }
+    }
+  } else {
+    BX_PANIC(("%s: unknown directive '%s'", context, params[0]));
+  }
+  return 0;
+}
+
+Bit32s virtio_blk_options_save(FILE *fp)
+{
+  return SIM->write_param_list(fp, (bx_list_c*) SIM->get_param(BXPN_VIRTIO_BLK), NULL, 0);
+}
+
+// device plugin entry point
+
+PLUGIN_ENTRY_FOR_MODULE(virtio_blk)
+{
+  if (mode == PLUGIN_INIT) {
+    theVirtioBlk = new bx_virtio_blk_c();
+    BX_REGISTER_DEVICE_DEVMODEL(plugin, type, theVirtioBlk, BX_PLUGIN_VIRTIO_BLK);
+    // add new configuration parameter for the config interface
+    virtio_blk_init_options();
+    // register add-on option for bochsrc and command line
+    SIM->register_addon_option("virtio_blk", virtio_blk_options_parser, virtio_blk_options_save);
+  } else if (mode == PLUGIN_FINI) {
+    delete theVirtioBlk;
+    SIM->unregister_addon_option("virtio_blk");
+    bx_list_c *menu = (bx_list_c*)SIM->get_param("pci");
+    menu->remove("virtio_blk");
+  } else if (mode == PLUGIN_PROBE) {
+    return (int)PLUGTYPE_OPTIONAL;
+  } else if (mode == PLUGIN_FLAGS) {
+    return PLUGFLAG_PCI;
+  }
+  return 0; // Success
+}
+
+// the device object
+
+bx_virtio_blk_c::bx_virtio_blk_c()
+{
+  put("VIRTIO_BLK", "VBLK");
+  memset(&s, 0, sizeof(bx_virtio_blk_t));
+  s.coalesce_timer = BX_NULL_TIMER_HANDLE;
+  s.statusbar_id = -1;
+  hdimage = NULL;
+  buffer = NULL;
+  buffer_size = 0;
+  segs = NULL;
+  dma_sg = NULL;
+}
+
+bx_virtio_blk_c::~bx_virtio_blk_c()
+{
+  if (hdimage != NULL) {
+    hdimage->close();
+    delete hdimage;
+  }
+  if (buffer != NULL) {
+    delete [] buffer;
+  }
+  if (segs != NULL) {
+    delete [] segs;
+    delete [] dma_sg;
+  }
+  SIM->get_bochs_root()->remove("virtio_blk");
+  BX_DEBUG(("Exit"));
+}
+
+void bx_virtio_blk_c::init(void)
+{
+  bx_list_c *base = (bx_list_c*) SIM->get_param(BXPN_VIRTIO_BLK);
+  // Check if the device is disabled or not configured
+  if (!SIM->get_param_bool("enabled", base)->get()) {
+    BX_INFO(("virtio block device disabled"));
+    // mark unused plugin for removal
+    ((bx_param_bool_c*)((bx_list_c*)SIM->get_param(BXPN_PLUGIN_CTRL))->get_by_name("virtio_blk"))->set(0);
+    return;
+  }
+  const char *path = SIM->get_param_string("path", base)->getptr();
+  const char *image_mode = SIM->get_param_enum("mode", base)->get_selected();
+  if (strlen(path) == 0) {
+    BX_PANIC(("virtio_blk: disk image not specified"));
+    return;
+  }
+  hdimage = DEV_hdimage_init_image(image_mode,
+                                   0, SIM->get_param_string("journal", base)->getptr());
+  if (hdimage == NULL) {
+    return;
+  }
+  // default geometry, only used by vvfat (512 MB)
+  hdimage->cylinders = 1040;
+  hdimage->heads = 16;
+  hdimage->spt = 63;
+  hdimage->sect_size = 512;
+  if (hdimage->open(path) < 0) {
+    BX_PANIC(("virtio_blk: could not open disk image file '%s'", path));
+    return;
+  }
+  capacity = hdimage->hd_size >> 9;
+  BX_INFO(("virtio_blk: '%s', '%s' mode, %u MB", path, image_mode,
+           (Bit32u)(hdimage->hd_size >> 20)));
+
+  BX_VIRTIO_BLK_THIS s.devfunc = 0x00;
+  DEV_register_pci_handlers(this, &BX_VIRTIO_BLK_THIS s.devfunc, BX_PLUGIN_VIRTIO_BLK,
+                            "Virtio block device");
+
+  // initialize readonly registers
+  init_pci_conf(0x1af4, 0x1042, 0x01, 0x018000, 0x00, BX_PCI_INTA);
+  BX_VIRTIO_BLK_THIS init_bar_mem(0, VIRTIO_PCI_BAR_SIZE, mem_read_handler, mem_write_handler);
+
+  BX_VIRTIO_BLK_THIS s.host_features = ((Bit64u)1 << VIRTIO_F_VERSION_1) |
+    (1 << VIRTIO_BLK_F_SIZE_MAX) | (1 << VIRTIO_BLK_F_SEG_MAX) |
+    (1 << VIRTIO_BLK_F_GEOMETRY) | (1 << VIRTIO_BLK_F_BLK_SIZE) |
+    (1 << VIRTIO_BLK_F_FLUSH) | (1 << VIRTIO_RING_F_INDIRECT_DESC) |
+    (1 << VIRTIO_RING_F_EVENT_IDX);
+  if (hdimage->get_capabilities() & HDIMAGE_READONLY) {
+    BX_VIRTIO_BLK_THIS s.host_features |= (1 << VIRTIO_BLK_F_RO);
+  }
+  BX_VIRTIO_BLK_THIS s.coalesce = SIM->get_param_num("coalesce", base)->get();
+  if (BX_VIRTIO_BLK_THIS s.coalesce_timer == BX_NULL_TIMER_HANDLE) {
+    BX_VIRTIO_BLK_THIS s.coalesce_timer =
+      DEV_register_timer(this, coalesce_timer_handler, 0, 0, 0, "virtio_blk"); // one-shot, inactive
+  }
+  segs = new virtio_blk_seg_t[VIRTIO_BLK_MAX_DESC];
+  dma_sg = new bx_dma_segment[VIRTIO_BLK_MAX_DESC];
+  BX_VIRTIO_BLK_THIS s.statusbar_id = bx_gui->register_statusitem("VBLK", 1);
+}
+
+void bx_virtio_blk_c::reset(unsigned type)
+{
+  unsigned i;
+
+  static const struct reset_vals_t {
+    unsigned      addr;
+    unsigned char val;
+  } reset_vals[] = {
+    { 0x04, 0x00 }, { 0x05, 0x00 }, // command
+    { 0x06, 0x10 }, { 0x07, 0x00 }, // status (capability list)
+    { 0x2c, 0xf4 }, { 0x2d, 0x1a }, // subsystem vendor
+    { 0x2e, 0x00 }, { 0x2f, 0x11 }, // subsystem id
+    { 0x34, 0x40 },                 // capability pointer
+    { 0x3c, 0x00 },                 // IRQ
+  };
+  // vendor specific capabilities: type, offset and length in BAR #0
+  static const struct virtio_cap_t {
+    Bit8u  ptr;
+    Bit8u  next;
+    Bit8u  len;
+    Bit8u  type;
+    Bit32u offset;
+    Bit32u length;
+  } virtio_caps[] = {
+    { 0x40, 0x50, 16, VIRTIO_PCI_CAP_COMMON_CFG, VIRTIO_PCI_COMMON_CFG, VIRTIO_PCI_COMMON_SIZE },
+    { 0x50, 0x64, 20, VIRTIO_PCI_CAP_NOTIFY_CFG, VIRTIO_PCI_NOTIFY_CFG, 4 },
+    { 0x64, 0x74, 16, VIRTIO_PCI_CAP_ISR_CFG, VIRTIO_PCI_ISR_CFG, 1 },
+    { 0x74, 0x00, 16, VIRTIO_PCI_CAP_DEVICE_CFG, VIRTIO_PCI_DEVICE_CFG, VIRTIO_BLK_CONFIG_SIZE },
+  };
+  for (i = 0; i < sizeof(reset_vals) / sizeof(*reset_vals); ++i) {
+    BX_VIRTIO_BLK_THIS pci_conf[reset_vals[i].addr] = reset_vals[i].val;
+  }
+  for (i = 0; i < sizeof(virtio_caps) / sizeof(*virtio_caps); ++i) {
+    Bit8u *cap = &BX_VIRTIO_BLK_THIS pci_conf[virtio_caps[i].ptr];
+    cap[0] = 0x09; // vendor specific
+    cap[1] = virtio_caps[i].next;
+    cap[2] = virtio_caps[i].len;
+    cap[3] = virtio_caps[i].type;
+    cap[4] = 0;    // BAR #0
+    WriteHostDWordToLittleEndian((Bit32u*)&cap[8], virtio_caps[i].offset);
+    WriteHostDWordToLittleEndian((Bit32u*)&cap[12], virtio_caps[i].length);
+    if (virtio_caps[i].type == VIRTIO_PCI_CAP_NOTIFY_CFG) {
+      // notify_off_multiplier
+      WriteHostDWordToLittleEndian((Bit32u*)&cap[16], 4);
+    }
+  }
+  BX_VIRTIO_BLK_THIS device_reset();
+}
+
+// reset requested by the guest (status = 0) or by a system reset
+void bx_virtio_blk_c::device_reset(void)
+{
+  BX_VIRTIO_BLK_THIS s.dfselect = 0;
+  BX_VIRTIO_BLK_THIS s.gfselect = 0;
+  BX_VIRTIO_BLK_THIS s.guest_features = 0;
+  BX_VIRTIO_BLK_THIS s.status = 0;
+  BX_VIRTIO_BLK_THIS s.queue_select = 0;
+  memset(&BX_VIRTIO_BLK_THIS s.vq, 0, sizeof(virtio_queue_t));
+  BX_VIRTIO_BLK_THIS s.vq.size = VIRTIO_BLK_QUEUE_SIZE;
+  BX_VIRTIO_BLK_THIS s.isr = 0;
+  BX_VIRTIO_BLK_THIS s.irq_pending = 0;
+  bx_pc_system.deactivate_timer(BX_VIRTIO_BLK_THIS s.coalesce_timer);
+  BX_VIRTIO_BLK_THIS set_irq_level(0);
+}
+
+void bx_virtio_blk_c::register_state(void)
+{
+  bx_list_c *list = new bx_list_c(SIM->get_bochs_root(), "virtio_blk", "Virtio Block Device State");
+  BXRS_HEX_PARAM_FIELD(list, dfselect, BX_VIRTIO_BLK_THIS s.dfselect);
+  BXRS_HEX_PARAM_FIELD(list, gfselect, BX_VIRTIO_BLK_THIS s.gfselect);
+  BXRS_HEX_PARAM_FIELD(list, guest_features, BX_VIRTIO_BLK_THIS s.guest_features);
+  BXRS_HEX_PARAM_FIELD(list, status, BX_VIRTIO_BLK_THIS s.status);
+  BXRS_HEX_PARAM_FIELD(list, config_generation, BX_VIRTIO_BLK_THIS s.config_generation);
+  BXRS_HEX_PARAM_FIELD(list, queue_select, BX_VIRTIO_BLK_THIS s.queue_select);
+  BXRS_HEX_PARAM_FIELD(list, isr, BX_VIRTIO_BLK_THIS s.isr);
+  BXRS_PARAM_BOOL(list, irq_pending, BX_VIRTIO_BLK_THIS s.irq_pending);
+  bx_list_c *vq = new bx_list_c(list, "vq", "");
+  BXRS_DEC_PARAM_FIELD(vq, size, BX_VIRTIO_BLK_THIS s.vq.size);
+  BXRS_PARAM_BOOL(vq, enabled, BX_VIRTIO_BLK_THIS s.vq.enabled);
+  BXRS_HEX_PARAM_FIELD(vq, desc_addr, BX_VIRTIO_BLK_THIS s.vq.desc_addr);
+  BXRS_HEX_PARAM_FIELD(vq, avail_addr, BX_VIRTIO_BLK_THIS s.vq.avail_addr);
+  BXRS_HEX_PARAM_FIELD(vq, used_addr, BX_VIRTIO_BLK_THIS s.vq.used_addr);
+  BXRS_DEC_PARAM_FIELD(vq, last_avail_idx, BX_VIRTIO_BLK_THIS s.vq.last_avail_idx);
+  BXRS_DEC_PARAM_FIELD(vq, used_idx, BX_VIRTIO_BLK_THIS s.vq.used_idx);
+  BXRS_DEC_PARAM_FIELD(vq, signalled_used, BX_VIRTIO_BLK_THIS s.vq.signalled_used);
+  if (hdimage != NULL) {
+    hdimage->register_state(list);
+  }
+
+  register_pci_state(list);
+}
+
+void bx_virtio_blk_c::after_restore_state(void)
+{
+  bx_pci_device_c::after_restore_pci_state(NULL);
+  if (BX_VIRTIO_BLK_THIS s.irq_pending) {
+    // the delayed interrupt is not part of the saved state
+    BX_VIRTIO_BLK_THIS update_irq(1);
+  }
+}
+
+void bx_virtio_blk_c::set_irq_level(bool level)
+{
+  DEV_pci_set_irq(BX_VIRTIO_BLK_THIS s.devfunc, BX_VIRTIO_BLK_THIS pci_conf[0x3d], level);
+}
+
+// Check the interrupt suppression of the driver (used event index or
+// NO_INTERRUPT flag) for the entries added since the last interrupt.
+bool bx_virtio_blk_c::need_interrupt(void)
+{
+  virtio_queue_t *vq = &BX_VIRTIO_BLK_THIS s.vq;
+  Bit16u old_idx = vq->signalled_used, new_idx = vq->used_idx;
+
+  if (old_idx == new_idx)
+    return 0;
+  if (BX_VIRTIO_BLK_THIS s.guest_features & (1 << VIRTIO_RING_F_EVENT_IDX)) {
+    Bit16u used_event = vq_read16(vq->avail_addr + 4 + 2 * vq->size);
+    return ((Bit16u)(new_idx - used_event - 1) < (Bit16u)(new_idx - old_idx));
+  } else {
+    return ((vq_read16(vq->avail_addr) & VRING_AVAIL_F_NO_INTERRUPT) == 0);
+  }
+}
+
+// Raise the interrupt for completed requests now (force) or when the
+// coalescing period has elapsed.
+void bx_virtio_blk_c::update_irq(bool force)
+{
+  if (!force && (BX_VIRTIO_BLK_THIS s.coalesce > 0)) {
+    if (!BX_VIRTIO_BLK_THIS s.irq_pending) {
+      BX_VIRTIO_BLK_THIS s.irq_pending = 1;
+      bx_pc_system.activate_timer(BX_VIRTIO_BLK_THIS s.coalesce_timer,
+                                  BX_VIRTIO_BLK_THIS s.coalesce, 0);
+    }
+    return;
+  }
+  BX_VIRTIO_BLK_THIS s.irq_pending = 0;
+  if (BX_VIRTIO_BLK_THIS need_interrupt()) {
+    BX_VIRTIO_BLK_THIS s.vq.signalled_used = BX_VIRTIO_BLK_THIS s.vq.used_idx;
+    BX_VIRTIO_BLK_THIS s.isr |= 0x01;
+    BX_VIRTIO_BLK_THIS set_irq_level(1);
+  } else {
+    BX_VIRTIO_BLK_THIS s.vq.signalled_used = BX_VIRTIO_BLK_THIS s.vq.used_idx;
+  }
+}
+
+void bx_virtio_blk_c::coalesce_timer_handler(void *this_ptr)
+{
+  bx_virtio_blk_c *class_ptr = (bx_virtio_blk_c *) this_ptr;
+  class_ptr->coalesce_timer();
+}
+
+void bx_virtio_blk_c::coalesce_timer(void)
+{
+  if (BX_VIRTIO_BLK_THIS s.irq_pending) {
+    BX_VIRTIO_BLK_THIS update_irq(1);
+  }
+}
+
+Bit16u bx_virtio_blk_c::vq_read16(Bit64u addr)
+{
+  Bit16u value;
+
+  DEV_MEM_READ_PHYSICAL_DMA((bx_phy_address)addr, 2, (Bit8u*)&value);
+  return ReadHostWordFromLittleEndian(&value);
+}
+
+void bx_virtio_blk_c::vq_write16(Bit64u addr, Bit16u value)
+{
+  Bit16u data;
+
+  WriteHostWordToLittleEndian(&data, value);
+  DEV_MEM_WRITE_PHYSICAL_DMA((bx_phy_address)addr, 2, (Bit8u*)&data);
+}
+
+// Walk the descriptor chain starting at 'head' (following an indirect table
+// if present) and store the ranges in 'segs'. Returns 0 if the chain is
+// malformed.
+bool bx_virtio_blk_c::get_request_segments(Bit16u head, unsigned *nsegs)
+{
+  virtio_queue_t *vq = &BX_VIRTIO_BLK_THIS s.vq;
+  Bit64u table = vq->desc_addr;
+  Bit32u table_size = vq->size;
+  Bit32u idx = head;
+  Bit8u desc[16];
+  Bit64u addr;
+  Bit32u len;
+  Bit16u flags;
+  unsigned n = 0, count = 0;
+
+  while (1) {
+    if ((idx >= table_size) || (++count > VIRTIO_BLK_MAX_DESC)) {
+      BX_ERROR(("invalid descriptor chain (head=%d)", head));
+      return 0;
+    }
+    DEV_MEM_READ_PHYSICAL_DMA((bx_phy_address)(table + idx * 16), 16, desc);
+    addr = ReadHostQWordFromLittleEndian((Bit64u*)&desc[0]);
+    len = ReadHostDWordFromLittleEndian((Bit32u*)&desc[8]);
+    flags = ReadHostWordFromLittleEndian((Bit16u*)&desc[12]);
+    idx = ReadHostWordFromLittleEndian((Bit16u*)&desc[14]);
+    if (flags & VRING_DESC_F_INDIRECT) {
+      if ((table != vq->desc_addr) || (len < 16) || (len & 15) ||
+          !(BX_VIRTIO_BLK_THIS s.guest_features & (1 << VIRTIO_RING_F_INDIRECT_DESC))) {
+        BX_ERROR(("invalid indirect descriptor (head=%d)", head));
+        return 0;
+      }
+      table = addr;
+      table_size = len >> 4;
+      idx = 0;
+      continue;
+    }
+    if (len > 0) {
+      segs[n].addr = addr;
+      segs[n].len = len;
+      segs[n].write = ((flags & VRING_DESC_F_WRITE) != 0);
+      n++;
+    }
+    if (!(flags & VRING_DESC_F_NEXT))
+      break;
+  }
+  *nsegs = n;
+  return 1;
+}
+
+// Execute one request. The first 16 bytes of the device-readable part are
+// the header, the last byte of the device-writable part receives the status.
+Bit8u bx_virtio_blk_c::handle_request(virtio_blk_seg_t *seg, unsigned nsegs, Bit32u *used_len)
+{
+  Bit8u hdr[16];
+  Bit32u type, hdr_len = 0, total = 0;
+  Bit64u sector;
+  unsigned i, first, nsg = 0;
+  bool write;
+
+  *used_len = 0;
+  // gather the header
+  for (first = 0; (first < nsegs) && (hdr_len < 16) && !seg[first].write; ) {
+    Bit32u n = seg[first].len;
+    if (n > (16 - hdr_len)) n = 16 - hdr_len;
+    DEV_MEM_READ_PHYSICAL_DMA((bx_phy_address)seg[first].addr, n, &hdr[hdr_len]);
+    hdr_len += n;
+    seg[first].addr += n;
+    seg[first].len -= n;
+    if (seg[first].len == 0) first++;
+  }
+  if (hdr_len < 16) {
+    BX_ERROR(("request header too short"));
+    return VIRTIO_BLK_S_IOERR;
+  }
+  type = ReadHostDWordFromLittleEndian((Bit32u*)&hdr[0]);
+  sector = ReadHostQWordFromLittleEndian((Bit64u*)&hdr[8]);
+  if ((type != VIRTIO_BLK_T_IN) && (type != VIRTIO_BLK_T_OUT) &&
+      (type != VIRTIO_BLK_T_FLUSH) && (type != VIRTIO_BLK_T_GET_ID)) {
+    BX_DEBUG(("unsupported request type %d", type));
+    return VIRTIO_BLK_S_UNSUPP;
+  }
+  // all data segments must have the same direction
+  write = (type == VIRTIO_BLK_T_OUT);
+  for (i = first; i < nsegs; i++) {
+    if (seg[i].write == write) {
+      BX_ERROR(("invalid data direction in request type %d", type));
+      return VIRTIO_BLK_S_IOERR;
+    }
+    // the sum of the segment lengths must not wrap around
+    if (seg[i].len > (VIRTIO_BLK_MAX_XFER - total)) {
+      BX_ERROR(("request type %d exceeds %d bytes", type, VIRTIO_BLK_MAX_XFER));
+      return VIRTIO_BLK_S_IOERR;
+    }
+    dma_sg[nsg].addr = (bx_phy_address)seg[i].addr;
+    dma_sg[nsg].len = seg[i].len;
+    total += seg[i].len;
+    nsg++;
+  }
+
+  switch (type) {
+    case VIRTIO_BLK_T_IN:
+    case VIRTIO_BLK_T_OUT:
+      if ((total & 0x1ff) || (total > VIRTIO_BLK_MAX_XFER) ||
+          (sector > capacity) || ((total >> 9) > (capacity - sector))) {
+        BX_ERROR(("invalid transfer: sector=" FMT_LL "d, bytes=%d", sector, total));
+        return VIRTIO_BLK_S_IOERR;
+      }
+      if (total > BX_VIRTIO_BLK_THIS buffer_size) {
+        if (BX_VIRTIO_BLK_THIS buffer != NULL) {
+          delete [] BX_VIRTIO_BLK_THIS buffer;
+        }
+        BX_VIRTIO_BLK_THIS buffer_size = total;
+        BX_VIRTIO_BLK_THIS buffer = new Bit8u[total];
+      }
+      if (type == VIRTIO_BLK_T_IN) {
+        bx_gui->statusbar_setitem(BX_VIRTIO_BLK_THIS s.statusbar_id, 1);
+        if (hdimage->read_at((Bit64s)sector << 9, BX_VIRTIO_BLK_THIS buffer, total) != (ssize_t)total) {
+          BX_ERROR(("could not read %d bytes at sector " FMT_LL "d", total, sector));
+          return VIRTIO_BLK_S_IOERR;
+        }
+        DEV_MEM_WRITE_PHYSICAL_DMA_SG(dma_sg, nsg, BX_VIRTIO_BLK_THIS buffer);
+        *used_len = total;
+      } else {
+        if (BX_VIRTIO_BLK_THIS s.host_features & (1 << VIRTIO_BLK_F_RO)) {
+          return VIRTIO_BLK_S_IOERR;
+        }
+        bx_gui->statusbar_setitem(BX_VIRTIO_BLK_THIS s.statusbar_id, 1, 1 /* write */);
+        DEV_MEM_READ_PHYSICAL_DMA_SG(dma_sg, nsg, BX_VIRTIO_BLK_THIS buffer);
+        if (hdimage->write_at((Bit64s)sector << 9, BX_VIRTIO_BLK_THIS buffer, total) != (ssize_t)total) {
+          BX_ERROR(("could not write %d bytes at sector " FMT_LL "d", total, sector));
+          return VIRTIO_BLK_S_IOERR;
+        }
+      }
+      break;
+    case VIRTIO_BLK_T_FLUSH:
+      // the image data is written through, nothing to do
+      break;
+    case VIRTIO_BLK_T_GET_ID:
+      {
+        char serial[VIRTIO_BLK_ID_BYTES];
+        memset(serial, 0, VIRTIO_BLK_ID_BYTES);
+        strcpy(serial, "BXVBLK00001");
+        if (total > VIRTIO_BLK_ID_BYTES) total = VIRTIO_BLK_ID_BYTES;
+        for (i = 0; (i < nsg) && (*used_len < total); i++) {
+          Bit32u n = dma_sg[i].len;
+          if (n > (total - *used_len)) n = total - *used_len;
+          DEV_MEM_WRITE_PHYSICAL_DMA(dma_sg[i].addr, n, (Bit8u*)&serial[*used_len]);
+          *used_len += n;
+        }
+      }
+      break;
+  }
+  return VIRTIO_BLK_S_OK;
+}
+
+// Process all the requests made available since the last notify and update
+// the used ring index once for the whole batch.
+void bx_virtio_blk_c::process_queue(void)
+{
+  virtio_queue_t *vq = &BX_VIRTIO_BLK_THIS s.vq;
+  Bit16u avail_idx, head;
+  Bit32u used_len, elem[2];
+  unsigned nsegs;
+  Bit8u status;
+
+  if (!(BX_VIRTIO_BLK_THIS s.status & VIRTIO_STATUS_DRIVER_OK) || !vq->enabled ||
+      (BX_VIRTIO_BLK_THIS s.status & VIRTIO_STATUS_NEEDS_RESET))
+    return;
+
+  avail_idx = vq_read16(vq->avail_addr + 2);
+  if ((Bit16u)(avail_idx - vq->last_avail_idx) > vq->size) {
+    BX_ERROR(("invalid available index %d", avail_idx));
+    BX_VIRTIO_BLK_THIS s.status |= VIRTIO_STATUS_NEEDS_RESET;
+    return;
+  }
+  while (vq->last_avail_idx != avail_idx) {
+    head = vq_read16(vq->avail_addr + 4 + 2 * (vq->last_avail_idx % vq->size));
+    if (!get_request_segments(head, &nsegs) || (nsegs < 2) ||
+        !segs[nsegs - 1].write) {
+      BX_ERROR(("malformed request (head=%d)", head));
+      BX_VIRTIO_BLK_THIS s.status |= VIRTIO_STATUS_NEEDS_RESET;
+      break;
+    }
+    // the status byte is the last one of the chain
+    virtio_blk_seg_t *st = &segs[nsegs - 1];
+    Bit64u status_addr = st->addr + st->len - 1;
+    if (--st->len == 0) nsegs--;
+    status = handle_request(segs, nsegs, &used_len);
+    DEV_MEM_WRITE_PHYSICAL_DMA((bx_phy_address)status_addr, 1, &status);
+    // used ring element
+    WriteHostDWordToLittleEndian(&elem[0], head);
+    WriteHostDWordToLittleEndian(&elem[1], used_len + 1);
+    DEV_MEM_WRITE_PHYSICAL_DMA((bx_phy_address)(vq->used_addr + 4 + 8 * (vq->used_idx % vq->size)),
+                               8, (Bit8u*)elem);
+    vq->used_idx++;
+    vq->last_avail_idx++;
+    // pick up requests added in the meantime
+    if (vq->last_avail_idx == avail_idx) {
+      avail_idx = vq_read16(vq->avail_addr + 2);
+    }
+  }
+  vq_write16(vq->used_addr + 2, vq->used_idx);
+  if (BX_VIRTIO_BLK_THIS s.guest_features & (1 << VIRTIO_RING_F_EVENT_IDX)) {
+    // avail_event: the next notify is wanted for the next new request
+    vq_write16(vq->used_addr + 4 + 8 * vq->size, vq->last_avail_idx);
+  }
+  if (vq->used_idx != vq->signalled_used) {
+    BX_VIRTIO_BLK_THIS update_irq(0);
+  }
+}
+
+// common configuration structure (virtio_pci_common_cfg)
+void bx_virtio_blk_c::read_common_cfg(Bit8u *cfg)
+{
+  virtio_queue_t *vq = &BX_VIRTIO_BLK_THIS s.vq;
+  bool valid = (BX_VIRTIO_BLK_THIS s.queue_select == 0);
+
+  memset(cfg, 0, VIRTIO_PCI_COMMON_SIZE);
+  WriteHostDWordToLittleEndian((Bit32u*)&cfg[0x00], BX_VIRTIO_BLK_THIS s.dfselect);
+  if (BX_VIRTIO_BLK_THIS s.dfselect < 2) {
+    WriteHostDWordToLittleEndian((Bit32u*)&cfg[0x04],
+      (Bit32u)(BX_VIRTIO_BLK_THIS s.host_features >> (BX_VIRTIO_BLK_THIS s.dfselect * 32)));
+  }
+  WriteHostDWordToLittleEndian((Bit32u*)&cfg[0x08], BX_VIRTIO_BLK_THIS s.gfselect);
+  if (BX_VIRTIO_BLK_THIS s.gfselect < 2) {
+    WriteHostDWordToLittleEndian((Bit32u*)&cfg[0x0c],
+      (Bit32u)(BX_VIRTIO_BLK_THIS s.guest_features >> (BX_VIRTIO_BLK_THIS s.gfselect * 32)));
+  }
+  WriteHostWordToLittleEndian((Bit16u*)&cfg[0x10], 0xffff); // no MSI-X
+  WriteHostWordToLittleEndian((Bit16u*)&cfg[0x12], 1);      // num_queues
+  cfg[0x14] = BX_VIRTIO_BLK_THIS s.status;
+  cfg[0x15] = BX_VIRTIO_BLK_THIS s.config_generation;
+  WriteHostWordToLittleEndian((Bit16u*)&cfg[0x16], BX_VIRTIO_BLK_THIS s.queue_select);
+  WriteHostWordToLittleEndian((Bit16u*)&cfg[0x1a], 0xffff);
+  if (valid) {
+    WriteHostWordToLittleEndian((Bit16u*)&cfg[0x18], vq->size);
+    WriteHostWordToLittleEndian((Bit16u*)&cfg[0x1c], vq->enabled);
+    WriteHostWordToLittleEndian((Bit16u*)&cfg[0x1e], 0);    // queue_notify_off
+    WriteHostQWordToLittleEndian((Bit64u*)&cfg[0x20], vq->desc_addr);
+    WriteHostQWordToLittleEndian((Bit64u*)&cfg[0x28], vq->avail_addr);
+    WriteHostQWordToLittleEndian((Bit64u*)&cfg[0x30], vq->used_addr);
+  }
+}
+
+void bx_virtio_blk_c::write_common_cfg(const Bit8u *cfg, Bit32u offset, unsigned len)
+{
+  virtio_queue_t *vq = &BX_VIRTIO_BLK_THIS s.vq;
+  Bit32u end = offset + len;
+  Bit16u value16;
+
+#define CFG_WRITTEN(ofs, size) ((offset < ((ofs) + (size))) && (end > (ofs)))
+  if (CFG_WRITTEN(0x00, 4)) {
+    BX_VIRTIO_BLK_THIS s.dfselect = ReadHostDWordFromLittleEndian((Bit32u*)&cfg[0x00]);
+  }
+  if (CFG_WRITTEN(0x08, 4)) {
+    BX_VIRTIO_BLK_THIS s.gfselect = ReadHostDWordFromLittleEndian((Bit32u*)&cfg[0x08]);
+  }
+  if (CFG_WRITTEN(0x0c, 4) && (BX_VIRTIO_BLK_THIS s.gfselect < 2)) {
+    Bit64u mask = (Bit64u)0xffffffff << (BX_VIRTIO_BLK_THIS s.gfselect * 32);
+    Bit64u value = (Bit64u)ReadHostDWordFromLittleEndian((Bit32u*)&cfg[0x0c]) <<
+                   (BX_VIRTIO_BLK_THIS s.gfselect * 32);
+    BX_VIRTIO_BLK_THIS s.guest_features = (BX_VIRTIO_BLK_THIS s.guest_features & ~mask) |
+      (value & mask & BX_VIRTIO_BLK_THIS s.host_features);
+  }
+  if (CFG_WRITTEN(0x14, 1)) {
+    if (cfg[0x14] == 0) {
+      BX_DEBUG(("device reset"));
+      BX_VIRTIO_BLK_THIS device_reset();
+    } else {
+      BX_VIRTIO_BLK_THIS s.status = cfg[0x14];
+    }
+  }
+  if (CFG_WRITTEN(0x16, 2)) {
+    BX_VIRTIO_BLK_THIS s.queue_select = ReadHostWordFromLittleEndian((Bit16u*)&cfg[0x16]);
+  }
+  if ((BX_VIRTIO_BLK_THIS s.queue_select != 0) || vq->enabled)
+    return;
+  if (CFG_WRITTEN(0x18, 2)) {
+    value16 = ReadHostWordFromLittleEndian((Bit16u*)&cfg[0x18]);
+    if ((value16 > 0) && (value16 <= VIRTIO_BLK_QUEUE_SIZE)) {
+      vq->size = value16;
+    } else {
+      BX_ERROR(("invalid queue size %d", value16));
+    }
+  }
+  if (CFG_WRITTEN(0x20, 8)) {
+    vq->desc_addr = ReadHostQWordFromLittleEndian((Bit64u*)&cfg[0x20]);
+  }
+  if (CFG_WRITTEN(0x28, 8)) {
+    vq->avail_addr = ReadHostQWordFromLittleEndian((Bit64u*)&cfg[0x28]);
+  }
+  if (CFG_WRITTEN(0x30, 8)) {
+    vq->used_addr = ReadHostQWordFromLittleEndian((Bit64u*)&cfg[0x30]);
+  }
+  if (CFG_WRITTEN(0x1c, 2) && (ReadHostWordFromLittleEndian((Bit16u*)&cfg[0x1c]) == 1)) {
+    vq->enabled = 1;
+    vq->last_avail_idx = 0;
+    vq->used_idx = 0;
+    vq->signalled_used = 0;
+  }
+#undef CFG_WRITTEN
+}
+
+// device configuration structure (virtio_blk_config)
+void bx_virtio_blk_c::read_device_cfg(Bit8u *cfg)
+{
+  unsigned cylinders = (unsigned)(capacity / (16 * 63));
+
+  memset(cfg, 0, VIRTIO_BLK_CONFIG_SIZE);
+  WriteHostQWordToLittleEndian((Bit64u*)&cfg[0x00], capacity);
+  WriteHostDWordToLittleEndian((Bit32u*)&cfg[0x08], VIRTIO_BLK_SIZE_MAX);
+  WriteHostDWordToLittleEndian((Bit32u*)&cfg[0x0c], VIRTIO_BLK_SEG_MAX);
+  WriteHostWordToLittleEndian((Bit16u*)&cfg[0x10], (cylinders > 0xffff) ? 0xffff : cylinders);
+  cfg[0x12] = 16;
+  cfg[0x13] = 63;
+  WriteHostDWordToLittleEndian((Bit32u*)&cfg[0x14], hdimage->sect_size);
+}
+
+bool bx_virtio_blk_c::mem_read_handler(bx_phy_address addr, unsigned len,
+                                       void *data, void *param)
+{
+  bx_virtio_blk_c *class_ptr = (bx_virtio_blk_c *) param;
+
+  return class_ptr->mem_read(addr, len, data);
+}
+
+bool bx_virtio_blk_c::mem_read(bx_phy_address addr, unsigned len, void *data)
+{
+  Bit8u *data_ptr = (Bit8u*) data;
+  Bit32u offset = (Bit32u)(addr - BX_VIRTIO_BLK_THIS pci_bar[0].addr);
+  Bit32u region = offset & ~0xfff, size = 0;
+  Bit64u cfg[8];
+
+  offset &= 0xfff;
+  memset(data_ptr, 0, len);
+  switch (region) {
+    case VIRTIO_PCI_COMMON_CFG:
+      BX_VIRTIO_BLK_THIS read_common_cfg((Bit8u*)cfg);
+      size = VIRTIO_PCI_COMMON_SIZE;
+      break;
+    case VIRTIO_PCI_ISR_CFG:
+      // reading the ISR status acknowledges the interrupt
+      if (offset == 0) {
+        data_ptr[0] = BX_VIRTIO_BLK_THIS s.isr;
+        BX_VIRTIO_BLK_THIS s.isr = 0;
+        BX_VIRTIO_BLK_THIS set_irq_level(0);
+      }
+      break;
+    case VIRTIO_PCI_DEVICE_CFG:
+      BX_VIRTIO_BLK_THIS read_device_cfg((Bit8u*)cfg);
+      size = VIRTIO_BLK_CONFIG_SIZE;
+      break;
+  }
+  for (unsigned i = 0; i < len; i++) {
+    if ((offset + i) < size) {
+      data_ptr[i] = ((Bit8u*)cfg)[offset + i];
+    }
+  }
+  return 1;
+}
+
+bool bx_virtio_blk_c::mem_write_handler(bx_phy_address addr, unsigned len,
+                                        void *data, void *param)
+{
+  bx_virtio_blk_c *class_ptr = (bx_virtio_blk_c *) param;
+
+  return class_ptr->mem_write(addr, len, data);
+}
+
+bool bx_virtio_blk_c::mem_write(bx_phy_address addr, unsigned len, void *data)
+{
+  Bit8u *data_ptr = (Bit8u*) data;
+  Bit32u offset = (Bit32u)(addr - BX_VIRTIO_BLK_THIS pci_bar[0].addr);
+  Bit32u region = offset & ~0xfff;
+  Bit64u cfg[8];
+
+  offset &= 0xfff;
+  switch (region) {
+    case VIRTIO_PCI_COMMON_CFG:
+      if ((offset + len) <= VIRTIO_PCI_COMMON_SIZE) {
+        BX_VIRTIO_BLK_THIS read_common_cfg((Bit8u*)cfg);
+        memcpy((Bit8u*)cfg + offset, data_ptr, len);
+        BX_VIRTIO_BLK_THIS write_common_cfg((Bit8u*)cfg, offset, len);
+      }
+      break;
+    case VIRTIO_PCI_NOTIFY_CFG:
+      // there is only one queue
+      if (offset == 0) {
+        BX_VIRTIO_BLK_THIS process_queue();
+      }
+      break;
+    default:
+      BX_DEBUG(("write to read-only register 0x%04x ignored", region | offset));
+  }
+  return 1;
+}
+
+// pci configuration space write callback handler
+void bx_virtio_blk_c::pci_write_handler(Bit8u address, Bit32u value, unsigned io_len)
+{
+  Bit8u value8, oldval;
+
+  if ((address >= 0x14) && (address < 0x34))
+    return;
+
+  BX_DEBUG_PCI_WRITE(address, value, io_len);
+  for (unsigned i=0; i<io_len; i++) {
+    value8 = (value >> (i*8)) & 0xFF;
+    oldval = BX_VIRTIO_BLK_THIS pci_conf[address+i];
+    switch (address+i) {
+      case 0x04:
+        value8 &= 0x06;
+        break;
+      default:
+        value8 = oldval;
+    }
+    BX_VIRTIO_BLK_THIS pci_conf[address+i] = value8;
+  }
+}
+
+#endif // BX_SUPPORT_PCI && BX_SUPPORT_VIRTIO_BLK
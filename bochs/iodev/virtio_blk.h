@@ -0,0 +1,126 @@
+/////////////////////////////////////////////////////////////////////////
+// $Id$
+/////////////////////////////////////////////////////////////////////////
+//
+//  Copyright (C) 2021  The Bochs Project
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef BX_IODEV_VIRTIO_BLK_H
+#define BX_IODEV_VIRTIO_BLK_H
+
+#define BX_VIRTIO_BLK_THIS this->
+#define BX_VIRTIO_BLK_THIS_PTR this
+
+// layout of the memory BAR (virtio 1.0 PCI transport)
+#define VIRTIO_PCI_COMMON_CFG   0x0000
+#define VIRTIO_PCI_ISR_CFG      0x1000
+#define VIRTIO_PCI_DEVICE_CFG   0x2000
+#define VIRTIO_PCI_NOTIFY_CFG   0x3000
+#define VIRTIO_PCI_BAR_SIZE     0x4000
+#define VIRTIO_PCI_COMMON_SIZE  0x38
+#define VIRTIO_BLK_CONFIG_SIZE  0x20
+
+#define VIRTIO_BLK_QUEUE_SIZE   256
+#define VIRTIO_BLK_SEG_MAX      (VIRTIO_BLK_QUEUE_SIZE - 2)
+#define VIRTIO_BLK_SIZE_MAX     0x10000
+// descriptors followed in one chain, including indirect tables
+#define VIRTIO_BLK_MAX_DESC     1024
+
+typedef struct {
+  Bit16u size;
+  bool   enabled;
+  Bit64u desc_addr;
+  Bit64u avail_addr;
+  Bit64u used_addr;
+  Bit16u last_avail_idx;
+  Bit16u used_idx;
+  Bit16u signalled_used;  // used index at the time of the last interrupt
+} virtio_queue_t;
+
+// one device-readable or device-writable range of a request
+typedef struct {
+  Bit64u addr;
+  Bit32u len;
+  bool   write;
+} virtio_blk_seg_t;
+
+typedef struct {
+  Bit8u  devfunc;
+  Bit32u dfselect;
+  Bit32u gfselect;
+  Bit64u host_features;
+  Bit64u guest_features;
+  Bit8u  status;
+  Bit8u  config_generation;
+  Bit16u queue_select;
+  Bit8u  isr;
+  virtio_queue_t vq;
+
+  Bit32u coalesce;        // interrupt delay in usec (0 = immediate)
+  int    coalesce_timer;
+  bool   irq_pending;
+
+  int    statusbar_id;
+} bx_virtio_blk_t;
+
+class bx_virtio_blk_c : public bx_pci_device_c {
+public:
+  bx_virtio_blk_c();
+  virtual ~bx_virtio_blk_c();
+  virtual void init(void);
+  virtual void reset(unsigned type);
+  virtual void register_state(void);
+  virtual void after_restore_state(void);
+
+  virtual void pci_write_handler(Bit8u address, Bit32u value, unsigned io_len);
+
+private:
+  bx_virtio_blk_t s;
+
+  device_image_t *hdimage;
+  Bit64u capacity;        // in 512 byte units
+  Bit8u  *buffer;
+  Bit32u buffer_size;
+  virtio_blk_seg_t *segs;
+  bx_dma_segment *dma_sg;
+
+  void device_reset(void);
+  void set_irq_level(bool level);
+  void update_irq(bool force);
+  void process_queue(void);
+  bool get_request_segments(Bit16u head, unsigned *nsegs);
+  Bit8u handle_request(virtio_blk_seg_t *seg, unsigned nsegs, Bit32u *used_len);
+  bool need_interrupt(void);
+
+  void read_common_cfg(Bit8u *cfg);
+  void write_common_cfg(const Bit8u *cfg, Bit32u offset, unsigned len);
+  void read_device_cfg(Bit8u *cfg);
+
+  Bit16u vq_read16(Bit64u addr);
+  void vq_write16(Bit64u addr, Bit16u value);
+
+  static void coalesce_timer_handler(void *);
+  void coalesce_timer(void);
+
+  static bool mem_read_handler(bx_phy_address addr, unsigned len, void *data, void *param);
+  static bool mem_write_handler(bx_phy_address addr, unsigned len, void *data, void *param);
+  bool mem_read(bx_phy_address addr, unsigned len, void *data);
+  bool mem_write(bx_phy_address addr, unsigned len, void *data);
+};
+
+#endif
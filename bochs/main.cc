@@ -647,6 +647,12 @@ int bx_init_main(int argc, char *argv[])
 #if BX_SUPPORT_PCIDEV
           fprintf(stderr, "pcidev\n");
 #endif
+#if BX_SUPPORT_VIRTIO_BLK
+          fprintf(stderr, "virtio_blk\n");
+#endif
+#if BX_SUPPORT_AHCI
+          fprintf(stderr, "ahci\n");
+#endif
 #if BX_SUPPORT_NE2K
           fprintf(stderr, "ne2k\n");
 #endif
@@ -1055,46 +1061,16 @@ int bx_begin_simulation(int argc, char *argv[])
       // that kill_bochs_request was set by the GUI interface.
     }
 #if BX_SUPPORT_SMP
+    else if (SIM->get_param_bool(BXPN_SMP_PARALLEL)->get()) {
+      // parallel SMP simulation: every processor is running in its own
+      // host thread, returns when the simulation is stopped
+      bx_smp_run();
+    }
     else {
       // SMP simulation: do a few instructions on each processor, then switch
-      // to another.  Increasing quantum speeds up overall performance, but
-      // reduces granularity of synchronization between processors.
-      // Current implementation uses dynamic quantum, each processor will
-      // execute exactly one trace then quit the cpu_loop and switch to
-      // the next processor.
-
-      static int quantum = SIM->get_param_num(BXPN_SMP_QUANTUM)->get();
-      Bit32u executed = 0, processor = 0;
-      bool run = true;
-
-      if (setjmp(BX_CPU_C::jmp_buf_env)) {
-        // can get here only from exception function or VMEXIT
-        BX_CPU(processor)->icount++;
-        run = false;
-      }
-      while (1) {
-         // do some instructions in each processor
-        if (run)
-          BX_CPU(processor)->cpu_run_trace();
-        else
-          run = true;
-
-         // see how many instruction it was able to run
-         Bit32u n = (Bit32u)(BX_CPU(processor)->get_icount() - BX_CPU(processor)->icount_last_sync);
-         if (n == 0) n = quantum; // the CPU was halted
-         executed += n;
-
-         if (++processor == BX_SMP_PROCESSORS) {
-           processor = 0;
-           BX_TICKN(executed / BX_SMP_PROCESSORS);
-           executed %= BX_SMP_PROCESSORS;
-         }
-
-         BX_CPU(processor)->icount_last_sync = BX_CPU(processor)->get_icount();
-
-         if (bx_pc_system.kill_bochs_request)
-           break;
-      }
+      // to another. The amount of instructions is adapted to what every
+      // processor is doing, returns when the simulation is stopped.
+      bx_smp_run_round_robin();
     }
 #endif /* BX_SUPPORT_SMP */
   }
@@ -1116,6 +1092,7 @@ void bx_stop_simulation(void)
 
 void bx_sr_after_restore_state(void)
 {
+  bx_pc_system.after_restore_state();
 #if BX_SUPPORT_SMP == 0
   BX_CPU(0)->after_restore_state();
 #else
@@ -1370,6 +1347,7 @@ void bx_init_hardware()
     BX_INSTR_INITIALIZE(i);
   }
 #endif
+  bx_cpu_affinity_init();
 
   DEV_init_devices();
   // unload optional plugins which are unused and marked for removal
@@ -1441,10 +1419,22 @@ int bx_atexit(void)
   }
 #endif
 
+  // keep the decoded traces for the next run, the clones leave the file
+  // to the parent simulation
+  if (traceCacheFile.enabled() && (SIM->get_clone_id() == 0)) {
+    int traces = traceCacheFile.save();
+    if (traces < 0)
+      BX_ERROR(("failed to save the trace cache file"));
+    else if (traces > 0)
+      BX_INFO(("trace cache file: %d traces saved", traces));
+  }
+
   BX_MEM(0)->cleanup_memory();
 
   bx_pc_system.exit();
 
+  SIM->wait_for_clones();
+
   // restore signal handling to defaults
 #if BX_DEBUGGER == 0
   BX_INFO(("restoring default signal behavior"));
@@ -80,12 +80,20 @@ struct memory_handler_struct {
   memory_direct_access_handler_t da_handler;
 };
 
+// one guest physical range of a scatter-gather DMA transfer
+struct bx_dma_segment {
+  bx_phy_address addr;
+  Bit32u len;
+};
+
 #define SMRAM_CODE  1
 #define SMRAM_DATA  2
 
 class BOCHSAPI BX_MEM_C : public logfunctions {
 private:
   struct memory_handler_struct **memory_handlers;
+  // per 4K page dispatch table: 256 entries for each megabyte with handlers
+  struct memory_handler_struct ***memory_page_handlers;
   bool pci_enabled;
   bool bios_write_enabled;
   bool smram_available;
@@ -95,7 +103,21 @@ private:
   Bit64u  len, allocated;  // could be > 4G
   Bit8u   *actual_vector;
   Bit8u   *vector;   // aligned correctly
+  Bit64u  mapped_len; // size of the mmap()ed vector, 0 if allocated from heap
+  bool    huge_pages; // guest RAM is backed by host huge pages
+  Bit64u  numa_nodes; // host NUMA nodes the guest RAM is placed on, 0 if left to the host
+  unsigned numa_policy;
   Bit8u  **blocks;
+  // page sharing: untouched and zero filled blocks map the shared zero block,
+  // identical blocks map one copy, the first write makes a private copy
+  Bit8u   *zero_block; // NULL if the page sharing is disabled
+  Bit8u   *block_cow;  // the block is shared read-only
+  Bit32u  *slot_refs;  // number of blocks mapping each host memory block
+  Bit32u  *free_slots; // host memory blocks released by the deduplication
+  Bit32u   num_free_slots;
+  int      dedup_timer_index;
+  Bit32u   dedup_zero_blocks, dedup_merged_blocks;
+  bool     lazy_restore; // the saved RAM is read from the save state when needed
   Bit8u   *rom;      // 512k BIOS rom space + 128k expansion rom space
   Bit8u   *bogus;    // 4k for unexisting memory
   bool    rom_present[65];
@@ -111,9 +133,35 @@ private:
   static Bit8u * const swapped_out; // NULL; // (NULL - sizeof(Bit8u));
   Bit32u  next_swapout_idx;
   FILE    *overflow_file;
+  Bit8u   *block_referenced; // second chance bit of the replacement clock
+  // compressed swap tier between the resident blocks and the overflow file
+  Bit8u  **zblocks;     // compressed swapped out block, NULL if in the file
+  Bit32u  *zblock_len;
+  Bit8u   *zscratch;    // compression and decompression buffers
+  Bit64u   zram_limit, zram_used;
+  Bit32u   next_zevict_idx;
+  struct {
+    Bit64u to_zram, to_file, zram_to_file;   // evicted blocks
+    Bit64u from_zram, from_file;             // swapped in blocks
+    Bit64u zram_usec, file_usec;             // swap in latency
+    Bit64u raw_bytes, packed_bytes;          // compression ratio
+  } swap_stats;
+  // lazy restore: the blocks saved in the save state are read on first access
+  FILE    *restore_file;
+  Bit8u   *block_lazy;  // the block is still in the restore file
+  Bit32u   lazy_blocks, lazy_faults;
 
   BX_MEM_SMF void   read_block(Bit32u block);
+  BX_MEM_SMF void   load_swapped_block(Bit32u block, Bit8u *buffer);
+  BX_MEM_SMF void   write_overflow_block(Bit32u block, const Bit8u *buffer);
+  BX_MEM_SMF void   swap_out_block(Bit32u block);
+  BX_MEM_SMF void   free_zblock(Bit32u block);
+  BX_MEM_SMF void   report_swap_stats(void);
 #endif
+  BX_MEM_SMF void  start_lazy_prefetch(void);
+  BX_MEM_SMF void  end_lazy_restore(void);
+  BX_MEM_SMF void  update_page_handlers(Bit32u mb_idx);
+  BX_MEM_SMF Bit8u* getHostMemSpan(bx_phy_address addr, unsigned rw, unsigned *len);
   BX_MEM_SMF Bit8u flash_read(Bit32u addr);
   BX_MEM_SMF void  flash_write(Bit32u addr, Bit8u data);
 
@@ -122,8 +170,10 @@ public:
  ~BX_MEM_C();
 
   BX_MEM_SMF Bit8u*  get_vector(bx_phy_address addr);
+  BX_MEM_SMF Bit8u*  get_writable_vector(bx_phy_address addr);
   BX_MEM_SMF void    init_memory(Bit64u guest, Bit64u host);
   BX_MEM_SMF void    cleanup_memory(void);
+  BX_MEM_SMF void    after_clone(void);
 
   BX_MEM_SMF void    enable_smram(bool enable, bool restricted);
   BX_MEM_SMF void    disable_smram(void);
@@ -143,6 +193,11 @@ public:
 
   BX_MEM_SMF void    dmaReadPhysicalPage(bx_phy_address addr, unsigned len, Bit8u *data);
   BX_MEM_SMF void    dmaWritePhysicalPage(bx_phy_address addr, unsigned len, Bit8u *data);
+  // DMA transfers might cross the page boundaries
+  BX_MEM_SMF void    dmaReadPhysical(bx_phy_address addr, unsigned len, Bit8u *data);
+  BX_MEM_SMF void    dmaWritePhysical(bx_phy_address addr, unsigned len, Bit8u *data);
+  BX_MEM_SMF void    dmaReadPhysicalSG(const bx_dma_segment *sg, unsigned count, Bit8u *data);
+  BX_MEM_SMF void    dmaWritePhysicalSG(const bx_dma_segment *sg, unsigned count, Bit8u *data);
 
   BX_MEM_SMF void    load_ROM(const char *path, bx_phy_address romaddress, Bit8u type);
   BX_MEM_SMF void    load_RAM(const char *path, bx_phy_address romaddress);
@@ -163,10 +218,25 @@ public:
      return registerMemoryHandlers(param, read_handler, write_handler, NULL, begin_addr, end_addr);
   }
   BX_MEM_SMF bool unregisterMemoryHandlers(void *param, bx_phy_address begin_addr, bx_phy_address end_addr);
+  BX_MEM_SMF bool is_memory_handler_page(bx_phy_address a20addr);
+  BX_MEM_SMF struct memory_handler_struct* get_memory_handler(bx_phy_address a20addr);
 
   BX_MEM_SMF Bit64u  get_memory_len(void);
   BX_MEM_SMF void allocate_block(Bit32u index);
+  BX_MEM_SMF Bit8u* alloc_block_buffer(bool *reused);
+  BX_MEM_SMF void unshare_block(Bit32u index);
+  BX_MEM_SMF void release_block_buffer(Bit8u *buffer);
+  BX_MEM_SMF void rebuild_block_sharing(void);
+  BX_MEM_SMF void dedup_blocks(void);
+  static void dedup_timer_handler(void *this_ptr);
   BX_MEM_SMF Bit8u* alloc_vector_aligned(Bit64u bytes, Bit64u alignment);
+#if BX_HAVE_SYS_MMAN_H
+  BX_MEM_SMF Bit8u* map_vector(Bit64u guest, Bit64u bytes, unsigned backing, const char *path);
+#endif
+  BX_MEM_SMF void free_vector(void);
+  BX_MEM_SMF void report_huge_pages(void);
+  BX_MEM_SMF void setup_numa(void);
+  BX_MEM_SMF void report_numa(void);
 
 #if BX_SUPPORT_MONITOR_MWAIT
   BX_MEM_SMF bool is_monitor(bx_phy_address begin_addr, unsigned len);
@@ -176,8 +246,11 @@ public:
   void register_state(void);
 
   friend void ramfile_save_handler(void *devptr, FILE *fp);
+  friend void ram_delta_handler(void *devptr, FILE *fp);
+  friend bool ram_lazy_restore_handler(void *devptr, const char *path);
   friend Bit64s memory_param_save_handler(void *devptr, bx_param_c *param);
   friend void memory_param_restore_handler(void *devptr, bx_param_c *param, Bit64s val);
+  friend void memory_mapping_restore_handler(void *devptr, bx_list_c *list);
 };
 
 BOCHSAPI extern BX_MEM_C bx_mem;
@@ -201,10 +274,45 @@ BX_CPP_INLINE Bit8u* BX_MEM_C::get_vector(bx_phy_address addr)
   if (!BX_MEM_THIS blocks[block])
 #endif
     allocate_block(block);
+#if BX_LARGE_RAMFILE
+  BX_MEM_THIS block_referenced[block] = 1;
+#endif
 
   return BX_MEM_THIS blocks[block] + (Bit32u)(addr & (BX_MEM_BLOCK_LEN-1));
 }
 
+// get_vector() for the write access, the shared block is copied first
+BX_CPP_INLINE Bit8u* BX_MEM_C::get_writable_vector(bx_phy_address addr)
+{
+  Bit8u *ptr = get_vector(addr);
+  Bit32u block = (Bit32u)(addr / BX_MEM_BLOCK_LEN);
+  if (BX_MEM_THIS block_cow[block]) {
+    unshare_block(block);
+    ptr = get_vector(addr);
+  }
+  return ptr;
+}
+
+// a memory handler is registered in the 4K page of the address; it does not
+// access the handler itself, so it is safe to call without the SMP lock
+BX_CPP_INLINE bool BX_MEM_C::is_memory_handler_page(bx_phy_address a20addr)
+{
+  struct memory_handler_struct **page_handlers = BX_MEM_THIS memory_page_handlers[a20addr >> 20];
+  return page_handlers && page_handlers[(a20addr >> 12) & 0xff];
+}
+
+// the memory handler claiming the address, NULL if none
+BX_CPP_INLINE struct memory_handler_struct* BX_MEM_C::get_memory_handler(bx_phy_address a20addr)
+{
+  struct memory_handler_struct **page_handlers = BX_MEM_THIS memory_page_handlers[a20addr >> 20];
+  if (page_handlers) {
+    struct memory_handler_struct *memory_handler = page_handlers[(a20addr >> 12) & 0xff];
+    if (memory_handler && memory_handler->begin <= a20addr && memory_handler->end >= a20addr)
+      return memory_handler;
+  }
+  return NULL;
+}
+
 BX_CPP_INLINE Bit64u BX_MEM_C::get_memory_len(void)
 {
   return (BX_MEM_THIS len);
@@ -69,17 +69,15 @@ void BX_MEM_C::writePhysicalPage(BX_CPU_C *cpu, bx_phy_address addr, unsigned le
     }
   }
 
-  memory_handler = BX_MEM_THIS memory_handlers[a20addr >> 20];
-  while (memory_handler) {
-    if (memory_handler->write_handler != NULL) {
-      if (memory_handler->begin <= a20addr &&
-          memory_handler->end >= a20addr &&
-          memory_handler->write_handler(a20addr, len, data, memory_handler->param))
-      {
-        return;
-      }
+  if (BX_MEM_THIS is_memory_handler_page(a20addr)) {
+    // memory handlers belong to the devices which are not thread safe
+    BX_SMP_GUARD();
+    memory_handler = BX_MEM_THIS get_memory_handler(a20addr);
+    if (memory_handler && memory_handler->write_handler != NULL &&
+        memory_handler->write_handler(a20addr, len, data, memory_handler->param))
+    {
+      return;
     }
-    memory_handler = memory_handler->next;
   }
 
 mem_write:
@@ -90,23 +88,23 @@ mem_write:
     if (a20addr < 0x000a0000 || a20addr >= 0x00100000)
     {
       if (len == 8) {
+        WriteHostQWordToLittleEndian((Bit64u*) BX_MEM_THIS get_writable_vector(a20addr), *(Bit64u*)data);
         pageWriteStampTable.decWriteStamp(a20addr, 8);
-        WriteHostQWordToLittleEndian((Bit64u*) BX_MEM_THIS get_vector(a20addr), *(Bit64u*)data);
         return;
       }
       if (len == 4) {
+        WriteHostDWordToLittleEndian((Bit32u*) BX_MEM_THIS get_writable_vector(a20addr), *(Bit32u*)data);
         pageWriteStampTable.decWriteStamp(a20addr, 4);
-        WriteHostDWordToLittleEndian((Bit32u*) BX_MEM_THIS get_vector(a20addr), *(Bit32u*)data);
         return;
       }
       if (len == 2) {
+        WriteHostWordToLittleEndian((Bit16u*) BX_MEM_THIS get_writable_vector(a20addr), *(Bit16u*)data);
         pageWriteStampTable.decWriteStamp(a20addr, 2);
-        WriteHostWordToLittleEndian((Bit16u*) BX_MEM_THIS get_vector(a20addr), *(Bit16u*)data);
         return;
       }
       if (len == 1) {
+        * (BX_MEM_THIS get_writable_vector(a20addr)) = * (Bit8u *) data;
         pageWriteStampTable.decWriteStamp(a20addr, 1);
-        * (BX_MEM_THIS get_vector(a20addr)) = * (Bit8u *) data;
         return;
       }
       // len == other, just fall thru to special cases handling
@@ -124,8 +122,8 @@ mem_write:
       while(1) {
         // Write in chunks of 8 bytes if we can
         if ((len & 7) == 0) {
+          WriteHostQWordToLittleEndian((Bit64u*) BX_MEM_THIS get_writable_vector(a20addr), *(Bit64u*)data_ptr);
           pageWriteStampTable.decWriteStamp(a20addr, 8);
-          WriteHostQWordToLittleEndian((Bit64u*) BX_MEM_THIS get_vector(a20addr), *(Bit64u*)data_ptr);
           len -= 8;
           a20addr += 8;
           #ifdef BX_LITTLE_ENDIAN
@@ -136,8 +134,8 @@ mem_write:
 
           if (len == 0) return;
         } else {
+          *(BX_MEM_THIS get_writable_vector(a20addr)) = *data_ptr;
           pageWriteStampTable.decWriteStamp(a20addr, 1);
-          *(BX_MEM_THIS get_vector(a20addr)) = *data_ptr;
           if (len == 1) return;
           len--;
           a20addr++;
@@ -150,6 +148,9 @@ mem_write:
       }
     }
 
+    // shadow RAM and flash state are shared with the devices
+    BX_SMP_GUARD();
+
     pageWriteStampTable.decWriteStamp(a20addr);
 
     // addr must be in range 000A0000 .. 000FFFFF
@@ -160,7 +161,7 @@ mem_write:
       if (a20addr < 0x000c0000) {
         // devices are not allowed to access SMMRAM under VGA memory
         if (cpu) {
-          *(BX_MEM_THIS get_vector(a20addr)) = *data_ptr;
+          *(BX_MEM_THIS get_writable_vector(a20addr)) = *data_ptr;
         }
         goto inc_one;
       }
@@ -177,7 +178,7 @@ mem_write:
         if (BX_MEM_THIS memory_type[area][1] == 1) {
           // Writes to ShadowRAM
           BX_DEBUG(("Writing to ShadowRAM: address 0x" FMT_PHY_ADDRX ", data %02x", a20addr, *data_ptr));
-          *(BX_MEM_THIS get_vector(a20addr)) = *data_ptr;
+          *(BX_MEM_THIS get_writable_vector(a20addr)) = *data_ptr;
         } else if ((area >= BX_MEM_AREA_E0000) && BX_MEM_THIS bios_write_enabled) {
           // volatile BIOS write support
 #ifdef BX_LITTLE_ENDIAN
@@ -215,6 +216,7 @@ inc_one:
 
     }
   } else if (BX_MEM_THIS bios_write_enabled && is_bios) {
+    BX_SMP_GUARD();
     // volatile BIOS write support
 #ifdef BX_LITTLE_ENDIAN
     data_ptr = (Bit8u *) data;
@@ -269,15 +271,14 @@ void BX_MEM_C::readPhysicalPage(BX_CPU_C *cpu, bx_phy_address addr, unsigned len
     }
   }
 
-  memory_handler = BX_MEM_THIS memory_handlers[a20addr >> 20];
-  while (memory_handler) {
-    if (memory_handler->begin <= a20addr &&
-          memory_handler->end >= a20addr &&
-          memory_handler->read_handler(a20addr, len, data, memory_handler->param))
+  if (BX_MEM_THIS is_memory_handler_page(a20addr)) {
+    BX_SMP_GUARD();
+    memory_handler = BX_MEM_THIS get_memory_handler(a20addr);
+    if (memory_handler &&
+        memory_handler->read_handler(a20addr, len, data, memory_handler->param))
     {
       return;
     }
-    memory_handler = memory_handler->next;
   }
 
 mem_read:
@@ -341,6 +342,8 @@ mem_read:
       }
     }
 
+    BX_SMP_GUARD();
+
     // addr must be in range 000A0000 .. 000FFFFF
 
     for (unsigned i=0; i<len; i++) {
@@ -414,6 +417,7 @@ inc_one:
 #endif
 
     if (is_bios) {
+      BX_SMP_GUARD();
       for (unsigned i = 0; i < len; i++) {
         if (BX_MEM_THIS flash_type > 0) {
           *data_ptr = BX_MEM_THIS flash_read(a20addr & BIOS_MASK);
@@ -434,6 +438,103 @@ inc_one:
   }
 }
 
+// Host memory backing the DMA range at addr. The pages of a guest RAM block
+// are contiguous in the host memory, so the range is resolved once per block
+// instead of once per page. On return len is the part of the range covered,
+// if NULL the access is not direct and len is cut at the end of the page.
+Bit8u* BX_MEM_C::getHostMemSpan(bx_phy_address addr, unsigned rw, unsigned *len)
+{
+  bx_phy_address a20addr = A20ADDR(addr);
+  bx_phy_address page_end = (a20addr | 0xfff) + 1;
+  bx_phy_address end = a20addr + *len;
+
+  bool is_bios = (a20addr >= (bx_phy_address)BX_MEM_THIS bios_rom_addr);
+#if BX_PHY_ADDRESS_LONG
+  if (a20addr > BX_CONST64(0xffffffff)) is_bios = 0;
+#endif
+
+  Bit8u *memptr = BX_MEM_THIS getHostMemAddr(NULL, addr, rw);
+  if (memptr != NULL && end > page_end && a20addr >= 0x00100000 &&
+      a20addr < BX_MEM_THIS len && !is_bios)
+  {
+    bx_phy_address limit = (a20addr | (BX_MEM_BLOCK_LEN-1)) + 1;
+    if (limit > BX_MEM_THIS len) limit = BX_MEM_THIS len;
+    if (a20addr < (bx_phy_address)BX_MEM_THIS bios_rom_addr &&
+        limit > (bx_phy_address)BX_MEM_THIS bios_rom_addr)
+      limit = BX_MEM_THIS bios_rom_addr;
+    if (end > limit) end = limit;
+    bx_phy_address next = page_end;
+    while (next < end && !BX_MEM_THIS is_memory_handler_page(next))
+      next += 0x1000;
+    if (end > next) end = next;
+#if BX_SUPPORT_MONITOR_MWAIT
+    if ((rw & 1) && end > page_end && BX_MEM_THIS is_monitor(page_end, (unsigned)(end - page_end)))
+      end = page_end;
+#endif
+  }
+  else if (end > page_end) {
+    end = page_end;
+  }
+
+  *len = (unsigned)(end - a20addr);
+  return memptr;
+}
+
+void BX_MEM_C::dmaReadPhysical(bx_phy_address addr, unsigned len, Bit8u *data)
+{
+  while (len > 0) {
+    unsigned span = len;
+    Bit8u *memptr = BX_MEM_THIS getHostMemSpan(addr, BX_READ, &span);
+    if (memptr != NULL) {
+      memcpy(data, memptr, span);
+    }
+    else {
+      for (unsigned i=0;i < span; i++) {
+        readPhysicalPage(NULL, addr+i, 1, &data[i]);
+      }
+    }
+    addr += span;
+    data += span;
+    len -= span;
+  }
+}
+
+void BX_MEM_C::dmaWritePhysical(bx_phy_address addr, unsigned len, Bit8u *data)
+{
+  while (len > 0) {
+    unsigned span = len;
+    Bit8u *memptr = BX_MEM_THIS getHostMemSpan(addr, BX_WRITE, &span);
+    if (memptr != NULL) {
+      memcpy(memptr, data, span);
+      pageWriteStampTable.decWriteStampRange(A20ADDR(addr), span);
+    }
+    else {
+      for (unsigned i=0;i < span; i++) {
+        writePhysicalPage(NULL, addr+i, 1, &data[i]);
+      }
+    }
+    addr += span;
+    data += span;
+    len -= span;
+  }
+}
+
+void BX_MEM_C::dmaReadPhysicalSG(const bx_dma_segment *sg, unsigned count, Bit8u *data)
+{
+  for (unsigned n=0; n < count; n++) {
+    dmaReadPhysical(sg[n].addr, sg[n].len, data);
+    data += sg[n].len;
+  }
+}
+
+void BX_MEM_C::dmaWritePhysicalSG(const bx_dma_segment *sg, unsigned count, Bit8u *data)
+{
+  for (unsigned n=0; n < count; n++) {
+    dmaWritePhysical(sg[n].addr, sg[n].len, data);
+    data += sg[n].len;
+  }
+}
+
 void BX_MEM_C::dmaReadPhysicalPage(bx_phy_address addr, unsigned len, Bit8u *data)
 {
   // Note: accesses should always be contained within a single page
@@ -461,8 +562,8 @@ void BX_MEM_C::dmaWritePhysicalPage(bx_phy_address addr, unsigned len, Bit8u *da
 
   Bit8u *memptr = getHostMemAddr(NULL, addr, BX_WRITE);
   if (memptr != NULL) {
-    pageWriteStampTable.decWriteStamp(addr);
     memcpy(memptr, data, len);
+    pageWriteStampTable.decWriteStamp(addr);
   }
   else {
     for (unsigned i=0;i < len; i++) {
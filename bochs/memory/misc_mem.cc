@@ -26,14 +26,187 @@
 #include "param_names.h"
 #include "cpu/cpu.h"
 #include "iodev/iodev.h"
+#include "bxthread.h"
 #define LOG_THIS BX_MEM(0)->
 
+#if BX_HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#endif
+
 // alignment of memory vector, must be a power of 2
 #define BX_MEM_VECTOR_ALIGN 4096
+// host huge page size, the vector backed by huge pages is aligned to it
+#define BX_MEM_HUGE_PAGE_LEN (2*1024*1024)
 #define BX_MEM_HANDLERS   ((BX_CONST64(1) << BX_PHY_ADDRESS_WIDTH) >> 20) /* one per megabyte */
 
+// lazy restore: the background thread reads ahead the saved RAM
+static struct {
+  BX_THREAD_VAR(thread);
+  bool running;
+  volatile bool stop;
+  char path[BX_PATHNAME_LEN];
+  Bit64u *order;          // offsets in the saved RAM file
+  Bit32u count;
+  const Bit8u *pending;   // BX_LARGE_RAMFILE: the blocks not read yet
+  const Bit8u *vector;    // the saved RAM file mapped as guest RAM
+} lazy_prefetch;
+
+// host wide NUMA allocation counters when the guest RAM was placed
+static struct {
+  Bit64u local[BX_NUMA_MAX_NODES];
+  Bit64u remote[BX_NUMA_MAX_NODES];
+} numa_stat;
+
 #if BX_LARGE_RAMFILE
 Bit8u* const BX_MEM_C::swapped_out = ((Bit8u*)NULL - sizeof(Bit8u));
+
+// The swapped out blocks are compressed with a byte oriented LZ77 codec:
+// each sequence is a token (literal length and match length - 4, 4 bits
+// each, 15 means more length bytes follow), the literals and a 16-bit match
+// offset. The last sequence has only literals.
+#define BX_LZ_HASH_BITS  12
+#define BX_LZ_MIN_MATCH  4
+// the last bytes of the block are always stored as literals
+#define BX_LZ_LAST_LITERALS 5
+
+BX_CPP_INLINE Bit32u lz_read32(const Bit8u *p)
+{
+  Bit32u val;
+  memcpy(&val, p, 4);
+  return val;
+}
+
+BX_CPP_INLINE Bit64u lz_read64(const Bit8u *p)
+{
+  Bit64u val;
+  memcpy(&val, p, 8);
+  return val;
+}
+
+BX_CPP_INLINE Bit32u lz_hash(Bit32u val)
+{
+  return (val * 2654435761U) >> (32 - BX_LZ_HASH_BITS);
+}
+
+static bool lz_put_length(Bit8u *dst, Bit32u *op, Bit32u cap, Bit32u len)
+{
+  for (; len >= 255; len -= 255) {
+    if (*op >= cap) return 0;
+    dst[(*op)++] = 255;
+  }
+  if (*op >= cap) return 0;
+  dst[(*op)++] = (Bit8u) len;
+  return 1;
+}
+
+static bool lz_put_sequence(Bit8u *dst, Bit32u *op, Bit32u cap,
+          const Bit8u *literals, Bit32u nlit, Bit32u offset, Bit32u mlen)
+{
+  if (*op >= cap) return 0;
+  Bit32u token = (*op)++;
+  dst[token] = (Bit8u)((nlit >= 15 ? 15 : nlit) << 4);
+  if (nlit >= 15 && !lz_put_length(dst, op, cap, nlit - 15)) return 0;
+  if (*op + nlit > cap) return 0;
+  memcpy(dst + *op, literals, nlit);
+  *op += nlit;
+  if (mlen == 0) return 1; // last sequence
+
+  if (*op + 2 > cap) return 0;
+  dst[(*op)++] = (Bit8u) offset;
+  dst[(*op)++] = (Bit8u)(offset >> 8);
+  mlen -= BX_LZ_MIN_MATCH;
+  dst[token] |= (Bit8u)(mlen >= 15 ? 15 : mlen);
+  if (mlen >= 15 && !lz_put_length(dst, op, cap, mlen - 15)) return 0;
+  return 1;
+}
+
+// returns the compressed length, 0 if it does not fit into cap bytes
+static Bit32u lz_compress(const Bit8u *src, Bit32u len, Bit8u *dst, Bit32u cap)
+{
+  Bit32u table[1 << BX_LZ_HASH_BITS];
+  Bit32u ip = 0, anchor = 0, op = 0;
+
+  memset(table, 0, sizeof(table));
+  while (ip + BX_LZ_MIN_MATCH + BX_LZ_LAST_LITERALS <= len) {
+    Bit32u seq = lz_read32(src + ip);
+    Bit32u h = lz_hash(seq);
+    Bit32u ref = table[h]; // position + 1, 0 if empty
+    table[h] = ip + 1;
+    if (ref == 0 || (ip - (ref - 1)) > 0xffff || lz_read32(src + ref - 1) != seq) {
+      // skip faster over the data which does not compress
+      ip += 1 + ((ip - anchor) >> 6);
+      continue;
+    }
+    ref--;
+    Bit32u mlen = BX_LZ_MIN_MATCH, limit = len - BX_LZ_LAST_LITERALS - ip;
+    while (mlen + 8 <= limit && lz_read64(src + ref + mlen) == lz_read64(src + ip + mlen))
+      mlen += 8;
+    while (mlen < limit && src[ref + mlen] == src[ip + mlen])
+      mlen++;
+    if (! lz_put_sequence(dst, &op, cap, src + anchor, ip - anchor, ip - ref, mlen))
+      return 0;
+    ip += mlen;
+    anchor = ip;
+  }
+  if (! lz_put_sequence(dst, &op, cap, src + anchor, len - anchor, 0, 0))
+    return 0;
+  return op;
+}
+
+// returns the decompressed length, 0 if the data is corrupted
+static Bit32u lz_decompress(const Bit8u *src, Bit32u len, Bit8u *dst, Bit32u cap)
+{
+  Bit32u ip = 0, op = 0;
+
+  while (ip < len) {
+    Bit32u token = src[ip++];
+    Bit32u nlit = token >> 4, n;
+    if (nlit == 15) {
+      do {
+        if (ip >= len) return 0;
+        n = src[ip++];
+        nlit += n;
+      } while (n == 255);
+    }
+    if (ip + nlit > len || op + nlit > cap) return 0;
+    memcpy(dst + op, src + ip, nlit);
+    ip += nlit;
+    op += nlit;
+    if (ip == len) break; // last sequence
+
+    if (ip + 2 > len) return 0;
+    Bit32u offset = src[ip] | (src[ip + 1] << 8);
+    ip += 2;
+    Bit32u mlen = (token & 15);
+    if (mlen == 15) {
+      do {
+        if (ip >= len) return 0;
+        n = src[ip++];
+        mlen += n;
+      } while (n == 255);
+    }
+    mlen += BX_LZ_MIN_MATCH;
+    if (offset == 0 || offset > op || op + mlen > cap) return 0;
+    if (offset == 1) {
+      memset(dst + op, dst[op - 1], mlen);
+      op += mlen;
+      continue;
+    }
+    // the match might overlap the output, it repeats every offset bytes
+    // so the part already copied doubles the distance of the next copy
+    for (Bit32u dist = offset; mlen > 0; mlen -= n, op += n, dist <<= 1) {
+      n = BX_MIN(mlen, dist);
+      memcpy(dst + op, dst + op - dist, n);
+    }
+  }
+  return op;
+}
 #endif
 
 #define FLASH_READ_ARRAY  0xff
@@ -51,15 +224,41 @@ BX_MEM_C::BX_MEM_C()
 
   vector = NULL;
   actual_vector = NULL;
+  mapped_len = 0;
+  huge_pages = 0;
+  numa_nodes = 0;
+  numa_policy = BX_MEM_NUMA_NONE;
   blocks = NULL;
   len    = 0;
   used_blocks = 0;
+  zero_block = NULL;
+  block_cow = NULL;
+  slot_refs = NULL;
+  free_slots = NULL;
+  num_free_slots = 0;
+  dedup_timer_index = BX_NULL_TIMER_HANDLE;
+  dedup_zero_blocks = 0;
+  dedup_merged_blocks = 0;
+  lazy_restore = 0;
 
   memory_handlers = NULL;
+  memory_page_handlers = NULL;
 
 #if BX_LARGE_RAMFILE
   next_swapout_idx = 0;
   overflow_file = NULL;
+  block_referenced = NULL;
+  zblocks = NULL;
+  zblock_len = NULL;
+  zscratch = NULL;
+  zram_limit = 0;
+  zram_used = 0;
+  next_zevict_idx = 0;
+  memset(&swap_stats, 0, sizeof(swap_stats));
+  restore_file = NULL;
+  block_lazy = NULL;
+  lazy_blocks = 0;
+  lazy_faults = 0;
 #endif
 }
 
@@ -82,6 +281,96 @@ Bit8u* BX_MEM_C::alloc_vector_aligned(Bit64u bytes, Bit64u alignment)
   return vector;
 }
 
+#if BX_HAVE_SYS_MMAN_H
+// Map the guest RAM instead of allocating it, the host OS allocates and pages
+// it on demand. The file is mapped shared (writes go to the file and are seen
+// by all the processes mapping it, e.g. a file on tmpfs) or private
+// copy-on-write from a template file, so many instances share its pages.
+Bit8u* BX_MEM_C::map_vector(Bit64u guest, Bit64u bytes, unsigned backing, const char *path)
+{
+  // reserve the whole vector first, the ROM space and the guest RAM beyond
+  // the end of the template file remain anonymous memory
+  size_t align = BX_MEM_THIS huge_pages ? BX_MEM_HUGE_PAGE_LEN : 0;
+  void *area = mmap(NULL, (size_t) bytes + align, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (area == MAP_FAILED)
+    return NULL;
+
+  if (align) {
+    // trim the reservation to start at huge page boundary
+    Bit8u *aligned = (Bit8u *)(((bx_ptr_equiv_t) area + align - 1) & ~(bx_ptr_equiv_t)(align - 1));
+    size_t head = aligned - (Bit8u *) area;
+    if (head)
+      munmap(area, head);
+    munmap(aligned + bytes, align - head);
+    area = aligned;
+  }
+
+  if (backing != BX_MEM_BACKING_ANONYMOUS) {
+    if (*path == '\0')
+      BX_PANIC(("guest RAM file is not specified"));
+
+    int fd = open(path, (backing == BX_MEM_BACKING_FILE) ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if (fd < 0) {
+      BX_PANIC(("couldn't open guest RAM file '%s'", path));
+      munmap(area, (size_t) bytes);
+      return NULL;
+    }
+
+    struct stat stat_buf;
+    Bit64u file_len = 0;
+    if (fstat(fd, &stat_buf) == 0)
+      file_len = stat_buf.st_size;
+    if (backing == BX_MEM_BACKING_FILE && file_len < guest) {
+      if (ftruncate(fd, (off_t) guest) < 0)
+        BX_PANIC(("couldn't extend guest RAM file '%s'", path));
+      file_len = guest;
+    }
+
+    // the part of the last host page beyond end of the file reads as zero
+    size_t map_len = (size_t) BX_MIN(file_len, guest);
+    if (map_len > 0) {
+      void *ram = mmap(area, map_len, PROT_READ | PROT_WRITE, MAP_FIXED |
+                       ((backing == BX_MEM_BACKING_FILE) ? MAP_SHARED : MAP_PRIVATE), fd, 0);
+      if (ram == MAP_FAILED) {
+        close(fd);
+        munmap(area, (size_t) bytes);
+        return NULL;
+      }
+    }
+    close(fd);
+    BX_INFO(("guest RAM mapped from file '%s' (%s)", path,
+      (backing == BX_MEM_BACKING_FILE) ? "shared" : "copy-on-write"));
+  }
+
+#ifdef MADV_HUGEPAGE
+  // anonymous and copy-on-write guest RAM, file on hugetlbfs is already
+  // mapped with huge pages
+  if (BX_MEM_THIS huge_pages)
+    madvise(area, (size_t) guest, MADV_HUGEPAGE);
+#endif
+
+  BX_MEM_THIS mapped_len = bytes;
+  BX_MEM_THIS actual_vector = (Bit8u*) area;
+  return (Bit8u*) area;
+}
+#endif
+
+void BX_MEM_C::free_vector(void)
+{
+#if BX_HAVE_SYS_MMAN_H
+  if (BX_MEM_THIS mapped_len != 0) {
+    munmap(BX_MEM_THIS actual_vector, (size_t) BX_MEM_THIS mapped_len);
+    BX_MEM_THIS mapped_len = 0;
+  }
+  else
+#endif
+    delete [] BX_MEM_THIS actual_vector;
+
+  BX_MEM_THIS actual_vector = NULL;
+  BX_MEM_THIS vector = NULL;
+}
+
 BX_MEM_C::~BX_MEM_C()
 {
 #if BX_LARGE_RAMFILE
@@ -104,17 +393,44 @@ void BX_MEM_C::init_memory(Bit64u guest, Bit64u host)
 
   if (BX_MEM_THIS actual_vector != NULL) {
     BX_INFO(("freeing existing memory vector"));
-    delete [] BX_MEM_THIS actual_vector;
-    BX_MEM_THIS actual_vector = NULL;
-    BX_MEM_THIS vector = NULL;
+    free_vector();
     BX_MEM_THIS blocks = NULL;
   }
-  BX_MEM_THIS vector = alloc_vector_aligned(host + BIOSROMSZ + EXROMSIZE + 4096, BX_MEM_VECTOR_ALIGN);
-  BX_INFO(("allocated memory at %p. after alignment, vector=%p",
-        BX_MEM_THIS actual_vector, BX_MEM_THIS vector));
+
+  unsigned backing = SIM->get_param_enum(BXPN_MEM_BACKING)->get();
+  BX_MEM_THIS huge_pages = SIM->get_param_bool(BXPN_MEM_HUGE_PAGES)->get();
+  if (backing != BX_MEM_BACKING_HEAP) {
+#if BX_HAVE_SYS_MMAN_H
+    // all the guest RAM is mapped, the host allocates it when touched
+    BX_MEM_THIS vector = map_vector(guest, guest + BIOSROMSZ + EXROMSIZE + 4096, backing,
+                                    SIM->get_param_string(BXPN_MEM_BACKING_FILE)->getptr());
+    if (BX_MEM_THIS vector != NULL) {
+      host = guest;
+      BX_INFO(("mapped memory at %p", BX_MEM_THIS vector));
+    }
+    else {
+      BX_ERROR(("failed to map guest RAM, allocating it from heap"));
+      backing = BX_MEM_BACKING_HEAP;
+    }
+#else
+    BX_ERROR(("guest RAM mapping is not supported on this host, allocating it from heap"));
+    backing = BX_MEM_BACKING_HEAP;
+#endif
+  }
+  if (backing == BX_MEM_BACKING_HEAP) {
+    BX_MEM_THIS vector = alloc_vector_aligned(host + BIOSROMSZ + EXROMSIZE + 4096,
+          BX_MEM_THIS huge_pages ? BX_MEM_HUGE_PAGE_LEN : BX_MEM_VECTOR_ALIGN);
+    BX_INFO(("allocated memory at %p. after alignment, vector=%p",
+          BX_MEM_THIS actual_vector, BX_MEM_THIS vector));
+#if BX_HAVE_SYS_MMAN_H && defined(MADV_HUGEPAGE)
+    if (BX_MEM_THIS huge_pages)
+      madvise(BX_MEM_THIS vector, (size_t) host, MADV_HUGEPAGE);
+#endif
+  }
 
   BX_MEM_THIS len = guest;
   BX_MEM_THIS allocated = host;
+  setup_numa();
   BX_MEM_THIS rom = &BX_MEM_THIS vector[host];
   BX_MEM_THIS bogus = &BX_MEM_THIS vector[host + BIOSROMSZ + EXROMSIZE];
   memset(BX_MEM_THIS rom, 0xff, BIOSROMSZ + EXROMSIZE + 4096);
@@ -126,8 +442,16 @@ void BX_MEM_C::init_memory(Bit64u guest, Bit64u host)
   BX_INFO(("%.2fMB", (float)(BX_MEM_THIS len / (1024.0*1024.0))));
   BX_INFO(("mem block size = 0x%08x, blocks=%u", BX_MEM_BLOCK_LEN, num_blocks));
   BX_MEM_THIS blocks = new Bit8u* [num_blocks];
-  if (0) {
-    // all guest memory is allocated, just map it
+  BX_MEM_THIS block_cow = new Bit8u [num_blocks];
+  memset(BX_MEM_THIS block_cow, 0, num_blocks);
+  Bit32u num_slots = (Bit32u)(host / BX_MEM_BLOCK_LEN);
+  BX_MEM_THIS slot_refs = new Bit32u [num_slots];
+  BX_MEM_THIS free_slots = new Bit32u [num_slots];
+  BX_MEM_THIS num_free_slots = 0;
+  for (idx = 0; idx < num_slots; idx++)
+    BX_MEM_THIS slot_refs[idx] = (BX_MEM_THIS mapped_len != 0);
+  if (BX_MEM_THIS mapped_len != 0) {
+    // all guest memory is mapped, just map the blocks
     for (idx = 0; idx < num_blocks; idx++) {
       BX_MEM_THIS blocks[idx] = BX_MEM_THIS vector + (idx * BX_MEM_BLOCK_LEN);
     }
@@ -140,10 +464,34 @@ void BX_MEM_C::init_memory(Bit64u guest, Bit64u host)
     }
     BX_MEM_THIS used_blocks = 0;
   }
+#if BX_LARGE_RAMFILE
+  BX_MEM_THIS block_referenced = new Bit8u [num_blocks];
+  memset(BX_MEM_THIS block_referenced, 0, num_blocks);
+  BX_MEM_THIS block_lazy = new Bit8u [num_blocks];
+  memset(BX_MEM_THIS block_lazy, 0, num_blocks);
+  BX_MEM_THIS zblocks = new Bit8u* [num_blocks];
+  BX_MEM_THIS zblock_len = new Bit32u [num_blocks];
+  for (idx = 0; idx < num_blocks; idx++) {
+    BX_MEM_THIS zblocks[idx] = NULL;
+    BX_MEM_THIS zblock_len[idx] = 0;
+  }
+  BX_MEM_THIS zram_limit = ((Bit64u) SIM->get_param_num(BXPN_MEM_COMPRESSED_SIZE)->get()) << 20;
+  BX_MEM_THIS zram_used = 0;
+  if (BX_MEM_THIS zram_limit > 0 && BX_MEM_THIS allocated < BX_MEM_THIS len) {
+    BX_MEM_THIS zscratch = new Bit8u [BX_MEM_BLOCK_LEN * 2];
+    BX_INFO(("compressed swap space: %u MB", (unsigned)(BX_MEM_THIS zram_limit >> 20)));
+  }
+#else
+  if (SIM->get_param_num(BXPN_MEM_COMPRESSED_SIZE)->get() > 0)
+    BX_ERROR(("compressed swap space requires large RAM file support"));
+#endif
 
   BX_MEM_THIS memory_handlers = new struct memory_handler_struct *[BX_MEM_HANDLERS];
-  for (idx = 0; idx < BX_MEM_HANDLERS; idx++)
+  BX_MEM_THIS memory_page_handlers = new struct memory_handler_struct **[BX_MEM_HANDLERS];
+  for (idx = 0; idx < BX_MEM_HANDLERS; idx++) {
     BX_MEM_THIS memory_handlers[idx] = NULL;
+    BX_MEM_THIS memory_page_handlers[idx] = NULL;
+  }
 
   BX_MEM_THIS pci_enabled = SIM->get_param_bool(BXPN_PCI_ENABLED)->get();
   BX_MEM_THIS bios_write_enabled = 0;
@@ -163,27 +511,319 @@ void BX_MEM_C::init_memory(Bit64u guest, Bit64u host)
     BX_MEM_THIS memory_type[i][1] = 0;
   }
 
+  if (BX_MEM_THIS huge_pages)
+    report_huge_pages();
+
+  Bit32u dedup_period = SIM->get_param_num(BXPN_MEM_DEDUP)->get();
+  if (dedup_period > 0) {
+    if (backing == BX_MEM_BACKING_FILE) {
+      // the guest RAM file might be shared with other processes
+      BX_ERROR(("page sharing is not supported with shared guest RAM file"));
+    }
+    else {
+      BX_MEM_THIS zero_block = new Bit8u [BX_MEM_BLOCK_LEN];
+      memset(BX_MEM_THIS zero_block, 0, BX_MEM_BLOCK_LEN);
+#if BX_HAVE_SYS_MMAN_H && defined(MADV_MERGEABLE)
+      // let the host merge identical pages with other instances
+      madvise(BX_MEM_THIS vector, (size_t) host, MADV_MERGEABLE);
+#endif
+      if (BX_MEM_THIS dedup_timer_index == BX_NULL_TIMER_HANDLE) {
+        BX_MEM_THIS dedup_timer_index = bx_pc_system.register_timer(BX_MEM(0), dedup_timer_handler,
+          dedup_period * 1000000, 1, 1, "memory.dedup");
+      }
+      else {
+        bx_pc_system.activate_timer(BX_MEM_THIS dedup_timer_index, dedup_period * 1000000, 1);
+      }
+      BX_INFO(("page sharing enabled, deduplication every %u seconds", dedup_period));
+    }
+  }
+
   BX_MEM_THIS register_state();
 }
 
+// Report the part of the guest RAM backed by huge pages, as seen by the host
+// kernel. At startup only the hugetlbfs mappings are backed already, the
+// transparent huge pages are allocated when the guest RAM is touched.
+void BX_MEM_C::report_huge_pages(void)
+{
+#if defined(__linux__)
+  FILE *fp = fopen("/proc/self/smaps", "r");
+  if (fp == NULL) return;
+
+  Bit64u ram_start = (bx_ptr_equiv_t) BX_MEM_THIS vector;
+  Bit64u ram_end = ram_start + BX_MEM_THIS allocated;
+  Bit64u overlap = 0, hugetlb = 0, advised = 0, thp = 0;
+  unsigned long long start, end, val;
+  char line[512];
+
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (sscanf(line, "%llx-%llx ", &start, &end) == 2) {
+      // new mapping, count only the part of it keeping the guest RAM
+      if (start < ram_start) start = ram_start;
+      if (end > ram_end) end = ram_end;
+      overlap = (end > start) ? (end - start) : 0;
+    }
+    else if (overlap == 0) {
+      continue;
+    }
+    else if (sscanf(line, "KernelPageSize: %llu kB", &val) == 1) {
+      if (val >= 2048) hugetlb += overlap;
+    }
+    else if (sscanf(line, "AnonHugePages: %llu kB", &val) == 1) {
+      thp += BX_MIN(val * 1024, overlap);
+    }
+    else if (!strncmp(line, "VmFlags:", 8)) {
+      if (strstr(line, " hg")) advised += overlap;
+    }
+  }
+  fclose(fp);
+
+  BX_INFO(("guest RAM huge pages: %u MB hugetlbfs, %u MB in transparent huge pages, %u MB of %u MB eligible",
+    (unsigned)(hugetlb >> 20), (unsigned)(thp >> 20), (unsigned)((hugetlb + advised) >> 20),
+    (unsigned)((ram_end - ram_start) >> 20)));
+#else
+  BX_INFO(("guest RAM huge pages coverage is not available on this host"));
+#endif
+}
+
+static void numa_node_list(Bit64u mask, char *buf)
+{
+  char *p = buf;
+
+  *p = 0;
+  for (int node = 0; node < BX_NUMA_MAX_NODES; node++) {
+    if (mask & (BX_CONST64(1) << node))
+      p += sprintf(p, (p == buf) ? "%d" : ",%d", node);
+  }
+}
+
+// Bind the guest RAM to the selected host NUMA nodes or interleave it across
+// them. It is done before the guest touches the RAM, so the host allocates
+// the pages on the right node instead of migrating them later.
+void BX_MEM_C::setup_numa(void)
+{
+  int ids[BX_NUMA_MAX_NODES];
+  char list[BX_NUMA_MAX_NODES * 3 + 1];
+  Bit64u mask = 0;
+
+  BX_MEM_THIS numa_nodes = 0;
+  BX_MEM_THIS numa_policy = SIM->get_param_enum(BXPN_MEM_NUMA)->get();
+  if (BX_MEM_THIS numa_policy == BX_MEM_NUMA_NONE)
+    return;
+
+  Bit64u online = bx_numa_online_nodes();
+  if (online == 0) {
+    BX_ERROR(("NUMA placement of guest RAM is not supported on this host"));
+    return;
+  }
+  const char *nodes = SIM->get_param_string(BXPN_MEM_NUMA_NODES)->getptr();
+  if (*nodes == 0) {
+    mask = online;
+  }
+  else {
+    int n = bx_parse_id_list(nodes, ids, BX_NUMA_MAX_NODES);
+    if (n < 0) {
+      BX_PANIC(("malformed NUMA node list '%s'", nodes));
+      return;
+    }
+    for (int i = 0; i < n; i++) {
+      if (ids[i] < BX_NUMA_MAX_NODES)
+        mask |= BX_CONST64(1) << ids[i];
+    }
+    if (mask & ~online) {
+      numa_node_list(mask & ~online, list);
+      BX_ERROR(("NUMA node(s) %s not online, ignored", list));
+      mask &= online;
+    }
+  }
+  if (mask == 0) {
+    BX_ERROR(("no online NUMA node selected, guest RAM placement left to the host"));
+    return;
+  }
+  bool interleave = (BX_MEM_THIS numa_policy == BX_MEM_NUMA_INTERLEAVE);
+  numa_node_list(mask, list);
+  if (! bx_numa_bind(BX_MEM_THIS vector, BX_MEM_THIS allocated, mask, interleave)) {
+    BX_ERROR(("failed to place guest RAM on NUMA node(s) %s: %s", list, strerror(errno)));
+    return;
+  }
+  BX_MEM_THIS numa_nodes = mask;
+  for (int node = 0; node < BX_NUMA_MAX_NODES; node++) {
+    if (! bx_numa_node_stat(node, &numa_stat.local[node], &numa_stat.remote[node]))
+      numa_stat.local[node] = numa_stat.remote[node] = 0;
+  }
+  BX_INFO(("guest RAM %s NUMA node(s) %s", interleave ? "interleaved across" : "bound to", list));
+}
+
+// Report where the host placed the guest RAM and the host wide local and
+// remote allocation counters of the nodes since the RAM was placed. The
+// counters count page allocations, not the memory accesses.
+void BX_MEM_C::report_numa(void)
+{
+  Bit64u bytes[BX_NUMA_MAX_NODES], local, remote;
+
+  if (BX_MEM_THIS numa_nodes == 0)
+    return;
+  if (bx_numa_page_nodes(BX_MEM_THIS vector, BX_MEM_THIS allocated, bytes)) {
+    for (int node = 0; node < BX_NUMA_MAX_NODES; node++) {
+      if ((bytes[node] > 0) || (BX_MEM_THIS numa_nodes & (BX_CONST64(1) << node)))
+        BX_INFO(("NUMA node %d: %u MB of guest RAM", node, (unsigned)(bytes[node] >> 20)));
+    }
+  }
+  for (int node = 0; node < BX_NUMA_MAX_NODES; node++) {
+    if ((BX_MEM_THIS numa_nodes & (BX_CONST64(1) << node)) && bx_numa_node_stat(node, &local, &remote)) {
+      BX_INFO(("NUMA node %d: " FMT_LL "u local and " FMT_LL "u remote page allocations (host wide)",
+        node, local - numa_stat.local[node], remote - numa_stat.remote[node]));
+    }
+  }
+}
+
 #if BX_LARGE_RAMFILE
-void BX_MEM_C::read_block(Bit32u block)
+// Read the swapped out block from the compressed swap space or the overflow
+// file, the block not accessed since a lazy restore from the restore file
+void BX_MEM_C::load_swapped_block(Bit32u block, Bit8u *buffer)
 {
   const Bit64u block_address = ((Bit64u)block)*BX_MEM_BLOCK_LEN;
+  FILE *fp = BX_MEM_THIS overflow_file;
+
+  if (BX_MEM_THIS zblocks[block] != NULL) {
+    if (lz_decompress(BX_MEM_THIS zblocks[block], BX_MEM_THIS zblock_len[block],
+                      buffer, BX_MEM_BLOCK_LEN) != BX_MEM_BLOCK_LEN)
+      BX_PANIC(("FATAL ERROR: Corrupted compressed memory block at 0x" FMT_LL "x!", block_address));
+    return;
+  }
+  if (BX_MEM_THIS block_lazy[block])
+    fp = BX_MEM_THIS restore_file;
 
-  if (fseeko64(BX_MEM_THIS overflow_file, block_address, SEEK_SET))
+  if (fseeko64(fp, block_address, SEEK_SET))
     BX_PANIC(("FATAL ERROR: Could not seek to 0x" FMT_LL "x in memory overflow file!", block_address));
 
   // We could legitimately get an EOF condition if we are reading the last bit of memory.ram
-  if ((fread(BX_MEM_THIS blocks[block], BX_MEM_BLOCK_LEN, 1, BX_MEM_THIS overflow_file) != 1) && 
-      (!feof(BX_MEM_THIS overflow_file))) 
+  if ((fread(buffer, BX_MEM_BLOCK_LEN, 1, fp) != 1) && 
+      (!feof(fp))) 
     BX_PANIC(("FATAL ERROR: Could not read from 0x" FMT_LL "x in memory overflow file!", block_address)); 
 }
+
+void BX_MEM_C::read_block(Bit32u block)
+{
+  load_swapped_block(block, BX_MEM_THIS blocks[block]);
+  free_zblock(block);
+  if (BX_MEM_THIS block_lazy[block]) {
+    BX_MEM_THIS block_lazy[block] = 0;
+    BX_MEM_THIS lazy_faults++;
+    if (--BX_MEM_THIS lazy_blocks == 0)
+      end_lazy_restore();
+  }
+}
+
+void BX_MEM_C::free_zblock(Bit32u block)
+{
+  if (BX_MEM_THIS zblocks[block] != NULL) {
+    BX_MEM_THIS zram_used -= BX_MEM_THIS zblock_len[block];
+    delete [] BX_MEM_THIS zblocks[block];
+    BX_MEM_THIS zblocks[block] = NULL;
+    BX_MEM_THIS zblock_len[block] = 0;
+  }
+}
+
+void BX_MEM_C::write_overflow_block(Bit32u block, const Bit8u *buffer)
+{
+  bx_phy_address address = ((bx_phy_address)block)*BX_MEM_BLOCK_LEN;
+  // Create overflow file if it does not currently exist.
+  if (!BX_MEM_THIS overflow_file) {
+    BX_MEM_THIS overflow_file = tmpfile64();
+    if (!BX_MEM_THIS overflow_file)
+      BX_PANIC(("Unable to allocate memory overflow file"));
+  }
+  if (fseeko64(BX_MEM_THIS overflow_file, address, SEEK_SET))
+    BX_PANIC(("FATAL ERROR: Could not seek to 0x" FMT_PHY_ADDRX " in overflow file!", address)); 
+  if (1 != fwrite (buffer, BX_MEM_BLOCK_LEN, 1, BX_MEM_THIS overflow_file))
+    BX_PANIC(("FATAL ERROR: Could not write at 0x" FMT_PHY_ADDRX " in overflow file!", address));
+}
+
+// Move the resident block to the compressed swap space if it compresses well
+// and fits, to the overflow file otherwise. The compressed blocks are moved
+// to the overflow file in turn to make room for the new ones.
+void BX_MEM_C::swap_out_block(Bit32u block)
+{
+  const Bit32u num_blocks = (Bit32u)(BX_MEM_THIS len / BX_MEM_BLOCK_LEN);
+  Bit8u *buffer = BX_MEM_THIS blocks[block];
+
+  if (BX_MEM_THIS zscratch != NULL) {
+    Bit8u *packed = BX_MEM_THIS zscratch, *unpacked = BX_MEM_THIS zscratch + BX_MEM_BLOCK_LEN;
+    Bit32u packed_len = lz_compress(buffer, BX_MEM_BLOCK_LEN, packed, BX_MEM_BLOCK_LEN / 8 * 7);
+    if (packed_len > 0 && packed_len <= BX_MEM_THIS zram_limit) {
+      while (BX_MEM_THIS zram_used + packed_len > BX_MEM_THIS zram_limit) {
+        do {
+          if (++BX_MEM_THIS next_zevict_idx >= num_blocks)
+            BX_MEM_THIS next_zevict_idx = 0;
+        } while (BX_MEM_THIS zblocks[BX_MEM_THIS next_zevict_idx] == NULL);
+        load_swapped_block(BX_MEM_THIS next_zevict_idx, unpacked);
+        write_overflow_block(BX_MEM_THIS next_zevict_idx, unpacked);
+        free_zblock(BX_MEM_THIS next_zevict_idx);
+        BX_MEM_THIS swap_stats.zram_to_file++;
+      }
+      BX_MEM_THIS zblocks[block] = new Bit8u [packed_len];
+      memcpy(BX_MEM_THIS zblocks[block], packed, packed_len);
+      BX_MEM_THIS zblock_len[block] = packed_len;
+      BX_MEM_THIS zram_used += packed_len;
+      BX_MEM_THIS swap_stats.to_zram++;
+      BX_MEM_THIS swap_stats.raw_bytes += BX_MEM_BLOCK_LEN;
+      BX_MEM_THIS swap_stats.packed_bytes += packed_len;
+      BX_MEM_THIS blocks[block] = BX_MEM_C::swapped_out;
+      return;
+    }
+  }
+
+  write_overflow_block(block, buffer);
+  BX_MEM_THIS swap_stats.to_file++;
+  BX_MEM_THIS blocks[block] = BX_MEM_C::swapped_out;
+}
+
+void BX_MEM_C::report_swap_stats(void)
+{
+  if (BX_MEM_THIS swap_stats.to_zram + BX_MEM_THIS swap_stats.to_file == 0)
+    return;
+
+  BX_INFO(("swap: " FMT_LL "u blocks evicted, " FMT_LL "u compressed, " FMT_LL "u to file, " FMT_LL "u moved from compressed to file",
+    BX_MEM_THIS swap_stats.to_zram + BX_MEM_THIS swap_stats.to_file, BX_MEM_THIS swap_stats.to_zram,
+    BX_MEM_THIS swap_stats.to_file, BX_MEM_THIS swap_stats.zram_to_file));
+  BX_INFO(("swap: " FMT_LL "u blocks swapped in from compressed memory (" FMT_LL "u us avg), " FMT_LL "u from file (" FMT_LL "u us avg)",
+    BX_MEM_THIS swap_stats.from_zram,
+    BX_MEM_THIS swap_stats.zram_usec / BX_MAX(BX_MEM_THIS swap_stats.from_zram, 1),
+    BX_MEM_THIS swap_stats.from_file,
+    BX_MEM_THIS swap_stats.file_usec / BX_MAX(BX_MEM_THIS swap_stats.from_file, 1)));
+  if (BX_MEM_THIS swap_stats.packed_bytes > 0) {
+    BX_INFO(("swap: compression ratio %.2f, %u KB of compressed memory in use",
+      (double) BX_MEM_THIS swap_stats.raw_bytes / BX_MEM_THIS swap_stats.packed_bytes,
+      (unsigned)(BX_MEM_THIS zram_used >> 10)));
+  }
+}
 #endif
 
-void BX_MEM_C::allocate_block(Bit32u block)
+// The whole block is stored by the next incremental save: the host memory
+// block was holding other data when the last checkpoint was taken.
+static void mark_block_dirty(Bit32u block)
+{
+  bx_phy_address address = ((bx_phy_address)block)*BX_MEM_BLOCK_LEN;
+  for (Bit32u n = 0; n < BX_MEM_BLOCK_LEN; n += 4096)
+    pageWriteStampTable.markDirtyPage(pageWriteStampTable.hash(address + n));
+}
+
+// Find a host memory block for a guest block: one released by the page
+// sharing, a never used one or (BX_LARGE_RAMFILE) one swapped out to the
+// overflow file. The contents of the reused host memory block are undefined.
+Bit8u* BX_MEM_C::alloc_block_buffer(bool *reused)
 {
   const Bit32u max_blocks = (Bit32u)(BX_MEM_THIS allocated / BX_MEM_BLOCK_LEN);
+  Bit8u *buffer;
+
+  *reused = 0;
+  if (BX_MEM_THIS num_free_slots > 0) {
+    Bit32u slot = BX_MEM_THIS free_slots[--BX_MEM_THIS num_free_slots];
+    BX_MEM_THIS slot_refs[slot] = 1;
+    *reused = 1;
+    return BX_MEM_THIS vector + ((Bit64u)slot * BX_MEM_BLOCK_LEN);
+  }
 
 #if BX_LARGE_RAMFILE
   /* 
@@ -191,88 +831,508 @@ void BX_MEM_C::allocate_block(Bit32u block)
    * First, see if there is any spare host memory blocks we can still freely allocate
    */
   if (BX_MEM_THIS used_blocks >= max_blocks) {
-    Bit32u original_replacement_block = BX_MEM_THIS next_swapout_idx;
-    // Find a block to replace
-    bool used_for_tlb;
-    Bit8u *buffer;
-    do {
-      do {
-        // Wrap if necessary
-        if (++(BX_MEM_THIS next_swapout_idx)==((BX_MEM_THIS len)/BX_MEM_BLOCK_LEN))
-          BX_MEM_THIS next_swapout_idx = 0;
-        if (BX_MEM_THIS next_swapout_idx == original_replacement_block)
+    // the other CPUs must not use the block being replaced through the TLB
+    BX_SMP_STOP_WORLD();
+    const Bit32u num_blocks = (Bit32u)(BX_MEM_THIS len / BX_MEM_BLOCK_LEN);
+    // Find a block to replace: clock with second chance, the blocks
+    // accessed since the last pass of the clock hand are skipped once
+    Bit32u scanned = 0;
+    bool tlb_flushed = false;
+    for (;;) {
+      // Wrap if necessary
+      if (++(BX_MEM_THIS next_swapout_idx) == num_blocks)
+        BX_MEM_THIS next_swapout_idx = 0;
+      if (++scanned > 2 * num_blocks) {
+        if (tlb_flushed)
           BX_PANIC(("FATAL ERROR: Insufficient working RAM, all blocks are currently used for TLB entries!"));
-        buffer = BX_MEM_THIS blocks[BX_MEM_THIS next_swapout_idx];
-      } while ((!buffer) || (buffer == BX_MEM_C::swapped_out));
+        // drop the TLB entries keeping the blocks in memory and try again
+        bx_pc_system.MemoryMappingChanged();
+        tlb_flushed = true;
+        scanned = 0;
+      }
+      buffer = BX_MEM_THIS blocks[BX_MEM_THIS next_swapout_idx];
+      // the shared blocks stay in memory
+      if ((!buffer) || (buffer == BX_MEM_C::swapped_out) || BX_MEM_THIS block_cow[BX_MEM_THIS next_swapout_idx])
+        continue;
+      if (BX_MEM_THIS block_referenced[BX_MEM_THIS next_swapout_idx]) {
+        BX_MEM_THIS block_referenced[BX_MEM_THIS next_swapout_idx] = 0;
+        continue;
+      }
 
-      used_for_tlb = false;
+      bool used_for_tlb = false;
       // tlb buffer check loop
       const Bit8u* buffer_end = buffer+BX_MEM_BLOCK_LEN;
       // Don't replace it if any CPU is using it as a TLB entry
       for (int i=0; i<BX_SMP_PROCESSORS && !used_for_tlb;i++)
         used_for_tlb = BX_CPU(i)->check_addr_in_tlb_buffers(buffer, buffer_end);
-    } while (used_for_tlb);
+      if (! used_for_tlb) break;
+    }
     // Flush the block to be replaced
-    bx_phy_address address = ((bx_phy_address)BX_MEM_THIS next_swapout_idx)*BX_MEM_BLOCK_LEN;
-    // Create overflow file if it does not currently exist.
-    if (!BX_MEM_THIS overflow_file) {
-      BX_MEM_THIS overflow_file = tmpfile64();
-      if (!BX_MEM_THIS overflow_file)
-        BX_PANIC(("Unable to allocate memory overflow file"));
-    }
-    // Write swapped out block
-    if (fseeko64(BX_MEM_THIS overflow_file, address, SEEK_SET))
-      BX_PANIC(("FATAL ERROR: Could not seek to 0x" FMT_PHY_ADDRX " in overflow file!", address)); 
-    if (1 != fwrite (BX_MEM_THIS blocks[BX_MEM_THIS next_swapout_idx], BX_MEM_BLOCK_LEN, 1, BX_MEM_THIS overflow_file))
-      BX_PANIC(("FATAL ERROR: Could not write at 0x" FMT_PHY_ADDRX " in overflow file!", address));
-    // Mark swapped out block
-    BX_MEM_THIS blocks[BX_MEM_THIS next_swapout_idx] = BX_MEM_C::swapped_out;
-    BX_MEM_THIS blocks[block] = buffer;
-    read_block(block);
-    BX_DEBUG(("allocate_block: block=0x%x, replaced 0x%x", block, BX_MEM_THIS next_swapout_idx));
+    swap_out_block(BX_MEM_THIS next_swapout_idx);
+    BX_SMP_RESUME_WORLD();
+    BX_DEBUG(("allocate_block: replaced 0x%x", BX_MEM_THIS next_swapout_idx));
+    *reused = 1;
   }
   else {
-    BX_MEM_THIS blocks[block] = BX_MEM_THIS vector + (BX_MEM_THIS used_blocks++ * BX_MEM_BLOCK_LEN);
-    BX_DEBUG(("allocate_block: block=0x%x used 0x%x of 0x%x",
-          block, BX_MEM_THIS used_blocks, max_blocks));
+    buffer = BX_MEM_THIS vector + (BX_MEM_THIS used_blocks++ * BX_MEM_BLOCK_LEN);
+    BX_DEBUG(("allocate_block: used 0x%x of 0x%x", BX_MEM_THIS used_blocks, max_blocks));
   }
 #else
   // Legacy default allocator
   if (BX_MEM_THIS used_blocks >= max_blocks) {
     BX_PANIC(("FATAL ERROR: all available memory is already allocated !"));
+    return NULL;
   }
   else {
-    BX_MEM_THIS blocks[block] = BX_MEM_THIS vector + (BX_MEM_THIS used_blocks * BX_MEM_BLOCK_LEN);
+    buffer = BX_MEM_THIS vector + (BX_MEM_THIS used_blocks * BX_MEM_BLOCK_LEN);
     BX_MEM_THIS used_blocks++;
   }
   BX_DEBUG(("allocate_block: used_blocks=0x%x of 0x%x", BX_MEM_THIS used_blocks, max_blocks));
 #endif
+  BX_MEM_THIS slot_refs[(buffer - BX_MEM_THIS vector) / BX_MEM_BLOCK_LEN] = 1;
+  return buffer;
+}
+
+void BX_MEM_C::allocate_block(Bit32u block)
+{
+  // in parallel SMP mode another CPU might have allocated the block already
+  BX_SMP_GUARD();
+#if BX_LARGE_RAMFILE
+  if (BX_MEM_THIS blocks[block] && BX_MEM_THIS blocks[block] != BX_MEM_C::swapped_out)
+    return;
+  bool swapped_in = (BX_MEM_THIS blocks[block] == BX_MEM_C::swapped_out);
+#else
+  if (BX_MEM_THIS blocks[block])
+    return;
+  bool swapped_in = 0;
+#endif
+
+  if (BX_MEM_THIS zero_block && !swapped_in) {
+    // untouched memory reads as zeros, the first write allocates the block
+    BX_MEM_THIS block_cow[block] = 1;
+    BX_MEM_THIS blocks[block] = BX_MEM_THIS zero_block;
+    return;
+  }
+
+  bool reused;
+  Bit8u *buffer = alloc_block_buffer(&reused);
+#if BX_LARGE_RAMFILE
+  if (swapped_in) {
+    bool compressed = (BX_MEM_THIS zblocks[block] != NULL);
+    Bit64u start = bx_get_realtime64_usec();
+    // the other CPUs must not see the block before it is read back
+    BX_SMP_STOP_WORLD();
+    BX_MEM_THIS blocks[block] = buffer;
+    read_block(block);
+    BX_SMP_RESUME_WORLD();
+    Bit64u usec = bx_get_realtime64_usec() - start;
+    if (compressed) {
+      BX_MEM_THIS swap_stats.from_zram++;
+      BX_MEM_THIS swap_stats.zram_usec += usec;
+    }
+    else {
+      BX_MEM_THIS swap_stats.from_file++;
+      BX_MEM_THIS swap_stats.file_usec += usec;
+    }
+    BX_DEBUG(("allocate_block: block=0x%x swapped in from %s", block, compressed ? "compressed memory" : "file"));
+    return;
+  }
+#endif
+  if (reused) {
+    memset(buffer, 0, BX_MEM_BLOCK_LEN);
+    mark_block_dirty(block);
+  }
+  BX_MEM_THIS blocks[block] = buffer;
+}
+
+// Give the guest block its own copy of the shared host memory block on the
+// first write to it.
+void BX_MEM_C::unshare_block(Bit32u block)
+{
+  // the other CPUs must not write the shared block through the TLB
+  BX_SMP_STOP_WORLD();
+  Bit8u *shared = BX_MEM_THIS blocks[block];
+  if (BX_MEM_THIS block_cow[block]) {
+    if (shared != BX_MEM_THIS zero_block &&
+        BX_MEM_THIS slot_refs[(shared - BX_MEM_THIS vector) / BX_MEM_BLOCK_LEN] == 1) {
+      // the other guest blocks have their copies already
+      BX_MEM_THIS block_cow[block] = 0;
+    }
+    else {
+      bool reused;
+      Bit8u *buffer = alloc_block_buffer(&reused);
+      memcpy(buffer, shared, BX_MEM_BLOCK_LEN);
+      if (shared != BX_MEM_THIS zero_block)
+        BX_MEM_THIS slot_refs[(shared - BX_MEM_THIS vector) / BX_MEM_BLOCK_LEN]--;
+      BX_MEM_THIS blocks[block] = buffer;
+      BX_MEM_THIS block_cow[block] = 0;
+      mark_block_dirty(block);
+      // the TLBs still point to the shared block
+      bx_pc_system.MemoryMappingChanged();
+      BX_DEBUG(("unshare_block: block=0x%x", block));
+    }
+  }
+  BX_SMP_RESUME_WORLD();
+}
+
+void BX_MEM_C::release_block_buffer(Bit8u *buffer)
+{
+  if (buffer == BX_MEM_THIS zero_block)
+    return;
+
+  Bit32u slot = (Bit32u)((buffer - BX_MEM_THIS vector) / BX_MEM_BLOCK_LEN);
+  if (--BX_MEM_THIS slot_refs[slot] == 0) {
+    BX_MEM_THIS free_slots[BX_MEM_THIS num_free_slots++] = slot;
+#if BX_HAVE_SYS_MMAN_H && defined(MADV_DONTNEED)
+    // return the memory to the host, keep the huge pages intact
+    if (! BX_MEM_THIS huge_pages)
+      madvise(buffer, BX_MEM_BLOCK_LEN, MADV_DONTNEED);
+#endif
+  }
+}
+
+static Bit64u hash_block(const Bit8u *block, bool *zero)
+{
+  const Bit64u *data = (const Bit64u *) block;
+  Bit64u hash = BX_CONST64(0xcbf29ce484222325), any = 0;
+  for (unsigned n = 0; n < BX_MEM_BLOCK_LEN / 8; n++) {
+    any |= data[n];
+    hash = (hash ^ data[n]) * BX_CONST64(0x100000001b3);
+  }
+  *zero = (any == 0);
+  return hash ^ (hash >> 29);
+}
+
+// Map the zero filled guest blocks to the zero block and the identical guest
+// blocks to one host memory block, the released host memory blocks are
+// reused by the following allocations.
+void BX_MEM_C::dedup_blocks(void)
+{
+  Bit32u num_blocks = (Bit32u)(BX_MEM_THIS len / BX_MEM_BLOCK_LEN);
+  Bit32u idx, table_size = 1, zero = 0, merged = 0;
+
+  while (table_size < num_blocks * 2) table_size <<= 1;
+  Bit32u *table = new Bit32u[table_size];
+  Bit64u *hashes = new Bit64u[num_blocks];
+  memset(table, 0, table_size * sizeof(Bit32u));
+
+  BX_SMP_STOP_WORLD();
+  // the TLBs must not keep writable pointers to the blocks being shared
+  bx_pc_system.MemoryMappingChanged();
+
+  for (idx = 0; idx < num_blocks; idx++) {
+    Bit8u *buffer = BX_MEM_THIS blocks[idx];
+    if (!buffer || buffer == BX_MEM_THIS zero_block) continue;
+#if BX_LARGE_RAMFILE
+    if (buffer == BX_MEM_C::swapped_out) continue;
+#endif
+    // VMCS and VMCB are accessed by host pointer
+    bool pinned = false;
+    for (int i=0; i<BX_SMP_PROCESSORS && !pinned; i++)
+      pinned = BX_CPU(i)->check_addr_in_vmcs_buffers(buffer, buffer + BX_MEM_BLOCK_LEN);
+    if (pinned) continue;
+
+    bool is_zero;
+    hashes[idx] = hash_block(buffer, &is_zero);
+    if (is_zero) {
+      // the shared blocks are never zero filled
+      release_block_buffer(buffer);
+      BX_MEM_THIS blocks[idx] = BX_MEM_THIS zero_block;
+      BX_MEM_THIS block_cow[idx] = 1;
+      zero++;
+      continue;
+    }
+
+    Bit32u pos = (Bit32u) hashes[idx] & (table_size - 1);
+    while (table[pos]) {
+      Bit32u match = table[pos] - 1;
+      if (hashes[match] == hashes[idx] &&
+          !memcmp(BX_MEM_THIS blocks[match], buffer, BX_MEM_BLOCK_LEN)) break;
+      pos = (pos + 1) & (table_size - 1);
+    }
+    if (! table[pos]) {
+      table[pos] = idx + 1;
+      continue;
+    }
+
+    Bit8u *shared = BX_MEM_THIS blocks[table[pos] - 1];
+    if (shared != buffer) {
+      release_block_buffer(buffer);
+      BX_MEM_THIS slot_refs[(shared - BX_MEM_THIS vector) / BX_MEM_BLOCK_LEN]++;
+      BX_MEM_THIS blocks[idx] = shared;
+      BX_MEM_THIS block_cow[table[pos] - 1] = 1;
+      BX_MEM_THIS block_cow[idx] = 1;
+      merged++;
+    }
+  }
+  BX_SMP_RESUME_WORLD();
+
+  delete [] table;
+  delete [] hashes;
+
+  BX_MEM_THIS dedup_zero_blocks += zero;
+  BX_MEM_THIS dedup_merged_blocks += merged;
+  BX_DEBUG(("page sharing: %u zero and %u duplicate blocks released, %u host blocks free",
+    zero, merged, BX_MEM_THIS num_free_slots));
+}
+
+void BX_MEM_C::dedup_timer_handler(void *this_ptr)
+{
+  ((BX_MEM_C *) this_ptr)->dedup_blocks();
+}
+
+// The host memory blocks shared by the guest blocks and the free ones are
+// found from the restored mapping.
+void BX_MEM_C::rebuild_block_sharing(void)
+{
+  Bit32u num_blocks = (Bit32u)(BX_MEM_THIS len / BX_MEM_BLOCK_LEN);
+  Bit32u idx, used = BX_MEM_THIS used_blocks;
+
+  memset(BX_MEM_THIS slot_refs, 0, used * sizeof(Bit32u));
+  for (idx = 0; idx < num_blocks; idx++) {
+    Bit8u *buffer = BX_MEM_THIS blocks[idx];
+    BX_MEM_THIS block_cow[idx] = 0;
+    if (!buffer) continue;
+#if BX_LARGE_RAMFILE
+    if (buffer == BX_MEM_C::swapped_out) continue;
+#endif
+    BX_MEM_THIS slot_refs[(buffer - BX_MEM_THIS vector) / BX_MEM_BLOCK_LEN]++;
+  }
+  for (idx = 0; idx < num_blocks; idx++) {
+    Bit8u *buffer = BX_MEM_THIS blocks[idx];
+    if (!buffer) continue;
+#if BX_LARGE_RAMFILE
+    if (buffer == BX_MEM_C::swapped_out) continue;
+#endif
+    if (BX_MEM_THIS slot_refs[(buffer - BX_MEM_THIS vector) / BX_MEM_BLOCK_LEN] > 1)
+      BX_MEM_THIS block_cow[idx] = 1;
+  }
+  BX_MEM_THIS num_free_slots = 0;
+  for (idx = 0; idx < used; idx++) {
+    if (BX_MEM_THIS slot_refs[idx] == 0)
+      BX_MEM_THIS free_slots[BX_MEM_THIS num_free_slots++] = idx;
+  }
 }
 
 #if BX_LARGE_RAMFILE
 // The blocks in RAM must also be flushed to the save file.
+// So are the blocks in the compressed swap space and the blocks still in
+// the restore file of a lazy restore.
 void ramfile_save_handler(void *devptr, FILE *fp)
 {
+  Bit8u *buffer = NULL;
+
   for (Bit32u idx = 0; idx < (BX_MEM(0)->len / BX_MEM_BLOCK_LEN); idx++) {
-    if ((BX_MEM(0)->blocks[idx]) && (BX_MEM(0)->blocks[idx] != BX_MEM(0)->swapped_out))
+    Bit8u *block = BX_MEM(0)->blocks[idx];
+    if (block == BX_MEM(0)->swapped_out &&
+        (BX_MEM(0)->zblocks[idx] != NULL || BX_MEM(0)->block_lazy[idx])) {
+      if (buffer == NULL) buffer = new Bit8u[BX_MEM_BLOCK_LEN];
+      BX_MEM(0)->load_swapped_block(idx, buffer);
+      block = buffer;
+    }
+    if ((block) && (block != BX_MEM(0)->swapped_out))
     {
       bx_phy_address address = ((bx_phy_address)idx)*BX_MEM_BLOCK_LEN;
       if (fseeko64(fp, address, SEEK_SET))
         BX_PANIC(("FATAL ERROR: Could not seek to 0x" FMT_PHY_ADDRX " in overflow file!", address)); 
-      if (1 != fwrite (BX_MEM(0)->blocks[idx], BX_MEM_BLOCK_LEN, 1, fp))
+      if (1 != fwrite (block, BX_MEM_BLOCK_LEN, 1, fp))
         BX_PANIC(("FATAL ERROR: Could not write at 0x" FMT_PHY_ADDRX " in overflow file!", address));
     }
   }
+  delete [] buffer;
 }
 #endif
 
+// Incremental save: only the 4K pages written since the last checkpoint are
+// stored, at their offset in the saved RAM image.
+void ram_delta_handler(void *devptr, FILE *fp)
+{
+  Bit8u *buffer = NULL;
+  Bit32u pages = 0;
+
+  for (Bit32u idx = 0; idx < (BX_MEM(0)->len / BX_MEM_BLOCK_LEN); idx++) {
+    Bit8u *block = BX_MEM(0)->blocks[idx];
+    if (! block) continue;
+    bx_phy_address address = ((bx_phy_address)idx)*BX_MEM_BLOCK_LEN;
+#if BX_LARGE_RAMFILE
+    // the RAM image is the overflow file, indexed by the guest address
+    Bit64u offset = address;
+    if (block == BX_MEM(0)->swapped_out) {
+      block = NULL;
+      for (Bit32u n = 0; n < BX_MEM_BLOCK_LEN; n += 4096) {
+        if (pageWriteStampTable.isDirtyPage(address + n)) {
+          if (buffer == NULL) buffer = new Bit8u[BX_MEM_BLOCK_LEN];
+          BX_MEM(0)->load_swapped_block(idx, buffer);
+          block = buffer;
+          break;
+        }
+      }
+      if (! block) continue;
+    }
+#else
+    // the RAM image is the vector, the blocks are allocated in it on demand
+    if (block == BX_MEM(0)->zero_block) continue;
+    Bit64u offset = (Bit64u)(block - BX_MEM(0)->vector);
+#endif
+    for (Bit32u n = 0; n < BX_MEM_BLOCK_LEN; n += 4096) {
+      if (pageWriteStampTable.isDirtyPage(address + n)) {
+        bx_write_delta_record(fp, offset + n, block + n, 4096);
+        pages++;
+      }
+    }
+  }
+  delete [] buffer;
+  BX_INFO(("incremental save: %u KB of RAM changed since the last checkpoint", pages * 4));
+}
+
+void ram_clean_handler(void *devptr)
+{
+  pageWriteStampTable.resetDirtyPages();
+}
+
+// Lazy restore: the saved blocks are read from the saved RAM file on first
+// access (BX_LARGE_RAMFILE) or the file is mapped copy-on-write as the guest
+// RAM, the host reads its pages on first access then.
+bool ram_lazy_restore_handler(void *devptr, const char *path)
+{
+  if (! SIM->get_param_bool(BXPN_MEM_LAZY_RESTORE)->get())
+    return 0;
+
+  BX_MEM(0)->end_lazy_restore();
+#if BX_LARGE_RAMFILE
+  BX_MEM(0)->restore_file = fopen(path, "rb");
+  if (BX_MEM(0)->restore_file == NULL)
+    return 0;
+#elif BX_HAVE_SYS_MMAN_H
+  if ((BX_MEM(0)->mapped_len == 0) ||
+      (SIM->get_param_enum(BXPN_MEM_BACKING)->get() == BX_MEM_BACKING_FILE)) {
+    BX_ERROR(("lazy restore requires anonymous or template guest RAM backing"));
+    return 0;
+  }
+  struct stat stat_buf;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  if ((fstat(fd, &stat_buf) < 0) || ((Bit64u) stat_buf.st_size < BX_MEM(0)->allocated) ||
+      (mmap(BX_MEM(0)->vector, (size_t) BX_MEM(0)->allocated, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, fd, 0) == MAP_FAILED)) {
+    BX_ERROR(("couldn't map the saved RAM file '%s'", path));
+    close(fd);
+    return 0;
+  }
+  close(fd);
+  if (BX_MEM(0)->numa_nodes != 0) {
+    bx_numa_bind(BX_MEM(0)->vector, BX_MEM(0)->allocated, BX_MEM(0)->numa_nodes,
+                 BX_MEM(0)->numa_policy == BX_MEM_NUMA_INTERLEAVE);
+  }
+#else
+  BX_ERROR(("lazy restore is not supported on this host"));
+  return 0;
+#endif
+  strcpy(lazy_prefetch.path, path);
+  BX_MEM(0)->lazy_restore = 1;
+  return 1;
+}
+
+static BX_THREAD_FUNC(lazy_prefetch_thread, indata)
+{
+  Bit32u n;
+#if BX_LARGE_RAMFILE
+  // the pages read stay in the host page cache for the first access
+  Bit8u *buffer = new Bit8u[BX_MEM_BLOCK_LEN];
+  FILE *fp = fopen(lazy_prefetch.path, "rb");
+  for (n = 0; (fp != NULL) && (n < lazy_prefetch.count) && !lazy_prefetch.stop; n++) {
+    Bit64u offset = lazy_prefetch.order[n];
+    if (! lazy_prefetch.pending[offset / BX_MEM_BLOCK_LEN]) continue;
+    if (fseeko64(fp, offset, SEEK_SET) || (fread(buffer, BX_MEM_BLOCK_LEN, 1, fp) != 1))
+      break;
+  }
+  if (fp != NULL) fclose(fp);
+  delete [] buffer;
+#else
+  // touching a page of the mapped file maps it for the guest
+  const volatile Bit8u *vector = lazy_prefetch.vector;
+  for (n = 0; (n < lazy_prefetch.count) && !lazy_prefetch.stop; n++) {
+    for (Bit32u page = 0; page < BX_MEM_BLOCK_LEN; page += 4096)
+      (void) vector[lazy_prefetch.order[n] + page];
+  }
+#endif
+  BX_THREAD_EXIT;
+}
+
+// Read ahead the saved RAM of a lazy restore in the background: the blocks
+// resident at save time first, then the others in guest address order.
+void BX_MEM_C::start_lazy_prefetch(void)
+{
+  Bit32u num_blocks = (Bit32u)(BX_MEM_THIS len / BX_MEM_BLOCK_LEN);
+  Bit32u idx, n = 0;
+
+  delete [] lazy_prefetch.order;
+  lazy_prefetch.order = new Bit64u[num_blocks];
+#if BX_LARGE_RAMFILE
+  for (int resident = 2; resident > 0; resident--) {
+    for (idx = 0; idx < num_blocks; idx++) {
+      if (BX_MEM_THIS block_lazy[idx] == resident)
+        lazy_prefetch.order[n++] = ((Bit64u)idx) * BX_MEM_BLOCK_LEN;
+    }
+  }
+  lazy_prefetch.pending = BX_MEM_THIS block_lazy;
+  BX_INFO(("lazy restore: %u MB of saved RAM left in '%s'",
+    (unsigned)((((Bit64u) BX_MEM_THIS lazy_blocks) * BX_MEM_BLOCK_LEN) >> 20), lazy_prefetch.path));
+  if (BX_MEM_THIS lazy_blocks == 0) {
+    end_lazy_restore();
+    return;
+  }
+#else
+  for (idx = 0; idx < num_blocks; idx++) {
+    Bit8u *buffer = BX_MEM_THIS blocks[idx];
+    if (buffer && (buffer != BX_MEM_THIS zero_block))
+      lazy_prefetch.order[n++] = (Bit64u)(buffer - BX_MEM_THIS vector);
+  }
+  lazy_prefetch.vector = BX_MEM_THIS vector;
+  BX_INFO(("lazy restore: %u MB of saved RAM mapped from '%s'",
+    (unsigned)(BX_MEM_THIS allocated >> 20), lazy_prefetch.path));
+#endif
+  lazy_prefetch.count = n;
+  lazy_prefetch.stop = 0;
+  lazy_prefetch.running = 1;
+  BX_THREAD_CREATE(lazy_prefetch_thread, NULL, lazy_prefetch.thread);
+}
+
+void BX_MEM_C::end_lazy_restore(void)
+{
+  if (lazy_prefetch.running) {
+    lazy_prefetch.stop = 1;
+    BX_THREAD_JOIN(lazy_prefetch.thread);
+    lazy_prefetch.running = 0;
+  }
+  delete [] lazy_prefetch.order;
+  lazy_prefetch.order = NULL;
+  if (! BX_MEM_THIS lazy_restore)
+    return;
+
+#if BX_LARGE_RAMFILE
+  BX_INFO(("lazy restore: %u blocks read on first access, %u never accessed",
+    BX_MEM_THIS lazy_faults, BX_MEM_THIS lazy_blocks));
+  memset(BX_MEM_THIS block_lazy, 0, (size_t)(BX_MEM_THIS len / BX_MEM_BLOCK_LEN));
+  BX_MEM_THIS lazy_blocks = 0;
+  BX_MEM_THIS lazy_faults = 0;
+  if (BX_MEM_THIS restore_file != NULL) {
+    fclose(BX_MEM_THIS restore_file);
+    BX_MEM_THIS restore_file = NULL;
+  }
+#endif
+  BX_MEM_THIS lazy_restore = 0;
+}
+
 // Note: This must be called before the memory file save handler is called.
 Bit64s memory_param_save_handler(void *devptr, bx_param_c *param)
 {
   const char *pname = param->get_name();
   if (! strncmp(pname, "blk", 3)) {
     Bit32u blk_index = atoi(pname + 3);
-    if (! BX_MEM(0)->blocks[blk_index])
+    // the zero block is allocated again when accessed
+    if (! BX_MEM(0)->blocks[blk_index] || BX_MEM(0)->blocks[blk_index] == BX_MEM(0)->zero_block)
       return -1;
 #if BX_LARGE_RAMFILE
     // If swapped out, will be saved by common handler.
@@ -293,8 +1353,14 @@ void memory_param_restore_handler(void *devptr, bx_param_c *param, Bit64s val)
   if (! strncmp(pname, "blk", 3)) {
     Bit32u blk_index = atoi(pname + 3);
 #if BX_LARGE_RAMFILE
+    // the saved block is in the restored overflow file
+    BX_MEM(0)->free_zblock(blk_index);
     if ((Bit32s) val == -2) {
       BX_MEM(0)->blocks[blk_index] = BX_MEM(0)->swapped_out;
+      if (BX_MEM(0)->lazy_restore) {
+        BX_MEM(0)->block_lazy[blk_index] = 1;
+        BX_MEM(0)->lazy_blocks++;
+      }
       return;
     }
 #endif
@@ -302,6 +1368,16 @@ void memory_param_restore_handler(void *devptr, bx_param_c *param, Bit64s val)
         BX_MEM(0)->blocks[blk_index] = NULL;
         return;
       }
+#if BX_LARGE_RAMFILE
+      // all saved blocks stay in the restore file until accessed, the ones
+      // resident at save time are read ahead first
+      if (BX_MEM(0)->lazy_restore) {
+        BX_MEM(0)->blocks[blk_index] = BX_MEM(0)->swapped_out;
+        BX_MEM(0)->block_lazy[blk_index] = 2;
+        BX_MEM(0)->lazy_blocks++;
+        return;
+      }
+#endif
       BX_MEM(0)->blocks[blk_index] = BX_MEM(0)->vector + val * BX_MEM_BLOCK_LEN;
 #if BX_LARGE_RAMFILE
       BX_MEM(0)->read_block(blk_index);
@@ -309,6 +1385,84 @@ void memory_param_restore_handler(void *devptr, bx_param_c *param, Bit64s val)
   }
 }
 
+void memory_mapping_restore_handler(void *devptr, bx_list_c *list)
+{
+  BX_MEM(0)->rebuild_block_sharing();
+  if (BX_MEM(0)->lazy_restore)
+    BX_MEM(0)->start_lazy_prefetch();
+}
+
+// Called in a fork clone of the simulation. The private guest RAM is
+// copy-on-write already, but the shared mapping of the guest RAM file and
+// the swap file of the swapped out blocks would still be shared with the
+// parent, so the clone copies them. The file position of the restore file
+// of a lazy restore is shared as well, so the clone opens it again.
+void BX_MEM_C::after_clone(void)
+{
+  // the clone has no prefetch thread of a lazy restore
+  lazy_prefetch.running = 0;
+
+#if BX_HAVE_SYS_MMAN_H
+  if ((BX_MEM_THIS mapped_len != 0) &&
+      (SIM->get_param_enum(BXPN_MEM_BACKING)->get() == BX_MEM_BACKING_FILE)) {
+    size_t map_len = (size_t) BX_MEM_THIS len;
+    void *copy = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (copy == MAP_FAILED) {
+      BX_PANIC(("clone: couldn't copy the shared guest RAM"));
+      return;
+    }
+    memcpy(copy, BX_MEM_THIS vector, map_len);
+    if (mmap(BX_MEM_THIS vector, map_len, PROT_READ | PROT_WRITE,
+             MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0) == MAP_FAILED) {
+      BX_PANIC(("clone: couldn't remap the guest RAM"));
+    } else {
+#ifdef MADV_HUGEPAGE
+      if (BX_MEM_THIS huge_pages)
+        madvise(BX_MEM_THIS vector, map_len, MADV_HUGEPAGE);
+#endif
+      if (BX_MEM_THIS numa_nodes != 0) {
+        bx_numa_bind(BX_MEM_THIS vector, map_len, BX_MEM_THIS numa_nodes,
+                     BX_MEM_THIS numa_policy == BX_MEM_NUMA_INTERLEAVE);
+      }
+      memcpy(BX_MEM_THIS vector, copy, map_len);
+    }
+    munmap(copy, map_len);
+  }
+#endif
+
+#if BX_LARGE_RAMFILE
+  if (BX_MEM_THIS overflow_file != NULL) {
+    FILE *copy = tmpfile64();
+    if (copy == NULL) {
+      BX_PANIC(("clone: couldn't create the swap file"));
+      return;
+    }
+    Bit8u *buffer = new Bit8u[BX_MEM_BLOCK_LEN];
+    size_t n;
+    rewind(BX_MEM_THIS overflow_file);
+    while ((n = fread(buffer, 1, BX_MEM_BLOCK_LEN, BX_MEM_THIS overflow_file)) > 0) {
+      if (fwrite(buffer, 1, n, copy) != n) {
+        BX_PANIC(("clone: couldn't copy the swap file"));
+        break;
+      }
+    }
+    delete [] buffer;
+    fclose(BX_MEM_THIS overflow_file);
+    BX_MEM_THIS overflow_file = copy;
+  }
+  if (BX_MEM_THIS restore_file != NULL) {
+    FILE *fp = fopen(lazy_prefetch.path, "rb");
+    if (fp == NULL) {
+      BX_PANIC(("clone: couldn't open the restore file '%s'", lazy_prefetch.path));
+      return;
+    }
+    fclose(BX_MEM_THIS restore_file);
+    BX_MEM_THIS restore_file = fp;
+  }
+#endif
+}
+
 void BX_MEM_C::register_state()
 {
   char param_name[15];
@@ -318,14 +1472,19 @@ void BX_MEM_C::register_state()
 #if BX_LARGE_RAMFILE
   bx_shadow_filedata_c *ramfile = new bx_shadow_filedata_c(list, "ram", &(BX_MEM_THIS overflow_file));
   ramfile->set_sr_handlers(this, ramfile_save_handler, (filedata_restore_handler)NULL);
+  ramfile->set_delta_handlers(this, ram_delta_handler, ram_clean_handler);
+  ramfile->set_lazy_handler(this, ram_lazy_restore_handler);
 #else
-  new bx_shadow_data_c(list, "ram", BX_MEM_THIS vector, BX_MEM_THIS allocated);
+  bx_shadow_data_c *ram = new bx_shadow_data_c(list, "ram", BX_MEM_THIS vector, BX_MEM_THIS allocated);
+  ram->set_delta_handlers(this, ram_delta_handler, ram_clean_handler);
+  ram->set_lazy_handler(this, ram_lazy_restore_handler);
 #endif
   BXRS_DEC_PARAM_FIELD(list, len, BX_MEM_THIS len);
   BXRS_DEC_PARAM_FIELD(list, allocated, BX_MEM_THIS allocated);
   BXRS_DEC_PARAM_FIELD(list, used_blocks, BX_MEM_THIS used_blocks);
 
   bx_list_c *mapping = new bx_list_c(list, "mapping");
+  mapping->set_restore_handler(this, memory_mapping_restore_handler);
   for (Bit32u blk=0; blk < num_blocks; blk++) {
     sprintf(param_name, "blk%d", blk);
     bx_param_num_c *param = new bx_param_num_c(mapping, param_name, "", "", 0, BX_MAX_BIT32U, 0);
@@ -348,14 +1507,45 @@ void BX_MEM_C::cleanup_memory()
   unsigned idx;
 
   if (BX_MEM_THIS vector != NULL) {
-    delete [] BX_MEM_THIS actual_vector;
-    BX_MEM_THIS actual_vector = NULL;
-    BX_MEM_THIS vector = NULL;
+    end_lazy_restore();
+    if (BX_MEM_THIS huge_pages)
+      report_huge_pages();
+    report_numa();
+#if BX_LARGE_RAMFILE
+    report_swap_stats();
+    for (idx = 0; idx < (unsigned)(BX_MEM_THIS len / BX_MEM_BLOCK_LEN); idx++)
+      free_zblock(idx);
+    delete [] BX_MEM_THIS zblocks;
+    BX_MEM_THIS zblocks = NULL;
+    delete [] BX_MEM_THIS zblock_len;
+    BX_MEM_THIS zblock_len = NULL;
+    delete [] BX_MEM_THIS zscratch;
+    BX_MEM_THIS zscratch = NULL;
+    delete [] BX_MEM_THIS block_referenced;
+    BX_MEM_THIS block_referenced = NULL;
+    delete [] BX_MEM_THIS block_lazy;
+    BX_MEM_THIS block_lazy = NULL;
+#endif
+    if (BX_MEM_THIS zero_block != NULL) {
+      BX_INFO(("page sharing: %u zero and %u duplicate blocks released, %u of %u host blocks in use",
+        BX_MEM_THIS dedup_zero_blocks, BX_MEM_THIS dedup_merged_blocks,
+        BX_MEM_THIS used_blocks - BX_MEM_THIS num_free_slots, BX_MEM_THIS used_blocks));
+      delete [] BX_MEM_THIS zero_block;
+      BX_MEM_THIS zero_block = NULL;
+    }
+    free_vector();
     BX_MEM_THIS rom = NULL;
     BX_MEM_THIS bogus = NULL;
     delete [] BX_MEM_THIS blocks;
     BX_MEM_THIS blocks = 0;
     BX_MEM_THIS used_blocks = 0;
+    delete [] BX_MEM_THIS block_cow;
+    BX_MEM_THIS block_cow = NULL;
+    delete [] BX_MEM_THIS slot_refs;
+    BX_MEM_THIS slot_refs = NULL;
+    delete [] BX_MEM_THIS free_slots;
+    BX_MEM_THIS free_slots = NULL;
+    BX_MEM_THIS num_free_slots = 0;
     if (BX_MEM_THIS memory_handlers != NULL) {
       for (idx = 0; idx < BX_MEM_HANDLERS; idx++) {
         struct memory_handler_struct *memory_handler = BX_MEM_THIS memory_handlers[idx];
@@ -369,6 +1559,12 @@ void BX_MEM_C::cleanup_memory()
       delete [] BX_MEM_THIS memory_handlers;
       BX_MEM_THIS memory_handlers = NULL;
     }
+    if (BX_MEM_THIS memory_page_handlers != NULL) {
+      for (idx = 0; idx < BX_MEM_HANDLERS; idx++)
+        delete [] BX_MEM_THIS memory_page_handlers[idx];
+      delete [] BX_MEM_THIS memory_page_handlers;
+      BX_MEM_THIS memory_page_handlers = NULL;
+    }
   }
 }
 
@@ -561,7 +1757,10 @@ void BX_MEM_C::load_RAM(const char *path, bx_phy_address ramaddress)
 
   offset = (unsigned long)ramaddress;
   while (size > 0) {
-    ret = read(fd, (bx_ptr_t) BX_MEM_THIS get_vector(offset), size);
+    // the host memory blocks are not contiguous, read one block at a time
+    unsigned long chunk = BX_MEM_BLOCK_LEN - (offset & (BX_MEM_BLOCK_LEN-1));
+    if (chunk > size) chunk = size;
+    ret = read(fd, (bx_ptr_t) BX_MEM_THIS get_writable_vector(offset), chunk);
     if (ret <= 0) {
       BX_PANIC(("RAM: read failed on RAM image: '%s'",path));
     }
@@ -593,17 +1792,9 @@ bool BX_MEM_C::dbg_fetch_mem(BX_CPU_C *cpu, bx_phy_address addr, unsigned len, B
       use_smram = 1;
   }
 
-  memory_handler = BX_MEM_THIS memory_handlers[a20addr >> 20];
-  while (memory_handler) {
-    if (memory_handler->begin <= a20addr && memory_handler->end >= a20addr)
-    {
-      if (!use_smram) {
-        use_memory_handler = 1;
-        break;
-      }
-    }
-    memory_handler = memory_handler->next;
-  }
+  memory_handler = BX_MEM_THIS get_memory_handler(a20addr);
+  if (memory_handler && !use_smram)
+    use_memory_handler = 1;
 
   for (; len>0; len--) {
     if (use_memory_handler) {
@@ -692,17 +1883,9 @@ bool BX_MEM_C::dbg_set_mem(BX_CPU_C *cpu, bx_phy_address addr, unsigned len, Bit
       use_smram = 1;
   }
 
-  memory_handler = BX_MEM_THIS memory_handlers[a20addr >> 20];
-  while (memory_handler) {
-    if (memory_handler->begin <= a20addr && memory_handler->end >= a20addr)
-    {
-      if (!use_smram) {
-        use_memory_handler = 1;
-        break;
-      }
-    }
-    memory_handler = memory_handler->next;
-  }
+  memory_handler = BX_MEM_THIS get_memory_handler(a20addr);
+  if (memory_handler && !use_smram)
+    use_memory_handler = 1;
 
   for (; len>0; len--) {
     if (use_memory_handler) {
@@ -714,7 +1897,8 @@ bool BX_MEM_C::dbg_set_mem(BX_CPU_C *cpu, bx_phy_address addr, unsigned len, Bit
       if (area > BX_MEM_AREA_F0000) area = BX_MEM_AREA_F0000;
       if (BX_MEM_THIS memory_type[area][1] == 1) {
         // Write to ShadowRAM
-        *(BX_MEM_THIS get_vector(a20addr)) = *buf;
+        *(BX_MEM_THIS get_writable_vector(a20addr)) = *buf;
+        pageWriteStampTable.decWriteStamp(a20addr, 1);
       } else {
         // Ignore write to ROM
       }
@@ -722,7 +1906,8 @@ bool BX_MEM_C::dbg_set_mem(BX_CPU_C *cpu, bx_phy_address addr, unsigned len, Bit
 #endif  // #if BX_SUPPORT_PCI
     else if ((a20addr < 0x000c0000 || a20addr >= 0x00100000) && !is_bios)
     {
-      *(BX_MEM_THIS get_vector(a20addr)) = *buf;
+      *(BX_MEM_THIS get_writable_vector(a20addr)) = *buf;
+      pageWriteStampTable.decWriteStamp(a20addr, 1);
     }
     buf++;
     a20addr++;
@@ -804,16 +1989,12 @@ Bit8u *BX_MEM_C::getHostMemAddr(BX_CPU_C *cpu, bx_phy_address addr, unsigned rw)
   }
 #endif
 
-  struct memory_handler_struct *memory_handler = BX_MEM_THIS memory_handlers[a20addr >> 20];
-  while (memory_handler) {
-    if (memory_handler->begin <= a20addr &&
-        memory_handler->end >= a20addr) {
-      if (memory_handler->da_handler)
-        return memory_handler->da_handler(a20addr, rw, memory_handler->param);
-      else
-        return(NULL); // Vetoed! memory handler for i/o apic, vram, mmio and PCI PnP
-    }
-    memory_handler = memory_handler->next;
+  struct memory_handler_struct *memory_handler = BX_MEM_THIS get_memory_handler(a20addr);
+  if (memory_handler) {
+    if (memory_handler->da_handler)
+      return memory_handler->da_handler(a20addr, rw, memory_handler->param);
+    else
+      return(NULL); // Vetoed! memory handler for i/o apic, vram, mmio and PCI PnP
   }
 
   if (! write) {
@@ -885,7 +2066,7 @@ Bit8u *BX_MEM_C::getHostMemAddr(BX_CPU_C *cpu, bx_phy_address addr, unsigned rw)
     else
     {
       if (a20addr < 0x000c0000 || a20addr >= 0x00100000) {
-        return BX_MEM_THIS get_vector(a20addr);
+        return BX_MEM_THIS get_writable_vector(a20addr);
       }
       else {
         return(NULL);  // Vetoed!  ROMs
@@ -933,6 +2114,7 @@ BX_MEM_C::registerMemoryHandlers(void *param, memory_handler_t read_handler,
     memory_handler->begin = begin_addr;
     memory_handler->end = end_addr;
     memory_handler->bitmap = bitmap;
+    update_page_handlers(page_idx);
   }
   return 1;
 }
@@ -970,10 +2152,37 @@ BX_MEM_C::unregisterMemoryHandlers(void *param, bx_phy_address begin_addr, bx_ph
     else
       BX_MEM_THIS memory_handlers[page_idx] = memory_handler->next;
     delete memory_handler;
+    update_page_handlers(page_idx);
   }
   return ret;
 }
 
+// Rebuild the 4K page dispatch table of one megabyte from its handler list.
+// Handlers never overlap, so at most one of them claims each page. The table
+// is kept once allocated: the lookup may read it before taking the SMP lock.
+void BX_MEM_C::update_page_handlers(Bit32u mb_idx)
+{
+  struct memory_handler_struct **page_handlers = BX_MEM_THIS memory_page_handlers[mb_idx];
+
+  if (page_handlers == NULL) {
+    if (BX_MEM_THIS memory_handlers[mb_idx] == NULL)
+      return;
+    page_handlers = new struct memory_handler_struct *[256];
+    BX_MEM_THIS memory_page_handlers[mb_idx] = page_handlers;
+  }
+  for (Bit32u page = 0; page < 256; page++) {
+    bx_phy_address page_start = ((bx_phy_address)mb_idx << 20) | (page << 12);
+    bx_phy_address page_end = page_start + 0xfff;
+    struct memory_handler_struct *memory_handler = BX_MEM_THIS memory_handlers[mb_idx];
+    while (memory_handler) {
+      if (memory_handler->begin <= page_end && memory_handler->end >= page_start)
+        break;
+      memory_handler = memory_handler->next;
+    }
+    page_handlers[page] = memory_handler;
+  }
+}
+
 void BX_MEM_C::enable_smram(bool enable, bool restricted)
 {
   BX_MEM_THIS smram_available = 1;
@@ -1122,6 +2331,8 @@ bool BX_MEM_C::is_monitor(bx_phy_address begin_addr, unsigned len)
 
 void BX_MEM_C::check_monitor(bx_phy_address begin_addr, unsigned len)
 {
+  // the monitors are armed by the CPU threads in parallel SMP mode
+  BX_SMP_GUARD();
   for (int i=0; i<BX_SMP_PROCESSORS;i++) {
     BX_CPU(i)->check_monitor(begin_addr, len);
   }
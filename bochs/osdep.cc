@@ -370,3 +370,170 @@ Bit64u bx_get_realtime64_usec(void)
 }
 #endif
 #endif
+
+// Parse a list of ids like "0-3,8,10" into ids[]. Returns the number
+// of ids stored, or -1 if the list is malformed.
+int bx_parse_id_list(const char *list, int *ids, int max_ids)
+{
+  int count = 0;
+  const char *p = list;
+
+  while (*p != 0) {
+    char *end;
+    long first = strtol(p, &end, 10);
+    if ((end == p) || (first < 0)) return -1;
+    long last = first;
+    p = end;
+    if (*p == '-') {
+      p++;
+      last = strtol(p, &end, 10);
+      if ((end == p) || (last < first)) return -1;
+      p = end;
+    }
+    for (long id = first; id <= last; id++) {
+      if (count >= max_ids) return -1;
+      ids[count++] = (int) id;
+    }
+    while (isspace((unsigned char) *p)) p++;
+    if (*p == ',') p++;
+    else if ((*p != 0) && (*p != '\n')) return -1;
+    else break;
+  }
+  return count;
+}
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sched.h>
+#endif
+
+#if defined(__linux__) && defined(SYS_mbind) && defined(SYS_move_pages)
+
+#define BX_MPOL_BIND       2
+#define BX_MPOL_INTERLEAVE 3
+#define BX_MPOL_MF_MOVE    (1 << 1)
+
+Bit64u bx_numa_online_nodes(void)
+{
+  char buf[256];
+  int ids[BX_NUMA_MAX_NODES];
+  Bit64u mask = 0;
+
+  FILE *fp = fopen("/sys/devices/system/node/online", "r");
+  if (fp == NULL) return 0;
+  if (fgets(buf, sizeof(buf), fp) == NULL) buf[0] = 0;
+  fclose(fp);
+  int n = bx_parse_id_list(buf, ids, BX_NUMA_MAX_NODES);
+  for (int i = 0; i < n; i++) {
+    if (ids[i] < BX_NUMA_MAX_NODES)
+      mask |= BX_CONST64(1) << ids[i];
+  }
+  return mask;
+}
+
+int bx_numa_node_of_cpu(int cpu)
+{
+  char path[128];
+  struct stat st;
+
+  for (int node = 0; node < BX_NUMA_MAX_NODES; node++) {
+    sprintf(path, "/sys/devices/system/node/node%d/cpu%d", node, cpu);
+    if (stat(path, &st) == 0) return node;
+  }
+  return -1;
+}
+
+int bx_numa_bind(const void *addr, Bit64u len, Bit64u nodemask, int interleave)
+{
+  unsigned long mask[2];
+  Bit64u pgsize = (Bit64u) sysconf(_SC_PAGESIZE);
+  Bit64u start = ((Bit64u)(bx_ptr_equiv_t) addr + pgsize - 1) & ~(pgsize - 1);
+  Bit64u end = ((Bit64u)(bx_ptr_equiv_t) addr + len) & ~(pgsize - 1);
+
+  if (end <= start) return 0;
+  memset(mask, 0, sizeof(mask));
+  memcpy(mask, &nodemask, sizeof(nodemask));
+  return syscall(SYS_mbind, (void *)(bx_ptr_equiv_t) start, (unsigned long)(end - start),
+                 interleave ? BX_MPOL_INTERLEAVE : BX_MPOL_BIND, mask,
+                 (unsigned long) BX_NUMA_MAX_NODES + 1, BX_MPOL_MF_MOVE) == 0;
+}
+
+// Count the bytes of [addr, addr+len) resident on each node. Pages not
+// yet touched by the host are not counted.
+int bx_numa_page_nodes(const void *addr, Bit64u len, Bit64u *bytes)
+{
+  enum { CHUNK = 1024 };
+  void *pages[CHUNK];
+  int status[CHUNK];
+  Bit64u pgsize = (Bit64u) sysconf(_SC_PAGESIZE);
+  Bit64u start = ((Bit64u)(bx_ptr_equiv_t) addr + pgsize - 1) & ~(pgsize - 1);
+  Bit64u end = ((Bit64u)(bx_ptr_equiv_t) addr + len) & ~(pgsize - 1);
+
+  memset(bytes, 0, BX_NUMA_MAX_NODES * sizeof(Bit64u));
+  while (start < end) {
+    unsigned n = 0;
+    for (; (n < CHUNK) && (start < end); n++, start += pgsize)
+      pages[n] = (void *)(bx_ptr_equiv_t) start;
+    if (syscall(SYS_move_pages, 0, (unsigned long) n, pages, NULL, status, 0) != 0)
+      return 0;
+    for (unsigned i = 0; i < n; i++) {
+      if ((status[i] >= 0) && (status[i] < BX_NUMA_MAX_NODES))
+        bytes[status[i]] += pgsize;
+    }
+  }
+  return 1;
+}
+
+// Host wide allocation counters of a node: pages allocated on the node
+// for tasks running on it (local) and for tasks running elsewhere (remote).
+int bx_numa_node_stat(int node, Bit64u *local, Bit64u *remote)
+{
+  char path[128], name[64];
+  unsigned long long value;
+  int found = 0;
+
+  sprintf(path, "/sys/devices/system/node/node%d/numastat", node);
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) return 0;
+  *local = *remote = 0;
+  while (fscanf(fp, "%63s %llu", name, &value) == 2) {
+    if (!strcmp(name, "local_node")) {
+      *local = value;
+      found = 1;
+    } else if (!strcmp(name, "other_node")) {
+      *remote = value;
+    }
+  }
+  fclose(fp);
+  return found;
+}
+
+int bx_set_thread_affinity(int cpu)
+{
+  cpu_set_t set;
+
+  if ((cpu < 0) || (cpu >= CPU_SETSIZE)) return 0;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+#else
+
+Bit64u bx_numa_online_nodes(void) { return 0; }
+int bx_numa_node_of_cpu(int cpu) { return -1; }
+int bx_numa_bind(const void *addr, Bit64u len, Bit64u nodemask, int interleave) { return 0; }
+int bx_numa_page_nodes(const void *addr, Bit64u len, Bit64u *bytes) { return 0; }
+int bx_numa_node_stat(int node, Bit64u *local, Bit64u *remote) { return 0; }
+
+int bx_set_thread_affinity(int cpu)
+{
+#if defined(WIN32)
+  if ((cpu < 0) || (cpu >= (int)(8 * sizeof(DWORD_PTR)))) return 0;
+  return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << cpu) != 0;
+#else
+  return 0;
+#endif
+}
+
+#endif
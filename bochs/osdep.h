@@ -348,6 +348,18 @@ BX_CPP_INLINE void bx_ppc_store_le64(Bit64u *p, Bit64u v)
 BOCHSAPI_MSVCONLY extern Bit64u bx_get_realtime64_usec (void);
 #endif
 
+// NUMA placement helpers. Nodes are passed as a bitmask, so only the
+// first BX_NUMA_MAX_NODES host nodes can be addressed. On hosts without
+// NUMA support these report a single node and do nothing.
+#define BX_NUMA_MAX_NODES 64
+BOCHSAPI_MSVCONLY extern int bx_parse_id_list(const char *list, int *ids, int max_ids);
+BOCHSAPI_MSVCONLY extern Bit64u bx_numa_online_nodes(void);
+BOCHSAPI_MSVCONLY extern int bx_numa_node_of_cpu(int cpu);
+BOCHSAPI_MSVCONLY extern int bx_numa_bind(const void *addr, Bit64u len, Bit64u nodemask, int interleave);
+BOCHSAPI_MSVCONLY extern int bx_numa_page_nodes(const void *addr, Bit64u len, Bit64u *bytes);
+BOCHSAPI_MSVCONLY extern int bx_numa_node_stat(int node, Bit64u *local, Bit64u *remote);
+BOCHSAPI_MSVCONLY extern int bx_set_thread_affinity(int cpu);
+
 #ifdef WIN32
 #undef BX_HAVE_MSLEEP
 #define BX_HAVE_MSLEEP 1
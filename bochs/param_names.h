@@ -41,9 +41,17 @@
 #define BXPN_CPU_MODEL                   "cpu.model"
 #define BXPN_IPS                         "cpu.ips"
 #define BXPN_SMP_QUANTUM                 "cpu.quantum"
+#define BXPN_SMP_PARALLEL                "cpu.parallel"
+#define BXPN_SMP_SKEW                    "cpu.skew"
+#define BXPN_CPU_DTLB_SIZE               "cpu.dtlb_size"
+#define BXPN_CPU_ITLB_SIZE               "cpu.itlb_size"
+#define BXPN_CPU_STLB_SIZE               "cpu.stlb_size"
+#define BXPN_CPU_LARGE_TLB_SIZE          "cpu.large_tlb_size"
 #define BXPN_RESET_ON_TRIPLE_FAULT       "cpu.reset_on_triple_fault"
 #define BXPN_IGNORE_BAD_MSRS             "cpu.ignore_bad_msrs"
 #define BXPN_CONFIGURABLE_MSRS_PATH      "cpu.msrs"
+#define BXPN_CPU_TRACE_CACHE             "cpu.trace_cache"
+#define BXPN_CPU_AFFINITY                "cpu.affinity"
 #define BXPN_CPUID_LIMIT_WINNT           "cpu.cpuid_limit_winnt"
 #define BXPN_MWAIT_IS_NOP                "cpu.mwait_is_nop"
 #define BXPN_VENDOR_STRING               "cpuid.vendor_string"
@@ -81,6 +89,15 @@
 #define BXPN_CPUID_SMAP                  "cpuid.smap"
 #define BXPN_MEM_SIZE                    "memory.standard.ram.size"
 #define BXPN_HOST_MEM_SIZE               "memory.standard.ram.host_size"
+#define BXPN_MEM_BACKING                 "memory.standard.ram.backing"
+#define BXPN_MEM_BACKING_FILE            "memory.standard.ram.file"
+#define BXPN_MEM_HUGE_PAGES              "memory.standard.ram.huge_pages"
+#define BXPN_MEM_INCREMENTAL_SAVE        "memory.standard.ram.incremental_save"
+#define BXPN_MEM_DEDUP                   "memory.standard.ram.dedup"
+#define BXPN_MEM_COMPRESSED_SIZE         "memory.standard.ram.compressed"
+#define BXPN_MEM_LAZY_RESTORE            "memory.standard.ram.lazy_restore"
+#define BXPN_MEM_NUMA                    "memory.standard.ram.numa"
+#define BXPN_MEM_NUMA_NODES              "memory.standard.ram.numa_nodes"
 #define BXPN_ROMIMAGE                    "memory.standard.rom"
 #define BXPN_ROM_PATH                    "memory.standard.rom.file"
 #define BXPN_ROM_ADDRESS                 "memory.standard.rom.address"
@@ -100,6 +117,8 @@
 #define BXPN_PCI_ADV_OPTS                "pci.advopts"
 #define BXPN_PCIDEV_VENDOR               "pci.pcidev.vendor"
 #define BXPN_PCIDEV_DEVICE               "pci.pcidev.device"
+#define BXPN_VIRTIO_BLK                  "pci.virtio_blk"
+#define BXPN_AHCI                        "pci.ahci"
 #define BXPN_SEL_DISPLAY_LIBRARY         "display.display_library"
 #define BXPN_DISPLAYLIB_OPTIONS          "display.displaylib_options"
 #define BXPN_PRIVATE_COLORMAP            "display.private_colormap"
@@ -173,6 +192,11 @@
 #define BXPN_SOUND_ES1370                "sound.es1370"
 #define BXPN_PORT_E9_HACK                "misc.port_e9_hack"
 #define BXPN_GDBSTUB                     "misc.gdbstub"
+#define BXPN_CLONE                       "misc.clone"
+#define BXPN_CLONE_COUNT                 "misc.clone.count"
+#define BXPN_DISK_CACHE                  "misc.disk_cache"
+#define BXPN_DISK_CACHE_SIZE             "misc.disk_cache.size"
+#define BXPN_DISK_CACHE_READAHEAD        "misc.disk_cache.readahead"
 #define BXPN_LOG_FILENAME                "log.filename"
 #define BXPN_LOG_PREFIX                  "log.prefix"
 #define BXPN_DEBUGGER_LOG_FILENAME       "log.debugger_filename"
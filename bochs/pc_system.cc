@@ -55,12 +55,18 @@ bx_pc_system_c::bx_pc_system_c()
   timer[0].funct      = nullTimer;
   timer[0].this_ptr   = this;
   numTimers = 1; // So far, only the nullTimer.
+
+  for (unsigned i = 0; i < BX_MAX_TIMERS; i++)
+    timer[i].heapPos = -1;
+  timerHeapSize = 0;
+  timerHeapInsert(0);
 }
 
 void bx_pc_system_c::initialize(Bit32u ips)
 {
   ticksTotal = 0;
   timer[0].timeToFire = NullTimerInterval;
+  timerHeapUpdate(0);
   currCountdown       = NullTimerInterval;
   currCountdownPeriod = NullTimerInterval;
   lastTimeUsec = 0;
@@ -171,16 +177,23 @@ bool bx_pc_system_c::get_enable_a20(void)
 #endif
 }
 
+// The TLBs of the other CPUs can't be changed while they are running in
+// parallel SMP mode, stop them first.
+
 void bx_pc_system_c::MemoryMappingChanged(void)
 {
+  BX_SMP_STOP_WORLD();
   for (unsigned i=0; i<BX_SMP_PROCESSORS; i++)
     BX_CPU(i)->TLB_flush();
+  BX_SMP_RESUME_WORLD();
 }
 
 void bx_pc_system_c::invlpg(bx_address addr)
 {
+  BX_SMP_STOP_WORLD();
   for (unsigned i=0; i<BX_SMP_PROCESSORS; i++)
     BX_CPU(i)->TLB_invlpg(addr);
+  BX_SMP_RESUME_WORLD();
 }
 
 int bx_pc_system_c::Reset(unsigned type)
@@ -188,6 +201,8 @@ int bx_pc_system_c::Reset(unsigned type)
   // type is BX_RESET_HARDWARE or BX_RESET_SOFTWARE
   BX_INFO(("bx_pc_system_c::Reset(%s) called",type==BX_RESET_HARDWARE?"HARDWARE":"SOFTWARE"));
 
+  BX_SMP_STOP_WORLD();
+
   set_enable_a20(1);
 
   // Always reset cpu
@@ -200,6 +215,8 @@ int bx_pc_system_c::Reset(unsigned type)
     DEV_reset_devices(type);
   }
 
+  BX_SMP_RESUME_WORLD();
+
   return(0);
 }
 
@@ -212,6 +229,7 @@ void bx_pc_system_c::exit(void)
 {
   // delete all registered timers (exception: null timer and APIC timer)
   numTimers = 1 + BX_SUPPORT_APIC;
+  timerHeapRebuild();
   bx_devices.exit();
   if (bx_gui) {
     bx_gui->cleanup();
@@ -245,6 +263,12 @@ void bx_pc_system_c::register_state(void)
   }
 }
 
+void bx_pc_system_c::after_restore_state(void)
+{
+  // the timer queue is not part of the saved state
+  timerHeapRebuild();
+}
+
 // ================================================
 // Bochs internal timer delivery framework features
 // ================================================
@@ -300,6 +324,7 @@ int bx_pc_system_c::register_timer_ticks(void* this_ptr, bx_timer_handler_t func
   timer[i].param      = 0;
 
   if (active) {
+    timerHeapInsert(i);
     if (ticks < Bit64u(currCountdown)) {
       // This new timer needs to fire before the current countdown.
       // Skew the current countdown and countdown period to be smaller
@@ -320,9 +345,8 @@ int bx_pc_system_c::register_timer_ticks(void* this_ptr, bx_timer_handler_t func
 
 void bx_pc_system_c::countdownEvent(void)
 {
-  unsigned i, first = numTimers, last = 0;
-  Bit64u   minTimeToFire;
-  bool  triggered[BX_MAX_TIMERS];
+  unsigned i, numTriggered = 0;
+  unsigned triggered[BX_MAX_TIMERS];
 
   // The countdown decremented to 0.  We need to service all the active
   // timers, and invoke callbacks from those timers which have fired.
@@ -334,36 +358,27 @@ void bx_pc_system_c::countdownEvent(void)
   // Increment global ticks counter by number of ticks which have
   // elapsed since the last update.
   ticksTotal += Bit64u(currCountdownPeriod);
-  minTimeToFire = (Bit64u) -1;
 
-  for (i = 0; i < numTimers; i++) {
-    triggered[i] = 0; // Reset triggered flag.
-    if (timer[i].active) {
+  // The expired timers are at the top of the queue. They are taken in
+  // order of timer index, rescheduled continuous timers go behind them.
+  while (timer[timerHeap[0]].timeToFire <= ticksTotal) {
+    i = timerHeap[0];
 #if BX_TIMER_DEBUG
-      if (ticksTotal > timer[i].timeToFire)
-        BX_PANIC(("countdownEvent: ticksTotal > timeToFire[%u], D " FMT_LL "u", i,
-                  timer[i].timeToFire-ticksTotal));
+    if (ticksTotal > timer[i].timeToFire)
+      BX_PANIC(("countdownEvent: ticksTotal > timeToFire[%u], D " FMT_LL "u", i,
+                timer[i].timeToFire-ticksTotal));
 #endif
-      if (ticksTotal == timer[i].timeToFire) {
-        // This timer is ready to fire.
-        triggered[i] = 1;
-
-        if (timer[i].continuous==0) {
-          // If triggered timer is one-shot, deactive.
-          timer[i].active = 0;
-        } else {
-          // Continuous timer, increment time-to-fire by period.
-          timer[i].timeToFire += timer[i].period;
-          if (timer[i].timeToFire < minTimeToFire)
-            minTimeToFire = timer[i].timeToFire;
-        }
-        if (i < first) first = i;
-        last = i;
-      } else {
-        // This timer is not ready to fire yet.
-        if (timer[i].timeToFire < minTimeToFire)
-          minTimeToFire = timer[i].timeToFire;
-      }
+    // This timer is ready to fire.
+    triggered[numTriggered++] = i;
+
+    if (timer[i].continuous==0) {
+      // If triggered timer is one-shot, deactive.
+      timer[i].active = 0;
+      timerHeapRemove(i);
+    } else {
+      // Continuous timer, increment time-to-fire by period.
+      timer[i].timeToFire += timer[i].period;
+      timerHeapSiftDown(0);
     }
   }
 
@@ -371,12 +386,13 @@ void bx_pc_system_c::countdownEvent(void)
   // any of the callbacks, as they may call timer features, which need
   // to be advanced to the next countdown cycle.
   currCountdown = currCountdownPeriod =
-      Bit32u(minTimeToFire - ticksTotal);
+      Bit32u(timer[timerHeap[0]].timeToFire - ticksTotal);
 
-  for (i = first; i <= last; i++) {
+  for (unsigned n = 0; n < numTriggered; n++) {
+    i = triggered[n];
     // Call requested timer function.  It may request a different
     // timer period or deactivate etc.
-    if (triggered[i] && (timer[i].funct != NULL)) {
+    if (timer[i].funct != NULL) {
       triggeredTimer = i;
       timer[i].funct(timer[i].this_ptr);
       triggeredTimer = 0;
@@ -384,6 +400,91 @@ void bx_pc_system_c::countdownEvent(void)
   }
 }
 
+// ==================================
+// Timer queue (binary min-heap)
+// ==================================
+
+void bx_pc_system_c::timerHeapSiftUp(unsigned pos)
+{
+  unsigned i = timerHeap[pos];
+
+  while (pos > 0) {
+    unsigned parent = (pos - 1) >> 1;
+    if (! timerBefore(i, timerHeap[parent])) break;
+    timerHeap[pos] = timerHeap[parent];
+    timer[timerHeap[pos]].heapPos = pos;
+    pos = parent;
+  }
+  timerHeap[pos] = i;
+  timer[i].heapPos = pos;
+}
+
+void bx_pc_system_c::timerHeapSiftDown(unsigned pos)
+{
+  unsigned i = timerHeap[pos];
+
+  while (1) {
+    unsigned child = 2*pos + 1;
+    if (child >= timerHeapSize) break;
+    if (child + 1 < timerHeapSize && timerBefore(timerHeap[child+1], timerHeap[child]))
+      child++;
+    if (! timerBefore(timerHeap[child], i)) break;
+    timerHeap[pos] = timerHeap[child];
+    timer[timerHeap[pos]].heapPos = pos;
+    pos = child;
+  }
+  timerHeap[pos] = i;
+  timer[i].heapPos = pos;
+}
+
+void bx_pc_system_c::timerHeapInsert(unsigned i)
+{
+  timerHeap[timerHeapSize] = i;
+  timerHeapSiftUp(timerHeapSize++);
+}
+
+void bx_pc_system_c::timerHeapRemove(unsigned i)
+{
+  int pos = timer[i].heapPos;
+  if (pos < 0) return; // not queued
+
+  timer[i].heapPos = -1;
+  if ((unsigned) pos == --timerHeapSize) return;
+
+  // move the last element into the hole and restore the heap order
+  unsigned last = timerHeap[timerHeapSize];
+  timerHeap[pos] = last;
+  timerHeapSiftUp(pos);
+  if (timer[last].heapPos == pos)
+    timerHeapSiftDown(pos);
+}
+
+// requeue timer after its time to fire was changed
+void bx_pc_system_c::timerHeapUpdate(unsigned i)
+{
+  int pos = timer[i].heapPos;
+  if (pos < 0) {
+    timerHeapInsert(i);
+  }
+  else {
+    timerHeapSiftUp(pos);
+    timerHeapSiftDown(timer[i].heapPos);
+  }
+}
+
+void bx_pc_system_c::timerHeapRebuild(void)
+{
+  unsigned i;
+
+  for (i = 0; i < BX_MAX_TIMERS; i++)
+    timer[i].heapPos = -1;
+  timerHeapSize = 0;
+  for (i = 0; i < numTimers; i++) {
+    if (timer[i].inUse && timer[i].active)
+      timerHeapInsert(i);
+  }
+}
+
 void bx_pc_system_c::nullTimer(void* this_ptr)
 {
   // This function is always inserted in timer[0].  It is sort of
@@ -494,6 +595,7 @@ void bx_pc_system_c::activate_timer_ticks(unsigned i, Bit64u ticks, bool continu
   timer[i].timeToFire = (ticksTotal + Bit64u(currCountdownPeriod-currCountdown)) + ticks;
   timer[i].active     = 1;
   timer[i].continuous = continuous;
+  timerHeapUpdate(i);
 
   if (ticks < Bit64u(currCountdown)) {
     // This new timer needs to fire before the current countdown.
@@ -569,6 +671,7 @@ void bx_pc_system_c::deactivate_timer(unsigned i)
 #endif
 
   timer[i].active = 0;
+  timerHeapRemove(i);
 }
 
 bool bx_pc_system_c::unregisterTimer(unsigned timerIndex)
@@ -23,7 +23,7 @@
 #ifndef BX_PCSYS_H
 #define BX_PCSYS_H
 
-#define BX_MAX_TIMERS 64
+#define BX_MAX_TIMERS 512
 #define BX_NULL_TIMER_HANDLE 10000
 
 typedef void (*bx_timer_handler_t)(void *);
@@ -54,8 +54,15 @@ private:
 #define BxMaxTimerIDLen 32
     char id[BxMaxTimerIDLen];  // String ID of timer.
     Bit32u param;              // Device-specific value assigned to timer (optional)
+    int heapPos;               // Position in the timer queue, -1 if inactive.
   } timer[BX_MAX_TIMERS];
 
+  // The active timers are kept in a binary min-heap ordered by time to fire
+  // (and by timer index for timers firing at the same tick), so the next
+  // expiring timer is always found at timerHeap[0].
+  unsigned   timerHeap[BX_MAX_TIMERS];
+  unsigned   timerHeapSize;
+
   unsigned   numTimers;  // Number of currently allocated timers.
   unsigned   triggeredTimer;  // ID of the actually triggered timer.
   Bit32u     currCountdown; // Current countdown ticks value (decrements to 0).
@@ -82,6 +89,17 @@ private:
   // ticks finds that an event has occurred.
   void   countdownEvent(void);
 
+  BX_CPP_INLINE bool timerBefore(unsigned a, unsigned b) const {
+    return (timer[a].timeToFire < timer[b].timeToFire) ||
+           (timer[a].timeToFire == timer[b].timeToFire && a < b);
+  }
+  void   timerHeapSiftUp(unsigned pos);
+  void   timerHeapSiftDown(unsigned pos);
+  void   timerHeapInsert(unsigned i);
+  void   timerHeapRemove(unsigned i);
+  void   timerHeapUpdate(unsigned i);
+  void   timerHeapRebuild(void);
+
 public:
 
   // ==============================
@@ -186,6 +204,7 @@ public:
   void    invlpg(bx_address addr);    // flush TLB page in all CPUs
   void    exit(void);
   void    register_state(void);
+  void    after_restore_state(void);
 };
 
 #define BX_TICK1()                  bx_pc_system.tick1()
@@ -952,6 +952,22 @@ void bx_plugins_after_restore_state()
   }
 }
 
+/**************************************************************************/
+/* Plugin system: Execute code after the simulation has been cloned       */
+/**************************************************************************/
+
+void bx_plugins_after_clone(unsigned clone_id)
+{
+  device_t *device;
+
+  for (device = core_devices; device; device = device->next) {
+    device->devmodel->after_clone(clone_id);
+  }
+  for (device = devices; device; device = device->next) {
+    device->devmodel->after_clone(clone_id);
+  }
+}
+
 #if !BX_PLUGINS
 
 // Special code for handling modules when plugin support is turned off.
@@ -1047,6 +1063,12 @@ plugin_t bx_builtin_plugins[] = {
 #if BX_SUPPORT_PCIPNIC
   BUILTIN_OPTPCI_PLUGIN_ENTRY(pcipnic),
 #endif
+#if BX_SUPPORT_VIRTIO_BLK
+  BUILTIN_OPTPCI_PLUGIN_ENTRY(virtio_blk),
+#endif
+#if BX_SUPPORT_AHCI
+  BUILTIN_OPTPCI_PLUGIN_ENTRY(ahci),
+#endif
 #if BX_SUPPORT_SB16
   BUILTIN_OPT_PLUGIN_ENTRY(sb16),
 #endif
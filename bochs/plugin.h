@@ -68,6 +68,8 @@ extern "C" {
 #define BX_PLUGIN_USB_XHCI  "usb_xhci"
 #define BX_PLUGIN_PCIPNIC   "pcipnic"
 #define BX_PLUGIN_E1000     "e1000"
+#define BX_PLUGIN_VIRTIO_BLK "virtio_blk"
+#define BX_PLUGIN_AHCI      "ahci"
 #define BX_PLUGIN_GAMEPORT  "gameport"
 #define BX_PLUGIN_SPEAKER   "speaker"
 #define BX_PLUGIN_ACPI      "acpi"
@@ -141,6 +143,7 @@ extern "C" {
 #define DEV_reset_devices(type) {bx_devices.reset(type); }
 #define DEV_register_state() {bx_devices.register_state(); }
 #define DEV_after_restore_state() {bx_devices.after_restore_state(); }
+#define DEV_after_clone(a) {bx_devices.after_clone(a); }
 #define DEV_register_timer(a,b,c,d,e,f) bx_pc_system.register_timer(a,b,c,d,e,f)
 
 ///////// Removable devices macros
@@ -181,7 +184,7 @@ extern "C" {
 #define DEV_hd_write_handler(a, b, c, d) \
     (bx_devices.pluginHardDrive->virt_write_handler(b, c, d))
 #define DEV_hd_bmdma_read_sector(a,b,c) bx_devices.pluginHardDrive->bmdma_read_sector(a,b,c)
-#define DEV_hd_bmdma_write_sector(a,b) bx_devices.pluginHardDrive->bmdma_write_sector(a,b)
+#define DEV_hd_bmdma_write_sector(a,b,c) bx_devices.pluginHardDrive->bmdma_write_sector(a,b,c)
 #define DEV_hd_bmdma_complete(a) bx_devices.pluginHardDrive->bmdma_complete(a)
 
 #define DEV_bulk_io_quantum_requested() (bx_devices.bulkIOQuantumsRequested)
@@ -348,6 +351,7 @@ extern void bx_reset_plugins(unsigned);
 extern void bx_unload_plugins(void);
 extern void bx_plugins_register_state(void);
 extern void bx_plugins_after_restore_state(void);
+extern void bx_plugins_after_clone(unsigned clone_id);
 
 #if !BX_PLUGINS
 extern plugin_t bx_builtin_plugins[];
@@ -422,6 +426,8 @@ PLUGIN_ENTRY_FOR_MODULE(pci);
 PLUGIN_ENTRY_FOR_MODULE(pci2isa);
 PLUGIN_ENTRY_FOR_MODULE(pci_ide);
 PLUGIN_ENTRY_FOR_MODULE(pcidev);
+PLUGIN_ENTRY_FOR_MODULE(virtio_blk);
+PLUGIN_ENTRY_FOR_MODULE(ahci);
 PLUGIN_ENTRY_FOR_MODULE(usb_uhci);
 PLUGIN_ENTRY_FOR_MODULE(usb_ohci);
 PLUGIN_ENTRY_FOR_MODULE(usb_ehci);
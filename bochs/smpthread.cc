@@ -0,0 +1,637 @@
+/////////////////////////////////////////////////////////////////////////
+// $Id$
+/////////////////////////////////////////////////////////////////////////
+//
+//  Copyright (C) 2021  The Bochs Project
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+/////////////////////////////////////////////////////////////////////////
+
+#include "bochs.h"
+#include "bxthread.h"
+#include "param_names.h"
+#include "cpu/cpu.h"
+#include "iodev/iodev.h"
+
+#define LOG_THIS genlog->
+
+// longest host CPU list accepted by the affinity option
+#define BX_MAX_AFFINITY_CPUS 1024
+
+// host CPU every simulated CPU is pinned to, NULL if not pinned
+static int *cpu_affinity = NULL;
+
+// In the parallel SMP simulation the CPU threads get the listed host CPUs
+// in turn, otherwise all the CPUs run in the simulator thread pinned to the
+// first one. The CPU structures are moved to the node of their host CPU.
+void bx_cpu_affinity_init(void)
+{
+  int ids[BX_MAX_AFFINITY_CPUS];
+  bool parallel = 0;
+
+  delete [] cpu_affinity;
+  cpu_affinity = NULL;
+  const char *list = SIM->get_param_string(BXPN_CPU_AFFINITY)->getptr();
+  if (*list == 0)
+    return;
+  int n = bx_parse_id_list(list, ids, BX_MAX_AFFINITY_CPUS);
+  if (n <= 0) {
+    BX_PANIC(("malformed CPU affinity list '%s'", list));
+    return;
+  }
+#if BX_SUPPORT_SMP && BX_DEBUGGER == 0
+  parallel = (BX_SMP_PROCESSORS > 1) && SIM->get_param_bool(BXPN_SMP_PARALLEL)->get();
+#if BX_GDBSTUB
+  if (bx_dbg.gdbstub_enabled) parallel = 0;
+#endif
+#endif
+  cpu_affinity = new int[BX_SMP_PROCESSORS];
+  for (unsigned i = 0; i < BX_SMP_PROCESSORS; i++) {
+    cpu_affinity[i] = parallel ? ids[i % n] : ids[0];
+    int node = bx_numa_node_of_cpu(cpu_affinity[i]);
+    if (node >= 0) {
+      BX_CPU(i)->bind_numa_node(node);
+      BX_INFO(("CPU%u: host CPU %d, NUMA node %d", i, cpu_affinity[i], node));
+    }
+    else {
+      BX_INFO(("CPU%u: host CPU %d", i, cpu_affinity[i]));
+    }
+  }
+  if (! parallel)
+    bx_cpu_affinity_apply(0);
+}
+
+void bx_cpu_affinity_apply(unsigned id)
+{
+  if ((cpu_affinity != NULL) && !bx_set_thread_affinity(cpu_affinity[id]))
+    BX_ERROR(("CPU%u: failed to pin to host CPU %d", id, cpu_affinity[id]));
+}
+
+#if BX_SUPPORT_SMP
+
+// Round-robin SMP simulation.
+//
+// All the CPUs are run one after another in the simulator thread. Every CPU
+// executes a slice of instructions (its quantum) before switching to the
+// next one. The quantum adapts to what the CPU is doing: it is doubled each
+// time the CPU runs through the whole slice and halved when the CPU hints
+// that it is waiting for another processor (PAUSE, MWAIT or sending an IPI),
+// so that spinning CPUs give up their time quickly while compute bound CPUs
+// are switched less often. A halted CPU is skipped until an event is
+// delivered to it and doesn't contribute to the system time; when all CPUs
+// are halted the time skips forward to the next timer event.
+
+struct bx_smp_rr_cpu_t {
+  Bit32u quantum;            // current slice length
+  bool   idle;               // halted, skipped until an event arrives
+  Bit32u idle_events;        // pending events when the CPU went idle
+#if BX_ENABLE_STATISTICS
+  Bit64u stat_slices;
+  Bit64u stat_instructions;
+  Bit64u stat_idle_skips;
+  Bit64u stat_yields;
+  Bit32u stat_quantum;
+#endif
+};
+
+static bx_smp_rr_cpu_t *rr_cpu = NULL;
+
+// preserved across longjmp from exception handlers
+static unsigned rr_processor;
+static Bit32u rr_executed, rr_ran;
+
+#if BX_ENABLE_STATISTICS
+static void smp_rr_init_statistics(void)
+{
+  bx_list_c *root = new bx_list_c(SIM->get_statistics_root(), "smp", "SMP scheduler statistics");
+
+  for (unsigned n=0; n<BX_SMP_PROCESSORS; n++) {
+    char name[16];
+    sprintf(name, "cpu%u", n);
+    bx_list_c *list = new bx_list_c(root, name, name);
+    new bx_shadow_num_c(list, "slices", &rr_cpu[n].stat_slices);
+    new bx_shadow_num_c(list, "instructions", &rr_cpu[n].stat_instructions);
+    new bx_shadow_num_c(list, "idleSkips", &rr_cpu[n].stat_idle_skips);
+    new bx_shadow_num_c(list, "yields", &rr_cpu[n].stat_yields);
+    new bx_shadow_num_c(list, "quantum", &rr_cpu[n].stat_quantum);
+  }
+}
+#endif
+
+// Returns true if the CPU could be skipped in this round: it is halted and
+// nothing was delivered to it since the last time it was run.
+static BX_CPP_INLINE bool smp_rr_skip(unsigned id)
+{
+  BX_CPU_C *cpu = BX_CPU(id);
+
+  return rr_cpu[id].idle && cpu->activity_state != BX_CPU_C::BX_ACTIVITY_STATE_ACTIVE &&
+         cpu->pending_event == rr_cpu[id].idle_events && !BX_HRQ;
+}
+
+void bx_smp_run_round_robin(void)
+{
+  Bit32u min_quantum = SIM->get_param_num(BXPN_SMP_QUANTUM)->get();
+
+  if (rr_cpu == NULL) {
+    rr_cpu = new bx_smp_rr_cpu_t[BX_SMP_PROCESSORS];
+    memset(rr_cpu, 0, sizeof(bx_smp_rr_cpu_t) * BX_SMP_PROCESSORS);
+    for (unsigned n=0; n<BX_SMP_PROCESSORS; n++)
+      rr_cpu[n].quantum = min_quantum;
+#if BX_ENABLE_STATISTICS
+    smp_rr_init_statistics();
+#endif
+  }
+
+  rr_processor = 0;
+  rr_executed = rr_ran = 0;
+  for (unsigned n=0; n<BX_SMP_PROCESSORS; n++)
+    BX_CPU(n)->sync_icount();
+
+  if (setjmp(BX_CPU_C::jmp_buf_env)) {
+    // can get here only from exception function or VMEXIT,
+    // continue the slice of the same processor
+    BX_CPU(rr_processor)->icount++;
+  }
+
+  while (! bx_pc_system.kill_bochs_request) {
+    bx_smp_rr_cpu_t *rr = &rr_cpu[rr_processor];
+    BX_CPU_C *cpu = BX_CPU(rr_processor);
+
+    if (smp_rr_skip(rr_processor)) {
+#if BX_ENABLE_STATISTICS
+      rr->stat_idle_skips++;
+#endif
+    }
+    else {
+      rr->idle = 0;
+
+      do {
+        cpu->cpu_run_trace();
+      } while ((cpu->get_icount() - cpu->get_icount_last_sync()) < rr->quantum &&
+                cpu->activity_state == BX_CPU_C::BX_ACTIVITY_STATE_ACTIVE &&
+               !cpu->smp_yield_hint && !bx_pc_system.kill_bochs_request);
+
+      // see how many instructions it was able to run
+      Bit32u n = (Bit32u)(cpu->get_icount() - cpu->get_icount_last_sync());
+      cpu->sync_icount();
+
+      if (cpu->activity_state != BX_CPU_C::BX_ACTIVITY_STATE_ACTIVE) {
+        rr->idle = 1;
+        rr->idle_events = cpu->pending_event;
+        rr->quantum = min_quantum;
+      }
+      else if (cpu->smp_yield_hint) {
+        rr->quantum >>= 1;
+        if (rr->quantum < min_quantum) rr->quantum = min_quantum;
+#if BX_ENABLE_STATISTICS
+        rr->stat_yields++;
+#endif
+      }
+      else if (n >= rr->quantum) {
+        rr->quantum <<= 1;
+        if (rr->quantum > BX_SMP_QUANTUM_ADAPTIVE_MAX) rr->quantum = BX_SMP_QUANTUM_ADAPTIVE_MAX;
+      }
+      cpu->smp_yield_hint = 0;
+
+#if BX_ENABLE_STATISTICS
+      rr->stat_slices++;
+      rr->stat_instructions += n;
+      rr->stat_quantum = rr->quantum;
+#endif
+
+      if (n > 0) {
+        rr_executed += n;
+        rr_ran++;
+      }
+    }
+
+    if (++rr_processor == BX_SMP_PROCESSORS) {
+      rr_processor = 0;
+      if (rr_ran) {
+        // the system time follows the average progress of the running CPUs
+        BX_TICKN(rr_executed / rr_ran);
+        rr_executed = rr_ran = 0;
+      }
+      else {
+        // nobody is running, pass the time as quickly as possible
+        BX_TICKN(bx_pc_system.getNumCpuTicksLeftNextEvent());
+      }
+    }
+  }
+}
+
+// Parallel SMP simulation.
+//
+// Each simulated CPU runs its traces in its own host thread. Emulated time
+// is kept by the CPU threads themselves: every CPU counts the instructions
+// it executed (its virtual time) and reports them under the simulator lock
+// every 'slice' instructions. The system time is advanced to the virtual
+// time of the slowest running CPU and a CPU is not allowed to run ahead of
+// the system time more than 'skew' instructions. A halted CPU does not hold
+// the time back; when all CPUs are halted the time skips forward to the
+// next timer event, the same way as for a single halted processor.
+
+bool bx_smp_parallel = 0;
+
+// size of per-CPU trace cache invalidation queue, the whole trace cache is
+// flushed on overflow
+#define BX_SMP_SMC_QUEUE_SIZE 64
+
+struct bx_smp_cpu_t {
+  BX_THREAD_VAR(thread);
+  volatile Bit32u in_guest;  // executing guest code, not holding the lock
+  bool   idle;               // halted, doesn't hold back the system time
+  bool   exited;
+  Bit32u idle_events;        // pending events when the CPU went idle
+  Bit64u vtime;              // emulated time reached by the CPU
+
+  volatile Bit32u smc_pending;
+  bool smc_flush;
+  unsigned smc_count;
+  struct {
+    bx_phy_address pAddr;
+    Bit32u mask;
+  } smc[BX_SMP_SMC_QUEUE_SIZE];
+};
+
+static bx_smp_cpu_t *smp_cpu = NULL;
+
+static BX_MUTEX(smp_mutex);
+static BX_COND(smp_idle_cond);
+static BX_COND(smp_time_cond);
+static unsigned smp_idle_waiters = 0, smp_time_waiters = 0;
+
+static volatile Bit32u smp_stop_request = 0;
+static unsigned smp_stop_depth = 0;
+
+static Bit32u smp_skew, smp_slice;
+
+static BX_THREAD_LOCAL unsigned smp_lock_depth = 0;
+static BX_THREAD_LOCAL int smp_this_cpu = -1;
+
+// safety net for lost wakeups, in milliseconds of host time
+#define BX_SMP_WAIT_TIMEOUT 10
+
+int bx_smp_cpu_id(void)
+{
+  return smp_this_cpu;
+}
+
+// Wake up halted CPUs if an event was delivered to any of them.
+// Called with the simulator lock held.
+static void smp_wakeup_idle(void)
+{
+  for (unsigned n=0; n<BX_SMP_PROCESSORS; n++) {
+    if (! smp_cpu[n].idle) continue;
+    if (BX_CPU(n)->pending_event != smp_cpu[n].idle_events ||
+        BX_CPU(n)->activity_state == BX_CPU_C::BX_ACTIVITY_STATE_ACTIVE)
+    {
+      BX_COND_BROADCAST(smp_idle_cond);
+      return;
+    }
+  }
+}
+
+void bx_smp_lock(void)
+{
+  if (smp_lock_depth++ == 0) {
+    if (smp_this_cpu >= 0) {
+      smp_cpu[smp_this_cpu].in_guest = 0;
+      BX_MEMORY_BARRIER();
+    }
+    BX_LOCK(smp_mutex);
+  }
+}
+
+void bx_smp_unlock(void)
+{
+  if (--smp_lock_depth == 0) {
+    if (smp_idle_waiters)
+      smp_wakeup_idle();
+    // must be set while still holding the lock, see bx_smp_stop_world()
+    if (smp_this_cpu >= 0)
+      smp_cpu[smp_this_cpu].in_guest = 1;
+    BX_UNLOCK(smp_mutex);
+  }
+}
+
+// Stop all other CPUs at trace boundary or when they are waiting for the
+// simulator lock. Used when state shared by all CPUs (TLBs, trace caches,
+// the whole CPU state on reset) is changed. Could be nested.
+void bx_smp_stop_world(void)
+{
+  bx_smp_lock();
+  if (smp_stop_depth++ == 0) {
+    smp_stop_request = 1;
+    BX_MEMORY_BARRIER();
+    for (unsigned n=0; n<BX_SMP_PROCESSORS; n++) {
+      if ((int) n == smp_this_cpu) continue;
+      while (smp_cpu[n].in_guest && !smp_cpu[n].exited)
+        BX_YIELD();
+    }
+  }
+}
+
+void bx_smp_resume_world(void)
+{
+  if (--smp_stop_depth == 0)
+    smp_stop_request = 0;
+  bx_smp_unlock();
+}
+
+bool bx_smp_world_stopped(void)
+{
+  // only the lock owner could have the world stopped
+  return smp_lock_depth > 0 && smp_stop_depth > 0;
+}
+
+void bx_smp_post_smc(bx_phy_address pAddr, Bit32u mask)
+{
+  bx_smp_lock();
+  for (unsigned n=0; n<BX_SMP_PROCESSORS; n++) {
+    if ((int) n == smp_this_cpu) continue;
+    bx_smp_cpu_t *c = &smp_cpu[n];
+    if (c->smc_count < BX_SMP_SMC_QUEUE_SIZE) {
+      c->smc[c->smc_count].pAddr = pAddr;
+      c->smc[c->smc_count].mask = mask;
+      c->smc_count++;
+    }
+    else {
+      c->smc_flush = 1;
+    }
+    c->smc_pending = 1;
+  }
+  bx_smp_unlock();
+}
+
+void bx_smp_post_flush(void)
+{
+  bx_smp_lock();
+  for (unsigned n=0; n<BX_SMP_PROCESSORS; n++) {
+    if ((int) n == smp_this_cpu) continue;
+    smp_cpu[n].smc_flush = 1;
+    smp_cpu[n].smc_pending = 1;
+  }
+  bx_smp_unlock();
+}
+
+// apply trace cache invalidations requested by the other CPUs
+static void smp_process_smc(unsigned id)
+{
+  bx_smp_cpu_t *c = &smp_cpu[id];
+  BX_CPU_C *cpu = BX_CPU(id);
+
+  bx_smp_lock();
+  if (c->smc_flush) {
+    cpu->iCache.flushICacheEntries();
+  }
+  else {
+    for (unsigned n=0; n < c->smc_count; n++)
+      cpu->iCache.handleSMC(c->smc[n].pAddr, c->smc[n].mask);
+  }
+  c->smc_flush = 0;
+  c->smc_count = 0;
+  c->smc_pending = 0;
+  bx_smp_unlock();
+}
+
+// Advance the system time up to the virtual time of the slowest running CPU.
+// Called with the simulator lock held.
+static void smp_advance_time(void)
+{
+  Bit64u now = bx_pc_system.time_ticks(), target = BX_MAX_BIT64U;
+
+  for (unsigned n=0; n<BX_SMP_PROCESSORS; n++) {
+    if (!smp_cpu[n].idle && !smp_cpu[n].exited && smp_cpu[n].vtime < target)
+      target = smp_cpu[n].vtime;
+  }
+
+  if (target == BX_MAX_BIT64U || target <= now) return;
+
+  while (now < target) {
+    Bit64u delta = target - now;
+    Bit32u n = (delta > BX_MAX_BIT32U) ? BX_MAX_BIT32U : (Bit32u) delta;
+    BX_TICKN(n);
+    now += n;
+  }
+
+  if (smp_time_waiters)
+    BX_COND_BROADCAST(smp_time_cond);
+}
+
+static bool smp_all_idle(void)
+{
+  for (unsigned n=0; n<BX_SMP_PROCESSORS; n++) {
+    if (!smp_cpu[n].idle && !smp_cpu[n].exited) return 0;
+  }
+  return 1;
+}
+
+// Report executed instructions and synchronize with the system time
+static void smp_sync(unsigned id, Bit32u events)
+{
+  bx_smp_cpu_t *me = &smp_cpu[id];
+  BX_CPU_C *cpu = BX_CPU(id);
+
+  bx_smp_lock();
+
+  Bit32u n = (Bit32u)(cpu->get_icount() - cpu->get_icount_last_sync());
+  cpu->sync_icount();
+
+  if (n > 0 || cpu->activity_state == BX_CPU_C::BX_ACTIVITY_STATE_ACTIVE) {
+    if (me->idle) {
+      me->idle = 0;
+      me->vtime = bx_pc_system.time_ticks();
+    }
+    me->vtime += n;
+  }
+
+  if (cpu->activity_state != BX_CPU_C::BX_ACTIVITY_STATE_ACTIVE) {
+    me->idle = 1;
+    smp_advance_time();
+    if (smp_all_idle()) {
+      // nobody is running, pass the time as quickly as possible
+      BX_TICKN(bx_pc_system.getNumCpuTicksLeftNextEvent());
+      smp_wakeup_idle();
+    }
+    else if (cpu->pending_event == events && !smp_stop_request &&
+             !bx_pc_system.kill_bochs_request)
+    {
+      me->idle_events = events;
+      smp_idle_waiters++;
+      BX_COND_WAIT(smp_idle_cond, smp_mutex, BX_SMP_WAIT_TIMEOUT);
+      smp_idle_waiters--;
+    }
+  }
+  else {
+    smp_advance_time();
+    while (me->vtime > bx_pc_system.time_ticks() + smp_skew &&
+          !smp_stop_request && !bx_pc_system.kill_bochs_request)
+    {
+      smp_time_waiters++;
+      BX_COND_WAIT(smp_time_cond, smp_mutex, BX_SMP_WAIT_TIMEOUT);
+      smp_time_waiters--;
+      smp_advance_time();
+    }
+  }
+
+  // async_event is updated by the other threads without atomic operations,
+  // make sure the CPU doesn't miss an event signaled during the slice
+  cpu->async_event |= 1;
+
+  bx_smp_unlock();
+}
+
+static BX_THREAD_FUNC(smp_cpu_thread, indata)
+{
+  unsigned id = (unsigned)(bx_ptr_equiv_t) indata;
+  BX_CPU_C *cpu = BX_CPU(id);
+  bx_smp_cpu_t *me = &smp_cpu[id];
+
+  smp_this_cpu = id;
+  bx_cpu_affinity_apply(id);
+
+  switch (setjmp(BX_CPU_C::jmp_buf_env)) {
+    case 0:
+      break;
+    case 1:
+      // exception or VMEXIT
+      cpu->icount++;
+      // fall through
+    default:
+      // the instruction was restarted because of a locked RMW conflict
+      cpu->prev_rip = cpu->get_instruction_pointer();
+      cpu->speculative_rsp = 0;
+#if BX_SMP_ATOMIC_RMW
+      // exception in the middle of R-M-W instruction done exclusively
+      if (cpu->address_xlation.exclusive)
+        cpu->smp_end_exclusive_rmw();
+#endif
+      // the simulator lock might be still held at the point of exception
+      while (smp_lock_depth > 0)
+        bx_smp_unlock();
+      break;
+  }
+
+  while (! bx_pc_system.kill_bochs_request) {
+    if (smp_stop_request) {
+      // wait in the simulator lock until the world is resumed
+      bx_smp_lock();
+      bx_smp_unlock();
+      continue;
+    }
+
+    if (me->smc_pending)
+      smp_process_smc(id);
+
+    Bit32u events = cpu->pending_event;
+
+    cpu->cpu_run_trace();
+
+#if BX_SMP_ATOMIC_RMW
+    // an instruction reading the R-M-W operand might skip the write back
+    if (cpu->address_xlation.exclusive)
+      cpu->smp_end_exclusive_rmw();
+#endif
+
+    if ((cpu->get_icount() - cpu->get_icount_last_sync()) >= smp_slice ||
+         cpu->activity_state != BX_CPU_C::BX_ACTIVITY_STATE_ACTIVE)
+    {
+      smp_sync(id, events);
+    }
+  }
+
+  bx_smp_lock();
+  me->exited = 1;
+  smp_advance_time();
+  BX_COND_BROADCAST(smp_idle_cond);
+  BX_COND_BROADCAST(smp_time_cond);
+  bx_smp_unlock();
+  me->in_guest = 0;
+
+  BX_THREAD_EXIT;
+}
+
+void bx_smp_run(void)
+{
+  unsigned n;
+
+  smp_skew = SIM->get_param_num(BXPN_SMP_SKEW)->get();
+  smp_slice = smp_skew / 4;
+  if (smp_slice == 0) smp_slice = 1;
+
+  BX_INFO(("parallel SMP simulation: %d CPU threads, skew=%u", BX_SMP_PROCESSORS, smp_skew));
+
+  smp_cpu = new bx_smp_cpu_t[BX_SMP_PROCESSORS];
+  memset(smp_cpu, 0, sizeof(bx_smp_cpu_t) * BX_SMP_PROCESSORS);
+
+  BX_INIT_MUTEX(smp_mutex);
+  BX_INIT_COND(smp_idle_cond);
+  BX_INIT_COND(smp_time_cond);
+
+  Bit64u now = bx_pc_system.time_ticks();
+  for (n=0; n<BX_SMP_PROCESSORS; n++) {
+    smp_cpu[n].vtime = now;
+    smp_cpu[n].in_guest = 1;
+    BX_CPU(n)->sync_icount();
+  }
+
+  bx_smp_parallel = 1;
+
+  for (n=0; n<BX_SMP_PROCESSORS; n++)
+    BX_THREAD_CREATE(smp_cpu_thread, (void *)(bx_ptr_equiv_t) n, smp_cpu[n].thread);
+
+#if defined(WIN32)
+  // BX_THREAD_JOIN is not available here
+  for (n=0; n<BX_SMP_PROCESSORS; n++)
+    WaitForSingleObject(smp_cpu[n].thread, INFINITE);
+#else
+  for (n=0; n<BX_SMP_PROCESSORS; n++)
+    BX_THREAD_JOIN(smp_cpu[n].thread);
+#endif
+
+  bx_smp_parallel = 0;
+
+  BX_FINI_COND(smp_idle_cond);
+  BX_FINI_COND(smp_time_cond);
+  BX_FINI_MUTEX(smp_mutex);
+
+  delete [] smp_cpu;
+  smp_cpu = NULL;
+}
+
+void bx_smp_cpu_exit(void)
+{
+  bx_smp_cpu_t *me = &smp_cpu[smp_this_cpu];
+
+  if (bx_smp_world_stopped()) {
+    smp_stop_depth = 0;
+    smp_stop_request = 0;
+  }
+  while (smp_lock_depth > 0)
+    bx_smp_unlock();
+
+  bx_smp_lock();
+  bx_pc_system.kill_bochs_request = 1;
+  me->exited = 1;
+  BX_COND_BROADCAST(smp_idle_cond);
+  BX_COND_BROADCAST(smp_time_cond);
+  bx_smp_unlock();
+  me->in_guest = 0;
+
+  BX_THREAD_EXIT;
+}
+
+#endif
@@ -0,0 +1,123 @@
+/////////////////////////////////////////////////////////////////////////
+// $Id$
+/////////////////////////////////////////////////////////////////////////
+//
+//  Copyright (C) 2021  The Bochs Project
+//
+//  This library is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU Lesser General Public
+//  License as published by the Free Software Foundation; either
+//  version 2 of the License, or (at your option) any later version.
+//
+//  This library is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//  Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public
+//  License along with this library; if not, write to the Free Software
+//  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+/////////////////////////////////////////////////////////////////////////
+
+#ifndef BX_SMPTHREAD_H
+#define BX_SMPTHREAD_H
+
+// Parallel SMP simulation: every simulated CPU is running in its own host
+// thread. The devices, the timers and the memory handlers are not thread
+// safe and are protected by a single (recursive) simulator lock. Guest RAM
+// is accessed by the CPU threads directly, without taking the lock.
+
+#if defined(_MSC_VER)
+#  define BX_THREAD_LOCAL __declspec(thread)
+#else
+#  define BX_THREAD_LOCAL __thread
+#endif
+
+// Atomic operations on shared simulator state
+#if defined(_MSC_VER)
+#include <intrin.h>
+#  define BX_ATOMIC_OR32(ptr, val)  _InterlockedOr((volatile long*)(ptr), (long)(val))
+#  define BX_ATOMIC_AND32(ptr, val) ((Bit32u) _InterlockedAnd((volatile long*)(ptr), (long)(val)))
+#  define BX_ATOMIC_OR64(ptr, val)  _InterlockedOr64((volatile __int64*)(ptr), (__int64)(val))
+#  define BX_ATOMIC_CAS8(ptr, old, val) \
+     ((Bit8u) _InterlockedCompareExchange8((volatile char*)(ptr), (char)(val), (char)(old)) == (Bit8u)(old))
+#  define BX_ATOMIC_CAS16(ptr, old, val) \
+     ((Bit16u) _InterlockedCompareExchange16((volatile short*)(ptr), (short)(val), (short)(old)) == (Bit16u)(old))
+#  define BX_ATOMIC_CAS32(ptr, old, val) \
+     ((Bit32u) _InterlockedCompareExchange((volatile long*)(ptr), (long)(val), (long)(old)) == (Bit32u)(old))
+#  define BX_ATOMIC_CAS64(ptr, old, val) \
+     ((Bit64u) _InterlockedCompareExchange64((volatile __int64*)(ptr), (__int64)(val), (__int64)(old)) == (Bit64u)(old))
+#  define BX_MEMORY_BARRIER() MemoryBarrier()
+#else
+#  define BX_ATOMIC_OR32(ptr, val)  __sync_fetch_and_or((ptr), (val))
+#  define BX_ATOMIC_AND32(ptr, val) __sync_fetch_and_and((ptr), (val))
+#  define BX_ATOMIC_OR64(ptr, val)  __sync_fetch_and_or((ptr), (val))
+#  define BX_ATOMIC_CAS8(ptr, old, val)  __sync_bool_compare_and_swap((ptr), (old), (val))
+#  define BX_ATOMIC_CAS16(ptr, old, val) __sync_bool_compare_and_swap((ptr), (old), (val))
+#  define BX_ATOMIC_CAS32(ptr, old, val) __sync_bool_compare_and_swap((ptr), (old), (val))
+#  define BX_ATOMIC_CAS64(ptr, old, val) __sync_bool_compare_and_swap((ptr), (old), (val))
+#  define BX_MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+// pin the CPU emulation threads to the host CPUs given by the affinity
+// option and place the CPU structures on their NUMA nodes
+void bx_cpu_affinity_init(void);
+// pin the calling thread running CPU id
+void bx_cpu_affinity_apply(unsigned id);
+
+#if BX_SUPPORT_SMP
+
+// set when the CPUs are running in their own host threads
+BOCHSAPI extern bool bx_smp_parallel;
+
+BOCHSAPI_MSVCONLY void bx_smp_lock(void);
+BOCHSAPI_MSVCONLY void bx_smp_unlock(void);
+BOCHSAPI_MSVCONLY void bx_smp_stop_world(void);
+BOCHSAPI_MSVCONLY void bx_smp_resume_world(void);
+
+// true if the calling thread holds all other CPUs stopped
+bool bx_smp_world_stopped(void);
+// id of the CPU running in the calling thread, -1 for non-CPU threads
+int  bx_smp_cpu_id(void);
+
+// queue trace cache invalidation for all the CPUs except the calling one,
+// the CPU threads process the queue between traces
+void bx_smp_post_smc(bx_phy_address pAddr, Bit32u mask);
+void bx_smp_post_flush(void);
+
+// run all the CPUs in parallel until the simulation is stopped
+void bx_smp_run(void);
+// run the CPUs one after another in the calling thread
+void bx_smp_run_round_robin(void);
+// terminate the calling CPU thread and request end of the simulation
+void bx_smp_cpu_exit(void);
+
+#define BX_SMP_LOCK()   do { if (bx_smp_parallel) bx_smp_lock(); } while (0)
+#define BX_SMP_UNLOCK() do { if (bx_smp_parallel) bx_smp_unlock(); } while (0)
+
+#define BX_SMP_STOP_WORLD()   do { if (bx_smp_parallel) bx_smp_stop_world(); } while (0)
+#define BX_SMP_RESUME_WORLD() do { if (bx_smp_parallel) bx_smp_resume_world(); } while (0)
+
+// holds the simulator lock until the end of the current scope
+class bx_smp_guard_c {
+  bool locked;
+public:
+  bx_smp_guard_c(): locked(bx_smp_parallel) { if (locked) bx_smp_lock(); }
+ ~bx_smp_guard_c() { if (locked) bx_smp_unlock(); }
+};
+
+#define BX_SMP_GUARD() bx_smp_guard_c bx_smp_guard
+
+#else
+
+#define bx_smp_parallel (0)
+
+#define BX_SMP_LOCK()
+#define BX_SMP_UNLOCK()
+#define BX_SMP_STOP_WORLD()
+#define BX_SMP_RESUME_WORLD()
+#define BX_SMP_GUARD()
+
+#endif
+
+#endif